@@ -49,6 +49,7 @@ unsigned int g_logon_debug;
 
 static constexpr cfg_directive emsmdb_gxcfg_dflt[] = {
 	{"backfill_transport_headers", "0", CFG_BOOL},
+	{"emsmdb_compress_level", "2", CFG_SIZE, "1", "3"},
 	{"emsmdb_compress_threshold", "-1", CFG_SIZE},
 	{"outgoing_smtp_url", "sendmail://localhost"},
 	{"reported_server_version", "15.00.0847.4040"},
@@ -88,6 +89,7 @@ static bool exch_emsmdb_reload(std::shared_ptr<config_file> gxcfg,
 		return false;
 	}
 	emsmdb_backfill_transporthdr = gxcfg->get_ll("backfill_transport_headers");
+	emsmdb_compress_level = gxcfg->get_ll("emsmdb_compress_level");
 	emsmdb_compress_threshold = gxcfg->get_ll("emsmdb_compress_threshold");
 	auto str = znul(gxcfg->get_value("reported_server_version"));
 	auto &ver = server_normal_version;
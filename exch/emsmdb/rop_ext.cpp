@@ -2183,7 +2183,10 @@ pack_result rop_ext_make_rpc_ext(const void *pbuff_in, uint32_t in_len,
 		    rpc_header_ext.size_actual < emsmdb_compress_threshold) {
 			rpc_header_ext.flags &= ~RHE_FLAG_COMPRESSED;
 		} else {
-			auto compressed_len = lzxpress_compress(ext_buff.get(), subext.m_offset, tmp_buff.get(), ext_buff_size);
+			/* only a smaller result is of use */
+			auto compressed_len = lzxpress_compress(ext_buff.get(),
+			                      subext.m_offset, tmp_buff.get(), subext.m_offset,
+			                      emsmdb_compress_level | LZX_SKIP_INCOMPRESSIBLE);
 			if (compressed_len <= 0 || static_cast<size_t>(compressed_len) >= subext.m_offset) {
 				/* if we can not get benefit from the
 					compression, unmask the compress bit */
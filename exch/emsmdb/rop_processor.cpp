@@ -17,6 +17,7 @@
 #include <gromox/atomic.hpp>
 #include <gromox/clock.hpp>
 #include <gromox/defs.h>
+#include <gromox/lzxpress.hpp>
 #include <gromox/proc_common.h>
 #include <gromox/process.hpp>
 #include <gromox/util.hpp>
@@ -45,6 +46,7 @@ static unsigned int g_emsmdb_full_parenting;
 static unsigned int g_max_rop_payloads = 96;
 
 size_t emsmdb_compress_threshold;
+unsigned int emsmdb_compress_level = LZX_DEFAULT;
 unsigned int emsmdb_max_obh_per_session = 500;
 unsigned int emsmdb_max_cxh_per_user = 100;
 unsigned int emsmdb_pvt_folder_softdel, emsmdb_rop_chaining;
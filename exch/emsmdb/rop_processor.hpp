@@ -91,6 +91,7 @@ extern ec_error_t aoh_to_error(int);
 extern unsigned int emsmdb_rop_chaining, emsmdb_max_cxh_per_user;
 extern unsigned int emsmdb_max_obh_per_session, emsmdb_pvt_folder_softdel;
 extern unsigned int emsmdb_backfill_transporthdr, emsmdb_collapse_notif_storm;
+extern unsigned int emsmdb_compress_level;
 extern size_t ems_max_active_sessions, ems_max_active_users, emsmdb_compress_threshold;
 extern size_t ems_max_active_notifh, ems_max_pending_sesnotif;
 extern uint16_t server_normal_version[4];
@@ -1545,6 +1545,7 @@ void process(mFindItemRequest &&request, XMLElement *response, const EWSContext
 	                     request.Traversal == Enum::Associated ? TABLE_FLAG_ASSOCIATED :
 	                     request.Traversal == Enum::Shallow ? 0 : TABLE_FLAG_DEPTH;
 	const RESTRICTION* res = nullptr; // Must be built for every store individually (named properties)
+	RESTRICTION* res1 = nullptr, *res2 = nullptr; // Request and paging restriction of the current store
 	const SORTORDER_SET* sort = nullptr; // Lol same
 	std::string lastDir; // Simple restriction caching
 
@@ -1566,12 +1567,16 @@ void process(mFindItemRequest &&request, XMLElement *response, const EWSContext
 			throw EWSError::AccessDenied(E3244);
 		if (dir != lastDir) {
 			auto getId = [&](const PROPERTY_NAME& name){return ctx.getNamedPropId(dir, name);};
-			auto res1 = request.Restriction ? request.Restriction->build(getId) : nullptr;
-			auto res2 = paging ? paging->restriction(getId) : nullptr;
-			res = tRestriction::all(res1, res2);
+			res1 = request.Restriction ? request.Restriction->build(getId) : nullptr;
+			res2 = paging ? paging->restriction(getId) : nullptr;
 			sort = request.SortOrder ? tFieldOrder::build(*request.SortOrder, getId) : nullptr;
 			lastDir = dir;
 		}
+		// The date filter misses recurring series that started before the view
+		RESTRICTION* occ = request.CalendarView && folder.location == sFolderSpec::PRIVATE &&
+		                   folder.folderId == rop_util_make_eid_ex(1, PRIVATE_FID_CALENDAR) ?
+		                   request.CalendarView->occurrences(ctx, dir) : nullptr;
+		res = tRestriction::all(res1, occ ? occ : res2);
 		uint32_t tableId, rowCount;
 		if (!exmdb.load_content_table(dir.c_str(), CP_UTF8, folder.folderId,
 		    "", tableFlags, res, sort, &tableId, &rowCount))
@@ -2063,6 +2063,49 @@ RESTRICTION* tCalendarView::restriction(const sGetNameId& getId) const
 	return tRestriction::all(startRes, endRes);
 }
 
+/**
+ * @brief      Generate restriction selecting appointments with occurrences in the view
+ *
+ * Uses the store's occurrence index, so that recurring series are included
+ * if any of their instances falls into the time range.
+ * Only applicable to the private calendar folder.
+ *
+ * New restriction is stack allocated and must not be freed manually.
+ *
+ * @param      ctx       Request context
+ * @param      dir       Store directory
+ *
+ * @return     Pointer to restriction or nullptr if it cannot be used
+ */
+RESTRICTION* tCalendarView::occurrences(const EWSContext& ctx, const std::string& dir) const
+{
+	static constexpr size_t maxItems = 1024;
+	int64_t start = StartDate ? rop_util_nttime_to_unix(StartDate->toNT()) : -1;
+	int64_t end = EndDate ? rop_util_nttime_to_unix(EndDate->toNT()) : -1;
+	std::vector<freebusy_event> events;
+	std::vector<uint64_t> mids;
+	if (!ctx.plugin().exmdb.freebusy_query(dir.c_str(), start, end, &events, &mids))
+		return nullptr;
+	std::sort(mids.begin(), mids.end());
+	mids.erase(std::unique(mids.begin(), mids.end()), mids.end());
+	if (mids.size() > maxItems)
+		return nullptr;
+	RESTRICTION* res = EWSContext::construct<RESTRICTION>();
+	res->rt = mapi_rtype::r_or;
+	res->andor = EWSContext::construct<RESTRICTION_AND_OR>();
+	res->andor->count = static_cast<uint32_t>(mids.size());
+	res->andor->pres = mids.empty() ? nullptr : EWSContext::alloc<RESTRICTION>(mids.size());
+	for (size_t i = 0; i < mids.size(); ++i) {
+		RESTRICTION& r = res->andor->pres[i];
+		r.rt = mapi_rtype::property;
+		r.prop = EWSContext::construct<RESTRICTION_PROPERTY>();
+		r.prop->relop = relop::eq;
+		r.prop->proptag = r.prop->propval.proptag = PidTagMid;
+		r.prop->propval.pvalue = EWSContext::construct<uint64_t>(mids[i]);
+	}
+	return res;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 tFreeBusyView::tFreeBusyView(const char *username, const char *dir,
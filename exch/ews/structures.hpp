@@ -2195,6 +2195,7 @@ struct tCalendarView final : public tBasePagingType {
 	std::optional<sTimePoint> EndDate; // Attribute
 
 	RESTRICTION* restriction(const sGetNameId&) const override;
+	RESTRICTION* occurrences(const EWSContext&, const std::string&) const;
 
 	static RESTRICTION* datefilter(const sTimePoint&, bool, const sGetNameId&);
 };
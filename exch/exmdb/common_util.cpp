@@ -17,6 +17,7 @@
 #include <new>
 #include <optional>
 #include <pthread.h>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unistd.h>
@@ -98,7 +99,7 @@ static bool cu_eval_subobj_restriction(const db_conn &, cpid_t, uint64_t msgid,
 static bool gp_prepare_anystr(const db_conn &, mapi_object_type, uint64_t, proptag_t, xstmt &, sqlite3_stmt *&);
 static bool gp_prepare_mvstr(const db_conn &, mapi_object_type, uint64_t, proptag_t, xstmt &, sqlite3_stmt *&);
 static bool gp_prepare_default(const db_conn &, mapi_object_type, uint64_t, proptag_t, xstmt &, sqlite3_stmt *&);
-static void *gp_fetch(sqlite3 *, sqlite3_stmt *, uint16_t, cpid_t, GP_RESULT &);
+static void *gp_fetch(sqlite3 *, sqlite3_stmt *, uint16_t, cpid_t, GP_RESULT &, int vcol = 0);
 
 ec_error_t cu_set_propval(TPROPVAL_ARRAY *parray, proptag_t tag, const void *data)
 {
@@ -348,6 +349,23 @@ ec_error_t cu_allocate_cn(sqlite3 *psqlite, uint64_t *pcn)
 	return ecSuccess;
 }
 
+/**
+ * Stamp @folder_id with a fresh change number whenever its rule table
+ * was altered, so that rule processors holding a compiled copy can tell
+ * whether it is still current.
+ */
+bool cu_touch_rule_table(sqlite3 *psqlite, uint64_t folder_id)
+{
+	uint64_t cn = 0;
+	if (cu_allocate_cn(psqlite, &cn) != ecSuccess)
+		return false;
+	char sql_string[128];
+	snprintf(sql_string, std::size(sql_string), "REPLACE INTO "
+	         "folder_properties VALUES (%llu, %u, %llu)",
+	         LLU{folder_id}, PR_RULE_TABLE_CN, LLU{cn});
+	return gx_sql_exec(psqlite, sql_string) == SQLITE_OK;
+}
+
 BOOL common_util_allocate_folder_art(sqlite3 *psqlite, uint32_t *part)
 {
 	char sql_string[128];
@@ -411,6 +429,10 @@ void prepared_statements::begin(sqlite3 *psqlite, bool pvt_store)
 	rcpt_str = gx_sql_prep(psqlite, "SELECT proptag, propval"
 	               " FROM recipients_properties WHERE recipient_id=?"
 	               " AND proptag IN (?,?)");
+	msg_all = gx_sql_prep(psqlite, "SELECT proptag, propval"
+	              " FROM message_properties WHERE message_id=?");
+	rcpt_all = gx_sql_prep(psqlite, "SELECT proptag, propval"
+	               " FROM recipients_properties WHERE recipient_id=?");
 	/* Public stores keep read state in read_states, not messages. */
 	if (pvt_store)
 		msg_read = gx_sql_prep(psqlite, "SELECT read_state FROM "
@@ -2111,6 +2133,63 @@ static GP_RESULT gp_msgprop_synth(uint64_t msgid, proptag_t proptag,
 	return GP_UNHANDLED;
 }
 
+/**
+ * Whether a message property is computed by gp_msgprop/gp_spectableprop/
+ * gp_msgprop_synth (or by the caller from the user's permissions), or is
+ * special-cased in cu_eval_msg_restriction, rather than being a plain row
+ * of message_properties. Such values may depend on the parent folder,
+ * recipients, attachments, read states or the requesting user. Keep in
+ * sync with those functions.
+ */
+bool cu_msgprop_computed(proptag_t tag)
+{
+	switch (tag) {
+	case PR_ENTRYID:
+	case PR_PARENT_ENTRYID:
+	case PidTagFolderId:
+	case PidTagParentFolderId:
+	case PR_INSTANCE_SVREID:
+	case PR_PARENT_DISPLAY:
+	case PR_PARENT_DISPLAY_A:
+	case PR_MESSAGE_SIZE:
+	case PR_ASSOCIATED:
+	case PidTagChangeNumber:
+	case PR_READ:
+	case PR_HAS_NAMED_PROPERTIES:
+	case PR_HASATTACH:
+	case PidTagMid:
+	case PR_MESSAGE_FLAGS:
+	case PR_SUBJECT:
+	case PR_SUBJECT_A:
+	case PR_DISPLAY_TO:
+	case PR_DISPLAY_CC:
+	case PR_DISPLAY_BCC:
+	case PR_DISPLAY_TO_A:
+	case PR_DISPLAY_CC_A:
+	case PR_DISPLAY_BCC_A:
+	case PR_BODY:
+	case PR_BODY_A:
+	case PR_TRANSPORT_MESSAGE_HEADERS:
+	case PR_TRANSPORT_MESSAGE_HEADERS_A:
+	case PR_HTML:
+	case PR_RTF_COMPRESSED:
+	case PidTagMidString:
+	case PR_MESSAGE_CLASS:
+	case PR_RTF_IN_SYNC:
+	case PR_SENDER_ADDRTYPE:
+	case PR_SENT_REPRESENTING_ADDRTYPE:
+	case PR_ACCESS:
+	case PR_ACCESS_LEVEL:
+	case PR_STORE_RECORD_KEY:
+	case PR_MAPPING_SIGNATURE:
+	case PR_PARENT_SVREID:
+	case PR_ANR:
+		return true;
+	default:
+		return false;
+	}
+}
+
 static GP_RESULT gp_rcptprop_synth(proptag_t proptag, TAGGED_PROPVAL &pv)
 {
 	switch (proptag) {
@@ -2166,20 +2245,13 @@ static GP_RESULT gp_fallbackprop(mapi_object_type table_type, uint64_t objid,
 
 /**
  * @pv: caller-determined target slot where to write propval
+ *
+ * Handles the properties that are neither computed nor synthesized, i.e.
+ * the ones which have to come from the *_properties tables.
  */
-static GP_RESULT cu_get_properties1(mapi_object_type table_type, uint64_t id,
+static GP_RESULT gp_storedprop(mapi_object_type table_type, uint64_t id,
     cpid_t cpid, const db_conn &db, proptag_t tag, TAGGED_PROPVAL &pv)
 {
-	if (PROP_TYPE(tag) == PT_OBJECT &&
-	    (table_type != MAPI_ATTACH || tag != PR_ATTACH_DATA_OBJ))
-		return GP_SKIP;
-
-	/* Computed property (if): generate value */
-	auto ret = gp_spectableprop(table_type, tag, pv, db, id, cpid);
-	if (ret != GP_UNHANDLED)
-		return ret;
-
-	/* Normal stored property from sqlite */
 	auto &psqlite = db.psqlite;
 	xstmt own_stmt;
 	sqlite3_stmt *pstmt = nullptr;
@@ -2203,7 +2275,7 @@ static GP_RESULT cu_get_properties1(mapi_object_type table_type, uint64_t id,
 		return gp_fallbackprop(table_type, id, tag, pv, psqlite);
 
 	/* Transfer from sqlite to memory */
-	ret = GP_ERR;
+	GP_RESULT ret = GP_ERR;
 	pv.pvalue = gp_fetch(psqlite, pstmt, proptype, cpid, ret);
 	if (pv.pvalue == nullptr)
 		return ret;
@@ -2217,6 +2289,123 @@ static GP_RESULT cu_get_properties1(mapi_object_type table_type, uint64_t id,
 	return GP_ADV;
 }
 
+/**
+ * Whether a row of the *_properties table with tag @dbtag can satisfy a
+ * request for @tag. This mirrors the lookups done by gp_prepare_anystr,
+ * gp_prepare_mvstr and gp_prepare_default.
+ */
+static bool gp_stored_match(mapi_object_type table_type, proptag_t tag,
+    proptag_t dbtag)
+{
+	auto proptype = PROP_TYPE(tag);
+	if (proptype == PT_UNSPECIFIED || proptype == PT_STRING8 ||
+	    proptype == PT_UNICODE) {
+		if (dbtag == CHANGE_PROP_TYPE(tag, PT_UNICODE))
+			return true;
+		return table_type != MAPI_STORE && table_type != MAPI_FOLDER &&
+		       dbtag == CHANGE_PROP_TYPE(tag, PT_STRING8);
+	} else if (proptype == PT_MV_STRING8) {
+		return dbtag == CHANGE_PROP_TYPE(tag, PT_MV_UNICODE);
+	}
+	if (table_type == MAPI_FOLDER && tag == PR_LOCAL_COMMIT_TIME)
+		return dbtag == PR_LAST_MODIFICATION_TIME;
+	return dbtag == tag;
+}
+
+/**
+ * Read all of an object's stored properties in one range scan over the
+ * (id, proptag) index and hand the values out to the requested slots. On
+ * return, @res[i] is no longer %GP_UNHANDLED for any slot that was.
+ */
+static bool gp_storedprops_scan(mapi_object_type table_type, uint64_t id,
+    cpid_t cpid, const db_conn &db, proptag_cspan tags, TAGGED_PROPVAL *pv,
+    GP_RESULT *res, size_t pending)
+{
+	auto &psqlite = db.psqlite;
+	xstmt own_stmt;
+	sqlite3_stmt *pstmt = nullptr;
+	if (g_exmdb_enable_optim_stm && db.m_prepstm != nullptr) {
+		if (table_type == MAPI_MESSAGE)
+			pstmt = db.m_prepstm->msg_all;
+		else if (table_type == MAPI_MAILUSER)
+			pstmt = db.m_prepstm->rcpt_all;
+	}
+	if (pstmt != nullptr) {
+		sqlite3_reset(pstmt);
+	} else {
+		const char *q = nullptr;
+		switch (table_type) {
+		case MAPI_STORE: q = "SELECT proptag, propval FROM store_properties"; break;
+		case MAPI_FOLDER: q = "SELECT proptag, propval FROM folder_properties WHERE folder_id=?"; break;
+		case MAPI_MESSAGE: q = "SELECT proptag, propval FROM message_properties WHERE message_id=?"; break;
+		case MAPI_MAILUSER: q = "SELECT proptag, propval FROM recipients_properties WHERE recipient_id=?"; break;
+		case MAPI_ATTACH: q = "SELECT proptag, propval FROM attachment_properties WHERE attachment_id=?"; break;
+		default:
+			assert(!"Unknown table_type");
+			return false;
+		}
+		own_stmt = gx_sql_prep(psqlite, q);
+		if (own_stmt == nullptr)
+			return false;
+		pstmt = own_stmt;
+	}
+	if (table_type != MAPI_STORE)
+		sqlite3_bind_int64(pstmt, 1, id);
+	while (pending > 0 && gx_sql_step(pstmt) == SQLITE_ROW) {
+		proptag_t dbtag = sqlite3_column_int64(pstmt, 0);
+		for (size_t i = 0; i < tags.size(); ++i) {
+			if (res[i] != GP_UNHANDLED ||
+			    !gp_stored_match(table_type, tags[i], dbtag))
+				continue;
+			/* First row wins, as with the single-tag lookup. */
+			--pending;
+			res[i] = GP_ERR;
+			pv[i].pvalue = gp_fetch(psqlite, pstmt,
+			               PROP_TYPE(tags[i]), cpid, res[i], 1);
+			if (pv[i].pvalue == nullptr)
+				continue;
+			auto bin = static_cast<BINARY *>(pv[i].pvalue);
+			if (tags[i] == PR_ENTRYID && bin->cb == 0) {
+				bin->cb = std::size(empty_entryid);
+				bin->pv = deconst(empty_entryid);
+			}
+			res[i] = GP_ADV;
+		}
+	}
+	if (own_stmt == nullptr)
+		/* Release the read cursor of the shared statement early */
+		sqlite3_reset(pstmt);
+	/* Nothing found: generated a value */
+	for (size_t i = 0; i < tags.size(); ++i)
+		if (res[i] == GP_UNHANDLED)
+			res[i] = gp_fallbackprop(table_type, id, tags[i], pv[i], psqlite);
+	return true;
+}
+
+/**
+ * @pv: caller-determined target slot where to write propval
+ */
+static GP_RESULT cu_get_properties1(mapi_object_type table_type, uint64_t id,
+    cpid_t cpid, const db_conn &db, proptag_t tag, TAGGED_PROPVAL &pv)
+{
+	if (PROP_TYPE(tag) == PT_OBJECT &&
+	    (table_type != MAPI_ATTACH || tag != PR_ATTACH_DATA_OBJ))
+		return GP_SKIP;
+
+	/* Computed property (if): generate value */
+	auto ret = gp_spectableprop(table_type, tag, pv, db, id, cpid);
+	if (ret != GP_UNHANDLED)
+		return ret;
+
+	/* Normal stored property from sqlite */
+	return gp_storedprop(table_type, id, cpid, db, tag, pv);
+}
+
+/**
+ * Computed properties are produced first. If more than one of the remaining
+ * tags has to come from the database, they are all served from a single
+ * scan of the object's property rows instead of one indexed lookup each.
+ */
 bool cu_get_properties(mapi_object_type table_type, uint64_t objid, cpid_t cpid,
     const db_conn &psqlite, proptag_cspan pproptags, TPROPVAL_ARRAY *ppropvals)
 {
@@ -2224,13 +2413,47 @@ bool cu_get_properties(mapi_object_type table_type, uint64_t objid, cpid_t cpid,
 	ppropvals->ppropval = cu_alloc<TAGGED_PROPVAL>(pproptags.size());
 	if (ppropvals->ppropval == nullptr)
 		return FALSE;
-	for (size_t i = 0; i < pproptags.size(); ++i) {
+	if (pproptags.size() == 1) {
 		auto ret = cu_get_properties1(table_type, objid, cpid, psqlite,
-		           pproptags[i], ppropvals->ppropval[ppropvals->count]);
+		           pproptags[0], ppropvals->ppropval[0]);
 		if (ret == GP_ADV)
 			++ppropvals->count;
-		else if (ret == GP_ERR)
+		return ret != GP_ERR;
+	}
+	auto pv  = ppropvals->ppropval;
+	auto res = cu_alloc<GP_RESULT>(pproptags.size());
+	if (res == nullptr)
+		return false;
+	size_t pending = 0;
+	for (size_t i = 0; i < pproptags.size(); ++i) {
+		auto tag = pproptags[i];
+		if (PROP_TYPE(tag) == PT_OBJECT &&
+		    (table_type != MAPI_ATTACH || tag != PR_ATTACH_DATA_OBJ)) {
+			res[i] = GP_SKIP;
+			continue;
+		}
+		res[i] = gp_spectableprop(table_type, tag, pv[i], psqlite, objid, cpid);
+		if (res[i] == GP_ERR)
+			return false;
+		if (res[i] == GP_UNHANDLED)
+			++pending;
+	}
+	if (pending > 1) {
+		if (!gp_storedprops_scan(table_type, objid, cpid, psqlite,
+		    pproptags, pv, res, pending))
+			return false;
+	} else {
+		for (size_t i = 0; i < pproptags.size(); ++i)
+			if (res[i] == GP_UNHANDLED)
+				res[i] = gp_storedprop(table_type, objid, cpid,
+				         psqlite, pproptags[i], pv[i]);
+	}
+	/* Compact into request order, dropping skipped tags */
+	for (size_t i = 0; i < pproptags.size(); ++i) {
+		if (res[i] == GP_ERR)
 			return false;
+		if (res[i] == GP_ADV)
+			pv[ppropvals->count++] = pv[i];
 	}
 	return TRUE;
 }
@@ -2451,12 +2674,14 @@ static bool gp_prepare_default(const db_conn &db, mapi_object_type table_type,
 
 /**
  * @pstmt:	a statement for which sqlite3_step was already invoked
+ * @vcol:	column holding the value (for non-string types; strings are
+ * 		always read as the (proptag, propval) pair in columns 0/1)
  *
  * Read the current row from @pstmt (i.e. just one row; no read cursor
  * advancing here).
  */
 static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
-    proptype_t proptype, cpid_t cpid, GP_RESULT &gpr)
+    proptype_t proptype, cpid_t cpid, GP_RESULT &gpr, int vcol)
 {
 	EXT_PULL ext_pull;
 	void *pvalue = nullptr;
@@ -2489,7 +2714,7 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<float>();
 		if (v == nullptr)
 			return nullptr;
-		*v = sqlite3_column_double(pstmt, 0);
+		*v = sqlite3_column_double(pstmt, vcol);
 		return v;
 	}
 	case PT_DOUBLE:
@@ -2497,7 +2722,7 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<double>();
 		if (v == nullptr)
 			return nullptr;
-		*v = sqlite3_column_double(pstmt, 0);
+		*v = sqlite3_column_double(pstmt, vcol);
 		return v;
 	}
 	case PT_CURRENCY:
@@ -2506,36 +2731,36 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<uint64_t>();
 		if (v == nullptr)
 			return nullptr;
-		*v = sqlite3_column_int64(pstmt, 0);
+		*v = sqlite3_column_int64(pstmt, vcol);
 		return v;
 	}
 	case PT_SHORT: {
 		auto v = cu_alloc<uint16_t>();
 		if (v == nullptr)
 			return nullptr;
-		*v = sqlite3_column_int64(pstmt, 0);
+		*v = sqlite3_column_int64(pstmt, vcol);
 		return v;
 	}
 	case PT_LONG: {
 		auto v = cu_alloc<uint32_t>();
 		if (v == nullptr)
 			return nullptr;
-		*v = sqlite3_column_int64(pstmt, 0);
+		*v = sqlite3_column_int64(pstmt, vcol);
 		return v;
 	}
 	case PT_BOOLEAN: {
 		auto v = cu_alloc<uint8_t>();
 		if (v == nullptr)
 			return nullptr;
-		*v = sqlite3_column_int64(pstmt, 0);
+		*v = sqlite3_column_int64(pstmt, vcol);
 		return v;
 	}
 	case PT_CLSID: {
 		auto v = cu_alloc<GUID>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_guid(v) != pack_result::ok)
 			return nullptr;
@@ -2545,8 +2770,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<SVREID>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_svreid(v) != pack_result::ok)
 			return nullptr;
@@ -2556,8 +2781,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<RESTRICTION>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_restriction(v) != pack_result::ok)
 			return nullptr;
@@ -2567,8 +2792,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<RULE_ACTIONS>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_rule_actions(v) != pack_result::ok)
 			return nullptr;
@@ -2579,11 +2804,11 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto bv = cu_alloc<BINARY>();
 		if (bv == nullptr)
 			return nullptr;
-		bv->cb = sqlite3_column_bytes(pstmt, 0);
+		bv->cb = sqlite3_column_bytes(pstmt, vcol);
 		bv->pv = common_util_alloc(bv->cb);
 		if (bv->pv == nullptr)
 			return nullptr;
-		auto blob = sqlite3_column_blob(pstmt, 0);
+		auto blob = sqlite3_column_blob(pstmt, vcol);
 		if (bv->cb != 0 || blob != nullptr)
 			memcpy(bv->pv, blob, bv->cb);
 		return bv;
@@ -2592,8 +2817,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<SHORT_ARRAY>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_uint16_a(v) != pack_result::ok)
 			return nullptr;
@@ -2607,8 +2832,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<LONG_ARRAY>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_uint32_a(v) != pack_result::ok)
 			return nullptr;
@@ -2623,8 +2848,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<LONGLONG_ARRAY>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_uint64_a(v) != pack_result::ok)
 			return nullptr;
@@ -2637,7 +2862,7 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto ar = cu_alloc<FLOAT_ARRAY>();
 		if (ar == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0), sqlite3_column_bytes(pstmt, 0), common_util_alloc, 0);
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol), sqlite3_column_bytes(pstmt, vcol), common_util_alloc, 0);
 		if (ext_pull.g_float_a(ar) != pack_result::ok)
 			return nullptr;
 		if (ar->count > 0)
@@ -2650,7 +2875,7 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto ar = cu_alloc<DOUBLE_ARRAY>();
 		if (ar == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0), sqlite3_column_bytes(pstmt, 0), common_util_alloc, 0);
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol), sqlite3_column_bytes(pstmt, vcol), common_util_alloc, 0);
 		if (ext_pull.g_double_a(ar) != pack_result::ok)
 			return nullptr;
 		if (ar->count > 0)
@@ -2663,8 +2888,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto sa = cu_alloc<STRING_ARRAY>();
 		if (sa == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_wstr_a(sa) != pack_result::ok)
 			return nullptr;
@@ -2686,8 +2911,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<GUID_ARRAY>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_guid_a(v) != pack_result::ok)
 			return nullptr;
@@ -2700,8 +2925,8 @@ static void *gp_fetch(sqlite3 *psqlite, sqlite3_stmt *pstmt,
 		auto v = cu_alloc<BINARY_ARRAY>();
 		if (v == nullptr)
 			return nullptr;
-		ext_pull.init(sqlite3_column_blob(pstmt, 0),
-			sqlite3_column_bytes(pstmt, 0),
+		ext_pull.init(sqlite3_column_blob(pstmt, vcol),
+			sqlite3_column_bytes(pstmt, vcol),
 			common_util_alloc, 0);
 		if (ext_pull.g_bin_a(v) != pack_result::ok)
 			return nullptr;
@@ -4040,7 +4265,7 @@ BINARY* common_util_to_private_message_entryid(
 	return pbin;
 }
 
-BOOL cu_get_folder_permission(sqlite3 *psqlite, uint64_t folder_id,
+static BOOL cu_folder_perm_sql(sqlite3 *psqlite, uint64_t folder_id,
     const char *username, uint32_t *ppermission)
 {
 	char sql_string[1024];
@@ -4098,6 +4323,42 @@ BOOL cu_get_folder_permission(sqlite3 *psqlite, uint64_t folder_id,
 	return TRUE;
 }
 
+/**
+ * Compute the effective rights of @username on @folder_id: an exact ACL
+ * entry, else the union of all matching mlist ACL entries, else the
+ * "default" entry, else the store-wide default. Results are kept in the
+ * mailbox's folder_perm_cache.
+ */
+BOOL cu_get_folder_permission(const db_conn &db, uint64_t folder_id,
+    const char *username, uint32_t *ppermission) try
+{
+	if (g_exmdb_perm_cache_ttl == 0)
+		return cu_folder_perm_sql(db.psqlite, folder_id, username, ppermission);
+	auto &cache = db.perms();
+	/* Exact string: the SQL lookup of ACL rows is case-sensitive */
+	folder_perm_cache::key_type key{folder_id, znul(username)};
+	/*
+	 * The generation is taken before the permission rows are read, and
+	 * put() refuses the result if a writer flushed the cache since. That
+	 * only holds if the rows come from a snapshot younger than @gen:
+	 * when the caller's transaction has already read something, its
+	 * snapshot may predate a concurrent update_folder_permission, and
+	 * the result is returned without being cached.
+	 */
+	uint64_t gen = 0;
+	if (cache.get(key, ppermission, &gen))
+		return TRUE;
+	bool own_snapshot = sqlite3_txn_state(db.psqlite, "main") == SQLITE_TXN_NONE;
+	if (!cu_folder_perm_sql(db.psqlite, folder_id, username, ppermission))
+		return FALSE;
+	if (own_snapshot)
+		cache.put(std::move(key), *ppermission, gen);
+	return TRUE;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2433: ENOMEM");
+	return FALSE;
+}
+
 BINARY* common_util_username_to_addressbook_entryid(
 	const char *username)
 {
@@ -4611,6 +4872,325 @@ bool cu_eval_msg_restriction(const db_conn &psqlite,
 	return FALSE;
 }
 
+/**
+ * Whether a message property is served straight from message_properties
+ * and can hence be compared in SQL.
+ */
+static inline bool rx_sql_stored_tag(proptag_t tag)
+{
+	return !cu_msgprop_computed(tag);
+}
+
+/**
+ * Produce "p.propval OP rhs" with the same ordering that
+ * propval_compare() uses for @type (unsigned, truncated to the type width).
+ */
+static bool rx_sql_relop(relop op, proptype_t type, const void *rhs,
+    std::string &out)
+{
+	static constexpr const char *sqlops[] = {"<", "<=", ">", ">=", "=", "<>"};
+	if (op > RELOP_NE)
+		return false;
+	auto sqlop = sqlops[static_cast<unsigned int>(op)];
+	switch (type) {
+	case PT_SHORT:
+		out = fmt::format("(p.propval & 65535) {} {}", sqlop,
+		      *static_cast<const uint16_t *>(rhs));
+		return true;
+	case PT_LONG:
+		out = fmt::format("(p.propval & 4294967295) {} {}", sqlop,
+		      *static_cast<const uint32_t *>(rhs));
+		return true;
+	case PT_BOOLEAN:
+		out = fmt::format("((p.propval & 255) <> 0) {} {}", sqlop,
+		      !!*static_cast<const uint8_t *>(rhs) ? 1 : 0);
+		return true;
+	case PT_CURRENCY:
+	case PT_I8:
+	case PT_SYSTIME:
+		break;
+	default:
+		return false;
+	}
+	/* sqlite compares int64 signed; rebuild the unsigned order. */
+	auto v = static_cast<int64_t>(*static_cast<const uint64_t *>(rhs));
+	switch (op) {
+	case RELOP_EQ:
+	case RELOP_NE:
+		out = fmt::format("p.propval {} {}", sqlop, v);
+		break;
+	case RELOP_LT:
+	case RELOP_LE:
+		out = fmt::format("(p.propval >= 0 {} p.propval {} {})",
+		      v >= 0 ? "AND" : "OR", sqlop, v);
+		break;
+	default:
+		out = fmt::format("(p.propval < 0 {} p.propval {} {})",
+		      v >= 0 ? "OR" : "AND", sqlop, v);
+		break;
+	}
+	return true;
+}
+
+/**
+ * Wrap a predicate over one message_properties row p. An absent property
+ * makes the overall outcome @absent (cf. propval_compare_relop_nullok).
+ */
+static std::string rx_sql_wrap(proptag_t tag, const std::string &cond, bool absent)
+{
+	if (absent)
+		return fmt::format("NOT EXISTS (SELECT 1 FROM message_properties AS p "
+		       "WHERE p.message_id=m.message_id AND p.proptag={} AND NOT ({}))",
+		       tag, cond);
+	return fmt::format("EXISTS (SELECT 1 FROM message_properties AS p "
+	       "WHERE p.message_id=m.message_id AND p.proptag={} AND ({}))",
+	       tag, cond);
+}
+
+static bool rx_sql_expr(const RESTRICTION *pres, std::string &out)
+{
+	switch (pres->rt) {
+	case RES_AND:
+	case RES_OR: {
+		if (pres->andor->count == 0) {
+			out = pres->rt == RES_AND ? "1" : "0";
+			return true;
+		}
+		out = "(";
+		for (size_t i = 0; i < pres->andor->count; ++i) {
+			std::string sub;
+			if (!rx_sql_expr(&pres->andor->pres[i], sub))
+				return false;
+			if (i > 0)
+				out += pres->rt == RES_AND ? " AND " : " OR ";
+			out += std::move(sub);
+		}
+		out += ")";
+		return true;
+	}
+	case RES_NOT: {
+		std::string sub;
+		if (!rx_sql_expr(&pres->xnot->res, sub))
+			return false;
+		out = "NOT " + std::move(sub);
+		return true;
+	}
+	case RES_PROPERTY: {
+		auto rprop = pres->prop;
+		if (!rprop->comparable() || rprop->propval.pvalue == nullptr ||
+		    !rx_sql_stored_tag(rprop->proptag))
+			return false;
+		std::string cond;
+		if (!rx_sql_relop(rprop->relop, PROP_TYPE(rprop->proptag),
+		    rprop->propval.pvalue, cond))
+			return false;
+		out = rx_sql_wrap(rprop->proptag, cond,
+		      three_way_eval(rprop->relop, std::strong_ordering::less));
+		return true;
+	}
+	case RES_BITMASK: {
+		auto rbm = pres->bm;
+		if (!rbm->comparable() || !rx_sql_stored_tag(rbm->proptag) ||
+		    (rbm->bitmask_relop != BMR_EQZ && rbm->bitmask_relop != BMR_NEZ))
+			return false;
+		/* Absent values count as 0 */
+		auto eqz = rbm->bitmask_relop == BMR_EQZ;
+		out = rx_sql_wrap(rbm->proptag, fmt::format("(p.propval & {}) {} 0",
+		      rbm->mask, eqz ? "=" : "<>"), eqz);
+		return true;
+	}
+	case RES_EXIST: {
+		auto tag = pres->exist->proptag;
+		if (!rx_sql_stored_tag(tag))
+			return false;
+		switch (PROP_TYPE(tag)) {
+		case PT_SHORT: case PT_LONG: case PT_BOOLEAN: case PT_CURRENCY:
+		case PT_I8: case PT_SYSTIME: case PT_BINARY:
+			out = fmt::format("EXISTS (SELECT 1 FROM message_properties "
+			      "WHERE message_id=m.message_id AND proptag={})", tag);
+			return true;
+		case PT_STRING8:
+		case PT_UNICODE:
+			out = fmt::format("EXISTS (SELECT 1 FROM message_properties "
+			      "WHERE message_id=m.message_id AND proptag IN ({},{}))",
+			      CHANGE_PROP_TYPE(tag, PT_UNICODE),
+			      CHANGE_PROP_TYPE(tag, PT_STRING8));
+			return true;
+		default:
+			return false;
+		}
+	}
+	case RES_COMMENT:
+	case RES_ANNOTATION:
+		if (pres->comment->pres == nullptr) {
+			out = "1";
+			return true;
+		}
+		return rx_sql_expr(pres->comment->pres, out);
+	case RES_NULL:
+		out = "1";
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool rx_has_count(const RESTRICTION *pres)
+{
+	switch (pres->rt) {
+	case RES_AND:
+	case RES_OR:
+		for (const auto &sub : *pres->andor)
+			if (rx_has_count(&sub))
+				return true;
+		return false;
+	case RES_NOT:
+		return rx_has_count(&pres->xnot->res);
+	case RES_SUBRESTRICTION:
+		return rx_has_count(&pres->sub->res);
+	case RES_COMMENT:
+	case RES_ANNOTATION:
+		return pres->comment->pres != nullptr &&
+		       rx_has_count(pres->comment->pres);
+	case RES_COUNT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Translate as much of @pres as possible into an SQL expression over
+ * messages (or search_result) rows aliased "m". The result is exact for
+ * the translated part; the sub-restrictions that could not be translated
+ * are returned in @residual and must additionally hold, evaluated with
+ * cu_eval_msg_restriction. Only top-level RES_AND members are split that
+ * way; returns false if nothing could be translated.
+ */
+bool cu_msg_restriction_sql(const RESTRICTION *pres, std::string &sql,
+    std::vector<const RESTRICTION *> &residual) try
+{
+	sql.clear();
+	residual.clear();
+	/* RES_COUNT has side effects that depend on evaluation order */
+	if (rx_has_count(pres))
+		return false;
+	if (rx_sql_expr(pres, sql))
+		return true;
+	sql.clear();
+	if (pres->rt != RES_AND)
+		return false;
+	for (const auto &sub : *pres->andor) {
+		std::string expr;
+		if (!rx_sql_expr(&sub, expr)) {
+			residual.push_back(&sub);
+			continue;
+		}
+		if (!sql.empty())
+			sql += " AND ";
+		sql += std::move(expr);
+	}
+	return !sql.empty();
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2434: ENOMEM");
+	return false;
+}
+
+static bool rx_dep_add(proptag_t tag, std::vector<uint16_t> &ids)
+{
+	/* Writing any member of a group may change the others' values */
+	static constexpr proptag_t read_grp[] = {PR_READ, PR_MESSAGE_FLAGS};
+	static constexpr proptag_t subj_grp[] =
+		{PR_SUBJECT, PR_NORMALIZED_SUBJECT, PR_SUBJECT_PREFIX};
+	static constexpr proptag_t body_grp[] =
+		{PR_BODY, PR_HTML, PR_RTF_COMPRESSED, PR_RTF_IN_SYNC};
+	std::span<const proptag_t> grp;
+	switch (tag) {
+	case PR_READ:
+	case PR_MESSAGE_FLAGS:
+		grp = read_grp;
+		break;
+	case PR_SUBJECT:
+	case PR_SUBJECT_A:
+	case PR_NORMALIZED_SUBJECT:
+	case PR_NORMALIZED_SUBJECT_A:
+	case PR_SUBJECT_PREFIX:
+	case PR_SUBJECT_PREFIX_A:
+		grp = subj_grp;
+		break;
+	case PR_BODY:
+	case PR_BODY_A:
+	case PR_HTML:
+	case PR_RTF_COMPRESSED:
+	case PR_RTF_IN_SYNC:
+		grp = body_grp;
+		break;
+	default:
+		if (!rx_sql_stored_tag(tag))
+			return false;
+		ids.push_back(PROP_ID(tag));
+		return true;
+	}
+	for (auto t : grp)
+		ids.push_back(PROP_ID(t));
+	return true;
+}
+
+static bool rx_deps(const RESTRICTION *pres, std::vector<uint16_t> &ids)
+{
+	switch (pres->rt) {
+	case RES_AND:
+	case RES_OR:
+		for (const auto &sub : *pres->andor)
+			if (!rx_deps(&sub, ids))
+				return false;
+		return true;
+	case RES_NOT:
+		return rx_deps(&pres->xnot->res, ids);
+	case RES_CONTENT:
+		return rx_dep_add(pres->cont->proptag, ids);
+	case RES_PROPERTY:
+		return rx_dep_add(pres->prop->proptag, ids);
+	case RES_PROPCOMPARE:
+		return rx_dep_add(pres->pcmp->proptag1, ids) &&
+		       rx_dep_add(pres->pcmp->proptag2, ids);
+	case RES_BITMASK:
+		return rx_dep_add(pres->bm->proptag, ids);
+	case RES_SIZE:
+		return rx_dep_add(pres->size->proptag, ids);
+	case RES_EXIST:
+		return rx_dep_add(pres->exist->proptag, ids);
+	case RES_COMMENT:
+	case RES_ANNOTATION:
+		return pres->comment->pres == nullptr ||
+		       rx_deps(pres->comment->pres, ids);
+	case RES_NULL:
+		return true;
+	default:
+		/* Subobjects, RES_COUNT: depends on more than the message's props */
+		return false;
+	}
+}
+
+/**
+ * Collect the property IDs whose modification can change the outcome of
+ * @pres for a message. Returns false if any other change to a message
+ * (recipients, attachments, computed properties) may affect it too.
+ */
+bool cu_restriction_propids(const RESTRICTION *pres,
+    std::vector<uint16_t> &ids) try
+{
+	ids.clear();
+	if (!rx_deps(pres, ids))
+		return false;
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+	return true;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2442: ENOMEM");
+	return false;
+}
+
 bool cu_srchfld_has_msgresult(sqlite3 *psqlite, uint64_t folder_id,
     uint64_t message_id, bool *pb_exist)
 {
@@ -4728,6 +5308,13 @@ static errno_t copy_eml_ext(const char *old_midstr, std::string &new_midstr) try
 				old_ext.c_str(), new_ext.c_str(), strerror(errno));
 		return se;
 	}
+	/* The structure index is optional; readers fall back to the digest. */
+	auto old_mst = fmt::format("{}/mst/{}", basedir, old_midstr);
+	auto new_mst = fmt::format("{}/mst/{}", basedir, new_midstr);
+	if (gx_mkbasedir(new_mst.c_str(), FMODE_PRIVATE | S_IXUSR | S_IXGRP) >= 0 &&
+	    link(old_mst.c_str(), new_mst.c_str()) < 0 && errno != ENOENT)
+		mlog(LV_WARN, "W-2474: link %s -> %s: %s",
+			old_mst.c_str(), new_mst.c_str(), strerror(errno));
 	return 0;
 } catch (const std::bad_alloc &) {
 	mlog(LV_ERR, "%s: ENOMEM", __func__);
@@ -13,22 +13,27 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <fcntl.h>
 #include <future>
 #include <list>
 #include <mutex>
 #include <optional>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore>
 #include <string>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include <fmt/core.h>
 #include <sys/stat.h>
+#include <libHX/io.h>
 #include <libHX/scope.hpp>
+#include <libHX/string.h>
 #include <gromox/atomic.hpp>
 #include <gromox/clock.hpp>
 #include <gromox/database.h>
@@ -50,6 +55,7 @@
 #include <gromox/util.hpp>
 #include <gromox/fileio.h>
 #include "db_engine.hpp"
+#include "fulltext.hpp"
 #include "notification_agent.hpp"
 #define MAX_DYNAMIC_NODES				100
 
@@ -90,6 +96,16 @@ struct rowdel_node {
 	bool b_read = false;
 };
 
+struct warm_node {
+	std::string dir;
+	bool b_private = false;
+};
+
+/* Latency of db_base::ctor2_and_open, in microseconds */
+struct cold_open_stats {
+	unsigned long long count = 0, total = 0, max = 0;
+};
+
 }
 
 static size_t g_table_size; /* hash table size */
@@ -110,10 +126,38 @@ std::atomic<unsigned int> g_exmdb_schema_upgrades, g_exmdb_search_pacing;
 std::atomic<unsigned long long> g_exmdb_search_pacing_time = 2000000000;
 std::atomic<unsigned int> g_exmdb_search_yield, g_exmdb_search_nice;
 std::atomic<unsigned int> g_exmdb_pvt_folder_softdel, g_exmdb_max_sqlite_spares;
+std::atomic<unsigned int> g_exmdb_perm_cache_ttl = 60;
 std::atomic<unsigned long long> g_sqlite_busy_timeout_ns;
+unsigned long long g_exmdb_group_commit_ns;
+std::atomic<unsigned int> g_exmdb_maint_interval, g_exmdb_maint_idle = 30;
+std::atomic<unsigned long long> g_exmdb_maint_budget = 64ULL << 20;
+static pthread_t g_maint_tid;
+unsigned int g_exmdb_warmup_threads;
+std::atomic<unsigned int> g_exmdb_warmup_queue = 1000;
+std::string g_exmdb_warmup_list;
+static std::vector<pthread_t> g_warm_thrids;
+static std::mutex g_warm_lock;
+static std::condition_variable g_warm_cond;
+/* Pending warm-ups, and the same dirs for deduplication; protected by g_warm_lock */
+static std::deque<warm_node> g_warm_queue;
+static std::unordered_set<std::string> g_warm_queued;
+static cold_open_stats g_cold_demand, g_cold_warm; /* protected by g_warm_lock */
+static unsigned long long g_warm_dropped; /* protected by g_warm_lock */
+static bool g_warm_loaded;
+static thread_local bool g_warm_thread;
 std::string exmdb_eph_prefix;
+/* Mailboxes the current RPC has committed to, and whether to track them */
+static thread_local std::vector<std::shared_ptr<group_commit>> g_gc_pending;
+static thread_local bool g_gc_armed;
 
 static bool dbase_is_purgable(const db_base &, time_point);
+/*
+ * With db_maint_thread active, committers only checkpoint as a last resort
+ * (pages; sqlite's default is 1000).
+ */
+static constexpr unsigned int maint_autocheckpoint = 16384;
+static int group_commit_hook(void *);
+static void cold_open_account(const char *dir, time_duration);
 static void dbeng_notify_cttbl_modify_row(db_conn &, uint64_t folder_id, uint64_t message_id, db_base &, db_conn::NOTIFQ &);
 
 static void db_engine_load_dynamic_list(db_base *dbase, sqlite3* psqlite) try
@@ -142,7 +186,7 @@ static void db_engine_load_dynamic_list(db_base *dbase, sqlite3* psqlite) try
 			sqlite3_column_bytes(pstmt, 2), common_util_alloc, 0);
 		if (ext_pull.g_restriction(&tmp_restriction) != pack_result::ok)
 			continue;
-		pdynamic->prestriction = tmp_restriction.dup();
+		pdynamic->set_restriction(tmp_restriction.dup());
 		if (pdynamic->prestriction == nullptr)
 			break;
 		if (!cu_load_search_scopes(psqlite,
@@ -237,9 +281,11 @@ bool db_engine_set_maint(const char *path, enum db_maint_mode mode) try
  * Query or create db_conn in hash table.
  *
  * Iff this function returns a non-null pointer, then pdb->psqlite and
- * pdb->m_sqlite_eph are also guaranteed to be viable.
+ * pdb->m_sqlite_eph are also guaranteed to be viable. With @ro, psqlite is
+ * a read-only handle from a separate pool, for RPCs that only read
+ * exchange.sqlite3 and do not need the giant lock.
  */
-std::optional<db_conn> db_engine_get_db(const char *path)
+std::optional<db_conn> db_engine_get_db(const char *path, bool ro)
 {
 	if (*path == '\0')
 		return std::nullopt;
@@ -263,7 +309,7 @@ std::optional<db_conn> db_engine_get_db(const char *path)
 		pdb->last_time = tp_now();
 		std::optional<db_conn> conn(*pdb);
 		hhold.unlock(); /* The iterator is potentially invalid now */
-		if (!conn->open(path))
+		if (!conn->open(path, ro))
 			return std::nullopt;
 		if (getenv("SQLITE_WORKER") == nullptr)
 			return conn;
@@ -298,15 +344,17 @@ std::optional<db_conn> db_engine_get_db(const char *path)
 	 * serialized.
 	 */
 	hhold.unlock();
+	auto t_open = tp_now();
 	try {
 		pdb->ctor2_and_open(path);
 	} catch (const std::runtime_error& err) {
 		mlog(LV_ERR, "%s", err.what());
 		return std::nullopt;
 	}
+	cold_open_account(path, tp_now() - t_open);
 
 	std::optional<db_conn> conn(*pdb);
-	if (!conn->open(path))
+	if (!conn->open(path, ro))
 		return std::nullopt;
 	return conn;
 }
@@ -317,6 +365,10 @@ BOOL db_engine_vacuum(const char *path)
 	if (!db)
 		return false;
 	mlog(LV_INFO, "I-2067: Vacuuming %s (exchange.sqlite3)", path);
+	/* Takes effect with this VACUUM; lets db_maint_thread reclaim space later */
+	if (g_exmdb_maint_interval > 0 &&
+	    gx_sql_exec(db->psqlite, "PRAGMA auto_vacuum=INCREMENTAL") != SQLITE_OK)
+		/* keep the old mode */;
 	if (gx_sql_exec(db->psqlite, "VACUUM") != SQLITE_OK)
 		return false;
 	mlog(LV_INFO, "I-2102: Vacuuming %s ended", path);
@@ -495,7 +547,8 @@ BOOL db_engine_cgkreset(const char *dir, uint32_t flags)
 
 dynamic_node::dynamic_node(dynamic_node &&o) noexcept :
 	folder_id(o.folder_id), search_flags(o.search_flags),
-	prestriction(o.prestriction), scope_list(std::move(o.scope_list))
+	prestriction(o.prestriction), scope_list(std::move(o.scope_list)),
+	dep_ids(std::move(o.dep_ids)), dep_all(o.dep_all)
 {
 	o.prestriction = nullptr;
 }
@@ -512,9 +565,35 @@ dynamic_node &dynamic_node::operator=(dynamic_node &&o) noexcept
 	search_flags = o.search_flags;
 	std::swap(prestriction, o.prestriction);
 	scope_list = std::move(o.scope_list);
+	dep_ids = std::move(o.dep_ids);
+	dep_all = o.dep_all;
 	return *this;
 }
 
+/**
+ * Take ownership of @r and record which properties it looks at.
+ */
+void dynamic_node::set_restriction(RESTRICTION *r)
+{
+	if (prestriction != nullptr)
+		restriction_free(prestriction);
+	prestriction = r;
+	dep_all = r == nullptr || !cu_restriction_propids(r, dep_ids);
+}
+
+/**
+ * Whether modifying @changed (empty: unknown) may change which messages
+ * the search folder's restriction admits.
+ */
+bool dynamic_node::affected_by(proptag_cspan changed) const
+{
+	if (dep_all || changed.empty())
+		return true;
+	return std::any_of(changed.begin(), changed.end(), [&](proptag_t t) {
+		return std::binary_search(dep_ids.begin(), dep_ids.end(), PROP_ID(t));
+	});
+}
+
 table_node::table_node(const table_node &o, clone_t) :
 	table_id(o.table_id), table_flags(o.table_flags), cpid(o.cpid),
 	type(o.type), cloned(true), remote_id(o.remote_id), username(o.username),
@@ -557,25 +636,30 @@ db_base::db_base() :
  */
 db_handle db_base::get_db(const char* dir, DB_TYPE type)
 {
-	auto& spares = type == DB_MAIN? mx_sqlite : mx_sqlite_eph;
+	auto &spares = type == DB_MAIN ? mx_sqlite : type == DB_RO ?
+	               mx_sqlite_ro : mx_sqlite_eph;
 	if (!spares.empty()) {
 		db_handle handle = std::move(spares.back());
 		spares.pop_back();
 		return handle;
 	}
-	const auto &path = type == DB_MAIN ? fmt::format("{}/exmdb/exchange.sqlite3", dir) :
+	const auto &path = type != DB_EPH ? fmt::format("{}/exmdb/exchange.sqlite3", dir) :
 			   fmt::format("{}/{}/tables.sqlite3", exmdb_eph_prefix, dir);
-	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX;
-	flags |= type == DB_MAIN? 0 : SQLITE_OPEN_CREATE;
+	int flags = SQLITE_OPEN_NOMUTEX;
+	flags |= type == DB_RO ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+	flags |= type == DB_EPH ? SQLITE_OPEN_CREATE : 0;
 	sqlite3 *db = nullptr;
-	int ret = gx_mkbasedir(path.c_str(), FMODE_PRIVATE | S_IXUSR | S_IXGRP);
-	if (ret < 0) {
-		mlog(LV_ERR, "E-2329: mkbasedir %s: %s", path.c_str(), strerror(-ret));
-		return nullptr;
+	int ret;
+	if (type != DB_RO) {
+		ret = gx_mkbasedir(path.c_str(), FMODE_PRIVATE | S_IXUSR | S_IXGRP);
+		if (ret < 0) {
+			mlog(LV_ERR, "E-2329: mkbasedir %s: %s", path.c_str(), strerror(-ret));
+			return nullptr;
+		}
+		if (access(path.c_str(), W_OK) != 0 && errno != ENOENT)
+			mlog(LV_ERR, "E-1734: %s is not writable (%s), there may be more errors later",
+				path.c_str(), strerror(errno));
 	}
-	if (access(path.c_str(), W_OK) != 0 && errno != ENOENT)
-		mlog(LV_ERR, "E-1734: %s is not writable (%s), there may be more errors later",
-			path.c_str(), strerror(errno));
 	ret = sqlite3_open_v2(path.c_str(), &db, flags, nullptr);
 	db_handle hdb(db); /* automatically close connection if something goes wrong */
 	if (ret != SQLITE_OK) {
@@ -583,6 +667,11 @@ db_handle db_base::get_db(const char* dir, DB_TYPE type)
 			path.c_str(), sqlite3_errstr(ret), ret);
 		return nullptr;
 	}
+	if (type == DB_RO) {
+		/* journal mode and schema are the business of DB_MAIN handles */
+		sqlite3_busy_timeout(db, int(g_sqlite_busy_timeout_ns / 1000000));
+		return hdb;
+	}
 	ret = gx_sql_exec(db, "PRAGMA foreign_keys=ON");
 	if (ret != SQLITE_OK) {
 		mlog(LV_ERR, "E-2101: enable foreign keys %s: %s (%d)", dir, sqlite3_errstr(ret), ret);
@@ -591,19 +680,42 @@ db_handle db_base::get_db(const char* dir, DB_TYPE type)
 	if (gx_sql_exec(db, "PRAGMA journal_mode=WAL") != SQLITE_OK)
 		/* keep going with existing mode */;
 	sqlite3_busy_timeout(db, int(g_sqlite_busy_timeout_ns / 1000000)); // ns -> ms
-	ret = gx_sql_exec(db, type == DB_MAIN ? "PRAGMA synchronous=FULL" : "PRAGMA synchronous=OFF");
+	bool grouped = type == DB_MAIN && g_exmdb_group_commit_ns > 0;
+	ret = gx_sql_exec(db, type != DB_MAIN ? "PRAGMA synchronous=OFF" :
+	      grouped ? "PRAGMA synchronous=NORMAL" : "PRAGMA synchronous=FULL");
 	if (ret != SQLITE_OK)
 		/* keep going with existing mode */;
+	if (type == DB_MAIN && g_exmdb_maint_interval > 0 &&
+	    gx_sql_exec(db, "PRAGMA wal_autocheckpoint=" +
+	    std::to_string(maint_autocheckpoint)) != SQLITE_OK)
+		/* keep the default */;
+	if (grouped) {
+		try {
+			if (gcommit == nullptr)
+				gcommit = std::make_shared<group_commit>(path + "-wal");
+		} catch (const std::bad_alloc &) {
+			mlog(LV_ERR, "E-2447: ENOMEM");
+			return nullptr;
+		}
+		sqlite3_commit_hook(db, group_commit_hook, gcommit.get());
+	}
+	if (type == DB_MAIN && g_exmdb_fulltext && !fts_attach(db, dir)) {
+		mlog(LV_ERR, "E-2440: %s: cannot attach fulltext index: %s",
+			dir, sqlite3_errmsg(db));
+		return nullptr;
+	}
 	return hdb;
 }
 
 /**
  * Get cached database handles or open new ones.
+ *
+ * @ro:  hand out a read-only handle for exchange.sqlite3
  */
-void db_base::get_dbs(const char* dir, sqlite3 *&main, sqlite3 *&eph)
+void db_base::get_dbs(const char* dir, sqlite3 *&main, sqlite3 *&eph, bool ro)
 {
 	std::unique_lock lock(sqlite_lock);
-	main = get_db(dir, db_base::DB_MAIN).release();
+	main = get_db(dir, ro ? db_base::DB_RO : db_base::DB_MAIN).release();
 	eph  = get_db(dir, db_base::DB_EPH).release();
 }
 
@@ -635,6 +747,9 @@ void db_base::ctor2_and_open(const char *dir)
 			throw std::runtime_error(fmt::format("E-1351: unlink {}: {}", path, strerror(errno)));
 	}
 
+	if (!g_exmdb_fulltext)
+		fts_discard(dir);
+
 	/* We need a handle for the upgrade check... */
 	db_handle hdb(get_db(dir, DB_MAIN));
 	if (!hdb)
@@ -642,7 +757,12 @@ void db_base::ctor2_and_open(const char *dir)
 	auto ret = db_engine_autoupgrade(hdb.get(), dir);
 	if (ret != 0)
 		throw std::runtime_error(fmt::format("E-2105: autoupgrade {}: {}", dir, ret));
-	if (exmdb_server::is_private())
+	if (!g_exmdb_fulltext)
+		fts_drop_marks(hdb.get());
+	else if (!fts_attach(hdb.get(), dir))
+		throw std::runtime_error(fmt::format("E-2441: fts_attach {} failed", dir));
+	b_private = exmdb_server::is_private();
+	if (b_private)
 		db_engine_load_dynamic_list(this, hdb.get());
 
 	/* ...don't let it go to waste */
@@ -662,7 +782,7 @@ static void rollback_leaked_txn(sqlite3 *db)
 		/* nothing more we can do */;
 }
 
-void db_base::handle_spares(sqlite3 *main, sqlite3 *eph)
+void db_base::handle_spares(sqlite3 *main, sqlite3 *eph, bool ro)
 {
 	static constexpr size_t unlimited = 0;
 	rollback_leaked_txn(main);
@@ -674,9 +794,10 @@ void db_base::handle_spares(sqlite3 *main, sqlite3 *eph)
 			mx_sqlite_eph.emplace_back(std::move(eph));
 			eph = nullptr;
 		}
+		auto &main_spares = ro ? mx_sqlite_ro : mx_sqlite;
 		if (main != nullptr && g_exmdb_max_sqlite_spares != unlimited &&
-		    mx_sqlite.size() < g_exmdb_max_sqlite_spares) {
-			mx_sqlite.emplace_back(std::move(main));
+		    main_spares.size() < g_exmdb_max_sqlite_spares) {
+			main_spares.emplace_back(std::move(main));
 			main = nullptr;
 		}
 	} catch (const std::bad_alloc &) {
@@ -698,7 +819,7 @@ db_conn::db_conn(db_conn &&o) noexcept :
 	psqlite(std::move(o.psqlite)),
 	m_sqlite_eph(std::move(o.m_sqlite_eph)),
 	m_prepstm(std::move(o.m_prepstm)),
-	m_base(std::move(o.m_base))
+	m_base(std::move(o.m_base)), m_readonly(o.m_readonly)
 {
 	o.psqlite = o.m_sqlite_eph = nullptr;
 	o.m_base = nullptr;
@@ -715,7 +836,7 @@ db_conn::~db_conn()
 	 * pick them up immediately.
 	 */
 	m_prepstm.reset();
-	m_base->handle_spares(std::move(psqlite), std::move(m_sqlite_eph));
+	m_base->handle_spares(std::move(psqlite), std::move(m_sqlite_eph), m_readonly);
 	--m_base->reference;
 	g_maint_ref_cv.notify_all();
 }
@@ -727,7 +848,7 @@ db_conn &db_conn::operator=(db_conn &&o) noexcept
 	/* Clean up our own state first. */
 	m_prepstm.reset();
 	if (m_base != nullptr) {
-		m_base->handle_spares(std::move(psqlite), std::move(m_sqlite_eph));
+		m_base->handle_spares(std::move(psqlite), std::move(m_sqlite_eph), m_readonly);
 		--m_base->reference;
 		g_maint_ref_cv.notify_all();
 	}
@@ -736,6 +857,7 @@ db_conn &db_conn::operator=(db_conn &&o) noexcept
 	m_prepstm = std::move(o.m_prepstm);
 	o.psqlite = o.m_sqlite_eph = nullptr;
 	m_base = std::move(o.m_base);
+	m_readonly = o.m_readonly;
 	o.m_base = nullptr;
 	return *this;
 }
@@ -746,10 +868,13 @@ db_conn &db_conn::operator=(db_conn &&o) noexcept
  * Should be called exactly once after creation and before first usage.
  *
  * @dir:  Store directory
+ * @ro:   use a read-only handle for exchange.sqlite3 (for RPCs that never
+ *        write to it)
  */
-bool db_conn::open(const char *dir) try
+bool db_conn::open(const char *dir, bool ro) try
 {
-	m_base->get_dbs(dir, psqlite, m_sqlite_eph);
+	m_readonly = ro;
+	m_base->get_dbs(dir, psqlite, m_sqlite_eph, ro);
 	return psqlite && m_sqlite_eph;
 } catch (const std::bad_alloc &) {
 	mlog(LV_ERR, "%s: ENOMEM", __PRETTY_FUNCTION__);
@@ -775,6 +900,7 @@ db_base_wr_ptr db_conn::lock_base_wr()
 {
 	assert(m_base != nullptr);
 	m_base->giant_lock.lock();
+	++m_base->wr_gen;
 	return db_base_wr_ptr(m_base);
 }
 
@@ -791,9 +917,148 @@ void db_base::drop_all()
 {
 	instance_list.clear();
 	dynamic_list.clear();
+	dynamic_scope.clear();
 	tables.table_list.clear();
 	mx_sqlite_eph.clear();
 	mx_sqlite.clear();
+	mx_sqlite_ro.clear();
+	perms.clear();
+}
+
+/**
+ * Look up @key. On a miss, *@gen receives the generation number that the
+ * caller must hand to put() once it has computed the value.
+ */
+bool folder_perm_cache::get(const key_type &key, uint32_t *rights, uint64_t *gen)
+{
+	std::lock_guard lk(mtx);
+	auto it = map.find(key);
+	if (it != map.end() && tp_now() < it->second.expiry) {
+		*rights = it->second.rights;
+		++hits;
+		return true;
+	}
+	*gen = this->gen;
+	++misses;
+	return false;
+}
+
+void folder_perm_cache::put(key_type &&key, uint32_t rights, uint64_t gen)
+{
+	static constexpr size_t max_entries = 16384;
+	std::lock_guard lk(mtx);
+	if (gen != this->gen)
+		/* permissions were changed while the caller was computing */
+		return;
+	auto now = tp_now();
+	if (map.size() >= max_entries) {
+		std::erase_if(map, [=](const auto &e) { return e.second.expiry <= now; });
+		if (map.size() >= max_entries)
+			map.clear();
+	}
+	map.insert_or_assign(std::move(key),
+		entry{rights, now + std::chrono::seconds(g_exmdb_perm_cache_ttl)});
+}
+
+void folder_perm_cache::clear()
+{
+	std::lock_guard lk(mtx);
+	++gen;
+	++flushes;
+	map.clear();
+}
+
+/**
+ * Wait until everything this thread committed so far is on disk.
+ */
+void group_commit::wait()
+{
+	auto t_start = tp_now();
+	std::unique_lock lk(mtx);
+	auto ticket = ++tickets;
+	while (synced < ticket) {
+		if (syncing) {
+			cv.wait(lk);
+			continue;
+		}
+		/* Become the leader; let others pile up for the window */
+		syncing = true;
+		lk.unlock();
+		std::this_thread::sleep_for(std::chrono::nanoseconds(g_exmdb_group_commit_ns));
+		lk.lock();
+		auto target = tickets;
+		lk.unlock();
+		auto fd = open(wal_path.c_str(), O_RDONLY);
+		if (fd >= 0) {
+			if (fdatasync(fd) != 0)
+				mlog(LV_ERR, "E-2444: fdatasync %s: %s",
+					wal_path.c_str(), strerror(errno));
+			close(fd);
+		} else if (errno != ENOENT) {
+			/* ENOENT: WAL was checkpointed (and synced) away */
+			mlog(LV_ERR, "E-2445: open %s: %s", wal_path.c_str(), strerror(errno));
+		}
+		++syncs;
+		lk.lock();
+		synced = target;
+		syncing = false;
+		cv.notify_all();
+	}
+	lk.unlock();
+	++waits;
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(tp_now() - t_start).count();
+	size_t bucket = 0;
+	while (us > 0 && bucket < std::size(lat_hist) - 1) {
+		us >>= 1;
+		++bucket;
+	}
+	++lat_hist[bucket];
+}
+
+static int group_commit_hook(void *arg) try
+{
+	if (!g_gc_armed)
+		return 0;
+	auto gc = static_cast<group_commit *>(arg);
+	if (std::none_of(g_gc_pending.begin(), g_gc_pending.end(),
+	    [&](const std::shared_ptr<group_commit> &e) { return e.get() == gc; }))
+		g_gc_pending.push_back(gc->shared_from_this());
+	return 0;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2446: ENOMEM");
+	return 1; /* turn the COMMIT into a ROLLBACK rather than lose the sync */
+}
+
+/**
+ * Start tracking commits made by the current thread (an RPC begins).
+ */
+void db_engine_group_arm()
+{
+	g_gc_armed = g_exmdb_group_commit_ns > 0;
+}
+
+/**
+ * The RPC is done; make its commits durable before the reply goes out.
+ */
+void db_engine_group_sync()
+{
+	g_gc_armed = false;
+	for (auto &gc : g_gc_pending)
+		gc->wait();
+	g_gc_pending.clear();
+}
+
+static void group_commit_log(const std::string &dir, const group_commit &gc)
+{
+	if (gc.waits == 0)
+		return;
+	std::string h;
+	for (size_t i = 0; i < std::size(gc.lat_hist); ++i)
+		if (gc.lat_hist[i] != 0)
+			h += fmt::format(" <{}us:{}", 1ULL << i, gc.lat_hist[i].load());
+	mlog(LV_DEBUG, "exmdb: %s: group commit: %llu waits, %llu syncs;%s",
+		dir.c_str(), static_cast<unsigned long long>(gc.waits),
+		static_cast<unsigned long long>(gc.syncs), h.c_str());
 }
 
 /**
@@ -845,7 +1110,17 @@ static void *db_expiry_thread(void *param)
 		 * ought to be no new ones, since we also hold g_hash_lock).
 		 */
 		auto z = std::erase_if(g_hash_table, [=](const decltype(g_hash_table)::value_type &iter) {
-			return dbase_is_purgable(iter.second, now_time);
+			if (!dbase_is_purgable(iter.second, now_time))
+				return false;
+			if (iter.second.gcommit != nullptr)
+				group_commit_log(iter.first, *iter.second.gcommit);
+			auto &pc = iter.second.perms;
+			if (pc.hits + pc.misses > 0)
+				mlog(LV_DEBUG, "exmdb: %s: permission cache: %llu hits, %llu misses, %llu flushes",
+					iter.first.c_str(), static_cast<unsigned long long>(pc.hits),
+					static_cast<unsigned long long>(pc.misses),
+					static_cast<unsigned long long>(pc.flushes));
+			return true;
 		});
 		if (z > 0 && g_istore_standalone & ISTORE_SPLIT_WORKERS &&
 		    g_hash_table.empty()) {
@@ -869,14 +1144,45 @@ void dg_notify(db_conn::NOTIFQ &&notifq)
 	notifq.clear();
 }
 
+/**
+ * Link the messages of @scope_fid matching @prestriction into @search_fid.
+ *
+ * The part of the restriction that has an SQL equivalent is used to filter
+ * the candidate list right away; only the remainder is evaluated message by
+ * message. With exmdb_fulltext_index, content restrictions additionally
+ * narrow the candidates through the trigram index. Links are committed in
+ * blocks of exmdb_search_pacing messages (or exmdb_search_pacing_time), in
+ * between which the write lock is released.
+ */
 static bool db_engine_search_folder(const char *dir, cpid_t cpid,
     uint64_t search_fid, uint64_t scope_fid, const RESTRICTION *prestriction,
-    db_conn &db)
+    db_conn &db) try
 {
-	char sql_string[128];
+	std::string filter;
+	std::vector<const RESTRICTION *> residual;
+	bool pushdown = cu_msg_restriction_sql(prestriction, filter, residual);
+	std::string fts_match;
+	if ((!pushdown || !residual.empty()) && fts_available(db.psqlite) &&
+	    fts_match_expr(prestriction, fts_match)) {
+		/*
+		 * Still-dirty messages are candidates regardless, so the rest
+		 * of the backlog can be left to the maintenance pass.
+		 */
+		fts_sync(db, FTS_SYNC_BACKLOG);
+		/* Superset only; the content tests stay in the residual */
+		if (!pushdown) {
+			residual.assign(1, prestriction);
+			filter.clear();
+		} else {
+			filter += " AND ";
+		}
+		filter += "m.message_id IN (" + fts_prefilter_sql(fts_match) + ")";
+		pushdown = true;
+	}
 	auto sql_transact = gx_sql_begin(db.psqlite, txn_mode::read); // ends before writes take place
 	if (!sql_transact)
 		return false;
+	char sql_string[128];
 	snprintf(sql_string, std::size(sql_string), "SELECT is_search "
 	          "FROM folders WHERE folder_id=%llu", LLU{scope_fid});
 	auto pstmt = db.prep(sql_string);
@@ -884,65 +1190,78 @@ static bool db_engine_search_folder(const char *dir, cpid_t cpid,
 		return FALSE;
 	if (pstmt.step() != SQLITE_ROW)
 		return TRUE;
-	if (sqlite3_column_int64(pstmt, 0) == 0)
-		snprintf(sql_string, std::size(sql_string), "SELECT message_id FROM"
-		          " messages WHERE parent_fid=%llu",
-		          static_cast<unsigned long long>(scope_fid));
-	else
-		snprintf(sql_string, std::size(sql_string), "SELECT message_id FROM"
-		          " search_result WHERE folder_id=%llu",
-		          static_cast<unsigned long long>(scope_fid));
+	auto query = sqlite3_column_int64(pstmt, 0) == 0 ?
+	             fmt::format("SELECT m.message_id FROM messages AS m"
+	                         " WHERE m.parent_fid={}", scope_fid) :
+	             fmt::format("SELECT m.message_id FROM search_result AS m"
+	                         " WHERE m.folder_id={}", scope_fid);
+	if (pushdown)
+		query += " AND " + filter;
 	pstmt.finalize();
-	pstmt = db.prep(sql_string);
+	pstmt = db.prep(query);
 	if (pstmt == nullptr)
 		return FALSE;
-	auto pmessage_ids = eid_array_init();
-	if (pmessage_ids == nullptr)
-		return FALSE;
-	auto cl_0 = HX::make_scope_exit([&]() { eid_array_free(pmessage_ids); });
+	std::vector<uint64_t> message_ids;
 	while (pstmt.step() == SQLITE_ROW)
-		if (!eid_array_append(pmessage_ids,
-		    sqlite3_column_int64(pstmt, 0)))
-			return FALSE;
+		message_ids.push_back(sqlite3_column_int64(pstmt, 0));
 	pstmt.finalize();
 	auto t_start = tp_now();
 	auto cl_1 = HX::make_scope_exit([&]() {
 		auto t_end = tp_now();
 		auto t_diff = std::chrono::duration<double>(t_end - t_start).count();
-		if (pmessage_ids->count > 0 && t_diff >= 1)
-			mlog(LV_DEBUG, "db_eng_sf: %u messages in %.2f seconds",
-				pmessage_ids->count, t_diff);
+		if (message_ids.size() > 0 && t_diff >= 1)
+			mlog(LV_DEBUG, "db_eng_sf: %zu messages (%s) in %.2f seconds",
+				message_ids.size(), !pushdown ? "unfiltered" :
+				residual.empty() ? "filtered" : "prefiltered", t_diff);
 	});
 	sql_transact = xtransaction();
-	bool b_linked = false;
-	for (size_t i = 0; i < pmessage_ids->count; ++i) {
+	unsigned int pacing = std::max(1U, g_exmdb_search_pacing.load());
+	auto pacing_time = std::chrono::nanoseconds(g_exmdb_search_pacing_time.load());
+	std::vector<uint64_t> linked;
+	bool b_linked = false, b_closed = false;
+	for (size_t i = 0; i < message_ids.size() && !b_closed; ) {
 		if (g_dbeng_stop)
 			break;
 		auto sql_transact1 = gx_sql_begin(db.psqlite, txn_mode::write);
 		if (!sql_transact1)
 			return false;
-		if (!cu_eval_msg_restriction(db,
-		    cpid, pmessage_ids->pids[i], prestriction))
-			continue;
-		snprintf(sql_string, std::size(sql_string), "INSERT OR IGNORE INTO search_result "
-		         "(folder_id, message_id) VALUES (%llu, %llu)",
-		         LLU{search_fid}, LLU{pmessage_ids->pids[i]});
-		auto ret = db.exec(sql_string, SQLEXEC_SILENT_CONSTRAINT);
-		if (ret == SQLITE_CONSTRAINT)
-			/*
-			 * Search folder is closed (deleted) already, INSERT
-			 * does not succeed (FK violation), and neither will
-			 * subsequent queries.
-			 */
-			break;
-		else if (ret != SQLITE_OK)
-			continue;
-		if (sqlite3_changes(db.psqlite) == 0)
-			/*
-			 * Message was already linked by a concurrent dynamic
-			 * evaluation or an overlapping populate run. A second
-			 * add_row would trip UNIQUE t$id.inst_id, so skip.
-			 */
+		linked.clear();
+		auto t_block = tp_now();
+		for (unsigned int n = 0; i < message_ids.size() && n < pacing &&
+		     (n == 0 || tp_now() - t_block < pacing_time); ++i, ++n) {
+			auto mid = message_ids[i];
+			if (!pushdown) {
+				if (!cu_eval_msg_restriction(db, cpid, mid, prestriction))
+					continue;
+			} else if (!std::all_of(residual.begin(), residual.end(),
+			    [&](const RESTRICTION *r) { return cu_eval_msg_restriction(db, cpid, mid, r); })) {
+				continue;
+			}
+			snprintf(sql_string, std::size(sql_string), "INSERT OR IGNORE INTO search_result "
+			         "(folder_id, message_id) VALUES (%llu, %llu)",
+			         LLU{search_fid}, LLU{mid});
+			auto ret = db.exec(sql_string, SQLEXEC_SILENT_CONSTRAINT);
+			if (ret == SQLITE_CONSTRAINT) {
+				/*
+				 * Search folder is closed (deleted) already, INSERT
+				 * does not succeed (FK violation), and neither will
+				 * subsequent queries.
+				 */
+				b_closed = true;
+				break;
+			} else if (ret != SQLITE_OK) {
+				continue;
+			}
+			if (sqlite3_changes(db.psqlite) == 0)
+				/*
+				 * Message was already linked by a concurrent dynamic
+				 * evaluation or an overlapping populate run. A second
+				 * add_row would trip UNIQUE t$id.inst_id, so skip.
+				 */
+				continue;
+			linked.push_back(mid);
+		}
+		if (linked.empty())
 			continue;
 		if (sql_transact1.commit() != SQLITE_OK)
 			return false;
@@ -953,14 +1272,19 @@ static bool db_engine_search_folder(const char *dir, cpid_t cpid,
 		 */
 		db_conn::NOTIFQ notifq;
 		auto dbase = db.lock_base_wr();
-		db.proc_dynamic_event(cpid, dynamic_event::new_msg,
-			search_fid, pmessage_ids->pids[i], 0, *dbase, notifq);
-		/*
-		 * Regular notifications
-		 */
-		db.notify_link_creation(search_fid, pmessage_ids->pids[i], *dbase, notifq, false);
+		for (auto mid : linked) {
+			db.proc_dynamic_event(cpid, dynamic_event::new_msg,
+				search_fid, mid, 0, *dbase, notifq);
+			/*
+			 * Regular notifications
+			 */
+			db.notify_link_creation(search_fid, mid, *dbase, notifq, false);
+		}
+		dbase.reset();
 		dg_notify(std::move(notifq));
 		b_linked = true;
+		if (g_exmdb_search_yield)
+			sched_yield();
 	}
 	if (b_linked) {
 		db_conn::NOTIFQ notifq;
@@ -970,6 +1294,9 @@ static bool db_engine_search_folder(const char *dir, cpid_t cpid,
 		dg_notify(std::move(notifq));
 	}
 	return TRUE;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2435: ENOMEM");
+	return false;
 }
 
 static bool db_engine_load_folder_descendant(const char *dir,
@@ -1093,7 +1420,7 @@ static void *sf_popul_thread(void *param)
 		if (pfolder_ids == nullptr)
 			goto NEXT_SEARCH;	
 		auto cl_1 = HX::make_scope_exit([&]() { eid_array_free(pfolder_ids); });
-		exmdb_server::build_env(EM_PRIVATE, psearch->dir.c_str());
+		exmdb_server::build_env(EM_PRIVATE | EM_BACKGROUND, psearch->dir.c_str());
 		auto cl_2 = HX::make_scope_exit(exmdb_server::free_env);
 		for (auto le_folder : psearch->scope_list) {
 			if (!eid_array_append(pfolder_ids, le_folder))
@@ -1164,6 +1491,322 @@ void db_engine_init(size_t table_size, int cache_interval, unsigned int sfpop_ma
 	g_autoupg_limiter.emplace(par_upg);
 }
 
+/**
+ * Checkpoint one store. If it is @idle, also shrink it (with
+ * auto_vacuum=INCREMENTAL), spending roughly at most @budget bytes of I/O,
+ * and work off some of its full-text indexing backlog. A store in use only
+ * gets the passive checkpoint, which does not wait for its readers and
+ * writers. Returns the amount of I/O spent.
+ */
+static uint64_t db_maint_one(const std::string &dir, uint64_t budget, bool idle)
+{
+	{
+		std::lock_guard mhold(g_maint_lock);
+		if (g_maint_table.contains(dir))
+			return 0;
+	}
+	std::optional<db_conn> conn;
+	bool b_private = true;
+	{
+		/* Not via db_engine_get_db: that would renew last_time */
+		std::lock_guard hhold(g_hash_lock);
+		auto it = g_hash_table.find(dir);
+		if (it == g_hash_table.end())
+			return 0;
+		auto now = tp_now();
+		if (idle)
+			it->second.maint_time = now;
+		it->second.ckpt_time = now;
+		b_private = it->second.b_private;
+		conn.emplace(it->second);
+	}
+	if (!conn->open(dir.c_str()))
+		return 0;
+	auto db = conn->psqlite;
+	/* Do not queue up behind clients; there is always a next round */
+	sqlite3_busy_timeout(db, 100);
+	auto cl_0 = HX::make_scope_exit([&]() {
+		sqlite3_busy_timeout(db, int(g_sqlite_busy_timeout_ns / 1000000));
+	});
+	uint64_t page_size = 4096;
+	auto stm = gx_sql_prep(db, "PRAGMA page_size");
+	if (stm != nullptr && stm.step() == SQLITE_ROW)
+		page_size = stm.col_uint64(0);
+	stm.finalize();
+
+	int wal_frames = 0, ckpt_frames = 0;
+	auto t_start = tp_now();
+	auto ret = sqlite3_wal_checkpoint_v2(db, "main", SQLITE_CHECKPOINT_PASSIVE,
+	           &wal_frames, &ckpt_frames);
+	if (idle && ret == SQLITE_OK && wal_frames > 0 && wal_frames == ckpt_frames)
+		/* Everything is in the main file; give back the WAL's space */
+		ret = sqlite3_wal_checkpoint_v2(db, "main",
+		      SQLITE_CHECKPOINT_TRUNCATE, nullptr, nullptr);
+	auto t_ckpt = tp_now() - t_start;
+	uint64_t spent = std::max(ckpt_frames, 0) * page_size;
+
+	if (idle && fts_available(db)) {
+		/* fts_index_one reads properties through the alloc context */
+		exmdb_server::build_env((b_private ? EM_PRIVATE : 0) | EM_BACKGROUND, dir.c_str());
+		auto cl_1 = HX::make_scope_exit(exmdb_server::free_env);
+		fts_sync(*conn, FTS_SYNC_BACKLOG);
+	}
+
+	uint64_t vac_pages = 0;
+	stm = gx_sql_prep(db, "PRAGMA auto_vacuum");
+	bool incremental = stm != nullptr && stm.step() == SQLITE_ROW &&
+	                   stm.col_uint64(0) == 2;
+	stm.finalize();
+	if (idle && incremental && spent < budget) {
+		stm = gx_sql_prep(db, "PRAGMA freelist_count");
+		if (stm != nullptr && stm.step() == SQLITE_ROW)
+			vac_pages = std::min(stm.col_uint64(0), (budget - spent) / page_size);
+		stm.finalize();
+		if (vac_pages > 0 && gx_sql_exec(db, "PRAGMA incremental_vacuum(" +
+		    std::to_string(vac_pages) + ")") != SQLITE_OK)
+			vac_pages = 0;
+		spent += vac_pages * page_size;
+	}
+	if (wal_frames > 0 || vac_pages > 0)
+		mlog(LV_DEBUG, "exmdb: %s: maintenance (%s): WAL %d frames (%llu KB), "
+			"checkpointed %d in %.1f ms (%s), vacuumed %llu pages",
+			dir.c_str(), idle ? "idle" : "in use", wal_frames,
+			static_cast<unsigned long long>(wal_frames * page_size / 1024),
+			ckpt_frames,
+			std::chrono::duration<double, std::milli>(t_ckpt).count(),
+			ret == SQLITE_OK ? "ok" : sqlite3_errstr(ret),
+			static_cast<unsigned long long>(vac_pages));
+	return spent;
+}
+
+/**
+ * Background WAL checkpointing for all stores that were used since their
+ * last round, plus incremental vacuum for those that have been idle for
+ * exmdb_maint_idle. Each store may spend up to exmdb_maint_budget.
+ */
+static void *db_maint_thread(void *param)
+{
+	pthread_setname_np(pthread_self(), "db_maint");
+	unsigned int count = 0;
+	while (!g_dbeng_stop) {
+		sleep(1);
+		auto interval = g_exmdb_maint_interval.load();
+		if (interval == 0 || ++count < interval)
+			continue;
+		count = 0;
+		std::vector<std::pair<std::string, bool>> dirs;
+		try {
+			auto now = tp_now();
+			auto idle = std::chrono::seconds(g_exmdb_maint_idle);
+			std::lock_guard hhold(g_hash_lock);
+			for (const auto &[dir, dbase] : g_hash_table) {
+				if (dbase.last_time + idle <= now) {
+					if (dbase.maint_time < dbase.last_time)
+						dirs.emplace_back(dir, true);
+				} else if (dbase.ckpt_time < dbase.last_time) {
+					/* Keep the WAL short while the store is busy */
+					dirs.emplace_back(dir, false);
+				}
+			}
+		} catch (const std::bad_alloc &) {
+			mlog(LV_ERR, "E-2448: ENOMEM");
+			continue;
+		}
+		uint64_t budget = g_exmdb_maint_budget, spent = 0;
+		auto t_start = tp_now();
+		size_t done = 0;
+		for (const auto &[dir, idle] : dirs) {
+			if (g_dbeng_stop)
+				break;
+			spent += db_maint_one(dir, budget, idle);
+			++done;
+		}
+		if (done > 0)
+			mlog(LV_DEBUG, "exmdb: maintenance round: %zu/%zu stores, "
+				"%llu KB I/O, %.1f s", done, dirs.size(),
+				static_cast<unsigned long long>(spent / 1024),
+				std::chrono::duration<double>(tp_now() - t_start).count());
+	}
+	return nullptr;
+}
+
+static void cold_open_account(const char *dir, time_duration d)
+{
+	unsigned long long us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	{
+		std::lock_guard lk(g_warm_lock);
+		auto &st = g_warm_thread ? g_cold_warm : g_cold_demand;
+		++st.count;
+		st.total += us;
+		st.max = std::max(st.max, us);
+	}
+	mlog(LV_DEBUG, "exmdb: %s: cold open took %.1f ms (%s)", dir, us / 1000.0,
+		g_warm_thread ? "warm-up" : "on demand");
+}
+
+static void cold_open_log()
+{
+	std::lock_guard lk(g_warm_lock);
+	for (const auto &[st, what] : {std::pair{&g_cold_demand, "on demand"}, {&g_cold_warm, "by warm-up"}})
+		if (st->count > 0)
+			mlog(LV_INFO, "exmdb: %llu cold opens %s, avg %.1f ms, max %.1f ms",
+				st->count, what, st->total / 1000.0 / st->count,
+				st->max / 1000.0);
+	if (g_warm_dropped > 0)
+		mlog(LV_INFO, "exmdb: %llu warm-up requests dropped (exmdb_warmup_queue)",
+			g_warm_dropped);
+}
+
+/**
+ * Queue @dir for being opened in the background, so that the client which
+ * is about to use it (e.g. after a successful login) does not have to wait
+ * for schema upgrade checks, the dynamic search list and tables.sqlite3.
+ * Stores that are already open just have their expiry pushed back.
+ */
+bool db_engine_prewarm(const char *dir, bool pvt) try
+{
+	if (*dir == '\0' || g_exmdb_warmup_threads == 0)
+		return true;
+	{
+		std::lock_guard hhold(g_hash_lock);
+		auto it = g_hash_table.find(dir);
+		if (it != g_hash_table.end()) {
+			it->second.last_time = tp_now();
+			return true;
+		}
+	}
+	std::lock_guard lk(g_warm_lock);
+	if (g_warm_queued.contains(dir))
+		return true;
+	if (g_warm_queue.size() >= g_exmdb_warmup_queue) {
+		++g_warm_dropped;
+		return true;
+	}
+	g_warm_queue.emplace_back(dir, pvt);
+	try {
+		g_warm_queued.emplace(dir);
+	} catch (const std::bad_alloc &) {
+		g_warm_queue.pop_back();
+		throw;
+	}
+	g_warm_cond.notify_one();
+	return true;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2450: ENOMEM");
+	return false;
+}
+
+static void *db_warm_thread(void *param)
+{
+	g_warm_thread = true;
+	while (!g_dbeng_stop) {
+		warm_node node;
+		{
+			std::unique_lock lk(g_warm_lock);
+			g_warm_cond.wait(lk, []() { return g_dbeng_stop || !g_warm_queue.empty(); });
+			if (g_dbeng_stop)
+				break;
+			node = std::move(g_warm_queue.front());
+			g_warm_queue.pop_front();
+			g_warm_queued.erase(node.dir);
+		}
+		{
+			std::lock_guard mhold(g_maint_lock);
+			if (g_maint_table.contains(node.dir))
+				continue;
+		}
+		{
+			std::lock_guard hhold(g_hash_lock);
+			if (g_hash_table.contains(node.dir))
+				continue;
+			/* Leave headroom in the table for on-demand opens */
+			if (g_hash_table.size() >= g_table_size - g_table_size / 10) {
+				std::lock_guard lk(g_warm_lock);
+				++g_warm_dropped;
+				continue;
+			}
+		}
+		exmdb_server::build_env((node.b_private ? EM_PRIVATE : 0) | EM_BACKGROUND, node.dir.c_str());
+		auto cl_0 = HX::make_scope_exit(exmdb_server::free_env);
+		if (!db_engine_get_db(node.dir.c_str()))
+			mlog(LV_DEBUG, "exmdb: %s: warm-up failed", node.dir.c_str());
+	}
+	return nullptr;
+}
+
+/**
+ * Queue the stores that were in use at the last shutdown (most recent
+ * first) for warm-up.
+ */
+static void db_warm_load()
+{
+	std::unique_ptr<FILE, file_deleter> fp(fopen(g_exmdb_warmup_list.c_str(), "r"));
+	if (fp == nullptr) {
+		if (errno != ENOENT)
+			mlog(LV_WARN, "W-2451: fopen %s: %s",
+				g_exmdb_warmup_list.c_str(), strerror(errno));
+		return;
+	}
+	hxmc_t *line = nullptr;
+	auto cl_0 = HX::make_scope_exit([&]() { HXmc_free(line); });
+	size_t count = 0;
+	while (HX_getl(&line, fp.get()) != nullptr) {
+		HX_chomp(line);
+		if ((line[0] != 'P' && line[0] != 'D') || line[1] != ' ' || line[2] == '\0')
+			continue;
+		if (!db_engine_prewarm(&line[2], line[0] == 'P'))
+			break;
+		++count;
+	}
+	mlog(LV_INFO, "exmdb: queued %zu stores from %s for warm-up",
+		count, g_exmdb_warmup_list.c_str());
+}
+
+/**
+ * Record the open stores, most recently used first, for db_warm_load.
+ * Caller must ensure exclusive access to g_hash_table.
+ */
+static void db_warm_save() try
+{
+	std::vector<std::pair<time_point, const decltype(g_hash_table)::value_type *>> list;
+	list.reserve(g_hash_table.size());
+	for (const auto &e : g_hash_table)
+		list.emplace_back(e.second.last_time, &e);
+	std::sort(list.begin(), list.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+	if (list.size() > g_exmdb_warmup_queue)
+		list.resize(g_exmdb_warmup_queue);
+	std::string buf;
+	for (const auto &[tp, e] : list) {
+		buf += e->second.b_private ? "P " : "D ";
+		buf += e->first;
+		buf += '\n';
+	}
+	auto &path = g_exmdb_warmup_list;
+	auto slash = path.rfind('/');
+	auto basedir = slash == path.npos ? std::string(".") :
+	               slash == 0 ? std::string("/") : path.substr(0, slash);
+	gromox::tmpfile tf;
+	auto fd = tf.open_linkable(basedir.c_str(), O_WRONLY, FMODE_PRIVATE);
+	if (fd < 0) {
+		mlog(LV_ERR, "E-2452: open %s: %s", basedir.c_str(), strerror(-fd));
+		return;
+	}
+	auto ret = HXio_fullwrite(fd, buf.c_str(), buf.size());
+	if (ret < 0 || static_cast<size_t>(ret) != buf.size()) {
+		mlog(LV_ERR, "E-2453: write %s: %s", tf.m_path.c_str(), strerror(errno));
+		return;
+	}
+	auto err = tf.link_to_overwrite(path.c_str());
+	if (err != 0) {
+		mlog(LV_ERR, "E-2454: rename %s: %s", path.c_str(), strerror(err));
+		return;
+	}
+	mlog(LV_INFO, "exmdb: remembered %zu stores in %s for warm-up",
+		list.size(), path.c_str());
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2455: ENOMEM");
+}
+
 int db_engine_run()
 {
 	if (sqlite3_config(SQLITE_CONFIG_MULTITHREAD) != SQLITE_OK)
@@ -1183,6 +1826,12 @@ int db_engine_run()
 		mlog(LV_ERR, "exmdb_provider: failed to create db scan thread: %s", strerror(ret));
 		return -4;
 	}
+	ret = pthread_create4(&g_maint_tid, nullptr, db_maint_thread, nullptr);
+	if (ret != 0) {
+		mlog(LV_ERR, "E-2449: pthread_create: %s", strerror(ret));
+		db_engine_stop();
+		return -4;
+	}
 	for (unsigned int i = 0; i < g_sfpop_thrmax; ++i) {
 		pthread_t tid;
 		ret = pthread_create4(&tid, nullptr, sf_popul_thread, nullptr);
@@ -1196,6 +1845,23 @@ int db_engine_run()
 		pthread_setname_np(tid, buf);
 		g_sfpop_thrids.push_back(tid);
 	}
+	for (unsigned int i = 0; i < g_exmdb_warmup_threads; ++i) {
+		pthread_t tid;
+		ret = pthread_create4(&tid, nullptr, db_warm_thread, nullptr);
+		if (ret != 0) {
+			mlog(LV_ERR, "E-2470: pthread_create: %s", strerror(ret));
+			db_engine_stop();
+			return -5;
+		}
+		char buf[32];
+		snprintf(buf, sizeof(buf), "dbwarm/%u", i);
+		pthread_setname_np(tid, buf);
+		g_warm_thrids.push_back(tid);
+	}
+	if (g_exmdb_warmup_threads > 0 && !g_exmdb_warmup_list.empty()) {
+		db_warm_load();
+		g_warm_loaded = true;
+	}
 	return 0;
 }
 
@@ -1217,12 +1883,31 @@ void db_engine_stop()
 			pthread_kill(tid, SIGALRM);
 			pthread_join(tid, nullptr);
 		}
+		{
+			/* Pairs with the predicate check in db_warm_thread */
+			std::lock_guard lk(g_warm_lock);
+		}
+		g_warm_cond.notify_all();
+		for (auto tid : g_warm_thrids) {
+			pthread_kill(tid, SIGALRM);
+			pthread_join(tid, nullptr);
+		}
 		if (!pthread_equal(g_scan_tid, {})) {
 			pthread_kill(g_scan_tid, SIGALRM);
 			pthread_join(g_scan_tid, NULL);
 		}
+		if (!pthread_equal(g_maint_tid, {})) {
+			pthread_kill(g_maint_tid, SIGALRM);
+			pthread_join(g_maint_tid, nullptr);
+		}
 	}
 	g_sfpop_thrids.clear();
+	g_warm_thrids.clear();
+	if (g_warm_loaded) {
+		db_warm_save();
+		g_warm_loaded = false;
+	}
+	cold_open_log();
 	/*
 	 * This is db_engine_stop. We know we are single threaded and do not
 	 * really need to hold any locks.
@@ -1312,10 +1997,11 @@ void db_conn::update_dynamic(uint64_t folder_id, uint32_t search_flags,
 	
 	dn.folder_id    = folder_id;
 	dn.search_flags = search_flags;
-	dn.prestriction = prestriction->dup();
+	dn.set_restriction(prestriction->dup());
 	if (dn.prestriction == nullptr)
 		return;
 	dn.scope_list = scope_list;
+	dbase.dynamic_scope.clear();
 	auto i = std::find_if(dbase.dynamic_list.begin(), dbase.dynamic_list.end(),
 	         [=](const dynamic_node &n) { return n.folder_id == folder_id; });
 	if (i == dbase.dynamic_list.end())
@@ -1330,6 +2016,7 @@ void db_conn::delete_dynamic(uint64_t folder_id, db_base *dbase)
 {
 	gromox::erase_first_if(dbase->dynamic_list,
 		[=](const dynamic_node &n) { return n.folder_id == folder_id; });
+	dbase->dynamic_scope.clear();
 }
 
 static void dbeng_dynevt_1(db_conn &db, cpid_t cpid, uint64_t id1,
@@ -1394,26 +2081,17 @@ static void dbeng_dynevt_1(db_conn &db, cpid_t cpid, uint64_t id1,
 	}
 }
 
+/**
+ * @reeval:     for modify_msg, whether the modification can have changed
+ *              the outcome of the restriction
+ */
 static void dbeng_dynevt_2(db_conn &db, cpid_t cpid, dynamic_event event_type,
-    uint64_t id1, uint64_t id2, const dynamic_node *pdynamic, size_t i,
+    uint64_t id2, const dynamic_node *pdynamic, bool reeval,
     db_base &dbase, db_conn::NOTIFQ &notifq)
 {
 	auto pdb = &db;
-	BOOL b_included;
 	char sql_string[128];
 
-	if (pdynamic->search_flags & RECURSIVE_SEARCH) {
-		if (!cu_is_descendant_folder(pdb->psqlite,
-		    id1, pdynamic->scope_list[i], &b_included)) {
-			mlog(LV_DEBUG, "db_engine: fatal error in %s", __PRETTY_FUNCTION__);
-			return;
-		}
-		if (!b_included)
-			return;
-	} else {
-		if (id1 != pdynamic->scope_list[i])
-			return;
-	}
 	switch (event_type) {
 	case dynamic_event::new_msg: {
 		bool b_exist = false;
@@ -1465,7 +2143,7 @@ static void dbeng_dynevt_2(db_conn &db, cpid_t cpid, dynamic_event event_type,
 			mlog(LV_DEBUG, "db_engine: failed to check item in search_result");
 			return;
 		}
-		if (cu_eval_msg_restriction(
+		if (!reeval ? b_exist : cu_eval_msg_restriction(
 		    db, cpid, id2, pdynamic->prestriction)) {
 			if (b_exist) {
 				dbeng_notify_cttbl_modify_row(db, pdynamic->folder_id, id2, dbase, notifq);
@@ -1504,47 +2182,93 @@ static void dbeng_dynevt_2(db_conn &db, cpid_t cpid, dynamic_event event_type,
 	}
 }
 
+/**
+ * Determine the dynamic_list entries whose search scope (MS-OXCFOLD v23.2
+ * §1.1) contains @fid, consulting and filling dbase.dynamic_scope.
+ */
+static bool dbeng_dynamic_sinks(sqlite3 *psqlite, uint64_t fid,
+    db_base &dbase, std::vector<size_t> &out) try
+{
+	auto it = dbase.dynamic_scope.find(fid);
+	if (it != dbase.dynamic_scope.end()) {
+		out = it->second;
+		return true;
+	}
+	out.clear();
+	for (size_t n = 0; n < dbase.dynamic_list.size(); ++n) {
+		auto &dn = dbase.dynamic_list[n];
+		for (auto scope : dn.scope_list) {
+			BOOL b_included = fid == scope;
+			if (!b_included && (dn.search_flags & RECURSIVE_SEARCH) &&
+			    !cu_is_descendant_folder(psqlite, fid, scope, &b_included))
+				return false;
+			if (b_included) {
+				out.push_back(n);
+				break;
+			}
+		}
+	}
+	dbase.dynamic_scope.emplace(fid, out);
+	return true;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2443: ENOMEM");
+	return false;
+}
+
 /**
  * This is the entry function called by most everything else to notify *search
  * folders* of events that happened elsewhere.
  *
  * @id1:        event source folder
  * @id2:        message involved in the event
+ * @changed:    for modify_msg, the properties that were written (empty if
+ *              unknown); search folders whose restriction does not look at
+ *              any of them are not re-evaluated
  *
  * Caveat: id1 may be a regular folder like Inbox, but it also be a search
  * folder itself (population/depopulation as a result of search criteria
  * change).
+ *
+ * Changes to the calendar also invalidate the occurrence index.
  */
 void db_conn::proc_dynamic_event(cpid_t cpid, dynamic_event event_type,
-    uint64_t id1, uint64_t id2, uint64_t id3, db_base &dbase, NOTIFQ &notifq)
+    uint64_t id1, uint64_t id2, uint64_t id3, db_base &dbase, NOTIFQ &notifq,
+    proptag_cspan changed)
 {
 	auto pdb = this;
 	uint32_t folder_type;
 	
-	if (event_type == dynamic_event::move_folder &&
-	    !common_util_get_folder_type(pdb->psqlite, id3, &folder_type)) {
+	if (dbase.b_private && id1 == PRIVATE_FID_CALENDAR &&
+	    event_type != dynamic_event::move_folder)
+		dbase.fbidx.touch(id2);
+	if (dbase.dynamic_list.empty())
+		return;
+	if (event_type == dynamic_event::move_folder) {
+		dbase.dynamic_scope.clear();
+		if (!common_util_get_folder_type(pdb->psqlite, id3, &folder_type)) {
+			mlog(LV_DEBUG, "db_engine: fatal error in %s", __PRETTY_FUNCTION__);
+			return;
+		}
+		for (auto &dn : dbase.dynamic_list)
+			for (size_t i = 0; i < dn.scope_list.size(); ++i)
+				dbeng_dynevt_1(*pdb, cpid, id1, id2, id3,
+					folder_type, &dn, i, dbase, notifq);
+		return;
+	}
+	/*
+	 * A copy, since the recursive calls (search folder as event source)
+	 * may add to dynamic_scope.
+	 */
+	std::vector<size_t> sinks;
+	if (!dbeng_dynamic_sinks(pdb->psqlite, id1, dbase, sinks)) {
 		mlog(LV_DEBUG, "db_engine: fatal error in %s", __PRETTY_FUNCTION__);
 		return;
 	}
-	/* Iterate over all search folders (event sinks)... */
-	for (auto &dn : dbase.dynamic_list) {
-		auto pdynamic = &dn;
-		/*
-		 * Iterate over source folders (a.k.a. search scope; MS-OXCFOLD
-		 * v23.2 §1.1).
-		 *
-		 * [In conjunction with dynevt_1/2] if id1 is within the scope,
-		 * pdynamic gets the event.
-		 */
-		for (size_t i = 0; i < pdynamic->scope_list.size(); ++i) {
-			if (dynamic_event::move_folder == event_type) {
-				dbeng_dynevt_1(*pdb, cpid, id1, id2, id3,
-					folder_type, pdynamic, i, dbase, notifq);
-				continue;
-			}
-			dbeng_dynevt_2(*pdb, cpid, event_type, id1, id2,
-				pdynamic, i, dbase, notifq);
-		}
+	for (auto n : sinks) {
+		auto pdynamic = &dbase.dynamic_list[n];
+		dbeng_dynevt_2(*pdb, cpid, event_type, id2, pdynamic,
+			event_type != dynamic_event::modify_msg ||
+			pdynamic->affected_by(changed), dbase, notifq);
 	}
 }
 
@@ -3396,6 +4120,12 @@ static void dbeng_notify_cttbl_modify_row(db_conn &db, uint64_t folder_id,
 		    sqlite3_column_int64(pstmt, 0) == 0)
 			continue;
 		pstmt.finalize();
+		/* Cached column values (see query_content) are now stale */
+		snprintf(sql_string, std::size(sql_string), "UPDATE t%u SET "
+		         "cols=NULL WHERE inst_id=%llu",
+		         ptable->table_id, LLU{message_id});
+		if (pdb->eph_exec(sql_string) != SQLITE_OK)
+			continue;
 		if (NULL == pmodified_row) {
 			pmodified_row = &datagram.db_notify;
 			if (!common_util_get_message_parent_folder(pdb->psqlite,
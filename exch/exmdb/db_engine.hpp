@@ -10,6 +10,8 @@
 #include <shared_mutex>
 #include <sqlite3.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <gromox/clock.hpp>
 #include <gromox/database.h>
@@ -34,10 +36,16 @@ struct dynamic_node {
 	~dynamic_node();
 	dynamic_node &operator=(dynamic_node &&) noexcept;
 
+	void set_restriction(RESTRICTION *);
+	bool affected_by(proptag_cspan) const;
+
 	uint64_t folder_id = 0; /* search folder ID */
 	uint32_t search_flags = 0;
 	RESTRICTION *prestriction = nullptr;
 	std::vector<uint64_t> scope_list; /* source folder IDs */
+	/* Property IDs the restriction depends on (sorted); unused if dep_all */
+	std::vector<uint16_t> dep_ids;
+	bool dep_all = true;
 };
 
 enum class table_type : uint8_t {
@@ -110,7 +118,76 @@ struct instance_node {
 struct prepared_statements {
 	void begin(sqlite3 *, bool pvt_store);
 	gromox::xstmt msg_norm, msg_str, rcpt_norm, rcpt_str, msg_read,
-		msg_atx, msg_fai;
+		msg_atx, msg_fai, msg_all, rcpt_all;
+};
+
+/**
+ * Effective folder rights as computed by cu_get_folder_permission, keyed by
+ * (folder_id, username as passed to the permission lookup).
+ *
+ * exmdb drops the whole cache whenever it writes to the permissions table.
+ * Group ACLs also depend on mlist membership, which lives in MySQL and is
+ * not observable from here, so entries additionally expire after
+ * exmdb_perm_cache_ttl. @gen keeps a reader from putting back a value that
+ * it computed before a concurrent clear().
+ */
+struct folder_perm_cache {
+	using key_type = std::pair<uint64_t, std::string>;
+	struct entry {
+		uint32_t rights = 0;
+		gromox::time_point expiry;
+	};
+
+	bool get(const key_type &, uint32_t *rights, uint64_t *gen);
+	void put(key_type &&, uint32_t rights, uint64_t gen);
+	void clear();
+
+	std::mutex mtx;
+	std::map<key_type, entry> map; /* protected by mtx */
+	uint64_t gen = 0; /* protected by mtx */
+	std::atomic<uint64_t> hits{0}, misses{0}, flushes{0};
+};
+
+/**
+ * Expanded free/busy occurrences of the private calendar folder. Recurring
+ * appointments are expanded for [lo,hi], which grows with the queried
+ * ranges. Messages that were changed are re-expanded on the next query.
+ *
+ * @occ:   message id (GCV) => occurrences (with details)
+ * @stale: messages changed since their expansion
+ */
+struct occurrence_index {
+	void touch(uint64_t message_id);
+
+	std::mutex mtx;
+	bool valid = false; /* protected by mtx */
+	uint64_t gen = 0; /* bumped whenever an update starts; protected by mtx */
+	time_t lo = 0, hi = 0; /* protected by mtx */
+	std::unordered_map<uint64_t, std::vector<freebusy_event>> occ; /* protected by mtx */
+	std::unordered_set<uint64_t> stale; /* protected by mtx */
+	std::atomic<uint64_t> hits{0}, rebuilds{0}, refreshes{0};
+};
+
+/**
+ * Shared fsync window for exchange.sqlite3 (exmdb_group_commit). Commits
+ * run with synchronous=NORMAL; before an RPC returns, wait() makes sure
+ * an fdatasync of the WAL started after the commit has completed. There
+ * is no sync thread: the first caller of wait() sleeps for the window and
+ * performs the sync, inline, for everyone who queued up in the meantime.
+ *
+ * @lat_hist:   wait() latency, bucket i counts waits of [2^(i-1),2^i) µs
+ */
+struct group_commit : public std::enable_shared_from_this<group_commit> {
+	group_commit(std::string &&wal) : wal_path(std::move(wal)) {}
+	void wait();
+
+	std::string wal_path;
+	std::mutex mtx;
+	std::condition_variable cv;
+	uint64_t tickets = 0, synced = 0; /* protected by mtx */
+	bool syncing = false; /* protected by mtx */
+	std::atomic<uint64_t> syncs{0}, waits{0};
+	std::atomic<uint64_t> lat_hist[20]{};
 };
 
 struct db_close;
@@ -123,16 +200,29 @@ using db_handle = std::unique_ptr<sqlite3, db_close>;
  * @reference: client reference count, db_base can be destroyed when count is 0
  * @mx_sqlite: cached sqlite handles for exchange.sqlite3
  * @mx_sqlite_eph: cached sqlite handles for tables.sqlite3
+ * @mx_sqlite_ro: cached read-only sqlite handles for exchange.sqlite3
+ * @perms:      effective folder rights cache
+ * @gcommit:    group commit state (only with exmdb_group_commit)
+ * @maint_time: start of the last background checkpoint/vacuum pass
+ * @ckpt_time:  start of the last background checkpoint of the store in use
+ * @wr_gen:     number of times giant_lock was taken exclusively; lets a
+ *              reader that dropped the lock tell whether it missed a change
+ * @b_private:  private store (as opposed to a public/domain store)
+ * @fbidx:      calendar occurrence index (private stores only)
  */
 struct db_base {
-	enum DB_TYPE : uint8_t {DB_MAIN = 0, DB_EPH = 1};
+	enum DB_TYPE : uint8_t {DB_MAIN = 0, DB_EPH = 1, DB_RO = 2};
 
 	db_base();
 	~db_base();
 
 	mutable std::shared_mutex giant_lock;
+	std::atomic<uint64_t> wr_gen{0};
 	std::atomic<int> reference;
 	gromox::time_point last_time{};
+	gromox::time_point maint_time{}; /* protected by g_hash_lock */
+	gromox::time_point ckpt_time{}; /* protected by g_hash_lock */
+	bool b_private = false;
 	/* memory database for holding rop table objects instance */
 	struct {
 		std::atomic<uint32_t> last_id = 0;
@@ -141,23 +231,31 @@ struct db_base {
 	} tables;
 	std::vector<nsub_node> nsub_list;
 	std::vector<dynamic_node> dynamic_list; /* dynamic searches */
+	/*
+	 * Source folder => dynamic_list indices whose scope covers it. Filled
+	 * on demand; cleared whenever dynamic_list or the hierarchy changes.
+	 */
+	std::unordered_map<uint64_t, std::vector<size_t>> dynamic_scope;
 	std::vector<instance_node> instance_list;
+	folder_perm_cache perms;
+	std::shared_ptr<group_commit> gcommit;
+	occurrence_index fbidx;
 
 	uint32_t next_instance_id() const;
 	instance_node *get_instance(uint32_t);
 	inline const instance_node *get_instance_c(uint32_t id) const { return const_cast<db_base *>(this)->get_instance(id); }
 	const table_node *find_table(uint32_t) const;
-	void handle_spares(sqlite3 *, sqlite3 *);
+	void handle_spares(sqlite3 *, sqlite3 *, bool ro = false);
 
 	void ctor2_and_open(const char *dir);
 	void drop_all();
-	void get_dbs(const char *dir, sqlite3 *&main, sqlite3 *&eph);
+	void get_dbs(const char *dir, sqlite3 *&main, sqlite3 *&eph, bool ro = false);
 
 	private:
 	db_handle get_db(const char *dir, DB_TYPE);
 
 	std::mutex sqlite_lock;
-	std::vector<db_handle> mx_sqlite, mx_sqlite_eph;
+	std::vector<db_handle> mx_sqlite, mx_sqlite_eph, mx_sqlite_ro;
 };
 
 class db_base_rd_ptr {
@@ -210,12 +308,12 @@ struct db_conn {
 	db_conn(db_conn &&) noexcept;
 	db_conn &operator=(db_conn &&) noexcept;
 
-	bool open(const char *dir);
+	bool open(const char *dir, bool ro = false);
 	db_base_rd_ptr lock_base_rd() const;
 	db_base_wr_ptr lock_base_wr();
 	void update_dynamic(uint64_t folder_id, uint32_t search_flags, const RESTRICTION *, const std::vector<uint64_t> &scope_list, db_base &);
 	void delete_dynamic(uint64_t folder_id, db_base *);
-	void proc_dynamic_event(cpid_t, enum dynamic_event, uint64_t id1, uint64_t id2, uint64_t id3, db_base &, NOTIFQ &);
+	void proc_dynamic_event(cpid_t, enum dynamic_event, uint64_t id1, uint64_t id2, uint64_t id3, db_base &, NOTIFQ &, proptag_cspan changed = {});
 	void notify_new_mail(uint64_t folder_id, uint64_t msg_id, db_base &, NOTIFQ &);
 	void notify_message_creation(uint64_t folder_id, uint64_t msg_id, db_base &, NOTIFQ &);
 	void notify_link_creation(uint64_t parent_id, uint64_t msg_id, db_base &, NOTIFQ &, bool b_count = true);
@@ -245,12 +343,14 @@ struct db_conn {
 	int eph_exec(const char *q) const { return gromox::gx_sql_exec(m_sqlite_eph, q); }
 	int eph_exec(const std::string &q) const { return gromox::gx_sql_exec(m_sqlite_eph, q.c_str()); }
 	inline uint32_t next_table_id() { return ++m_base->tables.last_id; }
+	folder_perm_cache &perms() const { return m_base->perms; }
 
 	sqlite3 *psqlite = nullptr, *m_sqlite_eph = nullptr;
 	std::unique_ptr<prepared_statements> m_prepstm;
 
 	private:
 	db_base *m_base = nullptr;
+	bool m_readonly = false;
 };
 
 extern void db_engine_init(size_t table_size, int cache_interval, unsigned int sfpop_max, unsigned int par_upg, unsigned int par_shut);
@@ -258,13 +358,16 @@ extern int db_engine_run();
 extern void db_engine_stop();
 
 extern bool db_engine_set_maint(const char *path, enum db_maint_mode);
-extern std::optional<db_conn> db_engine_get_db(const char *dir);
+extern std::optional<db_conn> db_engine_get_db(const char *dir, bool ro = false);
 extern BOOL db_engine_vacuum(const char *path);
 extern BOOL db_engine_cgkreset(const char *dir, uint32_t flags);
 BOOL db_engine_unload_db(const char *path);
 extern bool db_engine_enqueue_populating_criteria(const char *dir, cpid_t, uint64_t folder_id, bool recursive, const RESTRICTION *, std::vector<uint64_t> &&scope_list);
 extern bool db_engine_check_populating(const char *dir, uint64_t folder_id);
 extern void dg_notify(db_conn::NOTIFQ &&);
+extern void db_engine_group_arm();
+extern void db_engine_group_sync();
+extern bool db_engine_prewarm(const char *dir, bool pvt);
 
 extern std::atomic<unsigned int> g_exmdb_schema_upgrades, g_exmdb_search_pacing;
 extern std::atomic<unsigned long long> g_exmdb_search_pacing_time, g_exmdb_lock_timeout;
@@ -272,6 +375,12 @@ extern std::atomic<unsigned int> g_exmdb_search_yield, g_exmdb_search_nice;
 extern std::atomic<unsigned int> g_exmdb_pvt_folder_softdel;
 extern std::string g_exmdb_ics_log_file, exmdb_eph_prefix;
 /* Max number of cached DB connections per store, 0 = unlimited */
-extern std::atomic<unsigned int> g_exmdb_max_sqlite_spares;
+extern std::atomic<unsigned int> g_exmdb_max_sqlite_spares, g_exmdb_perm_cache_ttl;
 extern std::atomic<unsigned long long> g_sqlite_busy_timeout_ns;
+extern unsigned long long g_exmdb_group_commit_ns;
+extern std::atomic<unsigned int> g_exmdb_maint_interval, g_exmdb_maint_idle;
+extern std::atomic<unsigned long long> g_exmdb_maint_budget;
+extern unsigned int g_exmdb_warmup_threads;
+extern std::atomic<unsigned int> g_exmdb_warmup_queue;
+extern std::string g_exmdb_warmup_list;
 extern unsigned int g_exmdb_par_shutdown;
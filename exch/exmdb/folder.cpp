@@ -705,7 +705,7 @@ static bool folder_empty_folder(db_conn &db, cpid_t cpid,
 		       pmessage_count, pfolder_count, dbase, notifq);
 
 	if (b_normal || b_fai) {
-		auto ret = need_msg_perm_check(db.psqlite, username, folder_id);
+		auto ret = need_msg_perm_check(db, username, folder_id);
 		if (ret < 0)
 			return false;
 		b_check = ret > 0 ? TRUE : false;
@@ -1315,7 +1315,7 @@ static bool folder_copy_sf_int(db_conn &db, cpid_t cpid,
 {
 	if (b_guest) {
 		uint32_t permission = rightsNone;
-		if (!cu_get_folder_permission(db.psqlite, dst_fid, username, &permission))
+		if (!cu_get_folder_permission(db, dst_fid, username, &permission))
 			return FALSE;
 		if (!(permission & frightsCreate)) {
 			*pb_partial = TRUE;
@@ -1346,7 +1346,7 @@ static bool folder_copy_sf_int(db_conn &db, cpid_t cpid,
 		auto parent_fid = pstmt.col_uint64(1);
 		if (b_guest) {
 			uint32_t permission = rightsNone;
-			if (!cu_get_folder_permission(db.psqlite, parent_fid, username, &permission))
+			if (!cu_get_folder_permission(db, parent_fid, username, &permission))
 				return FALSE;
 			if (permission & (frightsOwner | frightsReadAny)) {
 				/* do nothing */
@@ -1415,10 +1415,10 @@ static bool folder_copy_folder_internal(db_conn &db,
 		if (!b_guest) {
 			b_check = FALSE;
 		} else {
-			if (!cu_get_folder_permission(db.psqlite, fid_val, username, &permission))
+			if (!cu_get_folder_permission(db, fid_val, username, &permission))
 				return FALSE;
 			b_check	= (permission & (frightsOwner | frightsReadAny)) ? false : TRUE;
-			if (!cu_get_folder_permission(db.psqlite, dst_fid, username, &permission))
+			if (!cu_get_folder_permission(db, dst_fid, username, &permission))
 				return FALSE;
 			if (!(permission & frightsCreate)) {
 				*pb_partial = TRUE;
@@ -1473,7 +1473,7 @@ static bool folder_copy_folder_internal(db_conn &db,
 	if (!b_sub)
 		return TRUE;
 	if (b_guest) {
-		if (!cu_get_folder_permission(db.psqlite, dst_fid, username, &permission))
+		if (!cu_get_folder_permission(db, dst_fid, username, &permission))
 			return FALSE;
 		if (!(permission & frightsCreateSubfolder)) {
 			*pb_partial = TRUE;
@@ -1489,7 +1489,7 @@ static bool folder_copy_folder_internal(db_conn &db,
 		auto src_fid1 = pstmt.col_uint64(0);
 		fid_val = src_fid1;
 		if (b_check) {
-			if (!cu_get_folder_permission(db.psqlite, fid_val, username, &permission))
+			if (!cu_get_folder_permission(db, fid_val, username, &permission))
 				return FALSE;
 			if (!(permission & (frightsReadAny | frightsVisible))) {
 				*pb_partial = TRUE;
@@ -2092,7 +2092,7 @@ BOOL exmdb_server::get_folder_perm(const char *dir,
 	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::read);
 	if (!sql_transact)
 		return false;
-	return cu_get_folder_permission(pdb->psqlite,
+	return cu_get_folder_permission(*pdb,
 	       rop_util_get_gc_value(folder_id), username, ppermission);
 }
 
@@ -2105,7 +2105,9 @@ BOOL exmdb_server::empty_folder_permission(const char *dir, uint64_t folder_id)
 	/* Only one SQL operation, no transaction needed. */
 	snprintf(sql_string, 1024, "DELETE FROM permissions WHERE"
 	         " folder_id=%llu", LLU{rop_util_get_gc_value(folder_id)});
-	return pdb->exec(sql_string) == SQLITE_OK ? TRUE : false;
+	auto ret = pdb->exec(sql_string);
+	pdb->perms().clear();
+	return ret == SQLITE_OK ? TRUE : false;
 }
 
 /**
@@ -2309,7 +2311,9 @@ BOOL exmdb_server::update_folder_permission(const char *dir, uint64_t folder_id,
 			return false;
 	}
 	pstmt.finalize();
-	return sql_transact.commit() == SQLITE_OK ? TRUE : false;
+	auto ret = sql_transact.commit();
+	pdb->perms().clear();
+	return ret == SQLITE_OK ? TRUE : false;
 }
 
 BOOL exmdb_server::empty_folder_rule(const char *dir, uint64_t folder_id)
@@ -2318,10 +2322,16 @@ BOOL exmdb_server::empty_folder_rule(const char *dir, uint64_t folder_id)
 	auto pdb = db_engine_get_db(dir);
 	if (!pdb)
 		return FALSE;
-	/* Only one SQL operation, no transaction needed. */
+	auto fid_val = rop_util_get_gc_value(folder_id);
+	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::write);
+	if (!sql_transact)
+		return false;
 	snprintf(sql_string, 1024, "DELETE FROM rules WHERE "
-	         "folder_id=%llu", LLU{rop_util_get_gc_value(folder_id)});
-	return pdb->exec(sql_string) == SQLITE_OK ? TRUE : false;
+	         "folder_id=%llu", LLU{fid_val});
+	if (pdb->exec(sql_string) != SQLITE_OK ||
+	    !cu_touch_rule_table(pdb->psqlite, fid_val))
+		return false;
+	return sql_transact.commit() == SQLITE_OK ? TRUE : false;
 }
 
 /* after updating the database, update the table too! */
@@ -2554,6 +2564,8 @@ BOOL exmdb_server::update_folder_rule(const char *dir, uint64_t folder_id,
 		}
 		}
 	}
+	if (!cu_touch_rule_table(pdb->psqlite, fid_val))
+		return false;
 	return sql_transact.commit() == SQLITE_OK ? TRUE : false;
 } catch (const std::bad_alloc &) {
 	mlog(LV_ERR, "%s: ENOMEM", __PRETTY_FUNCTION__);
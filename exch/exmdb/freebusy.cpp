@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+// SPDX-FileCopyrightText: 2026 grommunio GmbH
+// This file is part of Gromox.
+/*
+ * Calendar occurrence index for free/busy lookups.
+ *
+ * The first freebusy_query on a store expands all appointments of the
+ * private calendar folder into db_base::fbidx; recurring series only for a
+ * window that covers the queried range and the near past/future. After
+ * that, writes to the calendar merely mark the affected messages (via
+ * db_conn::proc_dynamic_event), and the next query re-expands just those.
+ * The index is kept in memory and goes away with the db_base.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <unordered_set>
+#include <vector>
+#include <gromox/database.h>
+#include <gromox/exmdb_common_util.hpp>
+#include <gromox/exmdb_server.hpp>
+#include <gromox/freebusy.hpp>
+#include <gromox/mapi_types.hpp>
+#include <gromox/rop_util.hpp>
+#include <gromox/util.hpp>
+#include "db_engine.hpp"
+
+using namespace gromox;
+
+/* Window kept around now at least, and the widest window ever kept */
+static constexpr time_t occ_past = 31 * 86400, occ_future = 366 * 86400,
+	occ_span_max = 5 * 366 * 86400;
+/* Occurrences starting this much before the window may still overlap it */
+static constexpr time_t occ_margin = 7 * 86400;
+
+void occurrence_index::touch(uint64_t message_id) try
+{
+	std::lock_guard lk(mtx);
+	/* Also record while the first build is still expanding (gen != 0) */
+	if (gen != 0)
+		stale.insert(message_id);
+} catch (const std::bad_alloc &) {
+	std::lock_guard lk(mtx);
+	valid = false;
+}
+
+using occ_map = decltype(occurrence_index::occ);
+
+namespace {
+struct occ_row {
+	uint64_t mid = 0;
+	bool present = false;
+	TPROPVAL_ARRAY props{};
+};
+}
+
+/*
+ * Reading the appointments needs the giant lock; expanding them does not.
+ * The property arrays live in the RPC's alloc context.
+ */
+static bool occ_read(const db_conn &db, proptag_cspan tags, occ_row &row)
+{
+	row.present = cu_get_properties(MAPI_MESSAGE, row.mid, CP_ACP, db,
+	              tags, &row.props);
+	return row.present;
+}
+
+static bool occ_snapshot_all(const db_conn &db, proptag_cspan tags,
+    std::vector<occ_row> &rows)
+{
+	auto stm = db.prep("SELECT message_id FROM messages WHERE parent_fid=? "
+	           "AND is_associated=0 AND is_deleted=0");
+	if (stm == nullptr)
+		return false;
+	stm.bind_int64(1, PRIVATE_FID_CALENDAR);
+	while (stm.step() == SQLITE_ROW) {
+		occ_row row;
+		row.mid = stm.col_uint64(0);
+		if (!occ_read(db, tags, row))
+			return false;
+		rows.push_back(std::move(row));
+	}
+	return true;
+}
+
+static bool occ_snapshot_some(const db_conn &db, proptag_cspan tags,
+    const std::unordered_set<uint64_t> &mids, std::vector<occ_row> &rows)
+{
+	auto stm = db.prep("SELECT 1 FROM messages WHERE message_id=? AND "
+	           "parent_fid=? AND is_associated=0 AND is_deleted=0");
+	if (stm == nullptr)
+		return false;
+	for (auto mid : mids) {
+		stm.bind_int64(1, mid);
+		stm.bind_int64(2, PRIVATE_FID_CALENDAR);
+		bool present = stm.step() == SQLITE_ROW;
+		stm.reset();
+		occ_row row;
+		row.mid = mid;
+		if (present && !occ_read(db, tags, row))
+			return false;
+		rows.push_back(std::move(row));
+	}
+	return true;
+}
+
+static void occ_expand(const freebusy_tags &ptag, const std::vector<occ_row> &rows,
+    time_t lo, time_t hi, occ_map &occ)
+{
+	for (const auto &row : rows) {
+		occ.erase(row.mid);
+		if (!row.present)
+			continue;
+		std::vector<freebusy_event> evs;
+		/* Unusable appointments simply have no occurrences */
+		freebusy_expand(ptag, row.props, lo, hi, true, evs);
+		if (!evs.empty())
+			occ.emplace(row.mid, std::move(evs));
+	}
+}
+
+static void occ_collect(uint64_t mid, const std::vector<freebusy_event> &evs,
+    int64_t start_time, int64_t end_time, std::vector<freebusy_event> &fb_events,
+    std::vector<uint64_t> *message_ids)
+{
+	for (const auto &ev : evs) {
+		if ((start_time >= 0 && ev.end_time < start_time) ||
+		    (end_time >= 0 && ev.start_time > end_time))
+			continue;
+		fb_events.push_back(ev);
+		if (message_ids != nullptr)
+			message_ids->push_back(rop_util_make_eid_ex(1, mid));
+	}
+}
+
+/**
+ * Free/busy occurrences of the private calendar that overlap
+ * [@start_time, @end_time], with all details (the caller is responsible
+ * for applying permissions), plus the message (EID) each one belongs to
+ * unless @message_ids is nullptr.
+ * A negative bound means open-ended; such queries and those spanning
+ * several years bypass the index.
+ */
+BOOL exmdb_server::freebusy_query(const char *dir, int64_t start_time,
+    int64_t end_time, std::vector<freebusy_event> *fb_events,
+    std::vector<uint64_t> *message_ids) try
+{
+	if (!exmdb_server::is_private())
+		return FALSE;
+	auto pdb = db_engine_get_db(dir);
+	if (!pdb)
+		return FALSE;
+	PROPID_ARRAY ids;
+	if (!common_util_get_named_propids(pdb->psqlite, false,
+	    &freebusy_tags::propnames, &ids))
+		return FALSE;
+	freebusy_tags ptag(ids);
+	if (!ptag.init_ok)
+		return FALSE;
+	auto tags = ptag.proptags();
+	fb_events->clear();
+	if (message_ids != nullptr)
+		message_ids->clear();
+
+	/*
+	 * Writers mark the index before they commit, while holding the giant
+	 * lock exclusively, so a snapshot taken under the shared lock is
+	 * consistent with the marks. Recurrence expansion is then done
+	 * without the giant lock; @gen tells whether another update started
+	 * meanwhile, in which case our result is not installed.
+	 */
+	auto dbase = pdb->lock_base_rd();
+	auto &idx = dbase->fbidx; /* pdb's reference keeps dbase alive */
+	std::unique_lock lk(idx.mtx);
+	time_t lo = 0, hi = 0;
+	bool cacheable = start_time >= 0 && end_time >= 0;
+	bool rebuild = cacheable && (!idx.valid || start_time < idx.lo || end_time > idx.hi);
+	if (rebuild) {
+		auto now = time(nullptr);
+		lo = std::min<time_t>(start_time, now - occ_past);
+		hi = std::max<time_t>(end_time, now + occ_future);
+		if (idx.valid) {
+			lo = std::min(lo, idx.lo);
+			hi = std::max(hi, idx.hi);
+		}
+		cacheable = hi - lo <= occ_span_max;
+	}
+	std::vector<occ_row> rows;
+	if (!cacheable) {
+		lk.unlock();
+		if (!occ_snapshot_all(*pdb, tags, rows))
+			return FALSE;
+		dbase.reset();
+		occ_map occ;
+		occ_expand(ptag, rows, start_time, end_time, occ);
+		for (const auto &[mid, evs] : occ)
+			occ_collect(mid, evs, start_time, end_time, *fb_events, message_ids);
+		return TRUE;
+	}
+	if (!rebuild && idx.stale.empty()) {
+		dbase.reset();
+		++idx.hits;
+		for (const auto &[mid, evs] : idx.occ)
+			occ_collect(mid, evs, start_time, end_time, *fb_events, message_ids);
+		return TRUE;
+	}
+
+	occ_map occ;
+	std::unordered_set<uint64_t> mids;
+	if (rebuild) {
+		if (!occ_snapshot_all(*pdb, tags, rows))
+			return FALSE;
+	} else {
+		lo = idx.lo;
+		hi = idx.hi;
+		if (!occ_snapshot_some(*pdb, tags, idx.stale, rows))
+			return FALSE;
+		occ = idx.occ;
+	}
+	mids = std::move(idx.stale);
+	idx.stale.clear();
+	auto gen = ++idx.gen;
+	lk.unlock();
+	dbase.reset();
+
+	occ_expand(ptag, rows, lo - occ_margin, hi, occ);
+	for (const auto &[mid, evs] : occ)
+		occ_collect(mid, evs, start_time, end_time, *fb_events, message_ids);
+
+	lk.lock();
+	if (gen != idx.gen) {
+		/* Someone else is newer; make sure our marks are not lost */
+		idx.stale.insert(mids.begin(), mids.end());
+		return TRUE;
+	}
+	idx.occ = std::move(occ);
+	if (rebuild) {
+		idx.lo = lo;
+		idx.hi = hi;
+		idx.valid = true;
+		++idx.rebuilds;
+		mlog(LV_DEBUG, "exmdb: %s: occurrence index rebuilt (%zu appointments; "
+			"%llu rebuilds, %llu hits, %llu refreshes)", dir, idx.occ.size(),
+			static_cast<unsigned long long>(idx.rebuilds),
+			static_cast<unsigned long long>(idx.hits),
+			static_cast<unsigned long long>(idx.refreshes));
+	} else {
+		idx.refreshes += mids.size();
+	}
+	return TRUE;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2471: ENOMEM");
+	return FALSE;
+}
@@ -0,0 +1,449 @@
+// SPDX-License-Identifier: GPL-2.0-only WITH linking exception
+// SPDX-FileCopyrightText: 2026 grommunio GmbH
+// This file is part of Gromox.
+/*
+ * Optional per-mailbox full-text index for RES_CONTENT restrictions.
+ *
+ * The index lives in exmdb/fulltext.sqlite3, which is ATTACHed to every
+ * exchange.sqlite3 connection as "fts". TEMP triggers on message_properties
+ * and messages record the IDs of messages whose indexed text may have
+ * changed in main.fts_dirty. That table is part of exchange.sqlite3, so the
+ * mark commits atomically with the change itself; a transaction spanning
+ * two WAL databases would not be. fts_sync() later re-reads those messages
+ * into fts_msgtext.
+ *
+ * Lookups use fts_msgtext ∪ fts_dirty, so the result is always a superset
+ * of the matching messages, no matter how far indexing lags behind. It is
+ * only ever used to skip messages, never to accept them; the exact test is
+ * still done by cu_eval_msg_restriction.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+#include <fmt/core.h>
+#include <libHX/scope.hpp>
+#include <gromox/database.h>
+#include <gromox/exmdb_common_util.hpp>
+#include <gromox/exmdb_server.hpp>
+#include <gromox/fileio.h>
+#include <gromox/mapi_types.hpp>
+#include <gromox/mapitags.hpp>
+#include <gromox/util.hpp>
+#include "db_engine.hpp"
+#include "fulltext.hpp"
+
+using namespace gromox;
+
+bool g_exmdb_fulltext;
+
+/* Properties whose text feeds into one of the fts_msgtext columns */
+static constexpr char fts_watched_ids[] =
+	"55,61,3613," /* PR_SUBJECT, PR_SUBJECT_PREFIX, PR_NORMALIZED_SUBJECT */
+	"4096," /* PR_BODY */
+	"3098,3103,23809," /* PR_SENDER_{NAME,EMAIL_ADDRESS,SMTP_ADDRESS} */
+	"66,101,23810"; /* PR_SENT_REPRESENTING_{NAME,EMAIL_ADDRESS,SMTP_ADDRESS} */
+
+static constexpr proptag_t fts_sender_tags[] = {
+	PR_SENDER_NAME, PR_SENDER_EMAIL_ADDRESS, PR_SENDER_SMTP_ADDRESS,
+	PR_SENT_REPRESENTING_NAME, PR_SENT_REPRESENTING_EMAIL_ADDRESS,
+	PR_SENT_REPRESENTING_SMTP_ADDRESS,
+};
+
+/*
+ * @seq is renewed whenever a message is marked again, so that fts_sync can
+ * tell a mark it has processed from one that was set after its snapshot.
+ * AUTOINCREMENT keeps sequence numbers from being reused.
+ */
+static constexpr char fts_schema[] =
+	"CREATE TABLE IF NOT EXISTS fts.fts_meta (k TEXT PRIMARY KEY, v);"
+	"DROP TABLE IF EXISTS fts.fts_dirty;"
+	"CREATE TABLE IF NOT EXISTS main.fts_dirty (seq INTEGER PRIMARY KEY "
+	"AUTOINCREMENT, message_id INTEGER NOT NULL UNIQUE);"
+	"CREATE VIRTUAL TABLE IF NOT EXISTS fts.fts_msgtext USING "
+	"fts5(subject, body, sender, tokenize='trigram');";
+/* fts_meta 'seeded' value; indexes from before main.fts_dirty have 1 */
+static constexpr unsigned int fts_seed_version = 2;
+
+/**
+ * Check once that the sqlite library has FTS5 with the trigram tokenizer.
+ */
+bool fts_selftest()
+{
+	sqlite3 *db = nullptr;
+	if (sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+		sqlite3_close(db);
+		return false;
+	}
+	auto ret = sqlite3_exec(db, "CREATE VIRTUAL TABLE t USING "
+	           "fts5(x, tokenize='trigram')", nullptr, nullptr, nullptr);
+	if (ret != SQLITE_OK)
+		mlog(LV_ERR, "exmdb: exmdb_fulltext_index disabled; sqlite "
+			"lacks FTS5/trigram support: %s", sqlite3_errmsg(db));
+	sqlite3_close(db);
+	return ret == SQLITE_OK;
+}
+
+static std::string fts_path(const char *dir)
+{
+	return fmt::format("{}/exmdb/fulltext.sqlite3", dir);
+}
+
+/**
+ * Mark every message dirty. The marks are made durable before the index
+ * records that it has been seeded, since the two files are committed
+ * separately.
+ */
+static bool fts_seed(sqlite3 *db)
+{
+	int sync = 2;
+	auto stm = gx_sql_prep(db, "PRAGMA main.synchronous");
+	if (stm != nullptr && stm.step() == SQLITE_ROW)
+		sync = stm.col_int64(0);
+	stm.finalize();
+	if (gx_sql_exec(db, "PRAGMA main.synchronous=FULL") != SQLITE_OK)
+		return false;
+	auto cl_0 = HX::make_scope_exit([&]() {
+		gx_sql_exec(db, fmt::format("PRAGMA main.synchronous={}", sync).c_str());
+	});
+	auto xact = gx_sql_begin(db, txn_mode::write);
+	if (!xact)
+		return false;
+	if (gx_sql_exec(db, "INSERT OR IGNORE INTO fts_dirty (message_id) "
+	    "SELECT message_id FROM main.messages") != SQLITE_OK ||
+	    xact.commit() != SQLITE_OK)
+		return false;
+	return gx_sql_exec(db, fmt::format("INSERT OR REPLACE INTO fts_meta "
+	       "VALUES ('seeded', {})", fts_seed_version).c_str()) == SQLITE_OK;
+}
+
+/**
+ * Attach the index to a freshly opened exchange.sqlite3 connection and
+ * install the change-tracking triggers for it. A new index starts out with
+ * every message marked dirty. Calling it again on the same connection
+ * only reinstates triggers (which a schema upgrade may have dropped).
+ */
+bool fts_attach(sqlite3 *db, const char *dir)
+{
+	xstmt stm;
+	if (sqlite3_db_filename(db, "fts") == nullptr) {
+		auto path = fts_path(dir);
+		stm = gx_sql_prep(db, "ATTACH DATABASE ? AS fts");
+		if (stm == nullptr)
+			return false;
+		stm.bind_text(1, path.c_str());
+		if (stm.step() != SQLITE_DONE)
+			return false;
+		stm.finalize();
+	}
+	/* FULL: fts_sync relies on index writes being durable at commit */
+	if (gx_sql_exec(db, "PRAGMA fts.journal_mode=WAL") != SQLITE_OK ||
+	    gx_sql_exec(db, "PRAGMA fts.synchronous=FULL") != SQLITE_OK ||
+	    gx_sql_exec(db, fts_schema) != SQLITE_OK)
+		return false;
+	static constexpr struct {
+		const char *name, *event, *row;
+	} mp_triggers[] = {
+		{"ins", "INSERT", "NEW"},
+		{"upd", "UPDATE OF propval", "NEW"},
+		{"del", "DELETE", "OLD"},
+	};
+	for (const auto &t : mp_triggers) {
+		auto q = fmt::format("CREATE TEMP TRIGGER IF NOT EXISTS "
+		         "fts_mp_{} AFTER {} ON main.message_properties "
+		         "WHEN ({}.proptag >> 16) IN ({}) BEGIN "
+		         "INSERT OR REPLACE INTO fts_dirty (message_id) VALUES ({}.message_id); END",
+		         t.name, t.event, t.row, fts_watched_ids, t.row);
+		if (gx_sql_exec(db, q.c_str()) != SQLITE_OK)
+			return false;
+	}
+	if (gx_sql_exec(db, "CREATE TEMP TRIGGER IF NOT EXISTS fts_msg_del "
+	    "AFTER DELETE ON main.messages BEGIN "
+	    "INSERT OR REPLACE INTO fts_dirty (message_id) VALUES (OLD.message_id); END") != SQLITE_OK)
+		return false;
+
+	stm = gx_sql_prep(db, "SELECT v FROM fts_meta WHERE k='seeded'");
+	if (stm == nullptr)
+		return false;
+	if (stm.step() == SQLITE_ROW && stm.col_uint64(0) >= fts_seed_version)
+		return true;
+	stm.finalize();
+	/* Seeding twice is harmless; the marks are idempotent. */
+	return fts_seed(db);
+}
+
+/**
+ * Drop the change marks of a store whose index is being discarded, as they
+ * would no longer be maintained.
+ */
+void fts_drop_marks(sqlite3 *db)
+{
+	gx_sql_exec(db, "DROP TABLE IF EXISTS main.fts_dirty");
+}
+
+/**
+ * Modifications made while the feature is off are not tracked, so an index
+ * left over from an earlier run cannot be trusted anymore.
+ */
+void fts_discard(const char *dir)
+{
+	auto path = fts_path(dir);
+	for (const auto suffix : {"", "-wal", "-shm"}) {
+		auto p = path + suffix;
+		if (unlink(p.c_str()) != 0 && errno != ENOENT)
+			mlog(LV_WARN, "W-2436: unlink %s: %s", p.c_str(), strerror(errno));
+	}
+}
+
+bool fts_available(sqlite3 *db)
+{
+	return g_exmdb_fulltext && sqlite3_db_filename(db, "fts") != nullptr;
+}
+
+static bool fts_gettext(const db_conn &db, uint64_t mid, proptag_t tag,
+    std::string &out)
+{
+	void *pv = nullptr;
+	if (!cu_get_property(MAPI_MESSAGE, mid, CP_UTF8, db, tag, &pv))
+		return false;
+	if (pv != nullptr) {
+		if (!out.empty())
+			out += '\n';
+		out += static_cast<const char *>(pv);
+	}
+	return true;
+}
+
+static bool fts_index_one(const db_conn &db, uint64_t mid, sqlite3_stmt *ins)
+{
+	std::string subject, body, sender;
+	if (!fts_gettext(db, mid, PR_SUBJECT, subject) ||
+	    !fts_gettext(db, mid, PR_BODY, body))
+		return false;
+	for (auto tag : fts_sender_tags)
+		if (!fts_gettext(db, mid, tag, sender))
+			return false;
+	sqlite3_reset(ins);
+	sqlite3_bind_int64(ins, 1, mid);
+	sqlite3_bind_text(ins, 2, subject.c_str(), subject.size(), SQLITE_STATIC);
+	sqlite3_bind_text(ins, 3, body.c_str(), body.size(), SQLITE_STATIC);
+	sqlite3_bind_text(ins, 4, sender.c_str(), sender.size(), SQLITE_STATIC);
+	return gx_sql_step(ins) == SQLITE_DONE;
+}
+
+/**
+ * Bring up to @limit dirty messages into the index. Must be called outside
+ * of any transaction on @db.
+ *
+ * Each block is indexed in one transaction that only writes to
+ * fulltext.sqlite3 (synchronous=FULL), and the marks are retired in a
+ * second one on exchange.sqlite3. A crash in between merely leaves marks
+ * behind, whose messages get indexed again. A mark that a writer renewed
+ * after the first transaction's snapshot carries a new seq and survives.
+ */
+bool fts_sync(const db_conn &db, size_t limit) try
+{
+	static constexpr unsigned int block = 64;
+	if (!fts_available(db.psqlite))
+		return true;
+	auto actx = exmdb_server::get_alloc_context();
+	std::vector<std::pair<int64_t, uint64_t>> marks;
+	while (limit > 0) {
+		/* Deferred: only takes the write lock of fulltext.sqlite3 */
+		auto xact = gx_sql_begin(db.psqlite, txn_mode::read);
+		if (!xact)
+			return false;
+		auto stm = db.prep("SELECT seq, message_id FROM fts_dirty ORDER BY seq LIMIT ?");
+		if (stm == nullptr)
+			return false;
+		stm.bind_int64(1, std::min(limit, static_cast<size_t>(block)));
+		marks.clear();
+		while (stm.step() == SQLITE_ROW)
+			marks.emplace_back(stm.col_int64(0), stm.col_uint64(1));
+		stm.finalize();
+		if (marks.empty())
+			return true;
+		auto del = db.prep("DELETE FROM fts_msgtext WHERE rowid=?");
+		auto exist = db.prep("SELECT 1 FROM messages WHERE message_id=?");
+		auto ins = db.prep("INSERT INTO fts_msgtext (rowid, subject, body, sender) VALUES (?,?,?,?)");
+		if (del == nullptr || exist == nullptr || ins == nullptr)
+			return false;
+		for (auto [seq, mid] : marks) {
+			del.bind_int64(1, mid);
+			if (del.step() != SQLITE_DONE)
+				return false;
+			del.reset();
+			exist.bind_int64(1, mid);
+			auto present = exist.step() == SQLITE_ROW;
+			exist.reset();
+			if (!present)
+				continue;
+			/* Bodies are big; do not let them pile up in the arena. */
+			auto mark = actx != nullptr ? actx->m_ptrs.size() : 0;
+			auto ok = fts_index_one(db, mid, ins);
+			if (actx != nullptr)
+				actx->m_ptrs.resize(mark);
+			if (!ok)
+				return false;
+		}
+		del.finalize();
+		exist.finalize();
+		ins.finalize();
+		if (xact.commit() != SQLITE_OK)
+			return false;
+
+		xact = gx_sql_begin(db.psqlite, txn_mode::write);
+		if (!xact)
+			return false;
+		auto done = db.prep("DELETE FROM fts_dirty WHERE seq=?");
+		if (done == nullptr)
+			return false;
+		for (auto [seq, mid] : marks) {
+			done.bind_int64(1, seq);
+			if (done.step() != SQLITE_DONE)
+				return false;
+			done.reset();
+		}
+		done.finalize();
+		if (xact.commit() != SQLITE_OK)
+			return false;
+		limit -= marks.size();
+	}
+	return true;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2437: ENOMEM");
+	return false;
+}
+
+static const char *fts_column(proptag_t tag)
+{
+	switch (tag) {
+	case PR_SUBJECT:
+		return "subject";
+	case PR_BODY:
+		return "body";
+	case PR_SENDER_NAME:
+	case PR_SENDER_EMAIL_ADDRESS:
+	case PR_SENDER_SMTP_ADDRESS:
+	case PR_SENT_REPRESENTING_NAME:
+	case PR_SENT_REPRESENTING_EMAIL_ADDRESS:
+	case PR_SENT_REPRESENTING_SMTP_ADDRESS:
+		return "sender";
+	default:
+		return nullptr;
+	}
+}
+
+/**
+ * Build an FTS5 query that matches at least all messages satisfying @pres.
+ * Returns false if no such narrowing is possible.
+ */
+bool fts_match_expr(const RESTRICTION *pres, std::string &out) try
+{
+	switch (pres->rt) {
+	case RES_AND: {
+		out.clear();
+		for (const auto &sub : *pres->andor) {
+			std::string expr;
+			if (!fts_match_expr(&sub, expr))
+				continue;
+			if (!out.empty())
+				out += " AND ";
+			out += "(" + std::move(expr) + ")";
+		}
+		return !out.empty();
+	}
+	case RES_OR: {
+		if (pres->andor->count == 0)
+			return false;
+		out.clear();
+		for (const auto &sub : *pres->andor) {
+			std::string expr;
+			if (!fts_match_expr(&sub, expr))
+				return false;
+			if (!out.empty())
+				out += " OR ";
+			out += "(" + std::move(expr) + ")";
+		}
+		return true;
+	}
+	case RES_COMMENT:
+	case RES_ANNOTATION:
+		return pres->comment->pres != nullptr &&
+		       fts_match_expr(pres->comment->pres, out);
+	case RES_CONTENT: {
+		auto rcon = pres->cont;
+		auto col = fts_column(rcon->proptag);
+		if (col == nullptr || !rcon->comparable() ||
+		    PROP_TYPE(rcon->propval.proptag) != PT_UNICODE ||
+		    rcon->propval.pvalue == nullptr)
+			return false;
+		switch (rcon->fuzzy_level & 0xFFFF) {
+		case FL_FULLSTRING:
+		case FL_SUBSTRING:
+		case FL_PREFIX:
+			break;
+		default:
+			return false;
+		}
+		/* The trigram tokenizer cannot look up anything shorter */
+		auto needle = static_cast<const char *>(rcon->propval.pvalue);
+		size_t chars = 0;
+		for (auto p = needle; *p != '\0'; ++p)
+			if ((*p & 0xC0) != 0x80)
+				++chars;
+		if (chars < 3)
+			return false;
+		out = fmt::format("{{{}}} : \"", col);
+		for (auto p = needle; *p != '\0'; ++p) {
+			if (*p == '"')
+				out += '"';
+			out += *p;
+		}
+		out += '"';
+		return true;
+	}
+	default:
+		return false;
+	}
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2438: ENOMEM");
+	return false;
+}
+
+/**
+ * Subquery yielding the candidate message IDs for an fts_match_expr result.
+ */
+std::string fts_prefilter_sql(const std::string &match)
+{
+	std::string q = "SELECT rowid FROM fts_msgtext WHERE fts_msgtext MATCH '";
+	for (auto c : match) {
+		if (c == '\'')
+			q += '\'';
+		q += c;
+	}
+	q += "' UNION SELECT message_id FROM fts_dirty";
+	return q;
+}
+
+/**
+ * Collect the result of fts_prefilter_sql in @out.
+ */
+bool fts_candidates(const db_conn &db, const std::string &match,
+    std::unordered_set<uint64_t> &out) try
+{
+	auto stm = db.prep(fts_prefilter_sql(match).c_str());
+	if (stm == nullptr)
+		return false;
+	out.clear();
+	while (stm.step() == SQLITE_ROW)
+		out.insert(stm.col_uint64(0));
+	return true;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2439: ENOMEM");
+	return false;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <sqlite3.h>
+#include <gromox/mapidefs.h>
+
+struct db_conn;
+
+/*
+ * Messages indexed at most per fts_sync call: inside a client's RPC, and
+ * in the background (search folder population, maintenance pass).
+ */
+static constexpr size_t FTS_SYNC_QUOTA = 64, FTS_SYNC_BACKLOG = 512;
+
+extern bool g_exmdb_fulltext;
+
+extern bool fts_selftest();
+extern bool fts_attach(sqlite3 *, const char *dir);
+extern void fts_discard(const char *dir);
+extern void fts_drop_marks(sqlite3 *);
+extern bool fts_available(sqlite3 *);
+extern bool fts_sync(const db_conn &, size_t limit);
+extern bool fts_match_expr(const RESTRICTION *, std::string &);
+extern std::string fts_prefilter_sql(const std::string &match);
+extern bool fts_candidates(const db_conn &, const std::string &match, std::unordered_set<uint64_t> &);
@@ -150,7 +150,7 @@ BOOL exmdb_server::get_content_sync(const char *dir,
 			return FALSE;
 	}
 	auto fid_val = rop_util_get_gc_value(folder_id);
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/*
@@ -575,7 +575,7 @@ static void ics_enum_hierarchy_replist(void *vpar, uint16_t replid)
 /**
  * @username:   Used for permission checking and retrieving public store readstates
  */
-static BOOL ics_load_folder_changes(sqlite3 *psqlite, uint64_t folder_id,
+static BOOL ics_load_folder_changes(const db_conn &db, uint64_t folder_id,
     const char *username, const idset *pgiven, const idset *pseen,
     sqlite3_stmt *pstmt, sqlite3_stmt *stm_insert_chg,
     sqlite3_stmt *stm_insert_exist, uint64_t *plast_cn) try
@@ -590,7 +590,7 @@ static BOOL ics_load_folder_changes(sqlite3 *psqlite, uint64_t folder_id,
 		uint64_t fid_val = sqlite3_column_int64(pstmt, 0);
 		change_num = sqlite3_column_int64(pstmt, 1);
 		if (username != STORE_OWNER_GRANTED) {
-			if (!cu_get_folder_permission(psqlite,
+			if (!cu_get_folder_permission(db,
 			    fid_val, username, &permission))
 				return FALSE;
 			if (!(permission & (frightsReadAny | frightsVisible | frightsOwner)))
@@ -612,7 +612,7 @@ static BOOL ics_load_folder_changes(sqlite3 *psqlite, uint64_t folder_id,
 			return FALSE;
 	}
 	for (auto fid_val : recurse_list)
-		if (!ics_load_folder_changes(psqlite, fid_val, username, pgiven,
+		if (!ics_load_folder_changes(db, fid_val, username, pgiven,
 		    pseen, pstmt, stm_insert_chg, stm_insert_exist, plast_cn))
 			return FALSE;	
 	return TRUE;
@@ -644,7 +644,7 @@ BOOL exmdb_server::get_hierarchy_sync(const char *dir,
 	    " folder_id INTEGER UNIQUE NOT NULL)") != SQLITE_OK)
 		return FALSE;
 	auto fid_val = rop_util_get_gc_value(folder_id);
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	auto sql_transact2 = gx_sql_begin(pdb->psqlite, txn_mode::read);
@@ -668,7 +668,7 @@ BOOL exmdb_server::get_hierarchy_sync(const char *dir,
 	if (stm_insert_exist == nullptr)
 		return FALSE;
 	*plast_cn = 0;
-	if (!ics_load_folder_changes(pdb->psqlite, fid_val, username, pgiven,
+	if (!ics_load_folder_changes(*pdb, fid_val, username, pgiven,
 	    pseen, stm_select_fld, stm_insert_chg, stm_insert_exist, plast_cn))
 		return FALSE;
 	stm_select_fld.finalize();
@@ -716,7 +716,7 @@ BOOL exmdb_server::get_hierarchy_sync(const char *dir,
 			return t == PR_HAS_RULES || t == PidTagChangeNumber ||
 			       t == PR_LOCAL_COMMIT_TIME || t == PR_DELETED_COUNT_TOTAL ||
 			       t == PR_NORMAL_MESSAGE_SIZE || t == PR_LOCAL_COMMIT_TIME_MAX ||
-			       t == PR_HIERARCHY_CHANGE_NUM;
+			       t == PR_HIERARCHY_CHANGE_NUM || t == PR_RULE_TABLE_CN;
 		});
 		tags.push_back(PidTagParentFolderId);
 		if (!cu_get_properties(MAPI_FOLDER, fid_val1, CP_ACP,
@@ -39,6 +39,7 @@
 #include <gromox/util.hpp>
 #include "bounce_producer.hpp"
 #include "db_engine.hpp"
+#include "fulltext.hpp"
 #include "parser.hpp"
 
 using namespace std::string_literals;
@@ -67,8 +68,14 @@ static constexpr cfg_directive exmdb_cfg_defaults[] = {
 	{"exmdb_body_autosynthesis", "1", CFG_BOOL},
 	{"exmdb_eph_prefix", ""},
 	{"exmdb_file_compression", "zstd-6"},
+	{"exmdb_fulltext_index", "0", CFG_BOOL},
+	{"exmdb_group_commit", "0", CFG_TIME_NS, "0", "100ms"},
 	{"exmdb_hosts_allow", ""}, /* ::1 default set later during startup */
+	{"exmdb_maint_budget", "64M", CFG_SIZE},
+	{"exmdb_maint_idle", "30s", CFG_TIME},
+	{"exmdb_maint_interval", "0", CFG_TIME},
 	{"exmdb_max_sqlite_spares", "3", CFG_SIZE},
+	{"exmdb_perm_cache_ttl", "1min", CFG_TIME},
 	{"exmdb_pf_read_per_user", "1"},
 	{"exmdb_pf_read_states", "2"},
 	{"exmdb_private_folder_softdelete", "1", CFG_BOOL},
@@ -77,6 +84,9 @@ static constexpr cfg_directive exmdb_cfg_defaults[] = {
 	{"exmdb_search_pacing", "250", CFG_SIZE},
 	{"exmdb_search_pacing_time", "0.5s", CFG_TIME_NS},
 	{"exmdb_search_yield", "0", CFG_BOOL},
+	{"exmdb_warmup_list", PKGSTATEDIR "/exmdb_warmup.txt"},
+	{"exmdb_warmup_queue", "1000", CFG_SIZE},
+	{"exmdb_warmup_threads", "2", CFG_SIZE, "0", "64"},
 	{"exrpc_debug", "0"},
 	{"listen_port", "exmdb_listen_port", CFG_ALIAS},
 	{"max_ext_rule_number", "20", CFG_SIZE, "1", "100"},
@@ -127,6 +137,11 @@ static bool exmdb_provider_reload(std::shared_ptr<config_file> gxcfg = nullptr,
 	g_exmdb_search_nice = pconfig->get_ll("exmdb_search_nice");
 	g_exmdb_search_pacing_time = pconfig->get_ll("exmdb_search_pacing_time");
 	g_exmdb_max_sqlite_spares = pconfig->get_ll("exmdb_max_sqlite_spares");
+	g_exmdb_perm_cache_ttl = pconfig->get_ll("exmdb_perm_cache_ttl");
+	g_exmdb_maint_interval = pconfig->get_ll("exmdb_maint_interval");
+	g_exmdb_maint_idle = pconfig->get_ll("exmdb_maint_idle");
+	g_exmdb_maint_budget = pconfig->get_ll("exmdb_maint_budget");
+	g_exmdb_warmup_queue = pconfig->get_ll("exmdb_warmup_queue");
 	g_sqlite_busy_timeout_ns = pconfig->get_ll("sqlite_busy_timeout");
 	exmdb_eph_prefix = pconfig->get_value("exmdb_eph_prefix");
 	gx_sql_deep_backtrace = gxcfg->get_ll("exmdb_deep_backtrace");
@@ -155,6 +170,7 @@ bool SVC_exmdb_provider(enum plugin_op reason, const struct dlfuncs &ppdata)
 		textmaps_init();
 		exmdb_rpc_alloc = common_util_alloc;
 		exmdb_rpc_free = [](void *) {};
+		exmdb_rpc_zerocopy = true;
 		auto pconfig = g_config_during_init = config_file_initd("exmdb_provider.cfg",
 		               get_config_path(), exmdb_cfg_defaults);
 		if (NULL == pconfig) {
@@ -227,6 +243,12 @@ bool SVC_exmdb_provider(enum plugin_op reason, const struct dlfuncs &ppdata)
 			mlog(LV_INFO, "Content File Compression: zstd-%d", g_cid_compression);
 
 		g_exmdb_enable_optim_stm = gxcfg->get_ll("exmdb_optimize_stm");
+		/* Not reloadable: a store must not miss changes while it is open */
+		g_exmdb_fulltext = pconfig->get_ll("exmdb_fulltext_index") != 0 &&
+		                   fts_selftest();
+		/* Not reloadable: decides the synchronous mode of new connections */
+		g_exmdb_group_commit_ns = pconfig->get_ll("exmdb_group_commit");
+		g_exmdb_warmup_threads = pconfig->get_ll("exmdb_warmup_threads");
 		str = gxcfg->get_value("outgoing_smtp_url");
 		std::string smtp_url;
 		try {
@@ -250,6 +272,9 @@ bool SVC_exmdb_provider(enum plugin_op reason, const struct dlfuncs &ppdata)
 		db_engine_init(table_size, cache_interval, sfpop_max, par_upg, par_shut);
 		auto prog_id = service_get_prog_id();
 		bool run_parser = strncmp(prog_id, "istore-", 7) == 0;
+		/* Only the process that serves all stores keeps the list */
+		if (strcmp(prog_id, "istore-director") == 0)
+			g_exmdb_warmup_list = znul(pconfig->get_value("exmdb_warmup_list"));
 		if (run_parser)
 			/* Director or worker */
 			exmdb_parser_init(max_threads, max_routers);
@@ -345,12 +370,15 @@ void build_env(unsigned int flags, const char *dir) try
 	pctx->dir = dir;
 	pctx->account_id = 0;
 	g_env_key = std::move(pctx);
+	if (!(flags & EM_BACKGROUND))
+		db_engine_group_arm();
 } catch (const std::bad_alloc &) {
 	gromox::mlog(LV_ERR, "%s: ENOMEM", __func__);
 }
 
 void free_env()
 {
+	db_engine_group_sync();
 	g_env_key.reset();
 }
 
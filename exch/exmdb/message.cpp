@@ -34,6 +34,7 @@
 #include <gromox/fileio.h>
 #include <gromox/json.hpp>
 #include <gromox/mapidefs.h>
+#include <gromox/mjson.hpp>
 #include <gromox/mysql_adaptor.hpp>
 #include <gromox/oxcmail.hpp>
 #include <gromox/proptag_array.hpp>
@@ -301,7 +302,7 @@ BOOL exmdb_server::movecopy_messages(const char *dir, cpid_t cpid, BOOL b_guest,
 	if (!b_guest) {
 		b_check = FALSE;
 	} else if (folder_type != FOLDER_SEARCH) {
-		if (!cu_get_folder_permission(pdb->psqlite,
+		if (!cu_get_folder_permission(*pdb,
 		    src_val, username, &permission))
 			return FALSE;
 		b_check = (permission & (frightsOwner | frightsReadAny)) ? false : TRUE;
@@ -358,7 +359,7 @@ BOOL exmdb_server::movecopy_messages(const char *dir, cpid_t cpid, BOOL b_guest,
 		stm_find.reset();
 		if (folder_type == FOLDER_SEARCH) {
 			if (b_check) {
-				if (!cu_get_folder_permission(pdb->psqlite,
+				if (!cu_get_folder_permission(*pdb,
 				    parent_fid, username, &permission))
 					return false;
 				if (!(permission & (frightsOwner | frightsReadAny))) {
@@ -532,7 +533,7 @@ BOOL exmdb_server::delete_messages(const char *dir, cpid_t cpid,
 	} else if (folder_type == FOLDER_SEARCH) {
 		b_check = TRUE;
 	} else {
-		if (!cu_get_folder_permission(pdb->psqlite,
+		if (!cu_get_folder_permission(*pdb,
 		    src_val, username, &permission))
 			return FALSE;
 		b_check = (permission & (frightsOwner | frightsDeleteAny)) ? false : TRUE;
@@ -570,7 +571,7 @@ BOOL exmdb_server::delete_messages(const char *dir, cpid_t cpid,
 		sqlite3_reset(pstmt);
 		if (folder_type == FOLDER_SEARCH) {
 			if (b_check) {
-				if (!cu_get_folder_permission(pdb->psqlite,
+				if (!cu_get_folder_permission(*pdb,
 				    parent_fid, username, &permission))
 					return FALSE;
 				if (!(permission & (frightsOwner | frightsDeleteAny))) {
@@ -933,7 +934,7 @@ BOOL exmdb_server::get_message_properties(const char *dir,
     const char *username, cpid_t cpid, uint64_t message_id,
     proptag_cspan pproptags, TPROPVAL_ARRAY *ppropvals)
 {
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/* Only one SQL operation, no transaction needed. */
@@ -974,10 +975,18 @@ BOOL exmdb_server::set_message_properties(const char *dir,
 	cu_set_property(MAPI_FOLDER, fid_val, CP_ACP, pdb->psqlite,
 		PR_LOCAL_COMMIT_TIME_MAX, &nt_time, &b_result);
 
+	std::vector<proptag_t> changed;
+	try {
+		changed.reserve(pproperties->count);
+		for (const auto &pv : *pproperties)
+			changed.push_back(pv.proptag);
+	} catch (const std::bad_alloc &) {
+		changed.clear(); /* re-evaluate all search folders */
+	}
 	auto dbase = pdb->lock_base_wr();
 	db_conn::NOTIFQ notifq;
 	pdb->proc_dynamic_event(cpid, dynamic_event::modify_msg,
-		fid_val, mid_val, 0, *dbase, notifq);
+		fid_val, mid_val, 0, *dbase, notifq, changed);
 	pdb->notify_message_modification(fid_val, mid_val, *dbase, notifq);
 	if (sql_transact.commit() != SQLITE_OK)
 		return false;
@@ -1009,7 +1018,7 @@ BOOL exmdb_server::remove_message_properties(const char *dir, cpid_t cpid,
 	db_conn::NOTIFQ notifq;
 	pdb->notify_message_modification(fid_val, mid_val, *dbase, notifq);
 	pdb->proc_dynamic_event(cpid, dynamic_event::modify_msg,
-		fid_val, mid_val, 0, *dbase, notifq);
+		fid_val, mid_val, 0, *dbase, notifq, pproptags);
 	if (sql_transact.commit() != SQLITE_OK)
 		return false;
 	dg_notify(std::move(notifq));
@@ -1073,8 +1082,9 @@ BOOL exmdb_server::set_message_read_state(const char *dir,
 
 	auto dbase = pdb->lock_base_wr();
 	db_conn::NOTIFQ notifq;
+	static constexpr proptag_t read_tags[] = {PR_READ, PR_MESSAGE_FLAGS};
 	pdb->proc_dynamic_event(CP_ACP, dynamic_event::modify_msg,
-		fid_val, mid_val, 0, *dbase, notifq);
+		fid_val, mid_val, 0, *dbase, notifq, read_tags);
 	pdb->notify_message_modification(fid_val, mid_val, *dbase, notifq);
 	if (sql_transact.commit() != SQLITE_OK)
 		return false;
@@ -2339,6 +2349,14 @@ static ec_error_t message_disable_rule(const db_conn &db,
 		         "WHERE rule_id=%llu", ST_ERROR, LLU{id});
 		if (gx_sql_exec(psqlite, sql_string) != SQLITE_OK)
 			return ecError;
+		snprintf(sql_string, std::size(sql_string), "SELECT folder_id "
+		         "FROM rules WHERE rule_id=%llu", LLU{id});
+		auto pstmt = gx_sql_prep(psqlite, sql_string);
+		if (pstmt == nullptr)
+			return ecError;
+		if (pstmt.step() == SQLITE_ROW &&
+		    !cu_touch_rule_table(psqlite, sqlite3_column_int64(pstmt, 0)))
+			return ecError;
 		return ecSuccess;
 	}
 	if (!cu_get_property(MAPI_MESSAGE, id, CP_ACP, db,
@@ -3556,6 +3574,24 @@ static ec_error_t message_rule_new_message(const rulexec_in &rp, seen_list &seen
 	return ecSuccess;
 }
 
+/**
+ * Store the binary MIME structure index next to the ext digest. Readers fall
+ * back to the digest when the index is absent, so failure is not fatal.
+ */
+static void message_write_mst(const char *mid_string, const Json::Value &digest)
+{
+	MJSON mjson;
+	if (!mjson.load_from_json(digest))
+		return;
+	auto idx = mjson.to_index();
+	if (idx.empty())
+		return;
+	if (!exmdb_server::imapfile_write(exmdb_server::get_dir(), "mst",
+	    mid_string, idx))
+		mlog(LV_WARN, "W-2473: imapfile_write %s/mst/%s failed",
+			exmdb_server::get_dir(), mid_string);
+}
+
 static unsigned int detect_rcpt_type(const char *account, const TARRAY_SET *rcpts)
 {
 	if (rcpts == nullptr)
@@ -3792,6 +3828,7 @@ BOOL exmdb_server::deliver_message(const char *dir, const char *from_address,
 				mlog(LV_ERR, "deliver_message %s: set_mid_str %s failed", dir, mid_string);
 				return FALSE;
 			}
+			message_write_mst(mid_string, *digest);
 		}
 	}
 	mlog(LV_DEBUG, "to=%s from=%s fid=%llu delivery mid=%llu (%s)", account.c_str(),
@@ -3854,43 +3891,57 @@ BOOL exmdb_server::transport_new_mail(const char *dir, uint64_t folder_id,
 	return TRUE;
 }
 
+static bool message_write_digest(const db_conn &db, uint64_t mid,
+    const std::string &digest_stream)
+{
+	if (digest_stream.size() == 0)
+		return true;
+	Json::Value digest;
+	if (!str_to_json(digest_stream, digest) ||
+	    digest["file"].asString().size() == 0)
+		return true;
+	std::string ext_file = exmdb_server::get_dir() + "/ext/"s + digest["file"].asString();
+	auto ret = gx_mkbasedir(ext_file.c_str(), FMODE_PRIVATE);
+	if (ret < 0) {
+		mlog(LV_ERR, "E-1944: mkbasedir for %s: %s", ext_file.c_str(), strerror(-ret));
+		return false;
+	}
+	wrapfd fd = open(ext_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, FMODE_PRIVATE);
+	if (fd.get() < 0)
+		return true;
+	if (HXio_fullwrite(fd.get(), digest_stream.c_str(), digest_stream.size()) < 0) {
+		mlog(LV_ERR, "E-1321: write %s: %s", ext_file.c_str(), strerror(errno));
+		return false;
+	}
+	auto err = fd.close_wr();
+	if (err != 0) {
+		mlog(LV_ERR, "E-1322: close %s: %s", ext_file.c_str(), strerror(err));
+		return false;
+	}
+	message_write_mst(digest["file"].asCString(), digest);
+	return common_util_set_mid_string(db.psqlite, mid,
+	       digest["file"].asCString());
+}
+
 /**
- * Required properties:
- *
- * - if PidTagChangeNumber is set, so should PR_CHANGE_KEY+PCL
- *
- * Optional properties:
- *
- * - If PidTagMid is set, that MID is used or (if it exists) the message
- *   replaced.
- * - If PR_LAST_MODIFICATION_TIME is not present, it will be set to now().
+ * Body of write_message, run inside the caller's transaction. Events and
+ * notifications are left to the caller; @b_exist tells whether an existing
+ * message was replaced.
  */
-BOOL exmdb_server::write_message(const char *dir, cpid_t cpid,
-    uint64_t folder_id, const MESSAGE_CONTENT *pmsgctnt,
-    const std::string &digest_stream,
-    uint64_t *outmid, uint64_t *outcn, ec_error_t *pe_result)
+static BOOL message_write_one(const db_conn &db, cpid_t cpid,
+    uint64_t fid_val, const MESSAGE_CONTENT *pmsgctnt,
+    const std::string &digest_stream, uint64_t *outmid, uint64_t *outcn,
+    ec_error_t *pe_result, bool *b_exist)
 {
-	BOOL b_exist = false;
+	*b_exist = false;
 	auto pmid = pmsgctnt->proplist.get<uint64_t>(PidTagMid);
-	auto pdb = db_engine_get_db(dir);
-	if (!pdb)
-		return FALSE;
-	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::write);
-	if (!sql_transact)
-		return false;
-	if (cu_store_msgsize_limit_reached(*pdb, PR_STORAGE_QUOTA_LIMIT) ||
-	    cu_store_msgcount_limit_reached(pdb->psqlite)) {
-		*pe_result = MAPI_E_STORE_FULL;
-		return TRUE;	
-	}
-	auto fid_val = rop_util_get_gc_value(folder_id);
 	if (NULL != pmid) {
 		uint64_t parent_fid = 0;
-		if (!common_util_get_message_parent_folder(pdb->psqlite,
+		if (!common_util_get_message_parent_folder(db.psqlite,
 		    rop_util_get_gc_value(*pmid), &parent_fid))
 			return FALSE;	
 		if (parent_fid != 0) {
-			b_exist = TRUE;
+			*b_exist = true;
 			if (fid_val != parent_fid) {
 				*pe_result = ecRpcFailed;
 				return TRUE;
@@ -3903,7 +3954,7 @@ BOOL exmdb_server::write_message(const char *dir, cpid_t cpid,
 		*pvalue = nt_time;
 
 	bool partial = false;
-	if (!message_write_message(false, *pdb, cpid, false,
+	if (!message_write_message(false, db, cpid, false,
 	    fid_val, pmsgctnt, outmid, outcn, &partial))
 		return FALSE;
 	if (*outmid == 0) {
@@ -3911,35 +3962,46 @@ BOOL exmdb_server::write_message(const char *dir, cpid_t cpid,
 		*pe_result = ecRpcFailed;
 		return false;
 	}
+	if (!message_write_digest(db, *outmid, digest_stream))
+		return false;
+	*pe_result = ecSuccess;
+	return TRUE;
+}
 
-	if (digest_stream.size() > 0) {
-		Json::Value digest;
-		std::string mid_string;
-		if (str_to_json(digest_stream, digest) &&
-		    digest["file"].asString().size() > 0) {
-			std::string ext_file = exmdb_server::get_dir() + "/ext/"s + digest["file"].asString();
-			auto ret = gx_mkbasedir(ext_file.c_str(), FMODE_PRIVATE);
-			if (ret < 0) {
-				mlog(LV_ERR, "E-1944: mkbasedir for %s: %s", ext_file.c_str(), strerror(-ret));
-				return false;
-			}
-			wrapfd fd = open(ext_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, FMODE_PRIVATE);
-			if (fd.get() >= 0) {
-				if (HXio_fullwrite(fd.get(), digest_stream.c_str(), digest_stream.size()) < 0) {
-					mlog(LV_ERR, "E-1321: write %s: %s", ext_file.c_str(), strerror(errno));
-					return false;
-				}
-				auto err = fd.close_wr();
-				if (err != 0) {
-					mlog(LV_ERR, "E-1322: close %s: %s", ext_file.c_str(), strerror(err));
-					return false;
-				}
-				if (!common_util_set_mid_string(pdb->psqlite,
-				    *outmid, digest["file"].asCString()))
-					return false;
-			}
-		}
+/**
+ * Required properties:
+ *
+ * - if PidTagChangeNumber is set, so should PR_CHANGE_KEY+PCL
+ *
+ * Optional properties:
+ *
+ * - If PidTagMid is set, that MID is used or (if it exists) the message
+ *   replaced.
+ * - If PR_LAST_MODIFICATION_TIME is not present, it will be set to now().
+ */
+BOOL exmdb_server::write_message(const char *dir, cpid_t cpid,
+    uint64_t folder_id, const MESSAGE_CONTENT *pmsgctnt,
+    const std::string &digest_stream,
+    uint64_t *outmid, uint64_t *outcn, ec_error_t *pe_result)
+{
+	auto pdb = db_engine_get_db(dir);
+	if (!pdb)
+		return FALSE;
+	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::write);
+	if (!sql_transact)
+		return false;
+	if (cu_store_msgsize_limit_reached(*pdb, PR_STORAGE_QUOTA_LIMIT) ||
+	    cu_store_msgcount_limit_reached(pdb->psqlite)) {
+		*pe_result = MAPI_E_STORE_FULL;
+		return TRUE;	
 	}
+	auto fid_val = rop_util_get_gc_value(folder_id);
+	bool b_exist = false;
+	if (!message_write_one(*pdb, cpid, fid_val, pmsgctnt, digest_stream,
+	    outmid, outcn, pe_result, &b_exist))
+		return false;
+	if (*pe_result != ecSuccess)
+		return TRUE;
 
 	auto dbase = pdb->lock_base_wr();
 	db_conn::NOTIFQ notifq;
@@ -3956,17 +4018,90 @@ BOOL exmdb_server::write_message(const char *dir, cpid_t cpid,
 		return false;
 	dg_notify(std::move(notifq));
 	*outmid = eid_t(1, *outmid);
-	*pe_result = ecSuccess;
 	return TRUE;
 }
 
+/**
+ * Bulk variant of write_message for importers. All messages are written in
+ * one transaction; search folder updates and notifications are deferred
+ * until every message has been stored and are then run under a single
+ * database lock. The quota check is done once, before the first message.
+ *
+ * A per-message failure is reported in the corresponding @results entry;
+ * a failure of the database as such rolls back the whole batch and makes
+ * the call fail.
+ */
+BOOL exmdb_server::write_messages(const char *dir, cpid_t cpid,
+    const std::vector<message_write_item> &items,
+    std::vector<message_write_result> *results) try
+{
+	auto pdb = db_engine_get_db(dir);
+	if (!pdb)
+		return FALSE;
+	results->clear();
+	results->resize(items.size());
+	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::write);
+	if (!sql_transact)
+		return false;
+	std::vector<bool> exists(items.size());
+	for (size_t i = 0; i < items.size(); ++i) {
+		auto &r = (*results)[i];
+		/*
+		 * Same limits as write_message, checked against the sizes and
+		 * counts that the preceding messages of this batch have
+		 * already raised.
+		 */
+		if (cu_store_msgsize_limit_reached(*pdb, PR_STORAGE_QUOTA_LIMIT) ||
+		    cu_store_msgcount_limit_reached(pdb->psqlite)) {
+			for (size_t k = i; k < items.size(); ++k)
+				(*results)[k].e_result = MAPI_E_STORE_FULL;
+			break;
+		}
+		bool b_exist = false;
+		if (!message_write_one(*pdb, cpid,
+		    rop_util_get_gc_value(items[i].folder_id),
+		    items[i].pmsgctnt, items[i].digest, &r.outmid, &r.outcn,
+		    &r.e_result, &b_exist))
+			return false;
+		exists[i] = b_exist;
+	}
+
+	auto dbase = pdb->lock_base_wr();
+	db_conn::NOTIFQ notifq;
+	for (size_t i = 0; i < items.size(); ++i) {
+		auto &r = (*results)[i];
+		if (r.e_result != ecSuccess)
+			continue;
+		auto fid_val = rop_util_get_gc_value(items[i].folder_id);
+		if (exists[i]) {
+			pdb->proc_dynamic_event(cpid, dynamic_event::modify_msg,
+				fid_val, r.outmid, 0, *dbase, notifq);
+			pdb->notify_message_modification(fid_val, r.outmid, *dbase, notifq);
+		} else {
+			pdb->proc_dynamic_event(cpid, dynamic_event::new_msg,
+				fid_val, r.outmid, 0, *dbase, notifq);
+			pdb->notify_message_creation(fid_val, r.outmid, *dbase, notifq);
+		}
+	}
+	if (sql_transact.commit() != SQLITE_OK)
+		return false;
+	dg_notify(std::move(notifq));
+	for (auto &r : *results)
+		if (r.e_result == ecSuccess)
+			r.outmid = eid_t(1, r.outmid);
+	return TRUE;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2431: ENOMEM");
+	return false;
+}
+
 /**
  * @username:   Used for adjusting public store readstates
  */
 BOOL exmdb_server::read_message(const char *dir, const char *username,
     cpid_t cpid, uint64_t message_id, MESSAGE_CONTENT **ppmsgctnt)
 {
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	if (!exmdb_server::is_private())
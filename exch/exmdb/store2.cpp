@@ -62,6 +62,11 @@ BOOL exmdb_server::unload_store(const char *dir)
 	return db_engine_unload_db(dir);
 }
 
+BOOL exmdb_server::prewarm_store(const char *dir)
+{
+	return db_engine_prewarm(dir, exmdb_server::is_private());
+}
+
 BOOL exmdb_server::set_maintenance(const char *dir, uint32_t mode)
 {
 	return db_engine_set_maint(dir, static_cast<enum db_maint_mode>(mode)) ? TRUE : false;
@@ -107,7 +112,7 @@ BOOL exmdb_server::store_eid_to_user(const char *, const STORE_ENTRYID *store_ei
 
 namespace exmdb {
 
-int need_msg_perm_check(sqlite3 *db, const char *user, uint64_t fid)
+int need_msg_perm_check(const db_conn &db, const char *user, uint64_t fid)
 {
 	if (user == STORE_OWNER_GRANTED)
 		return false;
@@ -127,7 +132,7 @@ int have_delete_perm(const db_conn &db, const char *user, uint64_t fid, uint64_t
 	if (user == STORE_OWNER_GRANTED)
 		return true;
 	uint32_t perms;
-	if (!cu_get_folder_permission(db.psqlite, fid, user, &perms))
+	if (!cu_get_folder_permission(db, fid, user, &perms))
 		return -1;
 	if (mid == 0)
 		/* Whether the folder itself may be deleted */
@@ -208,7 +213,7 @@ static bool folder_purge_softdel(db_conn &db, cpid_t cpid,
 		/* Search folders do not have real messages */
 		return true;
 
-	auto ret = need_msg_perm_check(db.psqlite, username, folder_id);
+	auto ret = need_msg_perm_check(db, username, folder_id);
 	if (ret < 0)
 		return false;
 	auto b_check = ret > 0;
@@ -596,6 +601,8 @@ static bool purg_clean_mid(sqlite3 *db, const char *maildir, time_t upper_bound_
 		return false;
 	if (purg_delete_unused_files(maildir + "/ext"s, used, upper_bound_ts) == UINT64_MAX)
 		return false;
+	if (purg_delete_unused_files(maildir + "/mst"s, used, upper_bound_ts) == UINT64_MAX)
+		return false;
 	return true;
 }
 
@@ -971,7 +978,8 @@ static bool imapfile_name_ok(const std::string &type, const std::string &mid)
 {
 	if (mid.empty() || mid[0] == '.' || mid.find("/.") != mid.npos)
 		return false;
-	if (type != "eml" && type != "ext" && type != "tmp/imap.rfc822")
+	if (type != "eml" && type != "ext" && type != "mst" &&
+	    type != "tmp/imap.rfc822")
 		return false;
 	return true;
 }
@@ -989,6 +997,48 @@ BOOL exmdb_server::imapfile_read(const char *dir, const std::string &type,
 	return TRUE;
 }
 
+/**
+ * Read @length bytes at @offset of a datafile. The result is shorter when the
+ * range extends past the end of the file, and empty when it starts beyond it.
+ */
+BOOL exmdb_server::imapfile_read_range(const char *dir, const std::string &type,
+    const std::string &mid, uint64_t offset, uint32_t length,
+    std::string *data) try
+{
+	if (!imapfile_name_ok(type, mid))
+		return false;
+	wrapfd fd = open((dir + "/"s + type + "/" + mid).c_str(), O_RDONLY);
+	struct stat sb;
+	if (fd.get() < 0 || fstat(fd.get(), &sb) != 0)
+		return false;
+	auto fsize = static_cast<uint64_t>(sb.st_size);
+	if (offset >= fsize) {
+		data->clear();
+		return TRUE;
+	}
+	data->resize(std::min(static_cast<uint64_t>(length), fsize - offset));
+	size_t have = 0;
+	while (have < data->size()) {
+		auto ret = pread(fd.get(), &(*data)[have], data->size() - have,
+		           offset + have);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			mlog(LV_ERR, "E-2472: pread %s/%s/%s: %s", dir,
+			        type.c_str(), mid.c_str(), strerror(errno));
+			return false;
+		}
+		if (ret == 0)
+			break;
+		have += ret;
+	}
+	data->resize(have);
+	return TRUE;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "%s: ENOMEM", __PRETTY_FUNCTION__);
+	return false;
+}
+
 BOOL exmdb_server::imapfile_write(const char *dir, const std::string &type,
     const std::string &mid, const std::string &data)
 {
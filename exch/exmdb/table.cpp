@@ -11,9 +11,11 @@
 #include <iconv.h>
 #include <list>
 #include <map>
+#include <optional>
 #include <string>
 #include <unistd.h>
 #include <utility>
+#include <unordered_set>
 #include <vector>
 #include <fmt/core.h>
 #include <libHX/scope.hpp>
@@ -35,6 +37,7 @@
 #include <gromox/textmaps.hpp>
 #include <gromox/util.hpp>
 #include "db_engine.hpp"
+#include "fulltext.hpp"
 #include "parser.hpp"
 
 using LLU = unsigned long long;
@@ -91,12 +94,13 @@ static bool table_sum_table_count(db_conn &db, uint32_t table_id, uint32_t *prow
 /**
  * @username:   Used for retrieving public store readstates
  */
-static uint32_t table_sum_hierarchy(sqlite3 *psqlite,
+static uint32_t table_sum_hierarchy(const db_conn &db,
 	uint64_t folder_id, const char *username, BOOL b_depth)
 {
 	uint32_t count;
 	uint32_t permission;
 	char sql_string[128];
+	auto &psqlite = db.psqlite;
 	
 	if (!b_depth) {
 		if (username == STORE_OWNER_GRANTED) {
@@ -114,7 +118,7 @@ static uint32_t table_sum_hierarchy(sqlite3 *psqlite,
 			if (pstmt == nullptr)
 				return 0;
 			while (pstmt.step() == SQLITE_ROW) {
-				if (!cu_get_folder_permission(psqlite,
+				if (!cu_get_folder_permission(db,
 				    sqlite3_column_int64(pstmt, 0),
 				    username, &permission))
 					continue;
@@ -132,13 +136,13 @@ static uint32_t table_sum_hierarchy(sqlite3 *psqlite,
 			return 0;
 		while (pstmt.step() == SQLITE_ROW) {
 			if (username != STORE_OWNER_GRANTED) {
-				if (!cu_get_folder_permission(psqlite,
+				if (!cu_get_folder_permission(db,
 				    sqlite3_column_int64(pstmt, 0), username, &permission))
 					continue;
 				if (!(permission & (frightsReadAny | frightsVisible | frightsOwner)))
 					continue;
 			}
-			count += table_sum_hierarchy(psqlite,
+			count += table_sum_hierarchy(db,
 				sqlite3_column_int64(pstmt, 0), username, TRUE);
 			count ++;
 		}
@@ -168,7 +172,7 @@ static bool table_load_hierarchy(const db_conn &db,
 	while (pstmt1.step() == SQLITE_ROW) {
 		folder_id1 = sqlite3_column_int64(pstmt1, 0);
 		if (username != STORE_OWNER_GRANTED) {
-			if (!cu_get_folder_permission(psqlite,
+			if (!cu_get_folder_permission(db,
 			    folder_id1, username, &permission))
 				continue;
 			if (!(permission & (frightsReadAny | frightsVisible | frightsOwner)))
@@ -200,14 +204,14 @@ BOOL exmdb_server::sum_hierarchy(const char *dir,
 	BOOL b_depth, uint32_t *pcount)
 {
 	uint64_t fid_val;
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::read);
 	if (!sql_transact)
 		return false;
 	fid_val = rop_util_get_gc_value(folder_id);
-	*pcount = table_sum_hierarchy(pdb->psqlite,
+	*pcount = table_sum_hierarchy(*pdb,
 					fid_val, username, b_depth);
 	return TRUE;
 }
@@ -298,7 +302,7 @@ BOOL exmdb_server::sum_content(const char *dir, uint64_t folder_id,
 	uint64_t fid_val;
 	char sql_string[256];
 	
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/* Only one SQL operation, no transaction needed. */
@@ -784,7 +788,8 @@ static bool table_load_content_table(db_conn &db, db_base_wr_ptr &dbase,
 		"unread INTEGER DEFAULT NULL, "
 		"inst_num INTEGER NOT NULL, "
 		"value NONE DEFAULT NULL, "
-		"extremum NONE DEFAULT NULL)",		/* read(unread) for message row */
+		"extremum NONE DEFAULT NULL, "		/* read(unread) for message row */
+		"cols BLOB DEFAULT NULL)",		/* see table_cols_encode */
 		table_id);
 	if (db.eph_exec(sql_string) != SQLITE_OK)
 		return FALSE;
@@ -1023,8 +1028,17 @@ static bool table_load_content_table(db_conn &db, db_base_wr_ptr &dbase,
 	 * defined, stbl.
 	 */
 	uint64_t last_row_id = 0;
+	/* Messages that cannot satisfy the content parts of the restriction */
+	std::unordered_set<uint64_t> fts_cand;
+	std::string fts_match;
+	bool use_fts = !rows_done && conv_id == nullptr &&
+	               prestriction != nullptr && fts_available(db.psqlite) &&
+	               fts_match_expr(prestriction, fts_match) &&
+	               fts_candidates(db, fts_match, fts_cand);
 	while (!rows_done && pstmt.step() == SQLITE_ROW) {
 		uint64_t mid_val = pstmt.col_uint64(0);
+		if (use_fts && !fts_cand.contains(mid_val))
+			continue;
 		if (conv_id != nullptr) {
 			uint64_t parent_fid = 0;
 			if (cu_msg_is_fai(db, mid_val))
@@ -1261,6 +1275,16 @@ BOOL exmdb_server::load_content_table(const char *dir, cpid_t cpid,
 	auto pdb = db_engine_get_db(dir);
 	if (!pdb)
 		return FALSE;
+	/*
+	 * Only for restrictions that will use the index, and only a little:
+	 * unindexed messages are still returned as candidates, and the
+	 * maintenance pass works off the backlog.
+	 */
+	std::string fts_match;
+	if (prestriction != nullptr && fts_available(pdb->psqlite) &&
+	    fts_match_expr(prestriction, fts_match) &&
+	    !fts_sync(*pdb, FTS_SYNC_QUOTA))
+		/* ignore */;
 	auto dbase = pdb->lock_base_wr();
 	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::read);
 	if (!sql_transact)
@@ -1617,7 +1641,7 @@ BOOL exmdb_server::unload_table(const char *dir, uint32_t table_id)
 BOOL exmdb_server::sum_table(const char *dir,
 	uint32_t table_id, uint32_t *prows)
 {
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/*
@@ -1855,9 +1879,68 @@ static bool query_hierarchy(db_conn &db, cpid_t cpid, uint32_t table_id,
 	return TRUE;
 }
 
+/**
+ * Message-derived column values of a content table row are kept in t<N>.cols
+ * once read, so that scrolling back over rows does not hit the property
+ * tables again. The blob is [signature, TPROPVAL_ARRAY]; the signature
+ * covers the column set and codepage, so a changed SetColumns just makes
+ * existing blobs stale. dbeng_notify_cttbl_modify_row clears the blob when
+ * the message changes.
+ *
+ * Computed values may depend on objects other than the message itself
+ * (parent folder, read states, permissions) and hence are not tracked by
+ * row notifications; they are always read afresh.
+ */
+static inline bool table_col_volatile(proptag_t tag)
+{
+	return cu_msgprop_computed(tag);
+}
+
+static uint64_t table_cols_sig(cpid_t cpid, const proptag_t *tags, size_t n)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ static_cast<uint32_t>(cpid);
+	for (size_t i = 0; i < n; ++i) {
+		h ^= tags[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static bool table_cols_decode(sqlite3_stmt *stm, int col, uint64_t sig,
+    TPROPVAL_ARRAY &out)
+{
+	if (sqlite3_column_type(stm, col) != SQLITE_BLOB)
+		return false;
+	EXT_PULL ep;
+	ep.init(sqlite3_column_blob(stm, col), sqlite3_column_bytes(stm, col),
+		common_util_alloc, 0);
+	uint64_t have = 0;
+	return ep.g_uint64(&have) == pack_result::ok && have == sig &&
+	       ep.g_tpropval_a(&out) == pack_result::ok;
+}
+
+static bool table_cols_encode(uint64_t sig, const TPROPVAL_ARRAY &vals,
+    std::string &out) try
+{
+	EXT_PUSH ep;
+	if (!ep.init(nullptr, 0, 0) ||
+	    ep.p_uint64(sig) != pack_result::ok ||
+	    ep.p_tpropval_a(vals) != pack_result::ok)
+		return false;
+	out.assign(reinterpret_cast<const char *>(ep.m_udata), ep.m_offset);
+	return true;
+} catch (const std::bad_alloc &) {
+	return false;
+}
+
+/**
+ * Runs without the giant lock. @gen is db_base::wr_gen from when @ptnode
+ * was copied; column values read from the messages are only cached in
+ * t<N> if no notification can have invalidated them in the meantime.
+ */
 static bool query_content(db_conn &db, cpid_t cpid, uint32_t table_id,
     proptag_cspan pproptags, uint32_t start_pos, int32_t row_needed,
-    const table_node *ptnode, TARRAY_SET *pset)
+    const table_node *ptnode, uint64_t gen, TARRAY_SET *pset)
 {
 	char sql_string[1024];
 	int32_t end_pos;
@@ -1900,9 +1983,14 @@ static bool query_content(db_conn &db, cpid_t cpid, uint32_t table_id,
 	auto sql_transact = gx_sql_begin(db.psqlite, txn_mode::read);
 	if (!sql_transact)
 		return false;
-	auto sql_transact_eph = gx_sql_begin(db.m_sqlite_eph, txn_mode::read);
-	if (!sql_transact_eph)
+	auto vals    = cu_alloc<void *>(pproptags.size());
+	auto msgcol  = cu_alloc<size_t>(pproptags.size());
+	auto msgtags = cu_alloc<proptag_t>(pproptags.size());
+	auto voltags = cu_alloc<proptag_t>(pproptags.size());
+	if (vals == nullptr || msgcol == nullptr || msgtags == nullptr ||
+	    voltags == nullptr)
 		return false;
+	std::vector<std::pair<uint64_t, std::string>> fills;
 	if (!db.begin_optim())
 		return FALSE;
 	auto cl_0 = HX::make_scope_exit([&]() { db.end_optim(); });
@@ -1916,18 +2004,49 @@ static bool query_content(db_conn &db, cpid_t cpid, uint32_t table_id,
 		mrow->ppropval = cu_alloc<TAGGED_PROPVAL>(pproptags.size());
 		if (mrow->ppropval == nullptr)
 			return FALSE;
-		for (const auto tag : pproptags) {
-			void *pvalue = nullptr;
-			if (!table_column_content_tmptbl(pstmt, pstmt1,
+		/*
+		 * Columns which the temporary table cannot answer are
+		 * collected and read from the message in one go.
+		 */
+		size_t nmsg = 0, nvol = 0;
+		for (size_t i = 0; i < pproptags.size(); ++i) {
+			vals[i] = nullptr;
+			if (table_column_content_tmptbl(pstmt, pstmt1,
 			    pstmt2, ptnode->psorts, ptnode->folder_id, row_type,
-			    tag, ptnode->instance_tag,
-			    ptnode->extremum_tag, &pvalue)) {
-				if (row_type == CONTENT_ROW_HEADER)
-					continue;
-				if (!cu_get_property(MAPI_MESSAGE, inst_id, cpid,
-				    db, tag, &pvalue))
+			    pproptags[i], ptnode->instance_tag,
+			    ptnode->extremum_tag, &vals[i]) ||
+			    row_type == CONTENT_ROW_HEADER)
+				continue;
+			msgcol[nmsg] = i;
+			if (table_col_volatile(pproptags[i]))
+				voltags[nvol++] = pproptags[i];
+			else
+				msgtags[nmsg - nvol] = pproptags[i];
+			++nmsg;
+		}
+		TPROPVAL_ARRAY msgvals{}, volvals{};
+		bool fill = false;
+		uint64_t sig = 0;
+		if (nmsg > nvol) {
+			sig = table_cols_sig(cpid, msgtags, nmsg - nvol);
+			if (!table_cols_decode(pstmt, 13, sig, msgvals)) {
+				if (!cu_get_properties(MAPI_MESSAGE, inst_id, cpid, db,
+				    proptag_cspan(msgtags, nmsg - nvol), &msgvals))
 					return FALSE;
+				fill = true;
 			}
+		}
+		if (nvol > 0 && !cu_get_properties(MAPI_MESSAGE, inst_id,
+		    cpid, db, proptag_cspan(voltags, nvol), &volvals))
+			return FALSE;
+		for (size_t j = 0; j < nmsg; ++j) {
+			auto tag = pproptags[msgcol[j]];
+			vals[msgcol[j]] = table_col_volatile(tag) ?
+			                  volvals.getval(tag) : msgvals.getval(tag);
+		}
+		for (size_t i = 0; i < pproptags.size(); ++i) {
+			auto tag = pproptags[i];
+			auto pvalue = vals[i];
 			if (pvalue == nullptr)
 				continue;
 			switch (PROP_TYPE(tag)) {
@@ -1944,9 +2063,37 @@ static bool query_content(db_conn &db, cpid_t cpid, uint32_t table_id,
 			}
 			mrow->emplace_back(tag, pvalue);
 		}
+		/* msgvals has been truncated in place by now */
+		if (fill) {
+			std::string blob;
+			if (table_cols_encode(sig, msgvals, blob))
+				fills.emplace_back(pstmt.col_uint64(0), std::move(blob));
+		}
 		++pset->count;
 	}
-	sql_transact_eph = xtransaction();
+	pstmt.finalize();
+	/* Only rows that were read from the message need writing back */
+	auto dbase = db.lock_base_rd();
+	if (fills.size() > 0 && dbase->wr_gen == gen) {
+		auto sql_transact_eph = gx_sql_begin(db.m_sqlite_eph, txn_mode::write);
+		if (!sql_transact_eph)
+			return false;
+		auto ustm = db.eph_prep(fmt::format("UPDATE t{} SET cols=? "
+		            "WHERE row_id=?", table_id));
+		if (ustm == nullptr)
+			return false;
+		for (const auto &[row_id, blob] : fills) {
+			sqlite3_bind_blob(ustm, 1, blob.data(), blob.size(), SQLITE_STATIC);
+			sqlite3_bind_int64(ustm, 2, row_id);
+			if (ustm.step() != SQLITE_DONE)
+				return false;
+			sqlite3_reset(ustm);
+		}
+		ustm.finalize();
+		if (sql_transact_eph.commit() != SQLITE_OK)
+			return false;
+	}
+	dbase.reset();
 	if (sql_transact.commit() != SQLITE_OK)
 		return false;
 	return TRUE;
@@ -2072,9 +2219,36 @@ static bool query_rule(db_conn &db, cpid_t cpid, uint32_t table_id,
 	return TRUE;
 }
 
+/**
+ * Copy of a table node that stays valid after the giant lock is released.
+ * Only what the query_* functions look at is carried over.
+ */
+static bool table_node_snapshot(const table_node &src,
+    std::optional<table_node> &dst)
+{
+	auto &t = dst.emplace(src, table_node::clone_t{});
+	t.remote_id = t.username = nullptr;
+	t.prestriction = nullptr;
+	if (src.psorts == nullptr)
+		return true;
+	t.psorts = cu_alloc<SORTORDER_SET>();
+	if (t.psorts == nullptr)
+		return false;
+	*t.psorts = *src.psorts;
+	t.psorts->psort = cu_alloc<SORT_ORDER>(src.psorts->count);
+	if (t.psorts->psort == nullptr)
+		return false;
+	std::copy_n(src.psorts->psort, src.psorts->count, t.psorts->psort);
+	return true;
+}
+
 /**
  * @username:   Used for retrieving public store readstates
  *
+ * Runs on a read-only exchange.sqlite3 handle and only holds the giant lock
+ * to look up the table. Rows come from t<N> in one statement, so they form
+ * a consistent snapshot even if a notification changes t<N> meanwhile.
+ *
  * ...every property value returned in a row MUST
  * be less than or equal to 510 bytes in size.
  *
@@ -2085,16 +2259,24 @@ BOOL exmdb_server::query_table(const char *dir, const char *username,
     cpid_t cpid, uint32_t table_id, proptag_cspan pproptags,
 	uint32_t start_pos, int32_t row_needed, TARRAY_SET *pset)
 {
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/* Transaction is managed in query_* subfunctions. */
 	pset->count = 0;
 	pset->pparray = NULL;
-	auto dbase = pdb->lock_base_rd();
-	auto ptnode = dbase->find_table(table_id);
-	if (ptnode == nullptr)
-		return TRUE;
+	std::optional<table_node> tnode;
+	uint64_t gen;
+	{
+		auto dbase = pdb->lock_base_rd();
+		auto src = dbase->find_table(table_id);
+		if (src == nullptr)
+			return TRUE;
+		if (!table_node_snapshot(*src, tnode))
+			return FALSE;
+		gen = dbase->wr_gen;
+	}
+	auto ptnode = &*tnode;
 	if (!exmdb_server::is_private())
 		exmdb_server::set_public_username(username);
 	auto cl_0 = HX::make_scope_exit([]() { exmdb_server::set_public_username(nullptr); });
@@ -2104,7 +2286,7 @@ BOOL exmdb_server::query_table(const char *dir, const char *username,
 		       pproptags, start_pos, row_needed, pset);
 	case table_type::content:
 		return query_content(*pdb, cpid, table_id, pproptags,
-		       start_pos, row_needed, ptnode, pset);
+		       start_pos, row_needed, ptnode, gen, pset);
 	case table_type::permission:
 		return query_perm(*pdb, cpid, table_id, pproptags,
 		       start_pos, row_needed, ptnode, pset);
@@ -2505,7 +2687,7 @@ BOOL exmdb_server::match_table(const char *dir, const char *username,
 	const RESTRICTION *pres, proptag_cspan pproptags,
 	int32_t *pposition, TPROPVAL_ARRAY *ppropvals)
 {
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/* Transaction is managed within match_tbl_* subfunctions. */
@@ -2542,7 +2724,7 @@ BOOL exmdb_server::locate_table(const char *dir,
 	int idx;
 	char sql_string[256];
 	
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/* Only one SQL operation, no transaction needed. */
@@ -2748,7 +2930,7 @@ BOOL exmdb_server::read_table_row(const char *dir, const char *username,
     cpid_t cpid, uint32_t table_id, proptag_cspan pproptags,
 	uint64_t inst_id, uint32_t inst_num, TPROPVAL_ARRAY *ppropvals)
 {
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/* Transaction is managed within read_tblrow_* subfunction. */
@@ -2777,7 +2959,7 @@ BOOL exmdb_server::mark_table(const char *dir,
 	uint32_t *pinst_num, uint32_t *prow_type)
 {
 	char sql_string[256];
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	/* Only one SQL operation, no transaction needed. */
@@ -2837,7 +3019,7 @@ BOOL exmdb_server::get_table_all_proptags(const char *dir,
     uint32_t table_id, PROPTAG_ARRAY *pproptags) try
 {
 	char sql_string[256];
-	auto pdb = db_engine_get_db(dir);
+	auto pdb = db_engine_get_db(dir, true);
 	if (!pdb)
 		return FALSE;
 	auto sql_transact = gx_sql_begin(pdb->psqlite, txn_mode::read);
@@ -855,6 +855,8 @@ tproc_status http_parser::auth_basic(http_context *pcontext, const char *token)
 		ctx.auth_ts = now;
 		gx_strlcpy(ctx.prev_auth_token, token, std::size(ctx.prev_auth_token));
 		pcontext->log(LV_DEBUG, "htp_auth success");
+		if (system_services_prewarm_store != nullptr)
+			system_services_prewarm_store(pcontext->maildir);
 		return tproc_status::runoff;
 	}
 
@@ -906,6 +908,8 @@ int http_parser::auth_finalize(http_context &ctx, const char *user)
 	gx_strlcpy(ctx.lang, mres.lang.c_str(), std::size(ctx.lang));
 	if (*ctx.lang == '\0')
 		gx_strlcpy(ctx.lang, znul(g_config_file->get_value("user_default_lang")), sizeof(ctx.lang));
+	if (system_services_prewarm_store != nullptr)
+		system_services_prewarm_store(ctx.maildir);
 	return 1;
 }
 
@@ -14,6 +14,7 @@ decltype(system_services_judge_addr) system_services_judge_addr;
 bool (*system_services_judge_user)(const char *);
 void (*system_services_ban_user)(const char *, int);
 decltype(system_services_auth_login) system_services_auth_login;
+BOOL (*system_services_prewarm_store)(const char *);
 
 int system_services_run()
 {
@@ -29,6 +30,9 @@ int system_services_run()
 	E(system_services_judge_user, "user_filter_judge");
 	E(system_services_ban_user, "user_filter_ban");
 	E(system_services_auth_login, "auth_login_gen");
+	/* Optional; an exmdb_provider without warm-up support is fine */
+	system_services_prewarm_store = reinterpret_cast<decltype(system_services_prewarm_store)>(service_query("exmdb_client_prewarm_store",
+		typeid(decltype(*system_services_prewarm_store))));
 	return 0;
 #undef E
 }
@@ -1,22 +1,37 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 // SPDX-FileCopyrightText: 2021–2026 grommunio GmbH
 // This file is part of Gromox.
+/*
+ * The command server is event-driven: one thread polls all client
+ * connections and cuts the input into command lines, which a pool of
+ * worker threads executes. Threads are thus bound to commands, not to
+ * connections. A connection in plain mode has at most one command
+ * executing (responses are unframed, so they must not interleave); in
+ * multiplexed mode (cf. midb.hpp), any number, so that a slow command does
+ * not hold up the others sent over the same connection.
+ */
+#include <cerrno>
 #include <climits>
 #include <condition_variable>
-#include <csignal>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
 #include <memory>
 #include <mutex>
 #include <poll.h>
 #include <pthread.h>
 #include <span>
 #include <string>
+#include <string_view>
 #include <unistd.h>
 #include <unordered_map>
 #include <utility>
 #include <vector>
+#include <libHX/endian.h>
 #include <libHX/io.h>
 #include <libHX/string.h>
 #include <sys/socket.h>
@@ -36,17 +51,43 @@
 
 using namespace gromox;
 
+namespace {
+
+struct midcp_job {
+	midb_conn *conn = nullptr;
+	uint32_t reqid = 0;
+	std::string line;
+};
+
+/* Where cmd_write output of the current worker goes */
+struct midcp_frame {
+	midb_conn *conn = nullptr;
+	uint32_t reqid = 0;
+};
+
+}
+
+/*
+ * Commands of one multiplexed connection that may execute at the same time;
+ * beyond that, the connection is not read from until some have completed.
+ */
+static constexpr unsigned int MUX_INFLIGHT_MAX = 64;
+
 static unsigned int g_threads_num;
 static gromox::atomic_bool g_midbcmd_stop;
 static int g_timeout_interval;
 static std::vector<pthread_t> g_thread_ids;
-static std::mutex g_connection_lock; /* protects g_connlist_active, g_connlist_idle */
-static std::mutex g_cond_mutex;
-static std::condition_variable g_waken_cond;
-static std::list<midb_conn> g_connlist_active, g_connlist_idle;
+static pthread_t g_evloop_id;
+static int g_wake_pipe[2] = {-1, -1};
+static std::mutex g_connection_lock; /* protects g_connlist, g_jobs, midb_conn::{inflight,dead} */
+static std::condition_variable g_job_cond;
+static std::list<midb_conn> g_connlist;
+static std::deque<midcp_job> g_jobs;
 static std::unordered_map<std::string, midb_cmd> g_cmd_entry;
+static thread_local midcp_frame g_cur_frame;
 unsigned int g_cmd_debug;
 
+static void *midcp_evloop(void *);
 static void *midcp_thrwork(void *);
 static size_t cmd_parser_generate_args(char *cmd_line, size_t len, std::vector<char *> &out_argv);
 static int cmd_parser_ping(std::span<char *> argv, int sockd);
@@ -62,7 +103,7 @@ void cmd_parser_init(unsigned int threads_num, int timeout, unsigned int debug)
 std::list<midb_conn> cmd_parser_make_conn() try
 {
 	std::unique_lock chold(g_connection_lock);
-	if (g_connlist_active.size() + 1 + g_connlist_idle.size() >= g_threads_num)
+	if (g_connlist.size() + 1 >= g_threads_num)
 		return {};
 	chold.unlock();
 	std::list<midb_conn> holder;
@@ -73,22 +114,39 @@ std::list<midb_conn> cmd_parser_make_conn() try
 	return {};
 }
 
+static void midcp_wake()
+{
+	if (write(g_wake_pipe[1], "", 1) < 0)
+		/* pipe full: a wakeup is pending anyway */;
+}
+
 void cmd_parser_insert_conn(std::list<midb_conn> &&holder)
-{	
+{
+	holder.front().last_active = time(nullptr);
 	std::unique_lock chold(g_connection_lock);
-	g_connlist_idle.splice(g_connlist_idle.end(), std::move(holder));
+	g_connlist.splice(g_connlist.end(), std::move(holder));
 	chold.unlock();
-	g_waken_cond.notify_one();
+	midcp_wake();
 }
 
 int cmd_parser_run()
 {
 	cmd_parser_register_command("PING", {cmd_parser_ping, 2});
 	g_midbcmd_stop = false;
+	if (pipe2(g_wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+		mlog(LV_ERR, "cmd_parser: pipe: %s", strerror(errno));
+		return -1;
+	}
+	auto ret = pthread_create4(&g_evloop_id, nullptr, midcp_evloop, nullptr);
+	if (ret != 0) {
+		mlog(LV_ERR, "cmd_parser: failed to create event thread: %s", strerror(ret));
+		return -1;
+	}
+	pthread_setname_np(g_evloop_id, "cmd_parser/ev");
 
 	for (unsigned int i = 0; i < g_threads_num; ++i) {
 		pthread_t tid;
-		auto ret = pthread_create4(&tid, nullptr, midcp_thrwork, nullptr);
+		ret = pthread_create4(&tid, nullptr, midcp_thrwork, nullptr);
 		if (ret != 0) {
 			mlog(LV_ERR, "cmd_parser: failed to create pool thread: %s", strerror(ret));
 			return -1;
@@ -104,26 +162,36 @@ int cmd_parser_run()
 void cmd_parser_stop()
 {
 	g_midbcmd_stop = true;
-	g_waken_cond.notify_all();
-	std::unique_lock chold(g_connection_lock);
-	for (auto &c : g_connlist_active) {
-		auto pconnection = &c;
-		if (pconnection->is_selecting) {
-			pthread_kill(pconnection->thr_id, SIGALRM);
-		} else {
-			close(pconnection->sockd);
-			pconnection->sockd = -1;
-		}	
+	g_job_cond.notify_all();
+	if (g_wake_pipe[1] >= 0)
+		midcp_wake();
+	if (!pthread_equal(g_evloop_id, {})) {
+		pthread_join(g_evloop_id, nullptr);
+		g_evloop_id = {};
 	}
-	chold.unlock();
-	for (auto tid : g_thread_ids) {
-		pthread_kill(tid, SIGALRM);
-		pthread_join(tid, nullptr);
+	/*
+	 * Workers finish the command they are on, if any. One that is stuck
+	 * writing a response to a client that stopped reading gets an error
+	 * rather than keeping us waiting.
+	 */
+	{
+		std::lock_guard chold(g_connection_lock);
+		for (auto &c : g_connlist)
+			if (c.sockd >= 0)
+				shutdown(c.sockd, SHUT_RDWR);
 	}
+	for (auto tid : g_thread_ids)
+		pthread_join(tid, nullptr);
 	g_thread_ids.clear();
-	chold.lock();
-	g_connlist_active.clear();
-	g_connlist_idle.clear();
+	std::unique_lock chold(g_connection_lock);
+	g_jobs.clear();
+	g_connlist.clear();
+	chold.unlock();
+	for (auto &fd : g_wake_pipe) {
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
 }
 
 void cmd_parser_register_command(const char *command, const midb_cmd &info)
@@ -149,10 +217,35 @@ static void cmd_dump_argv(std::span<char *const> argv)
 	fprintf(stderr, "\n");
 }
 
+static ssize_t midcp_send_frame(midb_conn &conn, uint32_t reqid,
+    const void *buf, size_t z)
+{
+	char hdr[MIDB_MUX_HDR];
+	cpu_to_le32p(&hdr[0], reqid);
+	cpu_to_le32p(&hdr[4], z);
+	std::unique_lock wr_hold(conn.wr_lock);
+	if (HXio_fullwrite(conn.sockd, hdr, sizeof(hdr)) < 0)
+		return -1;
+	return z == 0 ? 0 : HXio_fullwrite(conn.sockd, buf, z);
+}
+
+/**
+ * Send @z bytes of response. In multiplexed mode, they go out as one frame
+ * tagged with the request ID of the command the calling worker executes.
+ */
+static ssize_t midcp_send(int fd, const void *buf, size_t z)
+{
+	auto conn = g_cur_frame.conn;
+	if (conn == nullptr || !conn->mux)
+		return HXio_fullwrite(fd, buf, z);
+	/* an empty frame would end the response */
+	return z == 0 ? 0 : midcp_send_frame(*conn, g_cur_frame.reqid, buf, z);
+}
+
 static ssize_t __attribute__((warn_unused_result))
 cmd_write_x(unsigned int level, int fd, const char *buf, size_t z)
 {
-	auto ret = HXio_fullwrite(fd, buf, z);
+	auto ret = midcp_send(fd, buf, z);
 	if (g_cmd_debug < level)
 		return ret;
 	if (dbg_current_argv.size() > 0) {
@@ -167,7 +260,7 @@ cmd_write_x(unsigned int level, int fd, const char *buf, size_t z)
 		z = INT_MAX;
 	fprintf(stderr, "> %.*s\n", static_cast<int>(z), buf);
 	return ret;
-} 
+}
 
 int cmd_write(int fd, const char *sbuf, size_t z)
 {
@@ -216,118 +309,209 @@ static int midcp_exec(std::span<char *> argv, MIDB_CONNECTION *conn)
 	return cmd_write_x(1, conn->sockd, rsp, len) < 0 ? MIDB_E_NETIO : 0;
 }
 
-static size_t connlist_idle_size()
+/**
+ * Execute one command line and produce its complete response.
+ */
+static int midcp_run(midcp_job &job)
 {
-	std::unique_lock lk(g_connection_lock);
-	return g_connlist_idle.size();
+	auto conn = job.conn;
+	auto len = job.line.size();
+	/* generate_args wants two bytes of scratch space */
+	job.line.append(2, '\0');
+	std::vector<char *> argv;
+	auto argc = cmd_parser_generate_args(job.line.data(), len, argv);
+	int ret = 0;
+	if (argc < 2) {
+		if (cmd_write_x(1, conn->sockd, "FALSE 1\r\n", 9) < 0)
+			ret = MIDB_E_NETIO;
+	} else {
+		HX_strupper(argv[0]);
+		ret = midcp_exec(argv, conn);
+	}
+	if (ret == 0 && conn->mux &&
+	    midcp_send_frame(*conn, job.reqid, nullptr, 0) < 0)
+		ret = MIDB_E_NETIO;
+	return ret;
 }
 
 static void *midcp_thrwork(void *param)
 {
-	int i, argc, offset, tv_msec, read_len;
-	struct pollfd pfd_read;
-	char buffer[CONN_BUFFLEN];
-
-	while (!g_midbcmd_stop) {
+	while (true) {
+		midcp_job job;
 		{
-			std::unique_lock cm_hold(g_cond_mutex);
-			g_waken_cond.wait(cm_hold, []() { return g_midbcmd_stop.load() || connlist_idle_size() > 0; });
+			std::unique_lock chold(g_connection_lock);
+			g_job_cond.wait(chold, []() { return g_midbcmd_stop.load() || !g_jobs.empty(); });
 			if (g_midbcmd_stop)
 				return nullptr;
+			job = std::move(g_jobs.front());
+			g_jobs.pop_front();
 		}
-
-		std::list<midb_conn>::iterator pconnection;
+		g_cur_frame = {job.conn, job.reqid};
+		auto ret = midcp_run(job);
+		g_cur_frame = {};
 		{
-			std::unique_lock co_hold(g_connection_lock);
-			if (g_connlist_idle.size() > 0) {
-				g_connlist_active.splice(g_connlist_active.end(), g_connlist_idle, g_connlist_idle.begin());
-				pconnection = std::prev(g_connlist_active.end());
-			} else {
+			std::unique_lock chold(g_connection_lock);
+			--job.conn->inflight;
+			job.conn->last_active = time(nullptr);
+			if (ret == MIDB_E_NETIO)
+				job.conn->dead = true;
+		}
+		midcp_wake();
+	}
+	return nullptr;
+}
+
+static bool midcp_may_dispatch(const midb_conn &c)
+{
+	std::unique_lock chold(g_connection_lock);
+	return c.mux ? c.inflight < MUX_INFLIGHT_MAX : c.inflight == 0;
+}
+
+/**
+ * Hand the complete command lines in @c.rbuf to the workers, as far as the
+ * connection's mode permits. Returns false if the connection is to be
+ * closed. Called from the event thread only.
+ *
+ * Complete lines held back for a busy multiplexed connection do not count
+ * against CONN_BUFFLEN; only the unterminated line at the end does.
+ */
+static bool midcp_dispatch(midb_conn &c) try
+{
+	size_t pos = 0;
+	while (midcp_may_dispatch(c)) {
+		auto eol = c.rbuf.find("\r\n", pos);
+		if (eol == c.rbuf.npos)
+			break;
+		std::string_view line(&c.rbuf[pos], eol - pos);
+		pos = eol + 2;
+		if (line.size() == 4 && strncasecmp(line.data(), "QUIT", 4) == 0) {
+			/* With c.inflight==0, there is no concurrent writer. */
+			if (!c.mux && HXio_fullwrite(c.sockd, "BYE\r\n", 5) < 0)
+				/* ignore */;
+			return false;
+		}
+		midcp_job job;
+		job.conn = &c;
+		if (!c.mux && line.size() == 3 && strncasecmp(line.data(), "MUX", 3) == 0) {
+			if (HXio_fullwrite(c.sockd, "TRUE\r\n", 6) < 0)
+				return false;
+			c.mux = true;
+			continue;
+		} else if (c.mux) {
+			char *end = nullptr;
+			std::string idstr(line.substr(0, line.find(' ')));
+			job.reqid = strtoul(idstr.c_str(), &end, 10);
+			if (idstr.empty() || *end != '\0' || idstr.size() == line.size())
+				return false; /* not recoverable, the framing is off */
+			line.remove_prefix(idstr.size() + 1);
+		}
+		job.line = line;
+		std::unique_lock chold(g_connection_lock);
+		g_jobs.push_back(std::move(job));
+		++c.inflight;
+		chold.unlock();
+		g_job_cond.notify_one();
+	}
+	c.rbuf.erase(0, pos);
+	auto eol = c.rbuf.rfind("\r\n");
+	auto partial = eol == c.rbuf.npos ? c.rbuf.size() : c.rbuf.size() - eol - 2;
+	return partial < CONN_BUFFLEN;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2464: ENOMEM");
+	return false;
+}
+
+static void *midcp_evloop(void *param)
+{
+	std::vector<struct pollfd> pfd;
+	std::vector<midb_conn *> pconn;
+	auto buffer = std::make_unique<char[]>(64 * 1024);
+
+	while (!g_midbcmd_stop) {
+		/*
+		 * gc is our little "garbage collector" which, when it
+		 * goes out of scope, destroys the connections -
+		 * outside locked sections.
+		 */
+		std::list<midb_conn> gc;
+		pfd.clear();
+		pconn.clear();
+		pfd.push_back({g_wake_pipe[0], POLLIN, 0});
+		std::unique_lock chold(g_connection_lock);
+		auto now = time(nullptr);
+		for (auto it = g_connlist.begin(); it != g_connlist.end(); ) {
+			auto &c = *it;
+			if (c.inflight == 0 && !c.dead &&
+			    now - c.last_active >= g_timeout_interval)
+				c.dead = true;
+			if (c.dead && c.inflight == 0) {
+				auto next = std::next(it);
+				gc.splice(gc.end(), g_connlist, it);
+				it = next;
 				continue;
 			}
+			++it;
+			if (c.dead || (c.mux ? c.inflight >= MUX_INFLIGHT_MAX : c.inflight > 0))
+				continue;
+			pfd.push_back({c.sockd, POLLIN | POLLPRI, 0});
+			pconn.push_back(&c);
 		}
-		offset = 0;
-
-		while (!g_midbcmd_stop) {
-			tv_msec = g_timeout_interval * 1000;
-			pfd_read.fd = pconnection->sockd;
-			pfd_read.events = POLLIN | POLLPRI;
-			pconnection->is_selecting = TRUE;
-			pconnection->thr_id = pthread_self();
-
-			/*
-			 * gc is our little "garbage collector" which, when it
-			 * goes out of scope, destroys the connections -
-			 * outside locked sections.
-			 */
-			std::list<midb_conn> gc;
-			if (1 != poll(&pfd_read, 1, tv_msec)) {
-				pconnection->is_selecting = FALSE;
-				std::unique_lock co_hold(g_connection_lock);
-				gc.splice(gc.end(), g_connlist_active, pconnection);
-				break;
-			}
-			pconnection->is_selecting = FALSE;
-			read_len = read(pconnection->sockd, buffer + offset,
-			           CONN_BUFFLEN - offset);
-			if (read_len <= 0) {
-				std::unique_lock co_hold(g_connection_lock);
-				gc.splice(gc.end(), g_connlist_active, pconnection);
-				break;
-			}
-			offset += read_len;
-			for (i = 0; i < offset - 1; ++i) {
-				if (buffer[i] != '\r' || buffer[i + 1] != '\n')
-					continue;
-				if (i == 4 && strncasecmp(buffer, "QUIT", 4) == 0) {
-					if (HXio_fullwrite(pconnection->sockd, "BYE\r\n", 5) < 0)
-						/* ignore */;
-					std::unique_lock co_hold(g_connection_lock);
-					gc.splice(gc.end(), g_connlist_active, pconnection);
-					goto NEXT_CONN;
-				}
+		chold.unlock();
+		gc.clear();
 
-				std::vector<char *> argv;
-				argc = cmd_parser_generate_args(buffer, i, argv);
-				if (argc < 2) {
-					if (HXio_fullwrite(pconnection->sockd, "FALSE 1\r\n", 9) < 0) {
-						std::unique_lock co_hold(g_connection_lock);
-						gc.splice(gc.end(), g_connlist_active, pconnection);
-						goto NEXT_CONN;
-					}
-					offset -= i + 2;
-					if (offset >= 0)
-						memmove(buffer, buffer + i + 2, offset);
-					i = 0;
-					continue;
-				}
+		/* Lines that were held back while the connection was busy */
+		bool pending = false;
+		for (auto c : pconn) {
+			if (c->rbuf.find("\r\n") == c->rbuf.npos)
+				continue;
+			pending = true;
+			if (!midcp_dispatch(*c)) {
+				chold.lock();
+				c->dead = true;
+				chold.unlock();
+			}
+		}
+		if (pending)
+			continue;
 
-				HX_strupper(argv[0]);
-				if (midcp_exec(argv, &*pconnection) == MIDB_E_NETIO) {
-					std::unique_lock co_hold(g_connection_lock);
-					gc.splice(gc.end(), g_connlist_active, pconnection);
-					goto NEXT_CONN;
+		if (poll(pfd.data(), pfd.size(), 1000) <= 0)
+			continue;
+		if (pfd[0].revents & POLLIN)
+			while (read(g_wake_pipe[0], buffer.get(), 64) > 0)
+				/* drain */;
+		for (size_t i = 1; i < pfd.size(); ++i) {
+			if (pfd[i].revents == 0)
+				continue;
+			auto &c = *pconn[i-1];
+			auto read_len = read(c.sockd, buffer.get(), 64 * 1024);
+			bool ok = read_len > 0;
+			if (ok) {
+				try {
+					c.rbuf.append(buffer.get(), read_len);
+				} catch (const std::bad_alloc &) {
+					mlog(LV_ERR, "E-2465: ENOMEM");
+					ok = false;
 				}
-				offset -= i + 2;
-				memmove(buffer, buffer + i + 2, offset);
-				i = 0;
 			}
-
-			if (offset == CONN_BUFFLEN) {
-				std::unique_lock co_hold(g_connection_lock);
-				gc.splice(gc.end(), g_connlist_active, pconnection);
-				break;
+			if (ok) {
+				chold.lock();
+				c.last_active = time(nullptr);
+				chold.unlock();
+				ok = midcp_dispatch(c);
+			}
+			if (!ok) {
+				chold.lock();
+				c.dead = true;
+				chold.unlock();
 			}
 		}
- NEXT_CONN:
-		;
 	}
 	return nullptr;
 }
 
 static int cmd_parser_ping(std::span<char *> argv, int sockd)
 {
-	return HXio_fullwrite(sockd, "TRUE\r\n", 6) < 0 ? MIDB_E_NETIO : 0;
+	return cmd_write(sockd, "TRUE\r\n");
 }
 
 static size_t cmd_parser_generate_args(char *cmd_line, size_t cmd_len,
@@ -335,7 +519,7 @@ static size_t cmd_parser_generate_args(char *cmd_line, size_t cmd_len,
 {
 	char *ptr;                   /* ptr that traverses command line  */
 	char *last_space;
-	
+
 	cmd_line[cmd_len] = ' ';
 	cmd_line[cmd_len + 1] = '\0';
 	ptr = cmd_line;
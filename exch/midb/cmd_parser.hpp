@@ -1,14 +1,24 @@
 #pragma once
+#include <ctime>
 #include <list>
-#include <pthread.h>
+#include <mutex>
 #include <span>
-#include <gromox/double_list.hpp>
+#include <string>
 #include <gromox/generic_connection.hpp>
 
+/**
+ * @rbuf:     received bytes not yet dispatched (event loop only)
+ * @inflight: commands handed to workers and not yet completed
+ * @mux:      request-ID framing is in effect (cf. midb.hpp)
+ * @dead:     to be closed once @inflight drops to zero
+ * @wr_lock:  serializes the response frames of concurrent commands
+ */
 struct midb_conn : public generic_connection {
-	DOUBLE_LIST_NODE node{};
-	BOOL is_selecting = false;
-	pthread_t thr_id{};
+	std::string rbuf;
+	time_t last_active = 0;
+	unsigned int inflight = 0;
+	bool mux = false, dead = false;
+	std::mutex wr_lock;
 };
 using MIDB_CONNECTION = midb_conn;
 
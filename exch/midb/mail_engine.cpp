@@ -31,6 +31,7 @@
 #include <vector>
 #include <fmt/core.h>
 #include <libHX/ctype_helper.h>
+#include <libHX/endian.h>
 #include <libHX/io.h>
 #include <libHX/scope.hpp>
 #include <libHX/string.h>
@@ -226,6 +227,24 @@ static std::string me_ct_to_utf8(const char *charset, std::string_view sv)
 	return out;
 }
 
+/**
+ * Write the binary MIME structure index that goes along with an ext digest.
+ * It is an optional accelerator for section fetches, so failures are only
+ * logged.
+ */
+static void me_write_mst(const char *dir, const std::string &mid_string,
+    const Json::Value &digest)
+{
+	MJSON mjson;
+	if (!mjson.load_from_json(digest))
+		return;
+	auto idx = mjson.to_index();
+	if (!idx.empty() &&
+	    !exmdb_client->imapfile_write(dir, "mst", mid_string, idx))
+		mlog(LV_WARN, "W-2461: imapfile_write %s/mst/%s failed",
+			dir, mid_string.c_str());
+}
+
 static uint64_t me_get_digest(sqlite3 *psqlite, const char *mid_string,
     Json::Value &digest) try
 {
@@ -257,6 +276,7 @@ static uint64_t me_get_digest(sqlite3 *psqlite, const char *mid_string,
 				dir, mid_string);
 			return 0;
 		}
+		me_write_mst(dir, mid_string, digest);
 	}
 	auto pstmt = gx_sql_prep(psqlite, "SELECT uid, recent, read,"
 	             " unsent, flagged, replied, forwarded, deleted,"
@@ -1390,6 +1410,7 @@ static bool me_insert_message(xstmt &stm_insert, uint32_t *puidnext,
 			mlog(LV_ERR, "E-1770: imapfile_write %s/ext/%s incomplete", dir, e.midstr.c_str());
 			return false;
 		}
+		me_write_mst(dir, e.midstr, digest);
 		std::string emlcontent;
 		auto err = imail.to_str(emlcontent);
 		if (err != 0) {
@@ -2363,6 +2384,7 @@ static int me_minst(std::span<char *> argv, int sockd) try
 		mlog(LV_ERR, "E-2073: imapfile_write %s/ext/%s failed", argv[1], argv[3]);
 		return MIDB_E_DISK_ERROR;
 	}
+	me_write_mst(argv[1], argv[3], digest);
 	auto pidb = me_get_idb(argv[1]);
 	if (pidb == nullptr)
 		return MIDB_E_HASHTABLE_FULL;
@@ -3263,32 +3285,33 @@ static int dtlu_query(IDB_ITEM *pidb, const char *sql_string,
 }
 
 /**
- * Fetch detail (via IMAP UID)
- *
- * Request:
- * 	P-DTLU <store-dir> <folder-name> <1-based imapuid(min)> <1-based imapuid(max)>
- * Response:
- * 	TRUE <#messages>
- * 	- <digest>  // repeat x #messages
+ * Parse the UID range of P-DTLU/P-DTLB from @argv[3..4].
  */
-static int me_pdtlu(std::span<char *> argv, int sockd) try
+static bool dtlu_range(std::span<char *> argv, seq_node::value_type &first,
+    seq_node::value_type &last)
 {
-	int total_mail = 0;
-	char sql_string[1024];
-	
-	seq_node::value_type first = strtol(argv[3], nullptr, 0), last = strtol(argv[4], nullptr, 0);
+	first = strtol(argv[3], nullptr, 0);
+	last  = strtol(argv[4], nullptr, 0);
 	if (first < 1 && first != SEQ_STAR)
-		return MIDB_E_PARAMETER_ERROR;
+		return false;
 	if (last < 1 && last != SEQ_STAR)
-		return MIDB_E_PARAMETER_ERROR;
+		return false;
 	if (first != SEQ_STAR && last != SEQ_STAR && last < first)
 		std::swap(first, last);
-	auto pidb = me_get_idb(argv[1]);
-	if (pidb == nullptr)
-		return MIDB_E_HASHTABLE_FULL;
-	auto folder_id = me_get_folder_id(pidb.get(), argv[2]);
-	if (folder_id == 0)
-		return MIDB_E_NO_FOLDER;
+	return true;
+}
+
+/**
+ * Get the mid_strings of the messages of @folder_id within the UID range
+ * [@first,@last], in UID order.
+ */
+static int dtlu_select(IDB_ITEM *pidb, uint64_t folder_id,
+    seq_node::value_type first, seq_node::value_type last,
+    std::vector<std::string> &temp_list)
+{
+	int total_mail = 0;
+	char sql_string[1024];
+
 	/* UNSET always means MAX, never MIN */
 	if (first == SEQ_STAR && last == SEQ_STAR)
 		snprintf(sql_string, std::size(sql_string), "SELECT mid_string"
@@ -3311,8 +3334,7 @@ static int me_pdtlu(std::span<char *> argv, int sockd) try
 		         "FROM messages WHERE folder_id=%llu AND uid>=%u AND"
 		         " uid<=%u ORDER BY uid", LLU{folder_id}, first, last);
 
-	std::vector<std::string> temp_list;
-	auto iret = dtlu_query(pidb.get(), sql_string, total_mail, temp_list);
+	auto iret = dtlu_query(pidb, sql_string, total_mail, temp_list);
 	if (iret != 0)
 		return iret;
 	if (temp_list.empty() && (first == SEQ_STAR || last == SEQ_STAR)) {
@@ -3320,10 +3342,37 @@ static int me_pdtlu(std::span<char *> argv, int sockd) try
 		snprintf(sql_string, std::size(sql_string), "SELECT mid_string"
 		         " FROM messages WHERE folder_id=%llu ORDER BY uid"
 		         " DESC LIMIT 1", LLU{folder_id});
-		iret = dtlu_query(pidb.get(), sql_string, total_mail, temp_list);
+		iret = dtlu_query(pidb, sql_string, total_mail, temp_list);
 		if (iret != 0)
 			return iret;
 	}
+	return 0;
+}
+
+/**
+ * Fetch detail (via IMAP UID)
+ *
+ * Request:
+ * 	P-DTLU <store-dir> <folder-name> <1-based imapuid(min)> <1-based imapuid(max)>
+ * Response:
+ * 	TRUE <#messages>
+ * 	- <digest>  // repeat x #messages
+ */
+static int me_pdtlu(std::span<char *> argv, int sockd) try
+{
+	seq_node::value_type first, last;
+	if (!dtlu_range(argv, first, last))
+		return MIDB_E_PARAMETER_ERROR;
+	auto pidb = me_get_idb(argv[1]);
+	if (pidb == nullptr)
+		return MIDB_E_HASHTABLE_FULL;
+	auto folder_id = me_get_folder_id(pidb.get(), argv[2]);
+	if (folder_id == 0)
+		return MIDB_E_NO_FOLDER;
+	std::vector<std::string> temp_list;
+	auto iret = dtlu_select(pidb.get(), folder_id, first, last, temp_list);
+	if (iret != 0)
+		return iret;
 
 	char temp_buff[32];
 	auto temp_len = gx_snprintf(temp_buff, std::size(temp_buff),
@@ -3348,6 +3397,145 @@ static int me_pdtlu(std::span<char *> argv, int sockd) try
 	return MIDB_E_NO_MEMORY;
 }
 
+static void dtlb_put32(std::string &rsp, uint32_t v)
+{
+	char b[4];
+	cpu_to_le32p(b, v);
+	rsp.append(b, sizeof(b));
+}
+
+static void dtlb_put64(std::string &rsp, uint64_t v)
+{
+	char b[8];
+	cpu_to_le64p(b, v);
+	rsp.append(b, sizeof(b));
+}
+
+static void dtlb_putstr(std::string &rsp, std::string_view s)
+{
+	dtlb_put32(rsp, s.size());
+	rsp += s;
+}
+
+static unsigned int dtlb_flags(const Json::Value &digest)
+{
+	static constexpr std::pair<const char *, unsigned int> map[] = {
+		{"recent", DTLB_FL_RECENT}, {"replied", DTLB_FL_ANSWERED},
+		{"flag", DTLB_FL_FLAGGED}, {"deleted", DTLB_FL_DELETED},
+		{"read", DTLB_FL_SEEN}, {"unsent", DTLB_FL_DRAFT},
+		{"forwarded", DTLB_FL_FORWARDED},
+	};
+	unsigned int fl = 0;
+	for (const auto &[name, bit] : map)
+		if (digest.isMember(name) && digest[name].asUInt() != 0)
+			fl |= bit;
+	return fl;
+}
+
+/**
+ * Append the P-DTLB record for one message to @rsp.
+ */
+static void dtlb_record(std::string &rsp, const Json::Value &digest,
+    const char *charset, unsigned int fields)
+{
+	MJSON mjson;
+	bool loaded = mjson.load_from_json(digest);
+	std::string env, body, bstruct;
+	mjson_io io;
+	/*
+	 * Structures of embedded messages are rendered from the eml file,
+	 * which only imapd has at hand (and caches); send the digest.
+	 */
+	bool want_digest = (fields & DTLB_DIGEST) || !loaded ||
+	     ((fields & (DTLB_BODY | DTLB_BODYSTRUCTURE)) && mjson.has_rfc822_part());
+	if (loaded && (fields & DTLB_ENVELOPE) &&
+	    mjson.fetch_envelope(charset, env) == -1)
+		env = "NIL";
+	if (loaded && !want_digest && (fields & DTLB_BODY) &&
+	    mjson.fetch_structure(io, charset, false, body) == -1)
+		body = "NIL";
+	if (loaded && !want_digest && (fields & DTLB_BODYSTRUCTURE) &&
+	    mjson.fetch_structure(io, charset, true, bstruct) == -1)
+		bstruct = "NIL";
+	time_t idate = 0;
+	if (loaded && !parse_rfc822_timestamp(mjson.get_mail_received(), &idate))
+		idate = strtol(mjson.get_mail_filename(), nullptr, 0);
+
+	auto rec_ofs = rsp.size();
+	dtlb_put32(rsp, 0);
+	dtlb_put32(rsp, digest["uid"].asUInt());
+	dtlb_put32(rsp, dtlb_flags(digest));
+	dtlb_put64(rsp, loaded ? mjson.get_mail_length() : 0);
+	dtlb_put64(rsp, idate);
+	dtlb_putstr(rsp, digest["file"].asString());
+	dtlb_putstr(rsp, digest["keywords"].asString());
+	dtlb_putstr(rsp, env);
+	dtlb_putstr(rsp, body);
+	dtlb_putstr(rsp, bstruct);
+	dtlb_putstr(rsp, want_digest ? json_to_str(digest) : std::string());
+	cpu_to_le32p(&rsp[rec_ofs], rsp.size() - rec_ofs - 4);
+}
+
+/**
+ * Fetch detail (via IMAP UID), binary records
+ *
+ * Request:
+ * 	P-DTLB <store-dir> <folder-name> <1-based imapuid(min)> <1-based imapuid(max)> <charset|-> <DTLB_* fields>
+ * Response:
+ * 	TRUE
+ * 	<record>  // repeat x #messages
+ * 	<le32 0>
+ *
+ * A record is a le32 payload length followed by the payload: le32 uid,
+ * le32 DTLB_FL_* flags, le64 RFC822 size, le64 internaldate (Unix time), and
+ * then mid, keywords, ENVELOPE, BODY, BODYSTRUCTURE and the JSON digest, each
+ * as le32 length plus bytes (empty if not asked for). Records are sent as
+ * they are produced, so the client can start answering before the range is
+ * complete. Unlike P-DTLU, there is no JSON for the client to parse in the
+ * common case.
+ */
+static int me_pdtlb(std::span<char *> argv, int sockd) try
+{
+	seq_node::value_type first, last;
+	if (!dtlu_range(argv, first, last))
+		return MIDB_E_PARAMETER_ERROR;
+	auto charset = strcmp(argv[5], "-") == 0 ? "" : argv[5];
+	unsigned int fields = strtoul(argv[6], nullptr, 0);
+	auto pidb = me_get_idb(argv[1]);
+	if (pidb == nullptr)
+		return MIDB_E_HASHTABLE_FULL;
+	auto folder_id = me_get_folder_id(pidb.get(), argv[2]);
+	if (folder_id == 0)
+		return MIDB_E_NO_FOLDER;
+	std::vector<std::string> temp_list;
+	auto iret = dtlu_select(pidb.get(), folder_id, first, last, temp_list);
+	if (iret != 0)
+		return iret;
+
+	std::string rsp;
+	rsp.reserve(65536);
+	rsp = "TRUE\r\n";
+	for (const auto &dt : temp_list) {
+		Json::Value digest;
+		/* vanished since the SELECT; P-DTLU sends {} for those */
+		if (me_get_digest(pidb->psqlite, dt.c_str(), digest) == 0)
+			continue;
+		dtlb_record(rsp, digest, charset, fields);
+		if (rsp.size() < rsp.capacity() / 2)
+			continue;
+		auto ret = cmd_write(sockd, rsp.c_str(), rsp.size());
+		if (ret != 0)
+			return ret;
+		rsp.clear();
+	}
+	pidb.reset();
+	dtlb_put32(rsp, 0);
+	return cmd_write(sockd, rsp.c_str(), rsp.size());
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2463: ENOMEM");
+	return MIDB_E_NO_MEMORY;
+}
+
 static std::string flags_rn(sqlite3 *db, uint64_t gcv)
 {
 	auto qstr = "SELECT replied,unsent,flagged,forwarded,deleted,read,recent "
@@ -4734,6 +4922,7 @@ static constexpr struct {
 	{"P-SIMU", {me_psimu, 5}},
 	{"P-DELL", {me_pdell, 3}},
 	{"P-DTLU", {me_pdtlu, 5}},
+	{"P-DTLB", {me_pdtlb, 7}},
 	{"P-SFLG", {me_psflg, 5}},
 	{"P-RFLG", {me_prflg, 5}},
 	{"M-SKWD", {me_mskwd, 4, 5}},
@@ -166,7 +166,6 @@ static int midls_thrwork(generic_connection &&gco)
 		}
 		auto &conn = holder.front();
 		static_cast<generic_connection &>(conn) = std::move(gco);
-		conn.is_selecting = FALSE;
 		if (HXio_fullwrite(conn.sockd, "OK\r\n", 4) < 0)
 			return 0;
 		cmd_parser_insert_conn(std::move(holder));
@@ -232,6 +231,7 @@ int main(int argc, char **argv)
 	
 	exmdb_rpc_alloc = cu_alloc_bytes;
 	exmdb_rpc_free = [](void *) {};
+	exmdb_rpc_zerocopy = true;
 	setvbuf(stdout, nullptr, _IOLBF, 0);
 	if (HX_getopt6(g_options_table, argc, argv, &argp,
 	    HXOPT_USAGEONERR | HXOPT_ITER_OPTS) != HXOPT_ERR_SUCCESS)
@@ -280,7 +280,7 @@ int main(int argc, char **argv)
 	mlog(LV_INFO, "system: exmdb proxy connection number is %d", proxy_num);
 	
 	unsigned int threads_num = pconfig->get_ll("midb_threads_num");
-	mlog(LV_INFO, "system: connection threads number is %d", threads_num);
+	mlog(LV_INFO, "system: command threads number is %d", threads_num);
 
 	size_t table_size = pconfig->get_ll("midb_table_size");
 	mlog(LV_INFO, "system: hash table size is %zu", table_size);
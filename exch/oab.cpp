@@ -9,16 +9,26 @@
 #	include "config.h"
 #endif
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <tinyxml2.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #ifdef HAVE_XXHASH
 	/* xxh3 must come first in 0.7.0, or everything breaks apart */
@@ -26,17 +36,22 @@
 #	include <xxhash.h>
 #endif
 #include <fmt/core.h>
+#include <libHX/endian.h>
+#include <libHX/io.h>
 #include <openssl/evp.h>
 #include <gromox/ab_tree.hpp>
 #include <gromox/clock.hpp>
 #include <gromox/config_file.hpp>
 #include <gromox/cryptoutil.hpp>
 #include <gromox/defs.h>
+#include <gromox/fileio.h>
 #include <gromox/hpm_common.h>
 #include <gromox/mapidefs.h>
 #include <gromox/mapitags.hpp>
 #include <gromox/mysql_adaptor.hpp>
+#include <gromox/paths.h>
 #include <gromox/plugin.hpp>
+#include <gromox/process.hpp>
 #include <gromox/svc_loader.hpp>
 #include <gromox/unordered_map_assist.hpp>
 #include <gromox/util.hpp>
@@ -48,6 +63,11 @@ using split_seq_t = std::pair<int32_t, uint32_t>;
 /* OAB v4 binary format constants */
 static constexpr uint32_t OAB_V4_VERSION = 0x20;
 static constexpr uint32_t OAB_TMPL_VERSION = 0x07;
+/*
+ * MS-OXOAB: PidTagOfflineAddressBookDistinguishedName is the DN of the
+ * address list, not the OAB object. For the GAL, Exchange uses "/" (the root).
+ */
+static constexpr char oab_gal_dn[] = "/";
 
 /* Header schema (4 properties) */
 static constexpr proptag_t hdr_props[] = {
@@ -70,15 +90,24 @@ static constexpr size_t OBJ_PROP_COUNT = std::size(obj_props);
 
 namespace {
 
+/* Differential patch file (MS-OXOAB v16 §2.12) from @seq-1 to @seq */
+struct oab_patch {
+	uint32_t seq = 0;
+	size_t uc_size = 0; /* size of the uncompressed target file */
+	std::string lzx_data, sha;
+};
+
 /* Cached OAB data for a single address book base */
 struct oab_cache_entry {
 	split_seq_t sequence;
-	std::string manifest_xml, lzx_data, tmpl_lzx_data;
-
-	/* transient state that is not part of the comparison: */
+	std::string manifest_xml, uc_data, lzx_data, tmpl_lzx_data;
+	/* Patches leading up to @sequence, oldest first */
+	std::vector<std::shared_ptr<const oab_patch>> patches;
 	gromox::time_point gen_time{};
-
-	bool operator==(const oab_cache_entry &o) const;
+	/* Offset of the first object record in uc_data */
+	size_t rec_off = 0;
+	/* Address book snapshot that the object records were made from */
+	std::weak_ptr<const ab_base> ab_src;
 };
 
 /* OAB binary writer helper */
@@ -161,12 +190,6 @@ static constexpr uint32_t lzx_position_base[LZX_NUM_POS_SLOTS] = {
 	16384,24576,32768,49152, 65536,98304,131072,196608,
 };
 
-bool oab_cache_entry::operator==(const oab_cache_entry &o) const
-{
-	return sequence == o.sequence && manifest_xml == o.manifest_xml &&
-	       lzx_data == o.lzx_data && tmpl_lzx_data == o.tmpl_lzx_data;
-}
-
 void oab_writer::put_u32le(uint32_t v)
 {
 	buf.push_back(v & 0xFF);
@@ -556,21 +579,31 @@ static unsigned int lzx_position_slot(uint32_t foff)
 }
 
 /**
- * Compute the number of main tree elements for a given uncompressed block
- * size. libmspack's OAB decompressor (oabd.c) creates a fresh LZX decoder per
- * block with window_bits derived from blk_dsize:
+ * libmspack's OAB decompressor (oabd.c) creates a fresh LZX decoder per block
+ * with window_bits derived from the block size (for patch blocks, the source
+ * size rounded up to 32 KB plus the target size):
  *
  *   window_bits = 17;
  *   while (window_bits < 25 && (1 << window_bits) < blk_dsize)
  *       window_bits++;
+ */
+static unsigned int lzx_window_bits_for(size_t blk_dsize)
+{
+	unsigned int wb = 17;
+	while (wb < 25 && (1u << wb) < blk_dsize)
+		++wb;
+	return wb;
+}
+
+/**
+ * Compute the number of main tree elements for a given window size:
+ *
  *   posn_slots = window_bits << 1;   (for window_bits <= 19)
  *   num_main_elements = 256 + posn_slots * 8;
  */
 static unsigned int lzx_main_elements_for(size_t blk_dsize)
 {
-	unsigned int wb = 17, posn_slots;
-	while (wb < 25 && (1u << wb) < blk_dsize)
-		++wb;
+	unsigned int wb = lzx_window_bits_for(blk_dsize), posn_slots;
 	if (wb == 20)
 		posn_slots = 42;
 	else if (wb == 21)
@@ -580,8 +613,12 @@ static unsigned int lzx_main_elements_for(size_t blk_dsize)
 	return 256 + posn_slots * 8;
 }
 
-static constexpr unsigned int LZX_HASH_BITS = 13;
+static constexpr unsigned int LZX_HASH_BITS = 15;
 static constexpr unsigned int LZX_HASH_SIZE = 1u << LZX_HASH_BITS;
+/* Number of chain links visited per position */
+static constexpr unsigned int LZX_MAX_CHAIN = 32;
+/* A match at least this long ends the search early */
+static constexpr unsigned int LZX_NICE_MATCH = 258;
 
 static inline uint32_t lzx_hash3(const uint8_t *p)
 {
@@ -590,20 +627,46 @@ static inline uint32_t lzx_hash3(const uint8_t *p)
 	return (v * 0x1E35A7BD) >> (32 - LZX_HASH_BITS);
 }
 
+namespace {
+
 /**
- * Greedy hash-based match finder with R0/R1/R2 repeated
+ * Hash chains over all positions of one block. chain[pos] links to the
+ * previous position with the same hash, so walking a chain visits
+ * candidates in order of increasing distance.
+ */
+struct lzx_hash_chain {
+	lzx_hash_chain(size_t len) : head(LZX_HASH_SIZE, UINT32_MAX), chain(len, UINT32_MAX) {}
+	void insert(const uint8_t *data, uint32_t pos)
+	{
+		auto h = lzx_hash3(data + pos);
+		chain[pos] = head[h];
+		head[h] = pos;
+	}
+
+	std::vector<uint32_t> head, chain;
+};
+
+}
+
+/**
+ * Greedy hash-chain match finder with R0/R1/R2 repeated
  * offset LRU. Produces an LZX token stream from raw data.
+ *
+ * The first @ref_len bytes of @data are reference data (LZX DELTA): they are
+ * only used as match sources, and tokens are produced for [ref_len, len).
  */
-static std::vector<lzx_token> lzx_find_matches(const uint8_t *data, size_t len,
+static std::vector<lzx_token> lzx_find_matches(const uint8_t *data,
+    size_t ref_len, size_t len, uint32_t max_dist,
     uint32_t &R0, uint32_t &R1, uint32_t &R2)
 {
 	std::vector<lzx_token> tokens;
-	tokens.reserve(len);
+	tokens.reserve(len - ref_len);
 
-	uint32_t htab[LZX_HASH_SIZE];
-	std::fill(std::begin(htab), std::end(htab), UINT32_MAX);
+	lzx_hash_chain hc(len);
+	for (size_t pos = 0; pos < ref_len && pos + 2 < len; ++pos)
+		hc.insert(data, pos);
 
-	for (size_t pos = 0; pos < len; ) {
+	for (size_t pos = ref_len; pos < len; ) {
 		size_t remain = len - pos;
 		uint32_t best_len = 0, best_offset = 0;
 		bool best_is_repeat = false;
@@ -630,25 +693,28 @@ static std::vector<lzx_token> lzx_find_matches(const uint8_t *data, size_t len,
 
 		/* Hash lookup needs 3 bytes */
 		if (remain >= 3) {
-			uint32_t h = lzx_hash3(data + pos);
-			uint32_t prev = htab[h];
-			if (prev != 0xFFFFFFFF && pos > prev) {
+			auto max_m = std::min(static_cast<size_t>(LZX_MAX_MATCH), remain);
+			auto prev = hc.head[lzx_hash3(data + pos)];
+			for (unsigned int depth = 0; prev != UINT32_MAX &&
+			     depth < LZX_MAX_CHAIN && best_len < max_m &&
+			     best_len < LZX_NICE_MATCH; prev = hc.chain[prev], ++depth) {
 				uint32_t dist = pos - prev;
-				/* max encodable distance for the 256 KB window */
-				if (dist <= 262141) {
-					auto mp = data + prev;
-					uint32_t mlen = 0;
-					auto max_m = std::min(static_cast<size_t>(LZX_MAX_MATCH), remain);
-					while (mlen < max_m && data[pos+mlen] == mp[mlen])
-						++mlen;
-					if (mlen >= LZX_MIN_MATCH && mlen > best_len) {
-						best_len = mlen;
-						best_offset = dist;
-						best_is_repeat = false;
-					}
+				if (dist > max_dist)
+					break;
+				auto mp = data + prev;
+				/* Cannot be longer than what we already have */
+				if (mp[best_len] != data[pos+best_len])
+					continue;
+				uint32_t mlen = 0;
+				while (mlen < max_m && data[pos+mlen] == mp[mlen])
+					++mlen;
+				if (mlen >= LZX_MIN_MATCH && mlen > best_len) {
+					best_len = mlen;
+					best_offset = dist;
+					best_is_repeat = false;
 				}
 			}
-			htab[h] = pos;
+			hc.insert(data, pos);
 		}
 
 		if (best_len < LZX_MIN_MATCH) {
@@ -698,7 +764,7 @@ static std::vector<lzx_token> lzx_find_matches(const uint8_t *data, size_t len,
 
 		/* Hash intermediate positions */
 		for (uint32_t j = 1; j < best_len && pos + j + 2 < len; ++j)
-			htab[lzx_hash3(data + pos + j)] = pos + j;
+			hc.insert(data, pos + j);
 
 		pos += best_len;
 	}
@@ -771,14 +837,19 @@ static void lzx_encode_tokens(lzx_bitstream &bs,
  * from zero.
  *
  * num_main is the number of main tree elements the decoder expects (derived
- * from the decoder's window size).
+ * from the decoder's window size). The decoder window is 2^window_bits bytes,
+ * and the largest encodable match distance is 3 less than that.
+ *
+ * For patch blocks, vdata starts with ref_len bytes of reference data that the
+ * decoder has preloaded into its window; only [ref_len, len) is encoded.
  */
-static std::string lzxd_encode_verbatim(const void *vdata, size_t len,
-    unsigned int num_main)
+static std::string lzxd_encode_verbatim(const void *vdata, size_t ref_len,
+    size_t len, unsigned int window_bits, unsigned int num_main)
 {
 	auto data = static_cast<const uint8_t *>(vdata);
 	uint32_t R0 = 1, R1 = 1, R2 = 1;
-	auto tokens = lzx_find_matches(data, len, R0, R1, R2);
+	auto tokens = lzx_find_matches(data, ref_len, len,
+	              (1U << window_bits) - 3, R0, R1, R2);
 
 	/* Collect symbol frequencies */
 	uint32_t main_freq[LZX_MAIN_SYMBOLS]{};
@@ -801,7 +872,7 @@ static std::string lzxd_encode_verbatim(const void *vdata, size_t len,
 	huff_make_codes(len_lengths, LZX_LEN_SYMBOLS, len_codes, 16);
 
 	lzx_bitstream bs;
-	bs.buf.reserve(len + 2);
+	bs.buf.reserve(len - ref_len + 2);
 
 	/*
 	 * MS-PATCH v12 §2.2.1: 16-bit LE chunk_size prefix.
@@ -815,7 +886,7 @@ static std::string lzxd_encode_verbatim(const void *vdata, size_t len,
 
 	/* Block type=1 (verbatim), block size (24 bits) */
 	bs.put_bits(3, 1);
-	bs.put_bits(24, len);
+	bs.put_bits(24, len - ref_len);
 
 	/*
 	 * Encode trees via pretree. Each block starts from zero previous
@@ -918,6 +989,125 @@ static std::string lzxd_encode_uncompressed(const void *vdata, size_t len)
 	return out;
 }
 
+namespace {
+
+/**
+ * Worker threads for LZX encoding and record serialisation. The pool is
+ * shared by all requests, so the number of threads stays at
+ * gx_concurrency() no matter how many domains are being generated at once.
+ */
+class oab_workers {
+	public:
+	~oab_workers() { stop(); }
+	bool submit(std::function<void()> &&);
+	void stop();
+
+	private:
+	void work();
+
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::deque<std::function<void()>> m_jobs;
+	std::vector<std::thread> m_threads;
+	bool m_stop = false;
+};
+
+}
+
+static oab_workers g_oab_workers;
+
+bool oab_workers::submit(std::function<void()> &&job) try
+{
+	std::unique_lock lock(m_lock);
+	if (m_stop)
+		return false;
+	if (m_threads.empty()) {
+		auto conc = std::max(gx_concurrency(), 2U) - 1;
+		for (unsigned int i = 0; i < conc; ++i)
+			m_threads.emplace_back(&oab_workers::work, this);
+	}
+	m_jobs.push_back(std::move(job));
+	lock.unlock();
+	m_cond.notify_one();
+	return true;
+} catch (const std::system_error &e) {
+	mlog(LV_WARN, "W-2467: oab: could not start worker: %s", e.what());
+	return !m_threads.empty();
+} catch (const std::bad_alloc &) {
+	return false;
+}
+
+void oab_workers::work()
+{
+	std::unique_lock lock(m_lock);
+	while (true) {
+		m_cond.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+		if (m_jobs.empty())
+			return;
+		auto job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+}
+
+void oab_workers::stop()
+{
+	std::unique_lock lock(m_lock);
+	m_stop = true;
+	lock.unlock();
+	m_cond.notify_all();
+	for (auto &t : m_threads)
+		t.join();
+	m_threads.clear();
+}
+
+/**
+ * Run @func(i) for all i in [0,n). The calling thread takes part; idle
+ * pool workers pick up the remaining indices. Helpers that only get to
+ * run after the caller has finished do not touch @func.
+ */
+template<typename F> static void oab_parallel_for(size_t n, F &&func)
+{
+	size_t helpers = std::min(static_cast<size_t>(gx_concurrency()), n);
+	if (helpers <= 1) {
+		for (size_t i = 0; i < n; ++i)
+			func(i);
+		return;
+	}
+	struct state {
+		std::mutex lock;
+		std::condition_variable cond;
+		std::atomic<size_t> next{0};
+		unsigned int running = 0;
+		bool done = false;
+	};
+	auto st = std::make_shared<state>();
+	auto loop = [st, n, &func]() {
+		for (size_t i; (i = st->next++) < n; )
+			func(i);
+	};
+	for (size_t h = 1; h < helpers; ++h)
+		if (!g_oab_workers.submit([st, loop]() {
+			{
+				std::lock_guard lk(st->lock);
+				if (st->done)
+					return;
+				++st->running;
+			}
+			loop();
+			std::lock_guard lk(st->lock);
+			if (--st->running == 0)
+				st->cond.notify_all();
+		}))
+			break;
+	loop();
+	std::unique_lock lk(st->lock);
+	st->done = true;
+	st->cond.wait(lk, [&]() { return st->running == 0; });
+}
+
 /**
  * Wrap uncompressed OAB binary data (MS-OXOAB v16 §2.11) in various ways.
  *
@@ -977,8 +1167,9 @@ static std::string oab_wrap_lzx(const std::string &raw, unsigned int mode)
 			 * LZX_BLK with LZXD payload (MS-OXOAB v16 §2.11.2).
 			 * LZXD frame with compressed payload.
 			 */
-			auto num_main = lzx_main_elements_for(chunk);
-			auto blk = lzxd_encode_verbatim(&raw[pos], chunk, num_main);
+			auto blk = lzxd_encode_verbatim(&raw[pos], 0, chunk,
+			           lzx_window_bits_for(chunk),
+			           lzx_main_elements_for(chunk));
 			put_u32(1); /* ulFlags: LZX compressed */
 			put_u32(blk.size()); /* ulCompSize */
 			put_u32(chunk); /* ulUncompSize */
@@ -1001,6 +1192,73 @@ static std::string oab_wrap_lzx(const std::string &raw, unsigned int mode)
 	return out;
 }
 
+/**
+ * Produce an OAB Version 4 Differential Patch File (MS-OXOAB v16 §2.12)
+ * which turns the uncompressed full details file @src into @tgt.
+ *
+ * Every PATCH_BLK is handled by a fresh LZXD decoder whose window has been
+ * preloaded with the next ulSourceSize bytes of the old file (libmspack
+ * oabd_decompress_incremental). Source chunks are assigned in proportion to
+ * the target position. Since the GAL is emitted in a stable order, records
+ * which did not change end up within reach of the match finder.
+ */
+static std::string oab_make_patch(const std::string &src, const std::string &tgt)
+{
+	static constexpr size_t BLOCK_MAX_HDR = 0x40000; /* ulBlockMax */
+	static constexpr size_t CHUNK_SIZE = 32768; /* one LZXD frame per block */
+	/* Keeps the decoder window at 256 KB, which our slot tables cover */
+	static constexpr size_t SRC_MAX = BLOCK_MAX_HDR - CHUNK_SIZE;
+	std::string out;
+
+	auto put_u32 = [&out](uint32_t v) {
+		out.push_back(v & 0xFF);
+		out.push_back((v >> 8) & 0xFF);
+		out.push_back((v >> 16) & 0xFF);
+		out.push_back((v >> 24) & 0xFF);
+	};
+
+	/* PATCH_HDR */
+	put_u32(3); /* ulVersionHi */
+	put_u32(2); /* ulVersionLo */
+	put_u32(BLOCK_MAX_HDR); /* ulBlockMax */
+	put_u32(src.size()); /* ulSourceSize */
+	put_u32(tgt.size()); /* ulTargetSize */
+	put_u32(crc32_oab(src.data(), src.size())); /* ulSourceCRC */
+	put_u32(crc32_oab(tgt.data(), tgt.size())); /* ulTargetCRC */
+
+	struct patch_blk {
+		size_t tpos, tlen, spos, slen;
+		std::string data;
+	};
+	std::vector<patch_blk> blocks;
+	for (size_t tpos = 0, spos = 0; tpos < tgt.size(); ) {
+		size_t tlen = std::min(tgt.size() - tpos, CHUNK_SIZE);
+		size_t send = tpos + tlen == tgt.size() ? src.size() :
+		              (tpos + tlen) * src.size() / tgt.size();
+		send = std::clamp(send, spos, std::min(src.size(), spos + SRC_MAX));
+		blocks.emplace_back(tpos, tlen, spos, send - spos);
+		tpos += tlen;
+		spos = send;
+	}
+	oab_parallel_for(blocks.size(), [&](size_t i) {
+		auto &b = blocks[i];
+		auto window = src.substr(b.spos, b.slen);
+		window.append(tgt, b.tpos, b.tlen);
+		auto wsize = ((b.slen + 32767) & ~static_cast<size_t>(32767)) + b.tlen;
+		b.data = lzxd_encode_verbatim(window.data(), b.slen, window.size(),
+		         lzx_window_bits_for(wsize), lzx_main_elements_for(wsize));
+	});
+	for (auto &b : blocks) {
+		/* PATCH_BLK */
+		put_u32(b.data.size()); /* ulPatchSize */
+		put_u32(b.tlen); /* ulTargetSize */
+		put_u32(b.slen); /* ulSourceSize */
+		put_u32(crc32_oab(&tgt[b.tpos], b.tlen)); /* ulCRC of target block */
+		out += std::move(b.data);
+	}
+	return out;
+}
+
 /**
  * Compute SHA-1 hex digest of data (MS-OXWOAB specifies SHA-1, 40 hex chars)
  */
@@ -1130,6 +1388,177 @@ static std::string generate_template_raw()
 	return w.data();
 }
 
+/**
+ * Procedure for MS-OXOAB v16 §2.9
+ * "Uncompressed OAB Version 4 Full Details File"
+ *
+ * @records is the output of generate_records.
+ */
+static std::string generate_uc(uint32_t sequence, const std::string &guid_str,
+    const std::string &oab_dn, size_t user_count, std::string_view records,
+    size_t &records_off)
+{
+	oab_writer w;
+
+	/* OAB_HDR (12 bytes, MS-OXOAB §2.9.1) */
+	w.put_u32le(OAB_V4_VERSION);
+	auto serial_off = w.size();
+	w.put_u32le(0); // placeholder for ulSerial (CRC32 of rest of file)
+	w.put_u32le(user_count);
+
+	/* OAB_META_DATA (MS-OXOAB §2.9.2): cbSize includes itself */
+	auto meta_off = w.begin_record();
+
+	/* rgHdrAtts: OAB_PROP_TABLE for header record */
+	w.put_u32le(HDR_PROP_COUNT);
+	for (size_t i = 0; i < HDR_PROP_COUNT; ++i) {
+		w.put_u32le(hdr_props[i]);
+		w.put_u32le(hdr_flags[i]);
+	}
+
+	/* rgOabAtts: OAB_PROP_TABLE for object records */
+	w.put_u32le(OBJ_PROP_COUNT);
+	for (size_t i = 0; i < OBJ_PROP_COUNT; ++i) {
+		w.put_u32le(obj_props[i]);
+		w.put_u32le(obj_flags[i]);
+	}
+
+	w.end_record(meta_off);
+
+	/* Header record (OAB_V4_REC, MS-OXOAB §2.9.4) */
+	{
+		auto rec_off = w.begin_record();
+		// Presence bit array: 4 props -> ceil(4/8)=1 byte
+		// MSB = prop 0; all 4 present -> 0xF0
+		w.put_u8(0xF0);
+
+		// Prop 0: PidTagOfflineAddressBookName (PT_UNICODE)
+		w.put_str("\\Global Address List");
+		// Prop 1: PidTagOfflineAddressBookDistinguishedName (PT_STRING8)
+		w.put_str(oab_dn);
+		// Prop 2: PidTagOfflineAddressBookSequence (PT_LONG)
+		w.put_varui(sequence);
+		// Prop 3: PidTagOfflineAddressBookContainerGuid (PT_STRING8)
+		w.put_str(guid_str);
+
+		w.end_record(rec_off);
+	}
+
+	records_off = w.size();
+	w.data().append(records);
+
+	/* Patch ulSerial: CRC32 of everything after the 12-byte OAB_HDR */
+	auto &raw   = w.data();
+	auto serial = crc32_oab(&raw[12], raw.size() - 12);
+	w.patch_u32le(serial_off, serial);
+	return std::move(w.data());
+}
+
+/**
+ * Append the OAB_V4_REC for GAL entry @mid to @w.
+ */
+static void generate_record(const ab_base &base, minid mid, oab_writer &w)
+{
+	auto rec_off = w.begin_record();
+
+	/* Collect property values */
+	std::string dn_val, smtp_val;
+
+	bool has_dn   = base.dn(mid, dn_val);
+	auto smtp_ptr = base.user_info(mid, userinfo::mail_address);
+	if (smtp_ptr != nullptr)
+		smtp_val = smtp_ptr;
+
+	auto display_val      = base.displayname(mid);
+	auto etyp_val         = base.etyp(mid);
+	uint32_t obj_type_val = etyp_to_objtype(etyp_val);
+	uint32_t dtyp_val     = base.dtyp(mid);
+	auto dtypx_opt        = base.dtypx(mid);
+	uint32_t dtypx_val    = dtypx_opt.value_or(0);
+	bool has_dtypx        = dtypx_opt.has_value();
+
+	std::string given_val, surname_val, title_val, dept_val;
+	std::string company_val, office_val, phone_val;
+
+	base.fetch_prop(mid, PR_GIVEN_NAME, given_val);
+	base.fetch_prop(mid, PR_SURNAME, surname_val);
+	base.fetch_prop(mid, PR_TITLE, title_val);
+	base.fetch_prop(mid, PR_DEPARTMENT_NAME, dept_val);
+	base.company_name(mid, company_val);
+	base.office_location(mid, office_val);
+	base.fetch_prop(mid, PR_BUSINESS_TELEPHONE_NUMBER, phone_val);
+
+	/*
+	 * Build presence bit array (14 props -> ceil(14/8) = 2 bytes)
+	 * MSB of first byte = prop 0, bit 6 = prop 1, ...
+	 * Per MS-OXOAB: empty strings MUST NOT be encoded;
+	 * mark absent in presence bits instead.
+	 */
+	uint8_t presence[2] = {0, 0};
+	if (has_dn && !dn_val.empty())      presence[0] |= 0x80; // prop 0
+	if (!smtp_val.empty())              presence[0] |= 0x40; // prop 1
+	if (!display_val.empty())           presence[0] |= 0x20; // prop 2
+	presence[0] |= 0x10; // prop 3: object type (always present)
+	presence[0] |= 0x08; // prop 4: display type (always present)
+	if (has_dtypx)                      presence[0] |= 0x04; // prop 5
+	if (!given_val.empty())             presence[0] |= 0x02; // prop 6
+	if (!surname_val.empty())           presence[0] |= 0x01; // prop 7
+	if (!title_val.empty())             presence[1] |= 0x80; // prop 8
+	if (!dept_val.empty())              presence[1] |= 0x40; // prop 9
+	if (!company_val.empty())           presence[1] |= 0x20; // prop 10
+	if (!office_val.empty())            presence[1] |= 0x10; // prop 11
+	if (!phone_val.empty())             presence[1] |= 0x08; // prop 12
+	// prop 13: PidTagOfflineAddressBookTruncatedProperties - always absent
+
+	w.put_u8(presence[0]);
+	w.put_u8(presence[1]);
+
+	/* Write present property values in schema order */
+	if (presence[0] & 0x80) w.put_str(dn_val);
+	if (presence[0] & 0x40) w.put_str(smtp_val);
+	if (presence[0] & 0x20) w.put_str(display_val);
+	w.put_varui(obj_type_val);  // always present
+	w.put_varui(dtyp_val);      // always present
+	if (presence[0] & 0x04) w.put_varui(dtypx_val);
+	if (presence[0] & 0x02) w.put_str(given_val);
+	if (presence[0] & 0x01) w.put_str(surname_val);
+	if (presence[1] & 0x80) w.put_str(title_val);
+	if (presence[1] & 0x40) w.put_str(dept_val);
+	if (presence[1] & 0x20) w.put_str(company_val);
+	if (presence[1] & 0x10) w.put_str(office_val);
+	if (presence[1] & 0x08) w.put_str(phone_val);
+
+	w.end_record(rec_off);
+}
+
+/**
+ * Object records (one OAB_V4_REC per GAL-visible entry) of an OABv4 Full
+ * Details File. They only depend on the address book snapshot, not on the
+ * sequence number. Slices of the GAL are serialised concurrently.
+ */
+static std::string generate_records(const ab_base &base)
+{
+	static constexpr size_t SLICE = 1024;
+	auto first = base.ufbegin();
+	size_t count = base.filtered_user_count();
+	std::vector<std::string> slices((count + SLICE - 1) / SLICE);
+	oab_parallel_for(slices.size(), [&](size_t i) {
+		oab_writer w;
+		auto end = std::min(count, (i + 1) * SLICE);
+		for (size_t k = i * SLICE; k < end; ++k)
+			generate_record(base, first[k], w);
+		slices[i] = std::move(w.data());
+	});
+	std::string out;
+	size_t total = 0;
+	for (const auto &sl : slices)
+		total += sl.size();
+	out.reserve(total);
+	for (const auto &sl : slices)
+		out += sl;
+	return out;
+}
+
 namespace {
 
 class OabPlugin {
@@ -1145,14 +1574,22 @@ class OabPlugin {
 	http_status serve_manifest(int ctx_id, int32_t base_id, const char *domain);
 	http_status serve_lzx(int ctx_id, int32_t base_id, const char *domain, uint32_t seq);
 	http_status serve_tmpl(int ctx_id, int32_t base_id, const char *domain, uint32_t seq);
+	http_status serve_patch(int ctx_id, int32_t base_id, const char *domain, uint32_t seq);
 	std::shared_ptr<const oab_cache_entry> get_or_generate(int32_t base_id, const char *domain, http_status &);
-	std::string generate_uc(int32_t base_id, uint32_t seq, const std::string &guid, const std::string &oab_dn);
-	http_status generate_oab(int32_t base_id, const char *domain, oab_cache_entry &entry);
+	void generate_oab(const char *domain, oab_cache_entry &entry, size_t user_count, std::string_view records);
+	void generate_manifest(const char *domain, oab_cache_entry &entry);
+	void add_patch(const oab_cache_entry &prev, oab_cache_entry &entry);
+	std::shared_ptr<oab_cache_entry> load_cache(const char *domain);
+	void save_cache(const char *domain, const oab_cache_entry &entry);
 
+	/* Protects m_cache, m_gen_lock and the gen_time/ab_src members */
 	std::mutex m_cache_lock;
 	std::unordered_map<std::string, std::shared_ptr<oab_cache_entry>, gromox::string_hash, std::equal_to<>> m_cache;
-	std::string m_org_name;
+	/* Serializes generation per domain */
+	std::unordered_map<std::string, std::shared_ptr<std::mutex>, gromox::string_hash, std::equal_to<>> m_gen_lock;
+	std::string m_org_name, m_cache_dir;
 	std::chrono::seconds m_cache_interval{300};
+	size_t m_diff_history = 16;
 };
 
 } /* anonymous namespace */
@@ -1161,6 +1598,8 @@ DECLARE_HPM_API(,);
 
 static constexpr cfg_directive oab_nsp_cfg_defaults[] = {
 	{"cache_interval", "5min", CFG_TIME, "1s", "1d"},
+	{"oab_cache_dir", PKGSTATEDIR "/oab"},
+	{"oab_diff_history", "16", CFG_SIZE, "0", "1000"},
 	{"x500_org_name", "Gromox default"},
 	CFG_TABLE_END,
 };
@@ -1176,6 +1615,8 @@ OabPlugin::OabPlugin()
 		auto ci = cfg->get_ll("cache_interval");
 		if (ci > 0)
 			m_cache_interval = std::chrono::seconds(ci);
+		m_cache_dir = znul(cfg->get_value("oab_cache_dir"));
+		m_diff_history = cfg->get_ll("oab_diff_history");
 	}
 	if (m_org_name.empty())
 		m_org_name = "Gromox default";
@@ -1199,6 +1640,16 @@ static unsigned int parse_seq_path(const char *s)
 	return seq;
 }
 
+/**
+ * Look for "binpatch-<seq>.lzx" and extract the sequence number.
+ */
+static unsigned int parse_patch_path(const char *s)
+{
+	if (strncmp(s, "binpatch-", 9) != 0)
+		return 0;
+	return parse_seq_path(s + 9);
+}
+
 /**
  * Look for "lng<lcid>-<seq>.lzx" and extract the parts.
  */
@@ -1241,6 +1692,7 @@ http_status OabPlugin::proc(int ctx_id, const void *content, uint64_t len) try
 	 * Parse URI: /OAB/oab.xml
 	 *            /OAB/<seq>.lzx
 	 *            /OAB/lng<lcid>-<seq>.lzx
+	 *            /OAB/binpatch-<seq>.lzx
 	 */
 	auto req = get_request(ctx_id);
 	const auto &uri = req->f_request_uri;
@@ -1253,6 +1705,9 @@ http_status OabPlugin::proc(int ctx_id, const void *content, uint64_t len) try
 	seq = parse_template_path(&uri[5]);
 	if (seq != 0)
 		return serve_tmpl(ctx_id, base_id, pdomain, seq);
+	seq = parse_patch_path(&uri[5]);
+	if (seq != 0)
+		return serve_patch(ctx_id, base_id, pdomain, seq);
 
 	return send_error(ctx_id, http_status::not_found);
 } catch (const std::bad_alloc &) {
@@ -1308,37 +1763,99 @@ OabPlugin::get_or_generate(int32_t base_id, const char *domain,
     http_status &h_status) try
 {
 	auto now_mono = tp_now();
-	auto now_wall = to_split_seq(time(nullptr));
-
-	std::lock_guard lock(m_cache_lock);
-	auto it = m_cache.find(domain);
-	if (it != m_cache.end() &&
-	    now_mono - it->second->gen_time < m_cache_interval)
-		return it->second;
+	std::shared_ptr<oab_cache_entry> prev;
+	std::shared_ptr<std::mutex> gen_lock;
+	{
+		std::lock_guard lock(m_cache_lock);
+		auto it = m_cache.find(domain);
+		if (it != m_cache.end()) {
+			if (now_mono - it->second->gen_time < m_cache_interval)
+				return it->second;
+			prev = it->second;
+		}
+		auto &gl = m_gen_lock[domain];
+		if (gl == nullptr)
+			gl = std::make_shared<std::mutex>();
+		gen_lock = gl;
+	}
 
-	auto entry = std::make_shared<oab_cache_entry>();
 	/*
-	 * Because the sequence number gets embedded in the OAB data, the "new"
-	 * OAB must be coded with the old seq number for
-	 * oab_cache_entry::operator== to yield the desired result.
+	 * Only one thread (re)generates a domain's OAB, and it does so
+	 * without holding m_cache_lock. Requests arriving in the meantime
+	 * are served the previous generation if there is one.
 	 */
-	if (it != m_cache.end()) {
-		entry->sequence = it->second->sequence;
-		h_status = generate_oab(base_id, domain, *entry);
-		if (h_status != http_status::ok)
-			return nullptr;
-		if (*it->second == *entry) {
-			it->second->gen_time = now_mono;
-			return it->second;
+	std::unique_lock gen_hold(*gen_lock, std::defer_lock);
+	if (!gen_hold.try_lock()) {
+		if (prev != nullptr)
+			return prev;
+		gen_hold.lock();
+	}
+	std::weak_ptr<const ab_base> prev_src;
+	{
+		std::lock_guard lock(m_cache_lock);
+		auto it = m_cache.find(domain);
+		prev = it != m_cache.end() ? it->second : nullptr;
+		if (prev != nullptr) {
+			if (now_mono - prev->gen_time < m_cache_interval)
+				return prev;
+			prev_src = prev->ab_src;
+		}
+	}
+	if (prev == nullptr) {
+		/* Continue with the generation a previous process left behind */
+		auto entry = load_cache(domain);
+		if (entry != nullptr) {
+			entry->gen_time = now_mono;
+			std::lock_guard lock(m_cache_lock);
+			m_cache[domain] = entry;
+			return entry;
 		}
 	}
 
-	/* Content changed or first generation — assign new sequence */
-	entry->sequence = now_wall;
-	h_status = generate_oab(base_id, domain, *entry);
-	if (h_status != http_status::ok)
+	auto pbase = ab_tree::AB.get(base_id);
+	if (pbase == nullptr) {
+		mlog(LV_WARN, "oab: ab_tree base_id %d not available", base_id);
+		h_status = http_status::server_error;
 		return nullptr;
+	}
+	/*
+	 * ab_base objects are immutable snapshots. If the previous generation
+	 * was made from this very snapshot, nothing can have changed.
+	 * Otherwise, the object records are compared; the sequence number
+	 * embedded in the header does not take part in that.
+	 */
+	if (prev != nullptr && !prev_src.owner_before(pbase) &&
+	    !pbase.owner_before(prev_src)) {
+		std::lock_guard lock(m_cache_lock);
+		prev->gen_time = now_mono;
+		return prev;
+	}
+	auto records = generate_records(*pbase);
+	if (prev != nullptr &&
+	    std::string_view(prev->uc_data).substr(prev->rec_off) == records) {
+		std::lock_guard lock(m_cache_lock);
+		prev->ab_src = pbase;
+		prev->gen_time = now_mono;
+		return prev;
+	}
+
+	/*
+	 * Content changed or first generation — assign new sequence. Outlook
+	 * only applies differential patches for consecutive sequence numbers.
+	 */
+	auto entry = std::make_shared<oab_cache_entry>();
+	if (prev != nullptr && prev->sequence.second < INT32_MAX)
+		entry->sequence = {prev->sequence.first, prev->sequence.second + 1};
+	else
+		entry->sequence = to_split_seq(time(nullptr));
+	generate_oab(domain, *entry, pbase->filtered_user_count(), records);
+	entry->ab_src = pbase;
+	if (prev != nullptr)
+		add_patch(*prev, *entry);
+	generate_manifest(domain, *entry);
 	entry->gen_time = now_mono;
+	save_cache(domain, *entry);
+	std::lock_guard lock(m_cache_lock);
 	m_cache[domain] = entry;
 	return entry;
 } catch (const std::bad_alloc &) {
@@ -1376,181 +1893,48 @@ http_status OabPlugin::serve_tmpl(int ctx_id, int32_t base_id,
 	return send_response(ctx_id, "application/octet-stream", entry->tmpl_lzx_data);
 }
 
-/**
- * Procedure for MS-OXOAB v16 §2.9
- * "Uncompressed OAB Version 4 Full Details File"
- */
-std::string OabPlugin::generate_uc(int32_t base_id, uint32_t sequence,
-    const std::string &guid_str, const std::string &oab_dn)
+http_status OabPlugin::serve_patch(int ctx_id, int32_t base_id,
+    const char *domain, uint32_t seq)
 {
-	auto pbase = ab_tree::AB.get(base_id);
-	if (pbase == nullptr) {
-		mlog(LV_WARN, "oab: ab_tree base_id %d not available", base_id);
-		return {};
-	}
-	const auto &base = *pbase;
-
-	/* Count GAL-visible users */
-	size_t user_count = base.filtered_user_count();
-
-	oab_writer w;
-
-	/* OAB_HDR (12 bytes, MS-OXOAB §2.9.1) */
-	w.put_u32le(OAB_V4_VERSION);
-	auto serial_off = w.size();
-	w.put_u32le(0); // placeholder for ulSerial (CRC32 of rest of file)
-	w.put_u32le(user_count);
-
-	/* OAB_META_DATA (MS-OXOAB §2.9.2): cbSize includes itself */
-	auto meta_off = w.begin_record();
-
-	/* rgHdrAtts: OAB_PROP_TABLE for header record */
-	w.put_u32le(HDR_PROP_COUNT);
-	for (size_t i = 0; i < HDR_PROP_COUNT; ++i) {
-		w.put_u32le(hdr_props[i]);
-		w.put_u32le(hdr_flags[i]);
-	}
-
-	/* rgOabAtts: OAB_PROP_TABLE for object records */
-	w.put_u32le(OBJ_PROP_COUNT);
-	for (size_t i = 0; i < OBJ_PROP_COUNT; ++i) {
-		w.put_u32le(obj_props[i]);
-		w.put_u32le(obj_flags[i]);
-	}
-
-	w.end_record(meta_off);
-
-	/* Header record (OAB_V4_REC, MS-OXOAB §2.9.4) */
-	{
-		auto rec_off = w.begin_record();
-		// Presence bit array: 4 props -> ceil(4/8)=1 byte
-		// MSB = prop 0; all 4 present -> 0xF0
-		w.put_u8(0xF0);
-
-		// Prop 0: PidTagOfflineAddressBookName (PT_UNICODE)
-		w.put_str("\\Global Address List");
-		// Prop 1: PidTagOfflineAddressBookDistinguishedName (PT_STRING8)
-		w.put_str(oab_dn);
-		// Prop 2: PidTagOfflineAddressBookSequence (PT_LONG)
-		w.put_varui(sequence);
-		// Prop 3: PidTagOfflineAddressBookContainerGuid (PT_STRING8)
-		w.put_str(guid_str);
-
-		w.end_record(rec_off);
-	}
-
-	/* Object records (one OAB_V4_REC per GAL-visible entry) */
-	for (auto it = base.ufbegin(); it != base.ufend(); ++it) {
-		auto mid = *it;
-		auto rec_off = w.begin_record();
-
-		/* Collect property values */
-		std::string dn_val, smtp_val;
-
-		bool has_dn   = base.dn(mid, dn_val);
-		auto smtp_ptr = base.user_info(mid, userinfo::mail_address);
-		if (smtp_ptr != nullptr)
-			smtp_val = smtp_ptr;
-
-		auto display_val      = base.displayname(mid);
-		auto etyp_val         = base.etyp(mid);
-		uint32_t obj_type_val = etyp_to_objtype(etyp_val);
-		uint32_t dtyp_val     = base.dtyp(mid);
-		auto dtypx_opt        = base.dtypx(mid);
-		uint32_t dtypx_val    = dtypx_opt.value_or(0);
-		bool has_dtypx        = dtypx_opt.has_value();
-
-		std::string given_val, surname_val, title_val, dept_val;
-		std::string company_val, office_val, phone_val;
-
-		base.fetch_prop(mid, PR_GIVEN_NAME, given_val);
-		base.fetch_prop(mid, PR_SURNAME, surname_val);
-		base.fetch_prop(mid, PR_TITLE, title_val);
-		base.fetch_prop(mid, PR_DEPARTMENT_NAME, dept_val);
-		base.company_name(mid, company_val);
-		base.office_location(mid, office_val);
-		base.fetch_prop(mid, PR_BUSINESS_TELEPHONE_NUMBER, phone_val);
-
-		/*
-		 * Build presence bit array (14 props -> ceil(14/8) = 2 bytes)
-		 * MSB of first byte = prop 0, bit 6 = prop 1, ...
-		 * Per MS-OXOAB: empty strings MUST NOT be encoded;
-		 * mark absent in presence bits instead.
-		 */
-		uint8_t presence[2] = {0, 0};
-		if (has_dn && !dn_val.empty())      presence[0] |= 0x80; // prop 0
-		if (!smtp_val.empty())              presence[0] |= 0x40; // prop 1
-		if (!display_val.empty())           presence[0] |= 0x20; // prop 2
-		presence[0] |= 0x10; // prop 3: object type (always present)
-		presence[0] |= 0x08; // prop 4: display type (always present)
-		if (has_dtypx)                      presence[0] |= 0x04; // prop 5
-		if (!given_val.empty())             presence[0] |= 0x02; // prop 6
-		if (!surname_val.empty())           presence[0] |= 0x01; // prop 7
-		if (!title_val.empty())             presence[1] |= 0x80; // prop 8
-		if (!dept_val.empty())              presence[1] |= 0x40; // prop 9
-		if (!company_val.empty())           presence[1] |= 0x20; // prop 10
-		if (!office_val.empty())            presence[1] |= 0x10; // prop 11
-		if (!phone_val.empty())             presence[1] |= 0x08; // prop 12
-		// prop 13: PidTagOfflineAddressBookTruncatedProperties - always absent
-
-		w.put_u8(presence[0]);
-		w.put_u8(presence[1]);
-
-		/* Write present property values in schema order */
-		if (presence[0] & 0x80) w.put_str(dn_val);
-		if (presence[0] & 0x40) w.put_str(smtp_val);
-		if (presence[0] & 0x20) w.put_str(display_val);
-		w.put_varui(obj_type_val);  // always present
-		w.put_varui(dtyp_val);      // always present
-		if (presence[0] & 0x04) w.put_varui(dtypx_val);
-		if (presence[0] & 0x02) w.put_str(given_val);
-		if (presence[0] & 0x01) w.put_str(surname_val);
-		if (presence[1] & 0x80) w.put_str(title_val);
-		if (presence[1] & 0x40) w.put_str(dept_val);
-		if (presence[1] & 0x20) w.put_str(company_val);
-		if (presence[1] & 0x10) w.put_str(office_val);
-		if (presence[1] & 0x08) w.put_str(phone_val);
-
-		w.end_record(rec_off);
-	}
-
-	/* Patch ulSerial: CRC32 of everything after the 12-byte OAB_HDR */
-	auto &raw   = w.data();
-	auto serial = crc32_oab(&raw[12], raw.size() - 12);
-	w.patch_u32le(serial_off, serial);
-	mlog(LV_INFO, "oab: generated OABv4 for base_id %d: %zu users, %zu bytes",
-		static_cast<int>(base_id), user_count, raw.size());
-	return std::move(w.data());
+	http_status status = http_status::server_error;
+	auto entry = get_or_generate(base_id, domain, status);
+	if (entry == nullptr)
+		return send_error(ctx_id, status);
+	for (const auto &p : entry->patches)
+		if (p->seq == seq)
+			return send_response(ctx_id, "application/octet-stream", p->lzx_data);
+	return send_error(ctx_id, http_status::not_found);
 }
 
 /**
  * Procedure for MS-OXOAB v16 §2.11 "Compressed OAB Version 4 Details File"
  */
-http_status OabPlugin::generate_oab(int32_t base_id, const char *domain,
-    oab_cache_entry &entry)
+void OabPlugin::generate_oab(const char *domain, oab_cache_entry &entry,
+    size_t user_count, std::string_view records)
 {
 	auto guid_str = domain_guid(domain, entry.sequence.first);
-	/*
-	 * MS-OXOAB: PidTagOfflineAddressBookDistinguishedName
-	 * is the DN of the address list, not the OAB object.
-	 * For the GAL, Exchange uses "/" (the root).
-	 */
-	std::string oab_dn = "/";
-	auto raw = generate_uc(base_id, entry.sequence.second, guid_str, oab_dn);
-	if (raw.empty())
-		return http_status::server_error;
-	entry.lzx_data = oab_wrap_lzx(raw, 3);
+	entry.uc_data = generate_uc(entry.sequence.second, guid_str, oab_gal_dn,
+	                user_count, records, entry.rec_off);
+	entry.lzx_data = oab_wrap_lzx(entry.uc_data, 3);
+	mlog(LV_INFO, "oab: generated OABv4 seq %u for %s: %zu users, %zu bytes",
+		entry.sequence.second, domain, user_count, entry.uc_data.size());
 
 	/* Generate and compress display template (MS-OXOAB 2.2) */
-	auto tmpl_raw = generate_template_raw();
-	entry.tmpl_lzx_data = oab_wrap_lzx(tmpl_raw, 3);
+	entry.tmpl_lzx_data = oab_wrap_lzx(generate_template_raw(), 3);
+}
 
+/**
+ * Generate the manifest XML (MS-OXWOAB) for an entry whose data parts are
+ * complete.
+ */
+void OabPlugin::generate_manifest(const char *domain, oab_cache_entry &entry)
+{
+	auto guid_str = domain_guid(domain, entry.sequence.first);
+	auto tmpl_size = generate_template_raw().size();
 	auto data_sha = sha1_hex(entry.lzx_data);
 	auto tmpl_sha = sha1_hex(entry.tmpl_lzx_data);
-	auto data_file = fmt::format("{}.lzx", entry.sequence.second);
 	auto tmpl_file = fmt::format("lng0409-{}.lzx", entry.sequence.second);
 
-	/* Generate manifest XML (MS-OXWOAB) */
 	tinyxml2::XMLDocument doc;
 	doc.InsertEndChild(doc.NewDeclaration());
 	auto root = doc.NewElement("OAB");
@@ -1558,7 +1942,7 @@ http_status OabPlugin::generate_oab(int32_t base_id, const char *domain,
 
 	auto oal = doc.NewElement("OAL");
 	oal->SetAttribute("id", guid_str.c_str());
-	oal->SetAttribute("dn", oab_dn.c_str());
+	oal->SetAttribute("dn", oab_gal_dn);
 	oal->SetAttribute("name", "\\Global Address List");
 	root->InsertEndChild(oal);
 
@@ -1567,16 +1951,27 @@ http_status OabPlugin::generate_oab(int32_t base_id, const char *domain,
 	full->SetAttribute("ver", OAB_V4_VERSION);
 	/* ambiguity warning in clang-19 warrants static_cast */
 	full->SetAttribute("size", static_cast<uint64_t>(entry.lzx_data.size()));
-	full->SetAttribute("uncompressedsize", static_cast<uint64_t>(raw.size()));
+	full->SetAttribute("uncompressedsize", static_cast<uint64_t>(entry.uc_data.size()));
 	full->SetAttribute("SHA", data_sha.c_str());
 	full->SetText((std::to_string(entry.sequence.second) + ".lzx").c_str());
 	oal->InsertEndChild(full);
 
+	for (const auto &p : entry.patches) {
+		auto diff = doc.NewElement("Diff");
+		diff->SetAttribute("seq", p->seq);
+		diff->SetAttribute("ver", OAB_V4_VERSION);
+		diff->SetAttribute("size", static_cast<uint64_t>(p->lzx_data.size()));
+		diff->SetAttribute("uncompressedsize", static_cast<uint64_t>(p->uc_size));
+		diff->SetAttribute("SHA", p->sha.c_str());
+		diff->SetText(fmt::format("binpatch-{}.lzx", p->seq).c_str());
+		oal->InsertEndChild(diff);
+	}
+
 	auto tmpl = doc.NewElement("Template");
 	tmpl->SetAttribute("seq", entry.sequence.second);
 	tmpl->SetAttribute("ver", OAB_TMPL_VERSION);
 	tmpl->SetAttribute("size", static_cast<uint64_t>(entry.tmpl_lzx_data.size()));
-	tmpl->SetAttribute("uncompressedsize", static_cast<uint64_t>(tmpl_raw.size()));
+	tmpl->SetAttribute("uncompressedsize", static_cast<uint64_t>(tmpl_size));
 	tmpl->SetAttribute("SHA", tmpl_sha.c_str());
 	tmpl->SetAttribute("langid", "0409");
 	tmpl->SetAttribute("type", "windows");
@@ -1587,7 +1982,245 @@ http_status OabPlugin::generate_oab(int32_t base_id, const char *domain,
 	doc.Print(&printer);
 	entry.manifest_xml.assign(printer.CStr(), printer.CStrSize() > 0 ?
 	                          printer.CStrSize() - 1 : 0);
-	return http_status::ok;
+}
+
+/**
+ * Compute the patch from @prev to @entry and carry over the older patches,
+ * as long as the chain of sequence numbers is unbroken.
+ */
+void OabPlugin::add_patch(const oab_cache_entry &prev, oab_cache_entry &entry)
+{
+	if (m_diff_history == 0 || prev.uc_data.empty() ||
+	    entry.sequence.first != prev.sequence.first ||
+	    entry.sequence.second != prev.sequence.second + 1)
+		return;
+	auto p = std::make_shared<oab_patch>();
+	p->seq = entry.sequence.second;
+	p->uc_size = entry.uc_data.size();
+	p->lzx_data = oab_make_patch(prev.uc_data, entry.uc_data);
+	/* Clients are better off downloading the full file */
+	if (p->lzx_data.size() >= entry.lzx_data.size())
+		return;
+	p->sha = sha1_hex(p->lzx_data);
+	entry.patches = prev.patches;
+	entry.patches.push_back(std::move(p));
+	if (entry.patches.size() > m_diff_history)
+		entry.patches.erase(entry.patches.begin(),
+			entry.patches.end() - m_diff_history);
+}
+
+static bool oab_cache_name_ok(const char *domain)
+{
+	return *domain != '\0' && *domain != '.' && strchr(domain, '/') == nullptr;
+}
+
+/**
+ * Locate the first object record in an uncompressed OABv4 Full Details File
+ * by skipping over OAB_HDR, OAB_META_DATA and the header record.
+ */
+static size_t oab_records_offset(std::string_view uc)
+{
+	size_t off = 12;
+	for (unsigned int i = 0; i < 2; ++i) {
+		if (off + 4 > uc.size())
+			return 0;
+		auto cb = le32p_to_cpu(&uc[off]);
+		if (cb < 4 || cb > uc.size() - off)
+			return 0;
+		off += cb;
+	}
+	return off;
+}
+
+/**
+ * Check that the header record of an uncompressed OABv4 Full Details File
+ * carries @seq and @guid, i.e. that it belongs to the generation which the
+ * sequence file names.
+ */
+static bool oab_uc_header_ok(std::string_view uc, uint32_t seq,
+    const std::string &guid)
+{
+	size_t off = 12;
+	if (off + 4 > uc.size())
+		return false;
+	off += le32p_to_cpu(&uc[off]); /* OAB_META_DATA */
+	if (off + 4 > uc.size())
+		return false;
+	auto cb = le32p_to_cpu(&uc[off]);
+	if (cb < 5 || cb > uc.size() - off)
+		return false;
+	auto rec = uc.substr(off + 4, cb - 4);
+	if (static_cast<uint8_t>(rec[0]) != 0xF0)
+		return false;
+	rec.remove_prefix(1);
+	for (unsigned int i = 0; i < 2; ++i) {
+		auto z = rec.find('\0');
+		if (z == rec.npos)
+			return false;
+		rec.remove_prefix(z + 1);
+	}
+	if (rec.empty())
+		return false;
+	uint32_t rseq = static_cast<uint8_t>(rec[0]);
+	rec.remove_prefix(1);
+	if (rseq > 0x80) {
+		auto n = rseq & 0x7F;
+		if (n > 4 || n > rec.size())
+			return false;
+		rseq = 0;
+		for (unsigned int i = 0; i < n; ++i)
+			rseq |= static_cast<uint32_t>(static_cast<uint8_t>(rec[i])) << (8 * i);
+		rec.remove_prefix(n);
+	}
+	auto z = rec.find('\0');
+	return rseq == seq && z != rec.npos && rec.substr(0, z) == guid;
+}
+
+static bool oab_read_file(const std::string &file, std::string &out)
+{
+	size_t size = 0;
+	std::unique_ptr<char[], stdlib_delete> data(HX_slurp_file(file.c_str(), &size));
+	if (data == nullptr)
+		return false;
+	out.assign(data.get(), size);
+	return true;
+}
+
+static errno_t oab_write_file(const std::string &dir, const std::string &file,
+    std::string_view data)
+{
+	gromox::tmpfile tf;
+	auto fd = tf.open_linkable(dir.c_str(), O_WRONLY, FMODE_PRIVATE);
+	if (fd < 0)
+		return -fd;
+	auto wrret = HXio_fullwrite(fd, data.data(), data.size());
+	if (wrret < 0 || static_cast<size_t>(wrret) != data.size())
+		return EIO;
+	return tf.link_to_overwrite((dir + "/" + file).c_str());
+}
+
+/**
+ * Reload the most recent generation (and the patches leading up to it) from
+ * the on-disk cache. Files that do not belong to the generation named by
+ * the sequence file (e.g. from an interrupted save) make the cache be
+ * ignored; patches are only kept as far as they chain up to it.
+ *
+ * Layout of <oab_cache_dir>/<domain>/:
+ *   sequence              "<generation> <seq>", written last
+ *   <seq>.uc              uncompressed full details file (source for diffs)
+ *   <seq>.lzx             compressed full details file
+ *   binpatch-<seq>.lzx    differential patch from seq-1 to seq
+ */
+std::shared_ptr<oab_cache_entry> OabPlugin::load_cache(const char *domain)
+{
+	if (m_cache_dir.empty() || !oab_cache_name_ok(domain))
+		return nullptr;
+	auto dir = m_cache_dir + "/" + domain;
+	std::string seqstr;
+	if (!oab_read_file(dir + "/sequence", seqstr))
+		return nullptr;
+	char *end = nullptr;
+	auto gen = strtol(seqstr.c_str(), &end, 10);
+	auto seq = strtoul(end, &end, 10);
+	if (seq == 0 || seq > INT32_MAX)
+		return nullptr;
+
+	auto entry = std::make_shared<oab_cache_entry>();
+	entry->sequence = {gen, seq};
+	if (!oab_read_file(fmt::format("{}/{}.uc", dir, seq), entry->uc_data) ||
+	    !oab_read_file(fmt::format("{}/{}.lzx", dir, seq), entry->lzx_data) ||
+	    entry->uc_data.size() < 12 || entry->lzx_data.empty())
+		return nullptr;
+	auto &uc = entry->uc_data;
+	entry->rec_off = oab_records_offset(uc);
+	if (entry->rec_off == 0 ||
+	    le32p_to_cpu(&uc[4]) != crc32_oab(&uc[12], uc.size() - 12)) {
+		mlog(LV_WARN, "W-2426: oab: %s/%lu.uc is corrupt, ignoring cache",
+			dir.c_str(), seq);
+		return nullptr;
+	}
+	if (!oab_uc_header_ok(uc, seq, domain_guid(domain, gen)) ||
+	    entry->lzx_data.size() < 16 ||
+	    le32p_to_cpu(&entry->lzx_data[12]) != uc.size()) { /* ulTargetSize */
+		mlog(LV_WARN, "W-2475: oab: %s does not hold generation %ld/%lu "
+			"throughout, ignoring cache", dir.c_str(), gen, seq);
+		return nullptr;
+	}
+	entry->tmpl_lzx_data = oab_wrap_lzx(generate_template_raw(), 3);
+
+	/* Each patch must lead to the source of its successor */
+	size_t want_size = uc.size();
+	auto want_crc = crc32_oab(uc.data(), uc.size());
+	for (auto pseq = seq; pseq > 0 && entry->patches.size() < m_diff_history; --pseq) {
+		auto p = std::make_shared<oab_patch>();
+		p->seq = pseq;
+		if (!oab_read_file(fmt::format("{}/binpatch-{}.lzx", dir, pseq), p->lzx_data) ||
+		    p->lzx_data.size() < 28)
+			break;
+		p->uc_size = le32p_to_cpu(&p->lzx_data[16]); /* ulTargetSize */
+		if (p->uc_size != want_size ||
+		    le32p_to_cpu(&p->lzx_data[24]) != want_crc) /* ulTargetCRC */
+			break;
+		want_size = le32p_to_cpu(&p->lzx_data[12]); /* ulSourceSize */
+		want_crc  = le32p_to_cpu(&p->lzx_data[20]); /* ulSourceCRC */
+		p->sha = sha1_hex(p->lzx_data);
+		entry->patches.push_back(std::move(p));
+	}
+	std::reverse(entry->patches.begin(), entry->patches.end());
+	generate_manifest(domain, *entry);
+	mlog(LV_INFO, "oab: loaded cached OAB for %s: seq %lu, %zu patches",
+		domain, seq, entry->patches.size());
+	return entry;
+}
+
+void OabPlugin::save_cache(const char *domain, const oab_cache_entry &entry) try
+{
+	if (m_cache_dir.empty() || !oab_cache_name_ok(domain))
+		return;
+	auto dir = m_cache_dir + "/" + domain;
+	auto seq = entry.sequence.second;
+	auto ret = gx_mkbasedir((dir + "/sequence").c_str(), FMODE_PRIVATE);
+	if (ret < 0) {
+		mlog(LV_ERR, "E-2427: mkbasedir %s: %s", dir.c_str(), strerror(-ret));
+		return;
+	}
+	std::unordered_set<std::string> keep;
+	keep.emplace(fmt::format("{}.uc", seq));
+	keep.emplace(fmt::format("{}.lzx", seq));
+	for (const auto &p : entry.patches)
+		keep.emplace(fmt::format("binpatch-{}.lzx", p->seq));
+
+	auto err = oab_write_file(dir, fmt::format("{}.uc", seq), entry.uc_data);
+	if (err == 0)
+		err = oab_write_file(dir, fmt::format("{}.lzx", seq), entry.lzx_data);
+	if (err == 0 && !entry.patches.empty() && entry.patches.back()->seq == seq)
+		err = oab_write_file(dir, fmt::format("binpatch-{}.lzx", seq),
+		      entry.patches.back()->lzx_data);
+	if (err == 0)
+		err = oab_write_file(dir, "sequence",
+		      fmt::format("{} {}\n", entry.sequence.first, seq));
+	if (err != 0) {
+		mlog(LV_ERR, "E-2428: oab: could not write cache in %s: %s",
+			dir.c_str(), strerror(err));
+		return;
+	}
+
+	/* Remove files of generations that are no longer served */
+	std::unique_ptr<DIR, file_deleter> dh(opendir(dir.c_str()));
+	if (dh == nullptr)
+		return;
+	const struct dirent *de;
+	while ((de = readdir(dh.get())) != nullptr) {
+		std::string_view name = de->d_name;
+		if ((!name.ends_with(".uc") && !name.ends_with(".lzx")) ||
+		    keep.contains(de->d_name))
+			continue;
+		auto file = dir + "/" + de->d_name;
+		if (remove(file.c_str()) < 0 && errno != ENOENT)
+			mlog(LV_WARN, "W-2429: remove %s: %s", file.c_str(), strerror(errno));
+	}
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2430: ENOMEM");
 }
 
 void OabPlugin::clear_cache()
@@ -1648,6 +2281,7 @@ bool HPM_oab(enum plugin_op reason, const struct dlfuncs &data)
 		return oab_init(data);
 	} else if (reason == PLUGIN_FREE) {
 		g_oab_plugin.reset();
+		g_oab_workers.stop();
 		ab_tree::AB.stop();
 		return TRUE;
 	} else if (reason == PLUGIN_RELOAD) {
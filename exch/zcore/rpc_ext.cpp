@@ -1607,7 +1607,9 @@ pack_result rpc_ext_pull_request(std::string_view pbin_in,
 	uint8_t call_id;
 	auto b_ret = pack_result::failure;
 	
-	ext_pull.init(pbin_in.data(), pbin_in.size(), common_util_alloc, EXT_FLAG_WCOUNT | EXT_FLAG_ZCORE);
+	/* Strings and binaries stay in @pbin_in, cf. zcrp_thrwork */
+	ext_pull.init(pbin_in.data(), pbin_in.size(), common_util_alloc,
+		EXT_FLAG_WCOUNT | EXT_FLAG_ZCORE | EXT_FLAG_ZEROCOPY);
 	QRF(ext_pull.g_uint8(&call_id));
 
 #define EDEF(t, id) case zcore_callid::t: { \
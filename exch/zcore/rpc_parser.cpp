@@ -178,7 +178,11 @@ static void *zcrp_thrwork(void *param)
 				/* ignore */;
 		continue;
 	}
-	pbuff = {};
+	/*
+	 * The request was parsed in place (EXT_FLAG_ZEROCOPY), so pbuff
+	 * stays around until the end of this iteration, i.e. beyond
+	 * common_util_free_environment.
+	 */
 
 	/*
 	 * Transfer ownership of the fd to rpc_parser. Afterwards, we try
@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 #include <gromox/common_types.hpp>
 #include <gromox/mapi_types.hpp>
@@ -91,6 +92,21 @@ struct GX_EXPORT folder_changes {
 };
 using FOLDER_CHANGES = folder_changes;
 
+/**
+ * One message of a write_messages batch. @digest has the same meaning as the
+ * digest argument of write_message (may be empty).
+ */
+struct GX_EXPORT message_write_item {
+	uint64_t folder_id = 0;
+	MESSAGE_CONTENT *pmsgctnt = nullptr;
+	std::string digest;
+};
+
+struct GX_EXPORT message_write_result {
+	uint64_t outmid = 0, outcn = 0;
+	ec_error_t e_result{};
+};
+
 extern GX_EXPORT attachment_content *attachment_content_init();
 extern GX_EXPORT void attachment_content_free(attachment_content *);
 extern GX_EXPORT attachment_list *attachment_list_init();
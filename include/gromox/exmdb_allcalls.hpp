@@ -159,3 +159,7 @@ EDEF(autoreply_setprop, 0x95)
 EDEF(read_delegates, 0x96)
 EDEF(write_delegates, 0x97)
 EDEF(link_messages, 0x98)
+EDEF(write_messages, 0x99)
+EDEF(prewarm_store, 0x9a)
+EDEF(freebusy_query, 0x9b)
+EDEF(imapfile_read_range, 0x9c)
@@ -77,6 +77,7 @@ BOOL common_util_allocate_eid(sqlite3 *psqlite, uint64_t *peid);
 BOOL common_util_allocate_eid_from_folder(sqlite3 *psqlite,
 	uint64_t folder_id, uint64_t *peid);
 extern ec_error_t cu_allocate_cn(sqlite3 *, uint64_t *new_cn);
+extern bool cu_touch_rule_table(sqlite3 *, uint64_t folder_id);
 BOOL common_util_allocate_folder_art(sqlite3 *psqlite, uint32_t *part);
 extern bool cu_eid_is_allocated(sqlite3 *, uint64_t eid_val, BOOL *result);
 extern bool cu_get_proptags(mapi_object_type, uint64_t id, sqlite3 *, std::vector<gromox::proptag_t> &);
@@ -84,6 +85,7 @@ BOOL common_util_get_mapping_guid(sqlite3 *psqlite,
 	uint16_t replid, BOOL *pb_found, GUID *pguid);
 extern bool cu_get_property(mapi_object_type, uint64_t id, cpid_t, const db_conn &, gromox::proptag_t, void **out);
 extern bool cu_get_properties(mapi_object_type, uint64_t id, cpid_t, const db_conn &, proptag_cspan, TPROPVAL_ARRAY *);
+extern bool cu_msgprop_computed(gromox::proptag_t);
 extern BOOL cu_set_property(mapi_object_type, uint64_t id, cpid_t, sqlite3 *, gromox::proptag_t, const void *data, BOOL *result);
 extern BOOL cu_set_properties(mapi_object_type, uint64_t id, cpid_t, sqlite3 *, const TPROPVAL_ARRAY *, PROBLEM_ARRAY *);
 extern bool cu_remove_properties(mapi_object_type, uint64_t id, sqlite3 *, proptag_cspan);
@@ -111,13 +113,15 @@ BINARY* common_util_to_private_folder_entryid(
 BINARY* common_util_to_private_message_entryid(
 	sqlite3 *psqlite, const char *username,
 	uint64_t folder_id, uint64_t message_id);
-extern BOOL cu_get_folder_permission(sqlite3 *, uint64_t folder_id, const char *username, uint32_t *perms);
+extern BOOL cu_get_folder_permission(const db_conn &, uint64_t folder_id, const char *username, uint32_t *perms);
 extern BOOL cu_is_descendant_folder(sqlite3 *, uint64_t inner_fid, uint64_t outer_fid, BOOL *pb_included);
 BOOL common_util_get_message_parent_folder(sqlite3 *psqlite,
 	uint64_t message_id, uint64_t *pfolder_id);
 extern bool cu_load_search_scopes(sqlite3 *, uint64_t folder_id, std::vector<uint64_t> &src_fo);
 extern bool cu_eval_folder_restriction(const db_conn &, uint64_t folder_id, const RESTRICTION *);
 extern bool cu_eval_msg_restriction(const db_conn &, cpid_t, uint64_t msgid, const RESTRICTION *);
+extern bool cu_msg_restriction_sql(const RESTRICTION *, std::string &sql, std::vector<const RESTRICTION *> &residual);
+extern bool cu_restriction_propids(const RESTRICTION *, std::vector<uint16_t> &);
 extern bool cu_srchfld_has_msgresult(sqlite3 *, uint64_t folder_id, uint64_t message_id, bool *exist);
 BOOL common_util_get_mid_string(sqlite3 *psqlite,
 	uint64_t message_id, char **ppmid_string);
@@ -145,7 +149,7 @@ BOOL common_util_indexing_sub_contents(
 extern uint32_t common_util_calculate_message_size(const message_content *);
 extern uint32_t common_util_calculate_attachment_size(const attachment_content *);
 extern const char *exmdb_rpc_idtoname(exmdb_callid);
-extern int need_msg_perm_check(sqlite3 *, const char *user, uint64_t fid);
+extern int need_msg_perm_check(const db_conn &, const char *user, uint64_t fid);
 extern int have_delete_perm(const db_conn &, const char *user, uint64_t fid, uint64_t mid = 0);
 extern bool timeindex_delete(sqlite3 *db, uint64_t fid, uint64_t mid);
 extern bool timeindex_insert(sqlite3 *db, uint64_t fid, uint64_t mid);
@@ -141,3 +141,7 @@ EXMIDL(autoreply_getprop, (const char *dir, cpid_t cpid, proptag_cspan pproptags
 EXMIDL(autoreply_setprop, (const char *dir, cpid_t cpid, const TPROPVAL_ARRAY *ppropvals, IDLOUT PROBLEM_ARRAY *problems))
 EXMIDL(read_delegates, (const char *dir, uint32_t mode, IDLOUT std::vector<std::string> *userlist))
 EXMIDL(write_delegates, (const char *dir, uint32_t mode, const std::vector<std::string> &userlist))
+EXMIDL(write_messages, (const char *dir, cpid_t cpid, const std::vector<message_write_item> &items, IDLOUT std::vector<message_write_result> *results))
+EXMIDL(prewarm_store, (const char *dir))
+EXMIDL(freebusy_query, (const char *dir, int64_t start_time, int64_t end_time, IDLOUT std::vector<freebusy_event> *fb_events, std::vector<uint64_t> *message_ids))
+EXMIDL(imapfile_read_range, (const char *dir, const std::string &type, const std::string &mid, uint64_t offset, uint32_t length, IDLOUT std::string *data))
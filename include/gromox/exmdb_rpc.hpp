@@ -943,6 +943,13 @@ struct exreq_imapfile_read final : public exreq {
 	std::string type, mid;
 };
 
+struct exreq_imapfile_read_range final : public exreq {
+	using view_t = exreq_imapfile_read_range;
+	std::string type, mid;
+	uint64_t offset = 0;
+	uint32_t length = 0;
+};
+
 struct exreq_imapfile_write final : public exreq {
 	using view_t = exreq_imapfile_write;
 	std::string type, mid, data;
@@ -963,6 +970,17 @@ struct exreq_write_delegates final : public exreq {
 	std::vector<std::string> userlist;
 };
 
+struct exreq_freebusy_query final : public exreq {
+	using view_t = exreq_freebusy_query;
+	int64_t start_time = 0, end_time = 0;
+};
+
+struct exreq_write_messages final : public exreq {
+	using view_t = exreq_write_messages;
+	cpid_t cpid{};
+	std::vector<message_write_item> items;
+};
+
 /**
  * FOLDERS:     process folders
  * MESSAGES:    process messages
@@ -1515,6 +1533,17 @@ struct exresp_read_delegates final : public exresp {
 	std::vector<std::string> userlist;
 };
 
+struct exresp_freebusy_query final : public exresp {
+	using view_t = exresp_freebusy_query;
+	std::vector<freebusy_event> fb_events;
+	std::vector<uint64_t> message_ids;
+};
+
+struct exresp_write_messages final : public exresp {
+	using view_t = exresp_write_messages;
+	std::vector<message_write_result> results;
+};
+
 using exreq_ping_store = exreq;
 using exreq_get_all_named_propids = exreq;
 using exreq_get_store_all_proptags = exreq;
@@ -1522,6 +1551,7 @@ using exreq_get_folder_class_table = exreq;
 using exreq_allocate_cn = exreq;
 using exreq_vacuum = exreq;
 using exreq_unload_store = exreq;
+using exreq_prewarm_store = exreq;
 using exreq_purge_datafiles = exreq;
 using exreq_create_folder_v1 = exreq_create_folder;
 using exreq_read_delegates = exreq_set_maintenance;
@@ -1552,12 +1582,14 @@ using exresp_transport_new_mail = exresp;
 using exresp_vacuum = exresp;
 using exresp_unload_store = exresp;
 using exresp_ping_store = exresp;
+using exresp_prewarm_store = exresp;
 
 using exresp_purge_datafiles = exresp;
 using exresp_autoreply_tsupdate = exresp;
 using exresp_recalc_store_size = exresp;
 using exresp_flush_instance = exresp_error;
 using exresp_movecopy_folder = exresp_error;
+using exresp_imapfile_read_range = exresp_imapfile_read;
 using exresp_imapfile_write = exresp;
 using exresp_imapfile_delete = exresp;
 using exresp_cgkreset = exresp;
@@ -1573,13 +1605,15 @@ struct DB_NOTIFY_DATAGRAM {
 
 extern GX_EXPORT pack_result exmdb_ext_pull_request(std::string_view, std::unique_ptr<exreq> &alloc_by_callee);
 extern GX_EXPORT pack_result exmdb_ext_push_request(const exreq *, BINARY *);
-extern GX_EXPORT pack_result exmdb_ext_pull_response(std::string_view, exresp *partial_fill_by_caller);
+extern GX_EXPORT pack_result exmdb_ext_pull_response(std::string_view, exresp *partial_fill_by_caller, unsigned int ext_flags = 0);
 extern GX_EXPORT pack_result exmdb_ext_push_response(const exresp *presponse, BINARY *);
 extern GX_EXPORT pack_result exmdb_ext_pull_db_notify(std::string_view, DB_NOTIFY_DATAGRAM *);
 extern GX_EXPORT pack_result exmdb_ext_push_db_notify(const DB_NOTIFY_DATAGRAM *, BINARY *);
 extern GX_EXPORT const char *exmdb_rpc_strerror(exmdb_response);
 extern GX_EXPORT bool exmdb_client_read_socket(int, std::string &, long timeout = -1);
+extern GX_EXPORT bool exmdb_client_read_socket(int, BINARY &, void *(*alloc)(size_t), std::string &spill, long timeout = -1);
 extern GX_EXPORT BOOL exmdb_client_write_socket(int, std::string_view, long timeout = -1);
 
 extern GX_EXPORT void *(*exmdb_rpc_alloc)(size_t);
 extern GX_EXPORT void (*exmdb_rpc_free)(void *);
+extern GX_EXPORT bool exmdb_rpc_zerocopy;
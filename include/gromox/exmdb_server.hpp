@@ -8,9 +8,12 @@
 enum { /* exmdb_server_build_env flags */
 	EM_LOCAL = 0x1,
 	EM_PRIVATE = 0x2,
+	EM_BACKGROUND = 0x4, /* exmdb-internal work; no group commit wait */
 };
 
 struct message_content;
+struct message_write_item;
+struct message_write_result;
 
 namespace exmdb_server {
 
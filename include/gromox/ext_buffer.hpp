@@ -25,6 +25,10 @@ enum class pack_result {
  * %EXT_FLAG_ABK:	MH-NSP serialization mode
  * %EXT_FLAG_ZCORE:	unpacked rep uses zcore types for rule element pointers
  * %EXT_FLAG_DYNAMIC:   buffer is managed by EXT_PUSH [private flag]
+ * %EXT_FLAG_ZEROCOPY:	(EXT_PULL) unpacked 8-bit strings and binaries point
+ * 			into the packed buffer rather than being copied; the
+ * 			caller must keep that buffer alive and writable for as
+ * 			long as the unpacked data is in use
  *
  * The Exchange protocols use UTF-16, but the Gromox exmdb and zcore RPC
  * protocols use UTF-8. This may require using more than one context to process
@@ -40,6 +44,7 @@ enum {
 	EXT_FLAG_ABK = 1U << 3,
 	EXT_FLAG_ZCORE = 1U << 4,
 	EXT_FLAG_DYNAMIC = 1U << 5,
+	EXT_FLAG_ZEROCOPY = 1U << 6,
 };
 
 using EXT_BUFFER_ALLOC = void *(*)(size_t);
@@ -126,6 +131,7 @@ struct GX_EXPORT EXT_PULL {
 	pack_result g_bin(std::string *);
 	pack_result g_sbin(BINARY *);
 	pack_result g_bin_ex(BINARY *);
+	pack_result g_bin_body(BINARY *);
 	pack_result g_uint16_an(SHORT_ARRAY *, uint32_t count);
 	pack_result g_uint16_an(std::vector<uint16_t> *, size_t count);
 	pack_result g_uint16_a(SHORT_ARRAY *);
@@ -8,5 +8,26 @@
 
 using namespace gromox;
 
+/**
+ * Property tags of the named properties which free/busy evaluation needs,
+ * resolved for one store.
+ */
+struct GX_EXPORT freebusy_tags {
+	freebusy_tags(const char *dir);
+	freebusy_tags(const PROPID_ARRAY &);
+	std::vector<proptag_t> proptags() const;
+
+	static const PROPNAME_ARRAY propnames;
+	uint32_t apptstartwhole = 0, apptendwhole = 0, busystatus = 0, recurring = 0,
+		apptrecur = 0, apptsubtype = 0, private_flag = 0, apptstateflags = 0,
+		clipend = 0, location = 0, reminderset = 0, globalobjectid = 0,
+		timezonestruct = 0;
+	bool init_ok = false;
+
+	private:
+	void resolve(const PROPID_ARRAY &);
+};
+
 extern GX_EXPORT unsigned int freebusy_perms(const char *actor, const char *target);
 extern GX_EXPORT ec_error_t get_freebusy(const char *, const char *, time_t, time_t, std::vector<freebusy_event> &);
+extern GX_EXPORT bool freebusy_expand(const freebusy_tags &, const TPROPVAL_ARRAY &, time_t start, time_t end, bool detailed, std::vector<freebusy_event> &);
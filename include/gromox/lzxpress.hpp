@@ -1,5 +1,19 @@
 #pragma once
 #include <cstdint>
 #include <gromox/defs.h>
-extern GX_EXPORT ssize_t lzxpress_compress(const void *, uint32_t, void *, uint32_t);
+
+enum {
+	/* Compression levels (effort of the match finder) */
+	LZX_FAST = 1,
+	LZX_DEFAULT = 2,
+	LZX_BEST = 3,
+	LZX_LEVEL_MASK = 0xffU,
+	/*
+	 * Give up (return -1) early on larger inputs whose first few KB
+	 * do not compress.
+	 */
+	LZX_SKIP_INCOMPRESSIBLE = 0x100U,
+};
+
+extern GX_EXPORT ssize_t lzxpress_compress(const void *, uint32_t, void *, uint32_t, unsigned int flags = LZX_DEFAULT);
 extern GX_EXPORT ssize_t lzxpress_decompress(const void *, uint32_t, void *, uint32_t);
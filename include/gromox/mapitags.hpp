@@ -867,6 +867,7 @@ enum {
 	PidTagSentMailSvrEID = PROP_TAG(PT_SVREID, 0x6740),
 	PR_DAM_ORIG_MSG_SVREID = PROP_TAG(PT_BINARY, 0x6741), /* PidTagDeferredActionMessageOriginalEntryId */
 	PR_RULE_FOLDER_FID = PROP_TAG(PT_I8, 0x6742), /* Gromox-specific */
+	PR_RULE_TABLE_CN = PROP_TAG(PT_I8, 0x6743), /* Gromox-specific */
 	PidTagFolderId = PROP_TAG(PT_I8, 0x6748),
 	PidTagParentFolderId = PROP_TAG(PT_I8, 0x6749),
 	PidTagMid = PROP_TAG(PT_I8, 0x674A),
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 enum {
 	MIDB_E_UNKNOWN_COMMAND = 0,
 	MIDB_E_PARAMETER_ERROR = 1,
@@ -53,3 +54,35 @@ enum midb_flag : char {
 	unsent = 'U',
 	forwarded = 'W',
 };
+
+/*
+ * P-DTLB: items to pre-render (request), passed as a number.
+ * The digest is always included for messages with message/rfc822
+ * parts when BODY or BODYSTRUCTURE is asked for.
+ */
+enum {
+	DTLB_ENVELOPE = 0x1U,
+	DTLB_BODY = 0x2U,
+	DTLB_BODYSTRUCTURE = 0x4U,
+	DTLB_DIGEST = 0x8U,
+};
+
+/* P-DTLB: message flags of a record */
+enum {
+	DTLB_FL_RECENT = 0x1U,
+	DTLB_FL_ANSWERED = 0x2U,
+	DTLB_FL_FLAGGED = 0x4U,
+	DTLB_FL_DELETED = 0x8U,
+	DTLB_FL_SEEN = 0x10U,
+	DTLB_FL_DRAFT = 0x20U,
+	DTLB_FL_FORWARDED = 0x40U,
+};
+
+/*
+ * Multiplexed mode. A client that sends "MUX" (and gets "TRUE") thereafter
+ * prefixes every command line with a request ID ("<id> <command>"). Commands
+ * run concurrently. Their responses, unchanged in content, come back as
+ * frames of le32 request ID, le32 length and that many bytes; a frame of
+ * length zero ends the response to that ID.
+ */
+static constexpr size_t MIDB_MUX_HDR = 8;
@@ -1,6 +1,10 @@
 #pragma once
+#include <cstdint>
+#include <ctime>
+#include <functional>
 #include <span>
 #include <string>
+#include <string_view>
 #include <gromox/range_set.hpp>
 #include <gromox/xarray2.hpp>
 
@@ -45,6 +49,18 @@ using enum_folder_t = std::pair<uint64_t, std::string>;
 
 namespace midb_agent {
 
+/**
+ * One message of fetch_detail_stream(). The views are only valid during the
+ * callback. Items that were not asked for are empty. @digest is set instead
+ * of @body/@bodystructure for messages that the server could not pre-render.
+ */
+struct fetch_row {
+	uint64_t size = 0;
+	time_t idate = 0;
+	std::string_view envelope, body, bodystructure, digest;
+};
+using fetch_row_cb = std::function<bool(MITEM &, const fetch_row &)>;
+
 extern GX_EXPORT int list_mail(const char *path, const std::string &folder, std::vector<MSG_UNIT> &, int *num, uint64_t *size);
 extern GX_EXPORT int delete_mail(const char *path, const std::string &folder, const std::vector<MSG_UNIT *> &);
 extern GX_EXPORT int get_uid(const char *path, const std::string &folder, const std::string &mid, unsigned int *uid);
@@ -64,6 +80,7 @@ extern GX_EXPORT int remove_mail(const char *path, const std::string &folder, co
 extern GX_EXPORT int list_deleted(const char *path, const std::string &folder, XARRAY *, int *perrno);
 extern GX_EXPORT int fetch_simple_uid(const char *path, const std::string &folder, const gromox::imap_seq_list &, XARRAY *, int *perrno);
 extern GX_EXPORT int fetch_detail_uid(const char *path, const std::string &folder, const gromox::imap_seq_list &, XARRAY *, int *perrno);
+extern GX_EXPORT int fetch_detail_stream(const char *path, const std::string &folder, const gromox::imap_seq_list &, const char *charset, unsigned int fields, const fetch_row_cb &, int *perrno);
 extern GX_EXPORT int set_flags(const char *path, const std::string &folder, const std::string &mid, unsigned int flag_bits, unsigned int *new_bits, int *perrno);
 extern GX_EXPORT int unset_flags(const char *path, const std::string &folder, const std::string &mid, unsigned int flag_bits, unsigned int *new_bits, int *perrno);
 extern GX_EXPORT int get_flags(const char *path, const std::string &folder, const std::string &mid, unsigned int *pflag_bits, int *perrno, std::string *keywords = nullptr);
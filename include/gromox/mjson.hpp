@@ -2,6 +2,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -107,6 +108,8 @@ struct GX_EXPORT MJSON_MIME {
 struct GX_EXPORT MJSON {
 	void clear();
 	bool load_from_json(const Json::Value &);
+	bool load_from_index(std::string_view);
+	std::string to_index() const;
 	int fetch_structure(mjson_io &, const char *cset, bool ext, std::string &out) const;
 	int fetch_envelope(const char *cset, std::string &out) const;
 	bool has_rfc822_part() const;
@@ -3,8 +3,10 @@
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <iconv.h>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 #include <gromox/common_types.hpp>
 #include <gromox/defs.h>
@@ -106,6 +108,29 @@ struct GX_EXPORT xpg_locale {
 	std::string language, territory, codeset, modifier;
 };
 
+/**
+ * An iconv descriptor borrowed from a per-thread pool, so that repeated
+ * conversions between the same pair of charsets skip iconv_open. The
+ * descriptor goes back to the pool (in the initial shift state) on reset()
+ * or destruction; do not iconv_close it.
+ */
+class GX_EXPORT iconv_pooled {
+	public:
+	iconv_pooled() = default;
+	iconv_pooled(const char *to, const char *from);
+	iconv_pooled(iconv_pooled &&o) noexcept :
+		m_cd(std::exchange(o.m_cd, iconv_t(-1))), m_key(std::move(o.m_key)) {}
+	~iconv_pooled() { reset(); }
+	iconv_pooled &operator=(iconv_pooled &&) noexcept;
+	void reset();
+	bool valid() const { return m_cd != iconv_t(-1); }
+	operator iconv_t() const { return m_cd; }
+
+	private:
+	iconv_t m_cd = iconv_t(-1);
+	std::string m_key;
+};
+
 extern GX_EXPORT void *zalloc(size_t);
 extern GX_EXPORT uint32_t rand();
 extern GX_EXPORT bool parse_bool(const char *s);
@@ -1,8 +1,10 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 // SPDX-FileCopyrightText: 2020–2026 grommunio GmbH
 // This file is part of Gromox.
+#include <algorithm>
 #include <cerrno>
 #include <climits>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
@@ -12,6 +14,7 @@
 #include <utility>
 #include <fmt/core.h>
 #include <libHX/defs.h>
+#include <libHX/endian.h>
 #include <libHX/io.h>
 #include <libHX/string.h>
 #include <vmime/addressList.hpp>
@@ -218,6 +221,126 @@ const MJSON_MIME *MJSON::get_mime(const char *id) const
 	return m_root.has_value() ? m_root->find_by_id(id) : nullptr;
 }
 
+/*
+ * Binary MIME structure index ("mst" datafile)
+ *
+ * Header: "GXMI", u8 version, u8 pad, le16 part count, le64 mail size.
+ * Then one record per MIME part in pre-order: u8 mime_type, u8 length of
+ * the content type, u8 length of the transfer encoding, u8 pad, le32 number
+ * of children, le64 head offset, le64 content offset, le64 content length,
+ * followed by the content type and encoding strings. Part ids are implied by
+ * the tree position, just like in the digest.
+ */
+static constexpr char MST_MAGIC[] = {'G', 'X', 'M', 'I'};
+static constexpr uint8_t MST_VERSION = 1;
+static constexpr size_t MST_HDRSIZE = 16, MST_RECSIZE = 32, MST_MAXDEPTH = 64;
+
+static void mjson_index_part(const MJSON_MIME &m, std::string &out)
+{
+	char rec[MST_RECSIZE]{};
+	auto ctlen  = std::min(m.ctype.size(), static_cast<size_t>(UINT8_MAX));
+	auto enclen = std::min(m.encoding.size(), static_cast<size_t>(UINT8_MAX));
+	rec[0] = static_cast<uint8_t>(m.mime_type);
+	rec[1] = ctlen;
+	rec[2] = enclen;
+	cpu_to_le32p(&rec[4], m.children.size());
+	cpu_to_le64p(&rec[8], m.head);
+	cpu_to_le64p(&rec[16], m.begin);
+	cpu_to_le64p(&rec[24], m.length);
+	out.append(rec, std::size(rec));
+	out.append(m.ctype.c_str(), ctlen);
+	out.append(m.encoding.c_str(), enclen);
+	for (const auto &c : m.children)
+		mjson_index_part(c, out);
+}
+
+/**
+ * Serialize the MIME tree (offsets, content types and transfer encodings)
+ * into the compact form stored as the "mst" datafile. Returns an empty
+ * string if there is nothing to index.
+ */
+std::string MJSON::to_index() const try
+{
+	if (!m_root.has_value())
+		return {};
+	size_t count = 0;
+	enum_mime([](const MJSON_MIME *, size_t &n) { ++n; }, count);
+	if (count > UINT16_MAX)
+		return {};
+	std::string out;
+	char hdr[MST_HDRSIZE]{};
+	memcpy(hdr, MST_MAGIC, sizeof(MST_MAGIC));
+	hdr[4] = MST_VERSION;
+	cpu_to_le16p(&hdr[6], count);
+	cpu_to_le64p(&hdr[8], size);
+	out.append(hdr, std::size(hdr));
+	mjson_index_part(*m_root, out);
+	return out;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "%s: ENOMEM", __PRETTY_FUNCTION__);
+	return {};
+}
+
+static bool mjson_unindex_part(std::string_view &in, MJSON_MIME &m,
+    size_t &parts_left, unsigned int depth)
+{
+	if (in.size() < MST_RECSIZE || parts_left == 0 || depth > MST_MAXDEPTH)
+		return false;
+	auto rec = reinterpret_cast<const uint8_t *>(in.data());
+	if (rec[0] == static_cast<uint8_t>(mime_type::none) ||
+	    rec[0] > static_cast<uint8_t>(mime_type::multiple))
+		return false;
+	m.mime_type = static_cast<enum mime_type>(rec[0]);
+	size_t ctlen = rec[1], enclen = rec[2];
+	auto nchild = le32p_to_cpu(&rec[4]);
+	m.head   = le64p_to_cpu(&rec[8]);
+	m.begin  = le64p_to_cpu(&rec[16]);
+	m.length = le64p_to_cpu(&rec[24]);
+	if (m.begin < m.head || in.size() < MST_RECSIZE + ctlen + enclen ||
+	    nchild >= parts_left)
+		return false;
+	m.ctype.assign(&in[MST_RECSIZE], ctlen);
+	m.encoding.assign(&in[MST_RECSIZE+ctlen], enclen);
+	in.remove_prefix(MST_RECSIZE + ctlen + enclen);
+	--parts_left;
+	m.children.resize(nchild);
+	for (size_t i = 0; i < nchild; ++i) {
+		auto &c = m.children[i];
+		c.id = m.id.empty() ? std::to_string(i + 1) :
+		       m.id + "." + std::to_string(i + 1);
+		if (!mjson_unindex_part(in, c, parts_left, depth + 1))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Load the MIME tree from an "mst" index produced by to_index(). Only the
+ * structural fields (ids, offsets, content type, encoding) and the mail size
+ * are populated; envelope data stays empty. The caller sets `filename`
+ * (and `path`) as needed.
+ */
+bool MJSON::load_from_index(std::string_view in) try
+{
+	clear();
+	if (in.size() < MST_HDRSIZE ||
+	    memcmp(in.data(), MST_MAGIC, sizeof(MST_MAGIC)) != 0 ||
+	    static_cast<uint8_t>(in[4]) != MST_VERSION)
+		return false;
+	size_t parts_left = le16p_to_cpu(&in[6]);
+	size = le64p_to_cpu(&in[8]);
+	in.remove_prefix(MST_HDRSIZE);
+	MJSON_MIME root;
+	if (!mjson_unindex_part(in, root, parts_left, 0) ||
+	    parts_left != 0 || !in.empty())
+		return false;
+	m_root.emplace(std::move(root));
+	return true;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "%s: ENOMEM", __PRETTY_FUNCTION__);
+	return false;
+}
+
 static bool mjson_record_node(MJSON *pjson, const Json::Value &jv, unsigned int type) try
 {
 	MJSON_MIME temp_mime;
@@ -944,16 +944,33 @@ BOOL exmdb_client_do_rpc(const exreq *rq, exresp *rsp)
 	bin.pb = nullptr;
 
 	std::string rsp_bin;
-	if (!exmdb_client_read_socket(cref->m_fd.get(), rsp_bin, exmdb_client->m_rpc_timeout))
-		return false;
-	if (rsp_bin.empty())
+	std::string_view rsp_sv;
+	bool zerocopy = exmdb_rpc_zerocopy;
+	if (zerocopy) {
+		/*
+		 * The frame lives as long as the caller's allocation context.
+		 * Without one, it is read into rsp_bin and parsed by copying.
+		 */
+		BINARY rsp_frame{};
+		if (!exmdb_client_read_socket(cref->m_fd.get(), rsp_frame,
+		    exmdb_rpc_alloc, rsp_bin, exmdb_client->m_rpc_timeout))
+			return false;
+		rsp_sv = {rsp_frame.pc, rsp_frame.cb};
+		zerocopy = rsp_bin.empty();
+	} else {
+		if (!exmdb_client_read_socket(cref->m_fd.get(), rsp_bin,
+		    exmdb_client->m_rpc_timeout))
+			return false;
+		rsp_sv = rsp_bin;
+	}
+	if (rsp_sv.empty())
 		return false;
-	if (rsp_bin.size() == 1) {
+	if (rsp_sv.size() == 1) {
 		/* Connection is still good in principle. */
 		cref.putback();
 		return false;
 	}
-	if (rsp_bin.size() < 5) {
+	if (rsp_sv.size() < 5) {
 		/*
 		 * Malformed packet? Let connection die
 		 * (~exmdb_connection_ref), lest the next response might pick
@@ -963,9 +980,9 @@ BOOL exmdb_client_do_rpc(const exreq *rq, exresp *rsp)
 	}
 	cref.putback();
 	rsp->call_id = rq->call_id;
-	std::string_view rsp_sv(rsp_bin);
 	rsp_sv.remove_prefix(5);
-	auto ret = exmdb_ext_pull_response(rsp_sv, rsp);
+	auto ret = exmdb_ext_pull_response(rsp_sv, rsp,
+	           zerocopy ? EXT_FLAG_ZEROCOPY : 0);
 	return ret == pack_result::ok ? TRUE : false;
 }
 
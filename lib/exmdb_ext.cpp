@@ -27,6 +27,14 @@ using namespace gromox;
 
 void *(*exmdb_rpc_alloc)(size_t) = malloc;
 void (*exmdb_rpc_free)(void *) = free;
+/*
+ * Parse exmdb responses in place (EXT_FLAG_ZEROCOPY), with the receive buffer
+ * obtained from exmdb_rpc_alloc. Only for programs whose exmdb_rpc_alloc is
+ * an arena that is released as a whole, i.e. exmdb_rpc_free is a no-op.
+ * Calls from threads where exmdb_rpc_alloc returns nullptr fall back to
+ * copying.
+ */
+bool exmdb_rpc_zerocopy;
 template<typename T> T *cu_alloc()
 {
 	static_assert(std::is_trivially_destructible_v<T>);
@@ -2177,6 +2185,22 @@ static pack_result exmdb_push(EXT_PUSH &x, const exreq_imapfile_read &d)
 	return x.p_str(d.mid);
 }
 
+static pack_result exmdb_pull(EXT_PULL &x, exreq_imapfile_read_range &d)
+{
+	TRY(x.g_str(&d.type));
+	TRY(x.g_str(&d.mid));
+	TRY(x.g_uint64(&d.offset));
+	return x.g_uint32(&d.length);
+}
+
+static pack_result exmdb_push(EXT_PUSH &x, const exreq_imapfile_read_range &d)
+{
+	TRY(x.p_str(d.type));
+	TRY(x.p_str(d.mid));
+	TRY(x.p_uint64(d.offset));
+	return x.p_uint32(d.length);
+}
+
 static pack_result exmdb_pull(EXT_PULL &x, exreq_imapfile_write &d) try
 {
 	TRY(x.g_str(&d.type));
@@ -2231,6 +2255,106 @@ static pack_result exmdb_pull(EXT_PULL &x, exreq_write_delegates &d)
 	return x.g_str_a(&d.userlist);
 }
 
+static pack_result exmdb_push(EXT_PUSH &x, const exreq_write_messages &d)
+{
+	TRY(x.p_uint32(d.cpid));
+	TRY(x.p_uint32(d.items.size()));
+	for (const auto &e : d.items) {
+		TRY(x.p_uint64(e.folder_id));
+		TRY(x.p_msgctnt(*e.pmsgctnt));
+		TRY(x.p_str(e.digest));
+	}
+	return pack_result::ok;
+}
+
+static pack_result exmdb_pull(EXT_PULL &x, exreq_write_messages &d) try
+{
+	uint32_t count = 0;
+	TRY(x.g_nlscp(&d.cpid));
+	TRY(x.g_uint32(&count));
+	/* folder_id alone takes 8 bytes; do not trust @count beyond that */
+	if (count > (x.m_data_size - x.m_offset) / sizeof(uint64_t))
+		return pack_result::bufsize;
+	d.items.resize(count);
+	for (auto &e : d.items) {
+		TRY(x.g_uint64(&e.folder_id));
+		e.pmsgctnt = cu_alloc<MESSAGE_CONTENT>();
+		if (e.pmsgctnt == nullptr)
+			return pack_result::alloc;
+		TRY(x.g_msgctnt(e.pmsgctnt));
+		TRY(x.g_str(&e.digest));
+	}
+	return pack_result::ok;
+} catch (const std::bad_alloc &) {
+	return pack_result::alloc;
+}
+
+static pack_result exmdb_push(EXT_PUSH &x, const exresp_write_messages &d)
+{
+	TRY(x.p_uint32(d.results.size()));
+	for (const auto &e : d.results) {
+		TRY(x.p_uint64(e.outmid));
+		TRY(x.p_uint64(e.outcn));
+		TRY(x.p_uint32(e.e_result));
+	}
+	return pack_result::ok;
+}
+
+static pack_result exmdb_pull(EXT_PULL &x, exresp_write_messages &d) try
+{
+	uint32_t count = 0;
+	TRY(x.g_uint32(&count));
+	if (count > (x.m_data_size - x.m_offset) / (2 * sizeof(uint64_t) + sizeof(uint32_t)))
+		return pack_result::bufsize;
+	d.results.resize(count);
+	for (auto &e : d.results) {
+		TRY(x.g_uint64(&e.outmid));
+		TRY(x.g_uint64(&e.outcn));
+		TRY(x.g_uint32(reinterpret_cast<uint32_t *>(&e.e_result)));
+	}
+	return pack_result::ok;
+} catch (const std::bad_alloc &) {
+	return pack_result::alloc;
+}
+
+static pack_result exmdb_push(EXT_PUSH &x, const exreq_freebusy_query &d)
+{
+	TRY(x.p_int64(d.start_time));
+	return x.p_int64(d.end_time);
+}
+
+static pack_result exmdb_pull(EXT_PULL &x, exreq_freebusy_query &d)
+{
+	TRY(x.g_int64(&d.start_time));
+	return x.g_int64(&d.end_time);
+}
+
+static pack_result exmdb_push(EXT_PUSH &x, const exresp_freebusy_query &d)
+{
+	TRY(x.p_uint32(d.fb_events.size()));
+	for (const auto &e : d.fb_events)
+		TRY(x.p_fbevent(e));
+	TRY(x.p_uint32(d.message_ids.size()));
+	for (auto mid : d.message_ids)
+		TRY(x.p_uint64(mid));
+	return pack_result::ok;
+}
+
+static pack_result exmdb_pull(EXT_PULL &x, exresp_freebusy_query &d) try
+{
+	uint32_t count = 0;
+	TRY(x.g_fb_a(&d.fb_events));
+	TRY(x.g_uint32(&count));
+	if (count > (x.m_data_size - x.m_offset) / sizeof(uint64_t))
+		return pack_result::bufsize;
+	d.message_ids.resize(count);
+	for (auto &mid : d.message_ids)
+		TRY(x.g_uint64(&mid));
+	return pack_result::ok;
+} catch (const std::bad_alloc &) {
+	return pack_result::alloc;
+}
+
 /**
  * This uses *& because we do not know which request type we are going to get
  * (cf. exmdb_ext_pull_response).
@@ -3494,11 +3618,13 @@ static pack_result exmdb_push(EXT_PUSH &x, const exresp_purge_softdelete &d)
  * This uses just *presponse, because the caller expects to receive the
  * same response type as the request type.
  */
-pack_result exmdb_ext_pull_response(std::string_view pbin_in, exresp *presponse)
+pack_result exmdb_ext_pull_response(std::string_view pbin_in,
+    exresp *presponse, unsigned int ext_flags)
 {
 	EXT_PULL ext_pull;
 	
-	ext_pull.init(pbin_in.data(), pbin_in.size(), exmdb_rpc_alloc, EXT_FLAG_WCOUNT);
+	ext_pull.init(pbin_in.data(), pbin_in.size(), exmdb_rpc_alloc,
+		EXT_FLAG_WCOUNT | ext_flags);
 
 #define EDEF(t, id) case exmdb_callid::t: return exmdb_pull(ext_pull, *static_cast<exresp_ ## t *>(presponse));
 #define EOBSOL(t, id)
@@ -3678,16 +3804,22 @@ const char *exmdb_rpc_strerror(exmdb_response v)
 	return xbuf;
 }
 
-bool exmdb_client_read_socket(int fd, std::string &bin, long timeout_ms) try
+/**
+ * Read one response frame (a single status byte, or status plus
+ * length-prefixed payload). @getbuf is called once with the frame size and
+ * returns the buffer to fill, or nullptr.
+ */
+template<typename F> static bool exmdb_read_frame(int fd, long timeout_ms,
+    F &&getbuf)
 {
 	if (fd < 0) {
 		errno = EBADF;
 		return false;
 	}
-	size_t offset = 0;
+	uint8_t *buf = nullptr;
+	size_t offset = 0, size = 0;
 	struct pollfd pfd;
 
-	bin.clear();
 	pfd.fd = fd;
 	pfd.events = POLLIN | POLLPRI;
 
@@ -3706,36 +3838,75 @@ bool exmdb_client_read_socket(int fd, std::string &bin, long timeout_ms) try
 				return false;
 		}
 
-		if (bin.size() == 0) {
+		if (buf == nullptr) {
 			uint8_t resp_buff[5];
 			ssize_t read_len = read(fd, resp_buff, 5);
 			if (read_len == 1) {
-				bin.resize(1);
-				bin[0] = resp_buff[0];
+				buf = getbuf(1);
+				if (buf == nullptr)
+					return false;
+				buf[0] = resp_buff[0];
 				return TRUE;
 			} else if (read_len == 5) {
 				uint32_t cb = le32p_to_cpu(resp_buff + 1) + 5;
 				CLAMP32(cb);
-				bin.resize(cb);
-				memcpy(bin.data(), resp_buff, 5);
+				size = cb;
+				buf = getbuf(size);
+				if (buf == nullptr)
+					return false;
+				memcpy(buf, resp_buff, 5);
 				offset = 5;
-				if (offset == bin.size())
+				if (offset == size)
 					return TRUE;
 				continue;
 			} else {
-				bin.clear();
 				return false;
 			}
 		}
-		ssize_t read_len = read(fd, &bin[offset], bin.size() - offset);
-		if (read_len <= 0) {
-			bin.clear();
+		ssize_t read_len = read(fd, &buf[offset], size - offset);
+		if (read_len <= 0)
 			return false;
-		}
 		offset += read_len;
-		if (offset == bin.size())
+		if (offset == size)
 			return TRUE;
 	}
+}
+
+bool exmdb_client_read_socket(int fd, std::string &bin, long timeout_ms) try
+{
+	bin.clear();
+	auto ok = exmdb_read_frame(fd, timeout_ms, [&](size_t z) {
+		bin.resize(z);
+		return reinterpret_cast<uint8_t *>(bin.data());
+	});
+	if (!ok)
+		bin.clear();
+	return ok;
+} catch (const std::bad_alloc &) {
+	return false;
+}
+
+/**
+ * Like the std::string variant, but the frame is placed into memory from
+ * @alloc (normally exmdb_rpc_alloc), so that a response parsed in place
+ * stays valid for the lifetime of that allocation context. If @alloc
+ * yields nothing (e.g. the calling thread has no allocation context), the
+ * frame goes to @spill instead, which is left empty otherwise.
+ */
+bool exmdb_client_read_socket(int fd, BINARY &bin,
+    void *(*alloc)(size_t), std::string &spill, long timeout_ms) try
+{
+	bin = {};
+	spill.clear();
+	return exmdb_read_frame(fd, timeout_ms, [&](size_t z) {
+		bin.pv = alloc(z);
+		if (bin.pv == nullptr) {
+			spill.resize(z);
+			bin.pv = spill.data();
+		}
+		bin.cb = z;
+		return bin.pb;
+	});
 } catch (const std::bad_alloc &) {
 	return false;
 }
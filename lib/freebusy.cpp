@@ -28,40 +28,41 @@ struct ievent {
 	EXTENDEDEXCEPTION *xe = nullptr;
 };
 
-struct freebusy_tags {
-	freebusy_tags(const char *);
-
-	uint32_t apptstartwhole = 0, apptendwhole = 0, busystatus = 0, recurring = 0,
-		apptrecur = 0, apptsubtype = 0, private_flag = 0, apptstateflags = 0,
-		clipend = 0, location = 0, reminderset = 0, globalobjectid = 0,
-		timezonestruct = 0;
-	bool init_ok = false;
+}
+
+static const PROPERTY_NAME fb_propname_buff[] = {
+	{MNID_ID, PSETID_Appointment, PidLidAppointmentStartWhole},
+	{MNID_ID, PSETID_Appointment, PidLidAppointmentEndWhole},
+	{MNID_ID, PSETID_Appointment, PidLidBusyStatus},
+	{MNID_ID, PSETID_Appointment, PidLidRecurring},
+	{MNID_ID, PSETID_Appointment, PidLidAppointmentRecur},
+	{MNID_ID, PSETID_Appointment, PidLidAppointmentSubType},
+	{MNID_ID, PSETID_Common,      PidLidPrivate},
+	{MNID_ID, PSETID_Appointment, PidLidAppointmentStateFlags},
+	{MNID_ID, PSETID_Appointment, PidLidClipEnd},
+	{MNID_ID, PSETID_Appointment, PidLidLocation},
+	{MNID_ID, PSETID_Common,      PidLidReminderSet},
+	{MNID_ID, PSETID_Meeting,     PidLidGlobalObjectId},
+	{MNID_ID, PSETID_Appointment, PidLidTimeZoneStruct},
 };
 
-}
+const PROPNAME_ARRAY freebusy_tags::propnames = {std::size(fb_propname_buff), deconst(fb_propname_buff)};
 
 freebusy_tags::freebusy_tags(const char *dir)
 {
-	static const PROPERTY_NAME propname_buff[] = {
-		{MNID_ID, PSETID_Appointment, PidLidAppointmentStartWhole},
-		{MNID_ID, PSETID_Appointment, PidLidAppointmentEndWhole},
-		{MNID_ID, PSETID_Appointment, PidLidBusyStatus},
-		{MNID_ID, PSETID_Appointment, PidLidRecurring},
-		{MNID_ID, PSETID_Appointment, PidLidAppointmentRecur},
-		{MNID_ID, PSETID_Appointment, PidLidAppointmentSubType},
-		{MNID_ID, PSETID_Common,      PidLidPrivate},
-		{MNID_ID, PSETID_Appointment, PidLidAppointmentStateFlags},
-		{MNID_ID, PSETID_Appointment, PidLidClipEnd},
-		{MNID_ID, PSETID_Appointment, PidLidLocation},
-		{MNID_ID, PSETID_Common,      PidLidReminderSet},
-		{MNID_ID, PSETID_Meeting,     PidLidGlobalObjectId},
-		{MNID_ID, PSETID_Appointment, PidLidTimeZoneStruct},
-	};
-
-	const PROPNAME_ARRAY propnames = {std::size(propname_buff), deconst(propname_buff)};
 	PROPID_ARRAY ids;
-	if (exmdb_client->get_named_propids(dir, false, &propnames, &ids) &&
-	    ids.size() == propnames.size()) {
+	if (exmdb_client->get_named_propids(dir, false, &propnames, &ids))
+		resolve(ids);
+}
+
+freebusy_tags::freebusy_tags(const PROPID_ARRAY &ids)
+{
+	resolve(ids);
+}
+
+void freebusy_tags::resolve(const PROPID_ARRAY &ids)
+{
+	if (ids.size() == propnames.size()) {
 		apptstartwhole = PROP_TAG(PT_SYSTIME, ids[0]);
 		apptendwhole   = PROP_TAG(PT_SYSTIME, ids[1]);
 		busystatus     = PROP_TAG(PT_LONG,    ids[2]);
@@ -79,6 +80,18 @@ freebusy_tags::freebusy_tags(const char *dir)
 	}
 }
 
+/**
+ * All properties that freebusy_expand looks at.
+ */
+std::vector<proptag_t> freebusy_tags::proptags() const
+{
+	return {
+		apptstartwhole, apptendwhole, busystatus, recurring, apptrecur,
+		private_flag, apptstateflags, location, reminderset,
+		globalobjectid, timezonestruct, PR_SUBJECT,
+	};
+}
+
 static bool fill_tzcom(ical_component &tzcom, const SYSTEMTIME &sys, int year,
     int from_bias, int to_bias, bool dstmonth)
 {
@@ -335,7 +348,7 @@ static int goid_to_icaluid2(const BINARY *gobj, std::string &uid_buf) try
 	return -ENOMEM;
 }
 
-static bool goid_to_icaluid(BINARY *gobj, std::string &uid_buf)
+static bool goid_to_icaluid(const BINARY *gobj, std::string &uid_buf)
 {
 	auto ret = goid_to_icaluid2(gobj, uid_buf);
 	if (ret < 0)
@@ -354,20 +367,101 @@ unsigned int freebusy_perms(const char *actor, const char *target)
 	return perm & (frightsFreeBusySimple | frightsFreeBusyDetailed | frightsReadAny);
 }
 
-ec_error_t get_freebusy(const char *username, const char *dir, time_t start_time,
-    time_t end_time, std::vector<freebusy_event> &fb_data)
+/**
+ * Append the occurrences of one appointment to @fb_data. @props must carry
+ * the tags from freebusy_tags::proptags(). Recurring appointments are only
+ * expanded for [@start_time, @end_time]; single ones are emitted as-is.
+ * Returns false if the appointment is unusable.
+ */
+bool freebusy_expand(const freebusy_tags &ptag, const TPROPVAL_ARRAY &props,
+    time_t start_time, time_t end_time, bool detailed,
+    std::vector<freebusy_event> &fb_data)
 {
-	uint32_t permission = 0;
-	auto cal_eid = rop_util_make_eid_ex(1, PRIVATE_FID_CALENDAR);
+	std::string uid_buf;
+	if (!goid_to_icaluid(props.get<BINARY>(ptag.globalobjectid), uid_buf))
+		return false;
+	auto ts = props.get<const uint64_t>(ptag.apptstartwhole);
+	if (ts == nullptr)
+		return false;
+	auto start_whole = rop_util_nttime_to_unix(*ts);
+	ts = props.get<uint64_t>(ptag.apptendwhole);
+	if (ts == nullptr)
+		return false;
+	auto end_whole   = rop_util_nttime_to_unix(*ts);
+	auto subject     = props.get<char>(PR_SUBJECT);
+	auto location    = props.get<char>(ptag.location);
+	auto flag        = props.get<const uint8_t>(ptag.reminderset);
+	bool is_reminder = flag != nullptr && *flag != 0;
+	flag = props.get<uint8_t>(ptag.private_flag);
+	bool is_private  = flag != nullptr && *flag != 0;
+	auto num = props.get<const uint32_t>(ptag.busystatus);
+	uint32_t busy_type = num == nullptr || *num > olWorkingElsewhere ? 0 : *num;
+	num = props.get<uint32_t>(ptag.apptstateflags);
+	bool is_meeting = num != nullptr && *num & asfMeeting;
+	flag = props.get<uint8_t>(ptag.recurring);
+
+	// non-recurring appointments
+	if (flag == nullptr || *flag == 0) {
+		fb_data.emplace_back(start_whole, end_whole, busy_type, uid_buf.data(),
+			subject, location, is_meeting, false, false, is_reminder, is_private, detailed);
+		return true;
+	}
+	// recurring appointments
+	EXT_PULL ext_pull;
+	std::optional<ical_component> tzcom;
+	auto bin = props.get<BINARY>(ptag.timezonestruct);
+	if (bin != nullptr) {
+		TZSTRUCT tz;
+		ext_pull.init(bin->pb, bin->cb, exmdb_rpc_alloc, EXT_FLAG_UTF16);
+		if (ext_pull.g_tzstruct(&tz) != pack_result::ok)
+			return false;
+		tzcom = tz_to_vtimezone(1600, "timezone", tz);
+		if (!tzcom.has_value())
+			return false;
+	}
 
-	if (username != nullptr) {
-		permission = freebusy_perms(username, dir);
-		if (permission == 0)
-			return ecAccessDenied;
-	} else {
-		permission = frightsFreeBusyDetailed | frightsReadAny;
+	bin = props.get<BINARY>(ptag.apptrecur);
+	if (bin == nullptr)
+		return false;
+	APPOINTMENT_RECUR_PAT apprecurr;
+	ext_pull.init(bin->pb, bin->cb, exmdb_rpc_alloc, EXT_FLAG_UTF16);
+	if (ext_pull.g_apptrecpat(&apprecurr) != pack_result::ok)
+		return false;
+
+	std::vector<ievent> event_list;
+	if (!find_recur_times(tzcom.has_value() ? &*tzcom : nullptr,
+	    start_whole, apprecurr, start_time, end_time, event_list))
+		return false;
+
+	for (const auto &event : event_list) {
+		if (event.ei == nullptr || event.xe == nullptr) {
+			fb_data.emplace_back(event.start_time, event.end_time, busy_type,
+				uid_buf.data(), subject, location, is_meeting, TRUE, false,
+				is_reminder, is_private, detailed);
+			continue;
+		}
+
+		bool ov_meeting  = (event.ei->overrideflags & ARO_MEETINGTYPE) ? event.ei->meetingtype & 1 : is_meeting;
+		bool ov_reminder = (event.ei->overrideflags & ARO_REMINDER)    ? event.ei->reminderset == 0 : is_reminder;
+		uint32_t ov_busy = (event.ei->overrideflags & ARO_BUSYSTATUS)  ? event.ei->busystatus : busy_type;
+		auto ov_subj     = (event.ei->overrideflags & ARO_SUBJECT)     ? event.xe->subject : subject;
+		auto ov_location = (event.ei->overrideflags & ARO_LOCATION)    ? event.xe->location : location;
+
+		fb_data.emplace_back(event.start_time, event.end_time, ov_busy,
+			uid_buf.data(), ov_subj, ov_location, ov_meeting, TRUE, TRUE,
+			ov_reminder, is_private, detailed);
 	}
+	return true;
+}
 
+/**
+ * Evaluate the calendar with a content table, for servers which do not
+ * offer the freebusy_query RPC.
+ */
+static ec_error_t get_freebusy_table(const char *dir, time_t start_time,
+    time_t end_time, bool detailed, std::vector<freebusy_event> &fb_data)
+{
+	auto cal_eid = rop_util_make_eid_ex(1, PRIVATE_FID_CALENDAR);
 	freebusy_tags ptag(dir);
 	if (!ptag.init_ok)
 		return ecRpcFailed;
@@ -375,7 +469,6 @@ ec_error_t get_freebusy(const char *username, const char *dir, time_t start_time
 	auto end_nttime   = end_time < 0 ?
 	                    SYSTEMTIME::maxyear * 31557600ULL * 10000000 :
 	                    rop_util_unix_to_nttime(end_time);
-	bool detailed     = permission & (frightsFreeBusyDetailed | frightsReadAny);
 
 	/* C1: apptstartwhole >= start && apptstartwhole <= end */
 	RESTRICTION_PROPERTY rst_1 = {RELOP_GE, ptag.apptstartwhole, {ptag.apptstartwhole, &start_nttime}};
@@ -422,104 +515,51 @@ ec_error_t get_freebusy(const char *username, const char *dir, time_t start_time
 
 	auto cl_0 = HX::make_scope_exit([&]() { exmdb_client->unload_table(dir, table_id);});
 
-	proptag_t proptags[] = {
-		ptag.apptstartwhole, ptag.apptendwhole, ptag.busystatus,
-		ptag.recurring, ptag.apptsubtype, ptag.private_flag,
-		ptag.apptstateflags, ptag.location, ptag.reminderset,
-		PR_SUBJECT, PidTagMid,
-	};
+	static constexpr proptag_t mid_tag[] = {PidTagMid};
 	TARRAY_SET rows;
 	if (!exmdb_client->query_table(dir, nullptr, CP_ACP, table_id,
-	    proptags, 0, row_count, &rows))
+	    mid_tag, 0, row_count, &rows))
 		return ecRpcFailed;
 
+	auto proptags = ptag.proptags();
 	for (size_t i = 0; i < rows.count; ++i) {
-		message_content *ctnt = nullptr;
 		auto msgid = rows.pparray[i]->get<const uint64_t>(PidTagMid);
+		TPROPVAL_ARRAY props{};
 		if (msgid == nullptr ||
-		    !exmdb_client->read_message(dir, nullptr, CP_ACP, *msgid, &ctnt) ||
-		    ctnt == nullptr)
-			continue;
-		std::string uid_buf;
-		if (!goid_to_icaluid(ctnt->proplist.get<BINARY>(ptag.globalobjectid), uid_buf))
-			continue;
-		auto ts = rows.pparray[i]->get<const uint64_t>(ptag.apptstartwhole);
-		if (ts == nullptr)
-			continue;
-		auto start_whole = rop_util_nttime_to_unix(*ts);
-		ts = rows.pparray[i]->get<uint64_t>(ptag.apptendwhole);
-		if (ts == nullptr)
-			continue;
-		auto end_whole   = rop_util_nttime_to_unix(*ts);
-		auto subject     = rows.pparray[i]->get<char>(PR_SUBJECT);
-		auto location    = rows.pparray[i]->get<char>(ptag.location);
-		auto flag        = rows.pparray[i]->get<const uint8_t>(ptag.reminderset);
-		bool is_reminder = flag != nullptr && *flag != 0;
-		flag = rows.pparray[i]->get<uint8_t>(ptag.private_flag);
-		bool is_private  = flag != nullptr && *flag != 0;
-		auto num = rows.pparray[i]->get<const uint32_t>(ptag.busystatus);
-		uint32_t busy_type = num == nullptr || *num > olWorkingElsewhere ? 0 : *num;
-		num = rows.pparray[i]->get<uint32_t>(ptag.apptstateflags);
-		bool is_meeting = num != nullptr && *num & asfMeeting;
-		flag = rows.pparray[i]->get<uint8_t>(ptag.recurring);
-
-		// non-recurring appointments
-		if (flag == nullptr || *flag == 0) {
-			fb_data.emplace_back(start_whole, end_whole, busy_type, uid_buf.data(),
-				subject, location, is_meeting, false, false, is_reminder, is_private, detailed);
-			continue;
-		}
-		// recurring appointments
-		EXT_PULL ext_pull;
-		std::optional<ical_component> tzcom;
-		auto bin = ctnt->proplist.get<BINARY>(ptag.timezonestruct);
-		if (bin != nullptr) {
-			TZSTRUCT tz;
-			ext_pull.init(bin->pb, bin->cb, exmdb_rpc_alloc, EXT_FLAG_UTF16);
-			if (ext_pull.g_tzstruct(&tz) != pack_result::ok)
-				continue;
-			tzcom = tz_to_vtimezone(1600, "timezone", tz);
-			if (!tzcom.has_value())
-				continue;
-		}
-
-		bin = ctnt->proplist.get<BINARY>(ptag.apptrecur);
-		if (bin == nullptr)
-			continue;
-		APPOINTMENT_RECUR_PAT apprecurr;
-		ext_pull.init(bin->pb, bin->cb, exmdb_rpc_alloc, EXT_FLAG_UTF16);
-		if (ext_pull.g_apptrecpat(&apprecurr) != pack_result::ok)
+		    !exmdb_client->get_message_properties(dir, nullptr, CP_ACP,
+		    *msgid, proptags, &props))
 			continue;
-
-		std::vector<ievent> event_list;
-		if (!find_recur_times(tzcom.has_value() ? &*tzcom : nullptr,
-		    start_whole, apprecurr, start_time, end_time, event_list))
-			continue;
-
-		for (const auto &event : event_list) {
-			if (event.ei == nullptr || event.xe == nullptr) {
-				fb_data.emplace_back(event.start_time, event.end_time, busy_type,
-					uid_buf.data(), subject, location, is_meeting, TRUE, false,
-					is_reminder, is_private, detailed);
-				continue;
-			}
-
-			bool ov_meeting  = (event.ei->overrideflags & ARO_MEETINGTYPE) ? event.ei->meetingtype & 1 : is_meeting;
-			bool ov_reminder = (event.ei->overrideflags & ARO_REMINDER)    ? event.ei->reminderset == 0 : is_reminder;
-			uint32_t ov_busy = (event.ei->overrideflags & ARO_BUSYSTATUS)  ? event.ei->busystatus : busy_type;
-			auto ov_subj     = (event.ei->overrideflags & ARO_SUBJECT)     ? event.xe->subject : subject;
-			auto ov_location = (event.ei->overrideflags & ARO_LOCATION)    ? event.xe->location : location;
-
-			fb_data.emplace_back(event.start_time, event.end_time, ov_busy,
-				uid_buf.data(), ov_subj, ov_location, ov_meeting, TRUE, TRUE,
-				ov_reminder, is_private, detailed);
-		}
+		freebusy_expand(ptag, props, start_time, end_time, detailed, fb_data);
 	}
 
 	cl_0.release();
 	if (!exmdb_client->unload_table(dir, table_id))
 		/* ignore, there is nothing we could realistically do other than to pass up the error */;
-
 	return ecSuccess;
 }
 
+ec_error_t get_freebusy(const char *username, const char *dir, time_t start_time,
+    time_t end_time, std::vector<freebusy_event> &fb_data)
+{
+	uint32_t permission = 0;
+
+	if (username != nullptr) {
+		permission = freebusy_perms(username, dir);
+		if (permission == 0)
+			return ecAccessDenied;
+	} else {
+		permission = frightsFreeBusyDetailed | frightsReadAny;
+	}
+	bool detailed = permission & (frightsFreeBusyDetailed | frightsReadAny);
+
+	/* Served from the store's occurrence index */
+	std::vector<freebusy_event> all;
+	if (!exmdb_client->freebusy_query(dir, start_time, end_time, &all, nullptr))
+		return get_freebusy_table(dir, start_time, end_time, detailed, fb_data);
+	fb_data.reserve(fb_data.size() + all.size());
+	for (const auto &e : all)
+		fb_data.emplace_back(e.start_time, e.end_time, e.busy_status,
+			e.id, e.subject, e.location, e.is_meeting, e.is_recurring,
+			e.is_exception, e.is_reminderset, e.is_private, detailed);
+	return ecSuccess;
+}
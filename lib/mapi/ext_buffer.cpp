@@ -179,6 +179,10 @@ pack_result EXT_PULL::g_str(char **ppstr)
 	if (len + 1 > m_data_size - m_offset)
 		return pack_result::format;
 	len ++;
+	if (m_flags & EXT_FLAG_ZEROCOPY) {
+		*ppstr = deconst(&m_cdata[m_offset]);
+		return advance(len);
+	}
 	*ppstr = anew<char>(len);
 	if (*ppstr == nullptr)
 		return pack_result::alloc;
@@ -256,6 +260,12 @@ pack_result EXT_PULL::g_blob(DATA_BLOB *pblob)
 	if (m_offset > m_data_size)
 		return pack_result::bufsize;
 	uint32_t length = m_data_size - m_offset;
+	if (m_flags & EXT_FLAG_ZEROCOPY) {
+		pblob->pb = deconst(&m_udata[m_offset]);
+		pblob->cb = length;
+		m_offset += length;
+		return pack_result::ok;
+	}
 	pblob->pb = anew<uint8_t>(length);
 	if (pblob->pb == nullptr)
 		return pack_result::alloc;
@@ -265,6 +275,24 @@ pack_result EXT_PULL::g_blob(DATA_BLOB *pblob)
 	return pack_result::ok;
 }
 
+/* Payload of a BINARY whose length has already been pulled into @r->cb */
+pack_result EXT_PULL::g_bin_body(BINARY *r)
+{
+	if (m_flags & EXT_FLAG_ZEROCOPY) {
+		if (m_data_size < r->cb || m_offset + r->cb > m_data_size)
+			return pack_result::bufsize;
+		r->pv = deconst(&m_udata[m_offset]);
+		m_offset += r->cb;
+		return pack_result::ok;
+	}
+	r->pv = m_alloc(r->cb);
+	if (r->pv == nullptr) {
+		r->cb = 0;
+		return pack_result::alloc;
+	}
+	return g_bytes(r->pv, r->cb);
+}
+
 pack_result EXT_PULL::g_bin(BINARY *r)
 {
 	if (m_flags & EXT_FLAG_WCOUNT) {
@@ -279,12 +307,7 @@ pack_result EXT_PULL::g_bin(BINARY *r)
 		return pack_result::ok;
 	}
 	CLAMP32(r->cb);
-	r->pv = m_alloc(r->cb);
-	if (r->pv == nullptr) {
-		r->cb = 0;
-		return pack_result::alloc;
-	}
-	return g_bytes(r->pv, r->cb);
+	return g_bin_body(r);
 }
 
 pack_result EXT_PULL::g_bin(std::string *r) try
@@ -316,12 +339,7 @@ pack_result EXT_PULL::g_sbin(BINARY *r)
 		r->pb = NULL;
 		return pack_result::ok;
 	}
-	r->pv = m_alloc(r->cb);
-	if (r->pv == nullptr) {
-		r->cb = 0;
-		return pack_result::alloc;
-	}
-	return g_bytes(r->pv, r->cb);
+	return g_bin_body(r);
 }
 
 pack_result EXT_PULL::g_bin_ex(BINARY *r)
@@ -332,12 +350,7 @@ pack_result EXT_PULL::g_bin_ex(BINARY *r)
 		return pack_result::ok;
 	}
 	CLAMP32(r->cb);
-	r->pv = m_alloc(r->cb);
-	if (r->pv == nullptr) {
-		r->cb = 0;
-		return pack_result::alloc;
-	}
-	return g_bytes(r->pv, r->cb);
+	return g_bin_body(r);
 }
 
 pack_result EXT_PULL::g_uint16_an(SHORT_ARRAY *r, uint32_t count)
@@ -354,8 +354,8 @@ pack_result EXT_PUSH::p_fbevent(const freebusy_event &r)
 	TRY(p_uint32(r.busy_status));
 	TRY(p_bool(r.has_details));
 	if (r.has_details) {
-		TRY(p_str(r.id));
-		TRY(p_str(r.subject));
+		TRY(p_str(znul(r.id)));
+		TRY(p_str(znul(r.subject)));
 		TRY(p_bool(r.location != nullptr));
 		if (r.location != nullptr)
 			TRY(p_str(r.location));
@@ -16,6 +16,7 @@
  * - MIN replaced by std::min and U suffixes
  * - replace unlikely(x) by just (x)
  * - reordered designated initializers for `struct write_context wc` due to C++ rules
+ * - match finder replaced, compression levels (see below)
  */
 
 /*
@@ -65,138 +66,102 @@
 
 
 /*
- * LZX_PLAIN_COMP_HASH_BITS determines how big the hash table for finding
- * matches will be.
- *
- * The window in which we look for matches is 8192 bytes. That means with
- * random data a value of 13 is getting close to no collisions, while a 12
- * will miss about half the possible matches. With compressible data there
- * will generally be fewer and less diverse entries, so collisions are rarer.
- *
- * In the testsuite, bith 12 and 13 give better compression than Windows, but
- * 12 is faster. 11 does not save time and costs accuracy. Thus we prefer 12.
- */
-#define LZX_PLAIN_COMP_HASH_BITS 12
-/*
- * LZX_PLAIN_COMP_HASH_SEARCH_ATTEMPTS is how far ahead to search in the
- * circular hash table for a match, before we give up. A bigger number will
- * generally lead to better but slower compression, but a stupidly big number
- * will just be worse.
+ * The match finder is Gromox's own (replacing Samba's single-probe
+ * circular hash table): hash chains over the 8K window, with the effort
+ * per position set by the compression level.
  */
-#define LZX_PLAIN_COMP_HASH_SEARCH_ATTEMPTS 5
-#define HASH_MASK ((1 << LZX_PLAIN_COMP_HASH_BITS) - 1)
+#define LZX_WINDOW 8192
+#define LZX_HASH_BITS_MAX 13
 
-static inline uint16_t three_byte_hash(const uint8_t *bytes)
-{
-	uint16_t a = bytes[0];
-	uint16_t b = bytes[1] ^ 0x2e;
-	uint16_t c = bytes[2] ^ 0x55;
-	uint16_t ca = c - a;
-	uint16_t d = ((a + b) << 8) ^ (ca << 5) ^ (c + b) ^ (0xcab + a);
-	return d & HASH_MASK;
-}
+namespace {
 
+struct lzx_level {
+	unsigned int chain; /* candidates examined per position */
+	unsigned int nice; /* stop searching once a match is this long */
+	bool fill; /* also index the positions covered by matches */
+	bool lazy; /* look one position ahead before committing to a match */
+	bool accel; /* look up fewer positions in long literal runs */
+};
+
+struct lzx_finder {
+	/* most recent position+1 per hash value; 0 means none */
+	uint32_t head[1 << LZX_HASH_BITS_MAX];
+	/* distance from a position to the previous one with the same hash */
+	uint16_t prev[LZX_WINDOW];
+	unsigned int bits;
+};
 
-static inline void store_match(uint32_t *hash_table,
-			       uint16_t h,
-			       uint32_t offset)
-{
-	int i;
-	uint32_t o = hash_table[h];
-	uint16_t h2;
-	uint16_t worst_h;
-	int worst_score;
-
-	if (o >= offset) {
-		/* there is nothing there yet */
-		hash_table[h] = offset;
-		return;
-	}
-	for (i = 1; i < LZX_PLAIN_COMP_HASH_SEARCH_ATTEMPTS; i++) {
-		h2 = (h + i) & HASH_MASK;
-		if (hash_table[h2] >= offset) {
-			hash_table[h2] = offset;
-			return;
-		}
-	}
-	/*
-	 * There are no slots, but we really want to store this, so we'll kick
-	 * out the one with the longest distance.
-	 */
-	worst_h = h;
-	worst_score = offset - o;
-	for (i = 1; i < LZX_PLAIN_COMP_HASH_SEARCH_ATTEMPTS; i++) {
-		int score;
-		h2 = (h + i) & HASH_MASK;
-		o = hash_table[h2];
-		score = offset - o;
-		if (score > worst_score) {
-			worst_score = score;
-			worst_h = h2;
-		}
-	}
-	hash_table[worst_h] = offset;
 }
 
+static constexpr lzx_level lzx_levels[] = {
+	{1, 16, false, false, true},
+	{8, 64, true, false, false},
+	{64, 258, true, true, false},
+};
 
 struct match {
 	const uint8_t *there;
 	uint32_t length;
 };
 
+static inline uint32_t lzx_hash(const uint8_t *p, unsigned int bits)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 0x9E3779B1U) >> (32 - bits);
+}
 
-static inline struct match lookup_match(uint32_t *hash_table,
-					uint16_t h,
-					const uint8_t *data,
-					uint32_t offset,
-					size_t max_len)
+static inline void lzx_insert(lzx_finder &f, const uint8_t *data, uint32_t pos)
 {
-	int i;
-	uint32_t o;
-	uint16_t h2;
-	size_t len;
-	const uint8_t *there = nullptr;
-	const uint8_t *here = data + offset;
-	struct match best = {0};
-
-	for (i = 0; i < LZX_PLAIN_COMP_HASH_SEARCH_ATTEMPTS; i++) {
-		h2 = (h + i) & HASH_MASK;
-		o = hash_table[h2];
-		if (o >= offset) {
-			/*
-			 * Either this is 0xffffffff, or something is really
-			 * wrong.
-			 *
-			 * In setting this, we would never have stepped over
-			 * an 0xffffffff, so we won't now.
-			 */
-			break;
-		}
-		if (offset - o > 8192) {
-			/* Too far away to use */
-			continue;
-		}
-		there = data + o;
-		/*
-		 * When we already have a long match, we can try to avoid
-		 * measuring out another long, but shorter match.
-		 */
-		if (best.length > 1000 &&
-		    there[best.length - 1] != best.there[best.length - 1]) {
-			continue;
-		}
+	auto &h = f.head[lzx_hash(&data[pos], f.bits)];
+	uint32_t d = h != 0 ? pos + 1 - h : 0;
+	f.prev[pos % LZX_WINDOW] = d <= LZX_WINDOW ? d : 0;
+	h = pos + 1;
+}
 
-		for (len = 0;
-		     len < max_len && here[len] == there[len];
-		     len++) {
-			/* counting */
-		}
-		if (len > 2) {
-			if (len > best.length) {
-				best.length = len;
-				best.there = there;
+static inline uint32_t lzx_match_len(const uint8_t *a, const uint8_t *b,
+    uint32_t max_len)
+{
+	uint32_t n = 0;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for (; n + 8 <= max_len; n += 8) {
+		uint64_t x, y;
+		memcpy(&x, &a[n], sizeof(x));
+		memcpy(&y, &b[n], sizeof(y));
+		if (x != y)
+			return n + (__builtin_ctzll(x ^ y) >> 3);
+	}
+#endif
+	while (n < max_len && a[n] == b[n])
+		++n;
+	return n;
+}
+
+/* @max_len must be at least 3, and 3 bytes must be readable at @pos. */
+static match lzx_find(const lzx_finder &f, const uint8_t *data, uint32_t pos,
+    uint32_t max_len, const lzx_level &lv)
+{
+	match best = {nullptr, 0};
+	const uint8_t *here = &data[pos];
+	uint32_t cand = f.head[lzx_hash(here, f.bits)];
+
+	for (unsigned int n = lv.chain; cand != 0 && n > 0; --n) {
+		uint32_t c = cand - 1, dist = pos - c;
+		if (dist > LZX_WINDOW)
+			break;
+		const uint8_t *there = &data[c];
+		/* cheap reject: must at least extend the best match so far */
+		if (dist > 0 && there[best.length] == here[best.length]) {
+			auto len = lzx_match_len(here, there, max_len);
+			if (len >= 3 && len > best.length) {
+				best = {there, len};
+				if (len >= lv.nice || len == max_len)
+					break;
 			}
 		}
+		auto d = f.prev[c % LZX_WINDOW];
+		if (d == 0)
+			break;
+		cand -= d;
 	}
 	return best;
 }
@@ -308,7 +273,8 @@ static ssize_t encode_match(struct write_context *wc,
 ssize_t lzxpress_compress(const void *uncompressedv,
 			  uint32_t uncompressed_size,
 			  void *compressedv,
-			  uint32_t max_compressed_size)
+			  uint32_t max_compressed_size,
+			  unsigned int flags)
 {
 	auto uncompressed = static_cast<const uint8_t *>(uncompressedv);
 	auto compressed   = static_cast<uint8_t *>(compressedv);
@@ -333,8 +299,20 @@ ssize_t lzxpress_compress(const void *uncompressedv,
 		.indic_pos = 0,
 		.nibble_index = 0,
 	};
-	uint32_t hash_table[1 << LZX_PLAIN_COMP_HASH_BITS];
-	memset(hash_table, 0xff, sizeof(hash_table));
+	auto level = std::clamp(flags & LZX_LEVEL_MASK, 1U,
+	             static_cast<unsigned int>(std::size(lzx_levels)));
+	const auto &lv = lzx_levels[level-1];
+	lzx_finder f;
+	/* small inputs do not need (and should not pay for) a big table */
+	for (f.bits = 10; f.bits < LZX_HASH_BITS_MAX &&
+	     (1U << f.bits) < uncompressed_size; ++f.bits)
+		/* */;
+	memset(f.head, 0, sizeof(f.head[0]) << f.bits);
+	/* where to judge whether the input compresses at all */
+	uint32_t probe_pos = (flags & LZX_SKIP_INCOMPRESSIBLE) &&
+	                     uncompressed_size >= 16384 ? 4096 : UINT32_MAX;
+	uint32_t misses = 0, next_ins = 0;
+	match pending = {nullptr, 0};
 
 	if (!uncompressed_size) {
 		return 0;
@@ -352,21 +330,33 @@ ssize_t lzxpress_compress(const void *uncompressedv,
 		const uint32_t max_len = std::min(0xFFFF + 3U,
 					     uncompressed_size - uncompressed_pos);
 		const uint8_t *here = uncompressed + uncompressed_pos;
-		uint16_t h;
 		struct match match = {0};
 
-		if (max_len >= 3) {
-			h = three_byte_hash(here);
-			match = lookup_match(hash_table,
-					     h,
-					     uncompressed,
-					     uncompressed_pos,
-					     max_len);
-
-			store_match(hash_table, h, uncompressed_pos);
-		} else {
-			match.there = nullptr;
-			match.length = 0;
+		if (uncompressed_pos >= probe_pos) {
+			if (wc.compressed_pos + wc.compressed_pos / 32 >= uncompressed_pos)
+				return -1;
+			probe_pos = UINT32_MAX;
+		}
+		if (pending.there != nullptr) {
+			/* found (and indexed) by the lazy lookahead */
+			match = pending;
+			pending.there = nullptr;
+		} else if (max_len >= 3) {
+			match = lzx_find(f, uncompressed, uncompressed_pos,
+			        max_len, lv);
+			lzx_insert(f, uncompressed, uncompressed_pos);
+			next_ins = uncompressed_pos + 1;
+		}
+		if (lv.lazy && match.there != nullptr && match.length < lv.nice &&
+		    max_len > 3) {
+			auto next = lzx_find(f, uncompressed, uncompressed_pos + 1,
+			            max_len - 1, lv);
+			lzx_insert(f, uncompressed, uncompressed_pos + 1);
+			next_ins = uncompressed_pos + 2;
+			if (next.length > match.length) {
+				pending = next;
+				match.there = nullptr;
+			}
 		}
 
 		if (match.there == nullptr) {
@@ -384,14 +374,40 @@ ssize_t lzxpress_compress(const void *uncompressedv,
 			if (ret < 0) {
 				return ret;
 			}
+			/*
+			 * In a long literal run, emit the next few bytes
+			 * without looking them up.
+			 */
+			if (!lv.accel || ++misses < 64)
+				continue;
+			for (uint32_t skip = misses >> 6; skip > 0 &&
+			     uncompressed_pos < uncompressed_size; --skip) {
+				CHECK_OUTPUT_BYTES(sizeof(uint8_t));
+				wc.compressed[wc.compressed_pos++] = uncompressed[uncompressed_pos++];
+				ret = push_indicator_bit(&wc, 0);
+				if (ret < 0) {
+					return ret;
+				}
+			}
 		} else {
 			ret = encode_match(&wc, match, here);
 			if (ret < 0) {
 				return ret;
 			}
+			misses = 0;
+			/* long matches are mostly runs; not worth indexing */
+			if (lv.fill && match.length <= lv.nice) {
+				uint32_t end = std::min(uncompressed_pos + match.length,
+				               uncompressed_size - 2);
+				for (; next_ins < end; ++next_ins)
+					lzx_insert(f, uncompressed, next_ins);
+			}
 			uncompressed_pos += match.length;
 		}
 	}
+	if (uncompressed_pos < uncompressed_size)
+		/* ran out of output space; a truncated stream is of no use */
+		return -1;
 
 	if (wc.indic_bit != 0) {
 		wc.indic <<= 32 - wc.indic_bit;
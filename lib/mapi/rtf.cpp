@@ -25,7 +25,6 @@
 #include <gromox/util.hpp>
 #define QRF(expr) do { if (pack_result{expr} != pack_result::ok) return false; } while (false)
 #define QRF2(expr) do { if (pack_result{expr} != pack_result::ok) return ecInvalidParam; } while (false)
-#define ICONV_UNSET iconv_t(-1)
 
 #define MAX_ATTRS						10000
 #define MAX_GROUP_DEPTH					1000
@@ -314,7 +313,7 @@ struct rtf_reader final {
 	EXT_PULL ext_pull{};
 	EXT_PUSH ext_push{};
 	int ungot_chars[3] = {-1, -1, -1}, last_returned_ch = 0;
-	iconv_t conv_id = ICONV_UNSET;
+	iconv_pooled conv_id;
 	EXT_PUSH iconv_push{};
 	SIMPLE_TREE element_tree{};
 	ATTACHMENT_LIST *pattachments = nullptr;
@@ -369,7 +368,7 @@ bool rtf_reader::riconv_open(const char *fromcode)
 	 * This ensures multi-byte sequences are properly converted
 	 * before we change the character set interpretation.
 	 */
-	if (iconv_push.m_offset > 0 && conv_id != (iconv_t)-1) {
+	if (iconv_push.m_offset > 0 && conv_id.valid()) {
 		/*
 		 * Force flush of any remaining bytes in the old encoding.
 		 * If there's an incomplete sequence, it will be discarded
@@ -394,13 +393,10 @@ bool rtf_reader::riconv_open(const char *fromcode)
 		}
 		iconv_push.m_offset = 0;
 	}
-	if ((iconv_t)-1 != preader->conv_id) {
-		iconv_close(preader->conv_id);
-		preader->conv_id = (iconv_t)-1;
-	}
+	preader->conv_id.reset();
 	auto cs = replace_iconv_charset(fromcode);
-	preader->conv_id = iconv_open("UTF-8", cs);
-	if ((iconv_t)-1 == preader->conv_id) {
+	preader->conv_id = iconv_pooled("UTF-8", cs);
+	if (!preader->conv_id.valid()) {
 		mlog(LV_ERR, "E-2114: iconv_open %s: %s", cs, strerror(errno));
 		return false;
 	}
@@ -520,7 +516,7 @@ bool rtf_reader::riconv_flush(bool reset_iconv)
 	
 	if (preader->iconv_push.m_offset == 0 && !reset_iconv)
 		return true;
-	if (preader->conv_id == ICONV_UNSET) {
+	if (!preader->conv_id.valid()) {
 		if ('\0' == preader->default_encoding[0]) {
 			if (!riconv_open("windows-1252"))
 				return false;
@@ -748,8 +744,6 @@ rtf_reader::~rtf_reader()
 	if (proot != nullptr)
 		preader->element_tree.destroy_node(proot, rtf_delete_tree_node);
 	preader->element_tree.clear();
-	if (preader->conv_id != ICONV_UNSET)
-		iconv_close(preader->conv_id);
 }
 
 bool rtf_reader::express_begin_fontsize(int size)
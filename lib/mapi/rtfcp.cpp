@@ -1,10 +1,12 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 // SPDX-FileCopyrightText: 2025 grommunio GmbH
 // This file is part of Gromox.
+#include <array>
 #include <climits>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <libHX/endian.h>
 #include <gromox/defs.h>
 #include <gromox/ext_buffer.hpp>
@@ -179,22 +181,163 @@ ec_error_t rtfcp_uncompress(std::string_view input, std::string &out) try
 	return ecMAPIOOM;
 }
 
+static constexpr auto rtfcp_crc_table = [] {
+	std::array<uint32_t, 256> t{};
+	for (uint32_t i = 0; i < t.size(); ++i) {
+		uint32_t c = i;
+		for (unsigned int k = 0; k < 8; ++k)
+			c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+		t[i] = c;
+	}
+	return t;
+}();
+
+/* [MS-OXRTFCP] 3.1.3.2: CRC-32 seeded with 0, without final inversion */
+static uint32_t rtfcp_crc(const uint8_t *p, size_t z)
+{
+	uint32_t crc = 0;
+	for (size_t i = 0; i < z; ++i)
+		crc = rtfcp_crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#define RTF_HASHBITS 12
+#define RTF_MAXMATCH 17
+#define RTF_CHAIN 16
+
+namespace {
+
+/*
+ * Finds matches in the virtual stream "initial dictionary + input"; a
+ * position's dictionary offset is its stream index modulo RTF_DICTLENGTH.
+ */
+struct rtfcp_finder {
+	uint32_t head[1U << RTF_HASHBITS]{}; /* position+1; 0 is none */
+	uint16_t prev[RTF_DICTLENGTH]{}; /* distance to older position, or 0 */
+
+	static inline unsigned int hash(const uint8_t *p)
+	{
+		uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+		return (v * 0x9E3779B1U) >> (32 - RTF_HASHBITS);
+	}
+	inline void insert(const uint8_t *s, uint32_t pos)
+	{
+		auto &h = head[hash(&s[pos])];
+		uint32_t d = h != 0 ? pos + 1 - h : 0;
+		prev[pos % RTF_DICTLENGTH] = d < RTF_DICTLENGTH ? d : 0;
+		h = pos + 1;
+	}
+	uint32_t find(const uint8_t *s, uint32_t pos, uint32_t max_len,
+	    uint32_t *src) const;
+};
+
+}
+
+uint32_t rtfcp_finder::find(const uint8_t *s, uint32_t pos, uint32_t max_len,
+    uint32_t *src) const
+{
+	uint32_t best = 0;
+	auto h = head[hash(&s[pos])];
+	if (h == 0)
+		return 0;
+	uint32_t d = pos + 1 - h;
+	for (unsigned int n = RTF_CHAIN; n > 0; --n) {
+		/*
+		 * The distance must stay below the dictionary size; a reference to
+		 * the current write offset would read as the end marker.
+		 */
+		if (d == 0 || d >= RTF_DICTLENGTH || d > pos)
+			break;
+		auto c = pos - d;
+		uint32_t len = 0;
+		while (len < max_len && s[c+len] == s[pos+len])
+			++len;
+		if (len > best) {
+			best = len;
+			*src = c;
+			if (len == max_len)
+				break;
+		}
+		auto step = prev[c % RTF_DICTLENGTH];
+		if (step == 0)
+			break;
+		d += step;
+	}
+	return best;
+}
+
 /**
- * This uses the MELA uncompressed format.
+ * Produces the LZFu compressed format ([MS-OXRTFCP] 2.1.3.1), or MELA
+ * (uncompressed) in the unlikely event that LZFu does not pay off.
  * It is valid for @in and @out to refer to the same object.
  */
 ec_error_t rtfcp_encode(std::string_view in, std::string &out) try
 {
-	uint32_t len = std::min(in.size(), static_cast<size_t>(UINT32_MAX - 12));
-	char b[16];
-	cpu_to_le32p(&b[0], len + 12);
-	cpu_to_le32p(&b[4], len);
-	cpu_to_le32p(&b[8], RTF_UNCOMPRESSED);
-	cpu_to_le32p(&b[12], 0);
-	std::string t = std::string(b, sizeof(b));
-	t.append(in.data(), len);
+	uint32_t len = std::min(in.size(), static_cast<size_t>(UINT32_MAX - 12 - RTF_DICTLENGTH));
+	std::string sbuf;
+	sbuf.reserve(RTF_INITLENGTH + len + 2);
+	sbuf.assign(RTF_INITDICT, RTF_INITLENGTH);
+	sbuf.append(in.data(), len);
+	/* Padding for the hash function's lookahead */
+	sbuf.append(2, '\0');
+	auto s = reinterpret_cast<const uint8_t *>(sbuf.data());
+	uint32_t end = RTF_INITLENGTH + len;
+
+	auto finder = std::make_unique<rtfcp_finder>();
+	for (uint32_t i = 0; i + 3 <= RTF_INITLENGTH; ++i)
+		finder->insert(s, i);
+	std::string t(RTF_HEADERLENGTH, '\0');
+	t.reserve(RTF_HEADERLENGTH + len / 2 + 64);
+	size_t ctrl_pos = 0;
+	unsigned int ctrl_bit = 8;
+	auto next_item = [&](bool is_ref) {
+		if (ctrl_bit == 8) {
+			ctrl_pos = t.size();
+			t += '\0';
+			ctrl_bit = 0;
+		}
+		if (is_ref)
+			t[ctrl_pos] |= 1U << ctrl_bit;
+		++ctrl_bit;
+	};
+	auto push_ref = [&](uint32_t offset, uint32_t reflen) {
+		next_item(true);
+		uint16_t v = ((offset % RTF_DICTLENGTH) << 4) | (reflen - 2);
+		t += static_cast<char>(v >> 8);
+		t += static_cast<char>(v & 0xFF);
+	};
+	for (uint32_t pos = RTF_INITLENGTH; pos < end; ) {
+		uint32_t src = 0, mlen = 0;
+		auto max_len = std::min(end - pos, static_cast<uint32_t>(RTF_MAXMATCH));
+		if (max_len >= 3)
+			mlen = finder->find(s, pos, max_len, &src);
+		if (mlen < 3) {
+			next_item(false);
+			t += static_cast<char>(s[pos]);
+			finder->insert(s, pos);
+			++pos;
+			continue;
+		}
+		push_ref(src, mlen);
+		for (uint32_t i = 0; i < mlen; ++i)
+			finder->insert(s, pos + i);
+		pos += mlen;
+	}
+	/* The end marker is a reference to the current write offset */
+	push_ref(end, 2);
+	if (t.size() > RTF_HEADERLENGTH + static_cast<size_t>(len)) {
+		t.resize(RTF_HEADERLENGTH);
+		t.append(in.data(), len);
+		cpu_to_le32p(&t[8], RTF_UNCOMPRESSED);
+		cpu_to_le32p(&t[12], 0);
+	} else {
+		cpu_to_le32p(&t[8], RTF_COMPRESSED);
+		cpu_to_le32p(&t[12], rtfcp_crc(reinterpret_cast<const uint8_t *>(&t[RTF_HEADERLENGTH]),
+			t.size() - RTF_HEADERLENGTH));
+	}
+	cpu_to_le32p(&t[0], t.size() - 4);
+	cpu_to_le32p(&t[4], len);
 	out = std::move(t);
-	/* In-place editing via string.insert(0,...) is some 90% slower in GNU stdlibc++ */
 	return ecSuccess;
 } catch (const std::bad_alloc &) {
 	return ecMAPIOOM;
@@ -3,8 +3,13 @@
 // This file is part of Gromox.
 #include <algorithm>
 #include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <libHX/endian.h>
@@ -26,7 +31,9 @@
 #include <gromox/oxcmail.hpp>
 #include <gromox/pcl.hpp>
 #include <gromox/propval.hpp>
+#include <gromox/restriction.hpp>
 #include <gromox/rop_util.hpp>
+#include <gromox/rule_actions.hpp>
 #include <gromox/svc_common.h>
 #include <gromox/tie.hpp>
 #include <gromox/usercvt.hpp>
@@ -55,6 +62,122 @@ enum {
 	l_attendeecritchg, l_is_silent,
 };
 
+/**
+ * The message's properties sorted by proptag (first occurrence wins), so
+ * that each rule looks up only the tags its condition needs. Built once
+ * per message and only rebuilt when an action has replaced or resized
+ * the property array.
+ */
+struct rx_propindex {
+	void update(const TPROPVAL_ARRAY &);
+	const TAGGED_PROPVAL *find(proptag_t) const;
+
+	private:
+	std::vector<const TAGGED_PROPVAL *> m_sorted;
+	const TAGGED_PROPVAL *m_src = nullptr;
+	uint32_t m_count = 0;
+	bool m_valid = false;
+};
+
+/* Remaining RES_COUNT budget of each node during one evaluation */
+using rx_counts = std::unordered_map<const RESTRICTION_COUNT *, uint32_t>;
+
+/**
+ * A rule condition flattened into preorder. Each instruction records in
+ * @next where its subtree ends, so AND/OR can skip past operands without
+ * walking them. All proptags referenced at message level are collected
+ * into @tags and looked up in the message's rx_propindex once per
+ * evaluation, rather than once per leaf.
+ *
+ * RES_SUBRESTRICTION on recipients/attachments is compiled as well: the
+ * restriction below it is laid out with the same AND/OR/NOT structure,
+ * and each of its leaves (or RES_COUNT operand) becomes a program of its
+ * own in @subs, which is run against the subobject rows (@op).
+ */
+struct rx_program {
+	enum class rx_op : uint8_t {
+		plain,
+		row_any,   /* true if @subs[sub] matches any row of @subobj */
+		row_count, /* true if it matches exactly res.count->count rows */
+		row_fail,  /* restriction type not evaluable on subobjects */
+	};
+	struct insn {
+		mapi_rtype rt{};
+		rx_op op = rx_op::plain;
+		uint32_t next = 0, sub = 0;
+		proptag_t tag = 0, tag2 = 0, subobj = 0;
+		uint16_t slot = 0, slot2 = 0;
+		const RESTRICTION *res = nullptr;
+	};
+
+	bool compile(const RESTRICTION &, bool row = false);
+	bool eval(const MESSAGE_CONTENT *, const rx_propindex &) const;
+	bool eval_row(const TPROPVAL_ARRAY &) const;
+
+	std::vector<insn> code;
+	std::vector<proptag_t> tags;
+	std::vector<rx_program> subs;
+
+	private:
+	bool emit(const RESTRICTION &, bool row);
+	bool emit_sub(const RESTRICTION &, proptag_t subobj);
+	bool run(size_t pc, const MESSAGE_CONTENT *, const TAGGED_PROPVAL *const *) const;
+	bool run_rows(const insn &, const MESSAGE_CONTENT *) const;
+};
+
+struct rx_delete {
+	void operator()(BINARY *x) const { rop_util_free_binary(x); }
+	void operator()(MESSAGE_CONTENT *x) const { message_content_free(x); }
+	void operator()(RESTRICTION *x) const { restriction_free(x); }
+	void operator()(RULE_ACTIONS *x) const { rule_actions_free(x); }
+};
+
+/**
+ * A rule as kept in the per-folder cache. Unlike rule_node, it owns all of
+ * its data: standard rules are deep copies of the rule table rows,
+ * extended rules are deserialized into @xctx.
+ *
+ * @cn:		PidTagChangeNumber of the extended rule message
+ * @prog:	compiled form of the condition, if compilation succeeded
+ */
+struct rx_rule {
+	rx_rule() = default;
+	NOMOVE(rx_rule);
+
+	int32_t seq = 0;
+	uint32_t state = 0;
+	bool extended = false, compiled = false;
+	uint64_t rule_id = 0, cn = 0;
+	std::string name, provider;
+	std::unique_ptr<RESTRICTION, rx_delete> cond;
+	std::unique_ptr<RULE_ACTIONS, rx_delete> act;
+	alloc_context xctx;
+	RESTRICTION xcond{};
+	EXT_RULE_ACTIONS xact{};
+	NAMEDPROPERTY_INFO xcnames{}, xanames{};
+	rx_program prog;
+
+	inline bool active(bool oof) const {
+		return (state & ST_ENABLED) || (oof && (state & ST_ONLY_WHEN_OOF));
+	}
+	inline const RESTRICTION *condition() const {
+		return extended ? (xcond.pres != nullptr ? &xcond : nullptr) : cond.get();
+	}
+};
+
+/**
+ * @rule_cn:	folder's PR_RULE_TABLE_CN at the time @std_rules was loaded
+ * @ext_rules:	extended rules, indexed by message id
+ * @lru:	position in rp_cache_lru
+ */
+struct rx_folder_rules {
+	bool have_std = false;
+	uint64_t rule_cn = 0;
+	std::list<std::pair<std::string, uint64_t>>::iterator lru;
+	std::vector<std::shared_ptr<const rx_rule>> std_rules;
+	std::unordered_map<uint64_t, std::shared_ptr<const rx_rule>> ext_rules;
+};
+
 /**
  * @rule_id:	if @extended, message id of the extrule, else rule id.
  * @folder_id:	(Current) enclosing folder for @msg_id,
@@ -64,6 +187,8 @@ enum {
  * @name:	Name for debugging.
  * @provider:	Provider field from the rule, just copied to DAM/DEM.
  * @cond:	Rule conditions; may point to @xcond or something else.
+ * @prog:	Compiled form of @cond, if available.
+ * @origin:	Cache entry that @cond, @act and @xact point into.
  */
 struct rule_node {
 	rule_node() = default;
@@ -80,7 +205,8 @@ struct rule_node {
 	NAMEDPROPERTY_INFO xcnames{}, xanames{};
 	RESTRICTION *cond = nullptr;
 	RULE_ACTIONS *act = nullptr;
-	/* XXX: Who frees this? */
+	const rx_program *prog = nullptr;
+	std::shared_ptr<const rx_rule> origin;
 
 	bool operator<(const struct rule_node &o) const { return seq < o.seq; }
 };
@@ -91,11 +217,6 @@ struct message_node {
 	inline const char *dirc() const { return dir.c_str(); }
 };
 
-struct rx_delete {
-	void operator()(BINARY *x) const { rop_util_free_binary(x); }
-	void operator()(MESSAGE_CONTENT *x) const { message_content_free(x); }
-};
-
 struct mr_policy {
 	unsigned int dtyp = 0, capacity = 0;
 	bool autoproc = true, accept_appts = false;
@@ -113,6 +234,7 @@ using message_content_ptr = std::unique_ptr<MESSAGE_CONTENT, rx_delete>;
  *                Due to OP_MOVE, MIDs can change while rules execute.
  * @ctnt:         Message content. Also due to OP_MOVE, PR_CHANGE_KEY/PCL
  *                can change.
+ * @pidx:         Lookup index over @ctnt->proplist for rule conditions.
  * @rule_list:    Rules loaded from the mailbox (original Envelope-To's).
  *                Unlike EXC, we won't recurse into other mailbox's rules.
  * @exit:         Flag for op_process to stop early.
@@ -135,6 +257,7 @@ struct rxparam {
 	const char *ev_from = nullptr, *ev_to = nullptr;
 	message_node cur;
 	message_content *ctnt = nullptr;
+	rx_propindex pidx;
 	std::string orig_dir; /* rule table origin */
 	unsigned int m_flags = ~0U;
 	bool del = false, exit = false;
@@ -146,6 +269,12 @@ unsigned int g_ruleproc_debug;
 static std::string rp_smtp_url, rp_org_name;
 static thread_local alloc_context rp_alloc_ctx;
 static thread_local const char *rp_storedir;
+static thread_local alloc_context *rp_rule_ctx;
+static std::mutex rp_cache_lock;
+static std::map<std::pair<std::string, uint64_t>, rx_folder_rules> rp_cache;
+/* Keys of rp_cache, most recently used first */
+static std::list<std::pair<std::string, uint64_t>> rp_cache_lru;
+static size_t rp_cache_max;
 
 static void *cu_alloc(size_t z)
 {
@@ -221,7 +350,8 @@ rule_node::rule_node(rule_node &&o) :
 	name(std::move(o.name)), provider(std::move(o.provider)),
 	xcond(std::move(o.xcond)), xact(std::move(o.xact)),
 	xcnames(std::move(o.xcnames)), xanames(std::move(o.xanames)),
-	cond(o.cond == std::addressof(o.xcond) ? std::addressof(xcond) : o.cond), act(o.act)
+	cond(o.cond == std::addressof(o.xcond) ? std::addressof(xcond) : o.cond), act(o.act),
+	prog(o.prog), origin(std::move(o.origin))
 {
 	o.cond = nullptr;
 	o.act = nullptr;
@@ -245,6 +375,8 @@ rule_node &rule_node::operator=(rule_node &&o)
 	o.cond = nullptr;
 	act = o.act;
 	o.act = nullptr;
+	prog = o.prog;
+	origin = std::move(o.origin);
 	return *this;
 }
 
@@ -393,16 +525,62 @@ ec_error_t rxparam::is_oof(bool *oof) const
 }
 
 /**
- * Preconditions: @this->cur needs to be set
- * Postconditions: @rule_list has new rules appended to
+ * Look up (or make) the cache slot for a folder, evicting the least recently
+ * used one if the cache is full. Caller must hold rp_cache_lock.
  */
-ec_error_t rxparam::load_std_rules(bool oof,
-    std::vector<rule_node> &rule_list) const
+static rx_folder_rules &rx_cache_slot(const std::string &dir, uint64_t fid)
+{
+	auto key = std::make_pair(dir, fid);
+	auto it = rp_cache.find(key);
+	if (it != rp_cache.end()) {
+		rp_cache_lru.splice(rp_cache_lru.begin(), rp_cache_lru, it->second.lru);
+		return it->second;
+	}
+	if (rp_cache.size() >= rp_cache_max && !rp_cache_lru.empty()) {
+		rp_cache.erase(rp_cache_lru.back());
+		rp_cache_lru.pop_back();
+	}
+	rp_cache_lru.push_front(key);
+	try {
+		it = rp_cache.emplace(std::move(key), rx_folder_rules{}).first;
+	} catch (...) {
+		rp_cache_lru.pop_front();
+		throw;
+	}
+	it->second.lru = rp_cache_lru.begin();
+	return it->second;
+}
+
+static rule_node rx_make_node(std::shared_ptr<const rx_rule> &&r)
+{
+	rule_node rule;
+	rule.seq = r->seq;
+	rule.state = r->state;
+	rule.extended = r->extended;
+	rule.rule_id = r->rule_id;
+	rule.name = r->name;
+	rule.provider = r->provider;
+	rule.cond = deconst(r->condition());
+	if (r->extended)
+		rule.xact = r->xact;
+	else
+		rule.act = r->act.get();
+	if (r->compiled)
+		rule.prog = &r->prog;
+	rule.origin = std::move(r);
+	return rule;
+}
+
+/**
+ * Download the standard rules of a folder, irrespective of OOF state.
+ */
+static ec_error_t rx_fetch_std_rules(const char *dir, eid_t fid,
+    std::vector<std::shared_ptr<const rx_rule>> &out)
 {
 	uint32_t table_id = 0, row_count = 0;
 
 	RESTRICTION_BITMASK rst_1 = {BMR_NEZ, PR_RULE_STATE, ST_ENABLED};
-	RESTRICTION_BITMASK rst_2 = {BMR_NEZ, PR_RULE_STATE, oof ? ST_ONLY_WHEN_OOF : 0U};
+	RESTRICTION_BITMASK rst_2 = {BMR_NEZ, PR_RULE_STATE, ST_ONLY_WHEN_OOF};
 	RESTRICTION rst_3[]       = {{RES_BITMASK, {&rst_1}}, {RES_BITMASK, {&rst_2}}};
 	RESTRICTION_AND_OR rst_4  = {std::size(rst_3), rst_3};
 
@@ -411,8 +589,7 @@ ec_error_t rxparam::load_std_rules(bool oof,
 	RESTRICTION_AND_OR rst_7  = {std::size(rst_6), rst_6};
 	RESTRICTION rst_8         = {RES_AND, {&rst_7}};
 
-	auto dir = cur.dirc();
-	if (!exmdb_client->load_rule_table(dir, cur.fid, 0, &rst_8,
+	if (!exmdb_client->load_rule_table(dir, fid, 0, &rst_8,
 	    &table_id, &row_count))
 		return ecError;
 	auto cl_0 = HX::make_scope_exit([&]() { exmdb_client->unload_table(dir, table_id); });
@@ -434,15 +611,27 @@ ec_error_t rxparam::load_std_rules(bool oof,
 		auto id    = row->get<const uint64_t>(PR_RULE_ID);
 		if (seq == nullptr || state == nullptr || id == nullptr)
 			continue;
-		rule_node rule;
-		rule.seq = *seq;
-		rule.state = *state;
-		rule.rule_id = *id;
-		rule.name = znul(row->get<const char>(PR_RULE_NAME));
-		rule.provider = znul(row->get<const char>(PR_RULE_PROVIDER));
-		rule.cond = row->get<RESTRICTION>(PR_RULE_CONDITION);
-		rule.act = row->get<RULE_ACTIONS>(PR_RULE_ACTIONS);
-		rule_list.push_back(std::move(rule));
+		auto rule = std::make_shared<rx_rule>();
+		rule->seq = *seq;
+		rule->state = *state;
+		rule->rule_id = *id;
+		rule->name = znul(row->get<const char>(PR_RULE_NAME));
+		rule->provider = znul(row->get<const char>(PR_RULE_PROVIDER));
+		auto cond = row->get<const RESTRICTION>(PR_RULE_CONDITION);
+		auto act  = row->get<const RULE_ACTIONS>(PR_RULE_ACTIONS);
+		if (cond != nullptr) {
+			rule->cond.reset(cond->dup());
+			if (rule->cond == nullptr)
+				return ecServerOOM;
+		}
+		if (act != nullptr && act->count > 0) {
+			rule->act.reset(rule_actions_dup(act));
+			if (rule->act == nullptr)
+				return ecServerOOM;
+		}
+		if (rule->cond != nullptr)
+			rule->compiled = rule->prog.compile(*rule->cond);
+		out.push_back(std::move(rule));
 	}
 	return ecSuccess;
 }
@@ -450,6 +639,115 @@ ec_error_t rxparam::load_std_rules(bool oof,
 /**
  * Preconditions: @this->cur needs to be set
  * Postconditions: @rule_list has new rules appended to
+ *
+ * The folder's rule table is only downloaded again when its
+ * PR_RULE_TABLE_CN has moved since the last delivery.
+ */
+ec_error_t rxparam::load_std_rules(bool oof,
+    std::vector<rule_node> &rule_list) const
+{
+	static constexpr proptag_t tags[] = {PR_RULE_TABLE_CN};
+	auto dir = cur.dirc();
+	TPROPVAL_ARRAY props{};
+	if (!exmdb_client->get_folder_properties(dir, CP_ACP, cur.fid,
+	    tags, &props))
+		return ecError;
+	auto num = props.get<const uint64_t>(PR_RULE_TABLE_CN);
+	uint64_t rule_cn = num != nullptr ? *num : 0;
+	std::vector<std::shared_ptr<const rx_rule>> rules;
+	bool hit = false;
+	if (rp_cache_max > 0) {
+		std::lock_guard hold(rp_cache_lock);
+		auto &slot = rx_cache_slot(cur.dir, cur.fid);
+		if (slot.have_std && slot.rule_cn == rule_cn) {
+			rules = slot.std_rules;
+			hit = true;
+		}
+	}
+	if (!hit) {
+		auto err = rx_fetch_std_rules(dir, cur.fid, rules);
+		if (err != ecSuccess)
+			return err;
+		if (rp_cache_max > 0) {
+			std::lock_guard hold(rp_cache_lock);
+			auto &slot = rx_cache_slot(cur.dir, cur.fid);
+			slot.have_std = true;
+			slot.rule_cn  = rule_cn;
+			slot.std_rules = rules;
+		}
+	}
+	for (auto &&r : rules)
+		if (r->active(oof))
+			rule_list.push_back(rx_make_node(std::move(r)));
+	return ecSuccess;
+}
+
+static void *rx_rule_alloc(size_t z)
+{
+	return rp_rule_ctx->alloc(z);
+}
+
+/**
+ * Fetch and deserialize one extended rule. @out is left empty if the
+ * message does not carry a usable rule.
+ */
+static ec_error_t rx_fetch_ext_rule(const char *dir, const TPROPVAL_ARRAY &row,
+    std::shared_ptr<const rx_rule> &out)
+{
+	static constexpr proptag_t tags2[] = {
+		PR_EXTENDED_RULE_MSG_CONDITION, PR_EXTENDED_RULE_MSG_ACTIONS,
+	};
+	auto seq   = row.get<const int32_t>(PR_RULE_MSG_SEQUENCE);
+	auto state = row.get<const uint32_t>(PR_RULE_MSG_STATE);
+	auto mid   = row.get<const uint64_t>(PidTagMid);
+	auto cn    = row.get<const uint64_t>(PidTagChangeNumber);
+	TPROPVAL_ARRAY vals2{};
+	if (!exmdb_client->get_message_properties(dir, nullptr, CP_ACP,
+	    *mid, tags2, &vals2))
+		return ecSuccess;
+	auto cond = vals2.get<const BINARY>(PR_EXTENDED_RULE_MSG_CONDITION);
+	auto act  = vals2.get<const BINARY>(PR_EXTENDED_RULE_MSG_ACTIONS);
+	if (act == nullptr || act->cb == 0)
+		return ecSuccess;
+
+	auto rule = std::make_shared<rx_rule>();
+	rule->seq = *seq;
+	rule->state = *state;
+	rule->extended = true;
+	rule->rule_id = *mid;
+	rule->cn = cn != nullptr ? *cn : 0;
+	rule->name = znul(row.get<const char>(PR_RULE_MSG_NAME));
+	rule->provider = znul(row.get<const char>(PR_RULE_MSG_PROVIDER));
+	rp_rule_ctx = &rule->xctx;
+	auto cl_0 = HX::make_scope_exit([]() { rp_rule_ctx = nullptr; });
+	EXT_PULL ep;
+	if (cond != nullptr && cond->cb != 0) {
+		ep.init(cond->pb, cond->cb, rx_rule_alloc,
+			EXT_FLAG_WCOUNT | EXT_FLAG_UTF16);
+		if (ep.g_namedprop_info(&rule->xcnames) != pack_result::ok ||
+		    ep.g_restriction(&rule->xcond) != pack_result::ok)
+			return ecError;
+		rule->compiled = rule->prog.compile(rule->xcond);
+	}
+	uint32_t version = 0;
+	ep.init(act->pb, act->cb, rx_rule_alloc,
+		EXT_FLAG_WCOUNT | EXT_FLAG_UTF16);
+	if (ep.g_namedprop_info(&rule->xanames) != pack_result::ok ||
+	    ep.g_uint32(&version) != pack_result::ok ||
+	    version != 1 ||
+	    ep.g_ext_rule_actions(&rule->xact) != pack_result::ok)
+		return ecError;
+	out = std::move(rule);
+	return ecSuccess;
+}
+
+/**
+ * Preconditions: @this->cur needs to be set
+ * Postconditions: @rule_list has new rules appended to
+ *
+ * Extended rules whose message has not changed (same PidTagChangeNumber)
+ * since the last delivery are taken from the cache without downloading
+ * and deserializing them again.
  */
 ec_error_t rxparam::load_ext_rules(bool oof,
     std::vector<rule_node> &rule_list) const
@@ -457,7 +755,7 @@ ec_error_t rxparam::load_ext_rules(bool oof,
 	uint32_t table_id = 0, row_count = 0;
 
 	RESTRICTION_BITMASK rst_1 = {BMR_NEZ, PR_RULE_MSG_STATE, ST_ENABLED};
-	RESTRICTION_BITMASK rst_2 = {BMR_NEZ, PR_RULE_MSG_STATE, oof ? ST_ONLY_WHEN_OOF : 0U};
+	RESTRICTION_BITMASK rst_2 = {BMR_NEZ, PR_RULE_MSG_STATE, ST_ONLY_WHEN_OOF};
 	RESTRICTION rst_3[2]      = {{RES_BITMASK, {&rst_1}}, {RES_BITMASK, {&rst_2}}};
 	RESTRICTION_AND_OR rst_4  = {std::size(rst_3), rst_3};
 
@@ -478,16 +776,18 @@ ec_error_t rxparam::load_ext_rules(bool oof,
 
 	static constexpr proptag_t tags[] = {
 		PR_RULE_MSG_STATE, PidTagMid, PR_RULE_MSG_SEQUENCE,
-		PR_RULE_MSG_PROVIDER,
-	};
-	static constexpr proptag_t tags2[] = {
-		PR_EXTENDED_RULE_MSG_CONDITION, PR_EXTENDED_RULE_MSG_ACTIONS,
+		PR_RULE_MSG_PROVIDER, PR_RULE_MSG_NAME, PidTagChangeNumber,
 	};
 	tarray_set output_rows{};
 	if (!exmdb_client->query_table(dir, nullptr, CP_ACP, table_id, tags,
 	    0, row_count, &output_rows))
 		return ecError;
 
+	std::unordered_map<uint64_t, std::shared_ptr<const rx_rule>> known, seen;
+	if (rp_cache_max > 0) {
+		std::lock_guard hold(rp_cache_lock);
+		known = rx_cache_slot(cur.dir, cur.fid).ext_rules;
+	}
 	for (unsigned int i = 0; i < output_rows.count; ++i) {
 		auto row   = output_rows.pparray[i];
 		if (row == nullptr)
@@ -495,60 +795,46 @@ ec_error_t rxparam::load_ext_rules(bool oof,
 		auto seq   = row->get<const int32_t>(PR_RULE_MSG_SEQUENCE);
 		auto state = row->get<const uint32_t>(PR_RULE_MSG_STATE);
 		auto mid   = row->get<const uint64_t>(PidTagMid);
+		auto cn    = row->get<const uint64_t>(PidTagChangeNumber);
 		if (seq == nullptr || state == nullptr || mid == nullptr)
 			continue;
-
-		rule_node rule;
-		rule.seq = *seq;
-		rule.state = *state;
-		rule.extended = true;
-		rule.rule_id = *mid;
-		rule.name = znul(row->get<const char>(PR_RULE_MSG_NAME));
-		rule.provider = znul(row->get<const char>(PR_RULE_MSG_PROVIDER));
-		TPROPVAL_ARRAY vals2{};
-		if (!exmdb_client->get_message_properties(dir, nullptr, CP_ACP,
-		    *mid, tags2, &vals2))
-			continue;
-		auto cond = vals2.get<const BINARY>(PR_EXTENDED_RULE_MSG_CONDITION);
-		auto act  = vals2.get<const BINARY>(PR_EXTENDED_RULE_MSG_ACTIONS);
-		if (act == nullptr || act->cb == 0)
-			continue;
-		EXT_PULL ep;
-		if (cond != nullptr && cond->cb != 0) {
-			ep.init(cond->pb, cond->cb, exmdb_rpc_alloc,
-				EXT_FLAG_WCOUNT | EXT_FLAG_UTF16);
-			if (ep.g_namedprop_info(&rule.xcnames) != pack_result::ok ||
-			    ep.g_restriction(&rule.xcond) != pack_result::ok)
-				return ecError;
-			rule.cond = &rule.xcond;
+		std::shared_ptr<const rx_rule> rule;
+		auto it = known.find(*mid);
+		if (it != known.end() && cn != nullptr && it->second->cn == *cn) {
+			rule = it->second;
+		} else {
+			auto err = rx_fetch_ext_rule(dir, *row, rule);
+			if (err != ecSuccess)
+				return err;
+			if (rule == nullptr)
+				continue;
 		}
-		uint32_t version = 0;
-		ep.init(act->pb, act->cb, exmdb_rpc_alloc,
-			EXT_FLAG_WCOUNT | EXT_FLAG_UTF16);
-		if (ep.g_namedprop_info(&rule.xanames) != pack_result::ok ||
-		    ep.g_uint32(&version) != pack_result::ok ||
-		    version != 1 ||
-		    ep.g_ext_rule_actions(&rule.xact) != pack_result::ok)
-			return ecError;
-		rule_list.emplace_back(std::move(rule));
+		seen.emplace(*mid, rule);
+		if (rule->active(oof))
+			rule_list.emplace_back(rx_make_node(std::move(rule)));
+	}
+	if (rp_cache_max > 0) {
+		std::lock_guard hold(rp_cache_lock);
+		rx_cache_slot(cur.dir, cur.fid).ext_rules = std::move(seen);
 	}
 	return ecSuccess;
 }
 
-static bool rx_eval_props(const MESSAGE_CONTENT *ct, const TPROPVAL_ARRAY &props, const RESTRICTION &res);
+static bool rx_eval_props(const MESSAGE_CONTENT *ct, const TPROPVAL_ARRAY &props, const RESTRICTION &res, rx_counts &);
 
 static bool rx_eval_msgsub(const MESSAGE_CHILDREN &ch, proptag_t tag,
-    const RESTRICTION &res)
+    const RESTRICTION &res, rx_counts &counts)
 {
 	uint32_t count = 0;
 	if (tag == PR_MESSAGE_RECIPIENTS && ch.prcpts != nullptr) {
 		for (const auto &rcpt : *ch.prcpts) {
 			if (res.rt == RES_COUNT) {
 				if (rx_eval_props(nullptr, rcpt,
-				    static_cast<RESTRICTION_COUNT *>(res.pres)->sub_res))
+				    static_cast<RESTRICTION_COUNT *>(res.pres)->sub_res,
+				    counts))
 					++count;
 			} else {
-				if (rx_eval_props(nullptr, rcpt, res))
+				if (rx_eval_props(nullptr, rcpt, res, counts))
 					return true;
 			}
 		}
@@ -556,10 +842,11 @@ static bool rx_eval_msgsub(const MESSAGE_CHILDREN &ch, proptag_t tag,
 		for (const auto &at : *ch.pattachments) {
 			if (res.rt == RES_COUNT) {
 				if (rx_eval_props(nullptr, at.proplist,
-				    static_cast<RESTRICTION_COUNT *>(res.pres)->sub_res))
+				    static_cast<RESTRICTION_COUNT *>(res.pres)->sub_res,
+				    counts))
 					++count;
 			} else {
-				if (rx_eval_props(nullptr, at.proplist, res))
+				if (rx_eval_props(nullptr, at.proplist, res, counts))
 					return true;
 			}
 		}
@@ -568,21 +855,21 @@ static bool rx_eval_msgsub(const MESSAGE_CHILDREN &ch, proptag_t tag,
 }
 
 static bool rx_eval_sub(const MESSAGE_CONTENT *ct, proptag_t tag,
-    const RESTRICTION &res)
+    const RESTRICTION &res, rx_counts &counts)
 {
 	switch (res.rt) {
 	case RES_OR:
 		for (size_t i = 0; i < res.andor->count; ++i)
-			if (rx_eval_sub(ct, tag, res.andor->pres[i]))
+			if (rx_eval_sub(ct, tag, res.andor->pres[i], counts))
 				return true;
 		return false;
 	case RES_AND:
 		for (size_t i = 0; i < res.andor->count; ++i)
-			if (!rx_eval_sub(ct, tag, res.andor->pres[i]))
+			if (!rx_eval_sub(ct, tag, res.andor->pres[i], counts))
 				return false;
 		return true;
 	case RES_NOT:
-		return !rx_eval_sub(ct, tag, res.xnot->res);
+		return !rx_eval_sub(ct, tag, res.xnot->res, counts);
 	case RES_CONTENT:
 	case RES_PROPERTY:
 	case RES_PROPCOMPARE:
@@ -594,7 +881,7 @@ static bool rx_eval_sub(const MESSAGE_CONTENT *ct, proptag_t tag,
 	case RES_COUNT: {
 		MESSAGE_CHILDREN none{};
 		auto &ch = ct != nullptr ? ct->children : none;
-		return rx_eval_msgsub(ch, tag, res);
+		return rx_eval_msgsub(ch, tag, res, counts);
 	}
 	default:
 		mlog(LV_WARN, "W-2334: restriction type %u unevaluated",
@@ -603,22 +890,26 @@ static bool rx_eval_sub(const MESSAGE_CONTENT *ct, proptag_t tag,
 	}
 }
 
+/**
+ * The cached rule conditions are shared between deliveries, so RES_COUNT
+ * budgets are kept in @counts rather than decremented in place.
+ */
 static bool rx_eval_props(const MESSAGE_CONTENT *ct, const TPROPVAL_ARRAY &props,
-    const RESTRICTION &res)
+    const RESTRICTION &res, rx_counts &counts)
 {
 	switch (res.rt) {
 	case RES_OR:
 		for (size_t i = 0; i < res.andor->count; ++i)
-			if (rx_eval_props(ct, props, res.andor->pres[i]))
+			if (rx_eval_props(ct, props, res.andor->pres[i], counts))
 				return true;
 		return false;
 	case RES_AND:
 		for (size_t i = 0; i < res.andor->count; ++i)
-			if (!rx_eval_props(ct, props, res.andor->pres[i]))
+			if (!rx_eval_props(ct, props, res.andor->pres[i], counts))
 				return false;
 		return true;
 	case RES_NOT:
-		return !rx_eval_props(ct, props, res.xnot->res);
+		return !rx_eval_props(ct, props, res.xnot->res, counts);
 	case RES_CONTENT: {
 		auto &rcon = *res.cont;
 		return rcon.comparable() && rcon.eval(props.getval(rcon.proptag));
@@ -658,21 +949,22 @@ static bool rx_eval_props(const MESSAGE_CONTENT *ct, const TPROPVAL_ARRAY &props
 		auto &rsub = *res.sub;
 		if (rsub.subobject == PR_MESSAGE_RECIPIENTS ||
 		    rsub.subobject == PR_MESSAGE_ATTACHMENTS)
-			return rx_eval_sub(ct, rsub.subobject, rsub.res);
+			return rx_eval_sub(ct, rsub.subobject, rsub.res, counts);
 		return false;
 	}
 	case RES_COMMENT:
 	case RES_ANNOTATION:
 		if (res.comment->pres == nullptr)
 			return TRUE;
-		return rx_eval_props(ct, props, *res.comment->pres);
+		return rx_eval_props(ct, props, *res.comment->pres, counts);
 	case RES_COUNT: {
 		auto &rcnt = *res.count;
-		if (rcnt.count == 0)
+		auto &left = counts.try_emplace(&rcnt, rcnt.count).first->second;
+		if (left == 0)
 			return false;
-		if (!rx_eval_props(ct, props, rcnt.sub_res))
+		if (!rx_eval_props(ct, props, rcnt.sub_res, counts))
 			return false;
-		--rcnt.count;
+		--left;
 		return true;
 	}
 	case RES_NULL:
@@ -685,6 +977,303 @@ static bool rx_eval_props(const MESSAGE_CONTENT *ct, const TPROPVAL_ARRAY &props
 	return false;
 }
 
+/**
+ * Returns false if @res cannot be compiled. Within a subobject row
+ * program (@row), RES_COUNT is refused: its budget is shared across rows,
+ * which only the tree walker models.
+ */
+bool rx_program::emit(const RESTRICTION &res, bool row)
+{
+	auto idx = code.size();
+	code.emplace_back();
+	code[idx].rt  = res.rt;
+	code[idx].res = &res;
+	bool ok = true;
+	switch (res.rt) {
+	case RES_AND:
+	case RES_OR:
+		for (size_t i = 0; ok && i < res.andor->count; ++i)
+			ok = emit(res.andor->pres[i], row);
+		break;
+	case RES_NOT:
+		ok = emit(res.xnot->res, row);
+		break;
+	case RES_COMMENT:
+	case RES_ANNOTATION:
+		if (res.comment->pres != nullptr)
+			ok = emit(*res.comment->pres, row);
+		break;
+	case RES_COUNT:
+		ok = !row && emit(res.count->sub_res, row);
+		break;
+	case RES_CONTENT:
+		code[idx].tag = res.cont->proptag;
+		break;
+	case RES_PROPERTY:
+		code[idx].tag = res.prop->proptag;
+		break;
+	case RES_PROPCOMPARE:
+		code[idx].tag  = res.pcmp->proptag1;
+		code[idx].tag2 = res.pcmp->proptag2;
+		break;
+	case RES_BITMASK:
+		code[idx].tag = res.bm->proptag;
+		break;
+	case RES_SIZE:
+		code[idx].tag = res.size->proptag;
+		break;
+	case RES_EXIST:
+		code[idx].tag = res.exist->proptag;
+		break;
+	case RES_SUBRESTRICTION:
+		if (res.sub->subobject == PR_MESSAGE_RECIPIENTS ||
+		    res.sub->subobject == PR_MESSAGE_ATTACHMENTS) {
+			code.pop_back();
+			return emit_sub(res.sub->res, res.sub->subobject);
+		}
+		break;
+	default:
+		break;
+	}
+	code[idx].next = code.size();
+	return ok;
+}
+
+/**
+ * Lay out the restriction below a RES_SUBRESTRICTION the way rx_eval_sub
+ * interprets it.
+ */
+bool rx_program::emit_sub(const RESTRICTION &res, proptag_t subobj)
+{
+	auto idx = code.size();
+	code.emplace_back();
+	code[idx].rt  = res.rt;
+	code[idx].res = &res;
+	code[idx].subobj = subobj;
+	bool ok = true;
+	switch (res.rt) {
+	case RES_AND:
+	case RES_OR:
+		for (size_t i = 0; ok && i < res.andor->count; ++i)
+			ok = emit_sub(res.andor->pres[i], subobj);
+		break;
+	case RES_NOT:
+		ok = emit_sub(res.xnot->res, subobj);
+		break;
+	case RES_CONTENT:
+	case RES_PROPERTY:
+	case RES_PROPCOMPARE:
+	case RES_BITMASK:
+	case RES_SIZE:
+	case RES_EXIST:
+	case RES_COMMENT:
+	case RES_ANNOTATION:
+	case RES_COUNT: {
+		bool cnt = res.rt == RES_COUNT;
+		code[idx].op  = cnt ? rx_op::row_count : rx_op::row_any;
+		code[idx].sub = subs.size();
+		subs.emplace_back();
+		ok = subs.back().compile(cnt ? res.count->sub_res : res, true);
+		break;
+	}
+	default:
+		code[idx].op = rx_op::row_fail;
+		break;
+	}
+	code[idx].next = code.size();
+	return ok;
+}
+
+/**
+ * Flatten @res. Returns false if the condition is unsuitable, in which case
+ * the caller falls back to rx_eval_props.
+ */
+bool rx_program::compile(const RESTRICTION &res, bool row) try
+{
+	code.clear();
+	tags.clear();
+	subs.clear();
+	if (!emit(res, row))
+		return false;
+	for (const auto &i : code) {
+		if (i.tag != 0)
+			tags.push_back(i.tag);
+		if (i.tag2 != 0)
+			tags.push_back(i.tag2);
+	}
+	std::sort(tags.begin(), tags.end());
+	tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+	if (tags.size() > UINT16_MAX || code.size() > UINT32_MAX)
+		return false;
+	for (auto &i : code) {
+		i.slot  = std::lower_bound(tags.begin(), tags.end(), i.tag) - tags.begin();
+		i.slot2 = std::lower_bound(tags.begin(), tags.end(), i.tag2) - tags.begin();
+	}
+	return true;
+} catch (const std::bad_alloc &) {
+	return false;
+}
+
+bool rx_program::run_rows(const insn &in, const MESSAGE_CONTENT *ct) const
+{
+	if (in.op == rx_op::row_fail) {
+		mlog(LV_WARN, "W-2476: restriction type %u unevaluated on subobjects",
+			static_cast<unsigned int>(in.rt));
+		return false;
+	}
+	auto &prog = subs[in.sub];
+	uint32_t count = 0;
+	auto visit = [&](const TPROPVAL_ARRAY &row) {
+		if (!prog.eval_row(row))
+			return false;
+		++count;
+		return in.op == rx_op::row_any;
+	};
+	if (ct != nullptr && in.subobj == PR_MESSAGE_RECIPIENTS &&
+	    ct->children.prcpts != nullptr) {
+		for (const auto &rcpt : *ct->children.prcpts)
+			if (visit(rcpt))
+				return true;
+	} else if (ct != nullptr && in.subobj == PR_MESSAGE_ATTACHMENTS &&
+	    ct->children.pattachments != nullptr) {
+		for (const auto &at : *ct->children.pattachments)
+			if (visit(at.proplist))
+				return true;
+	}
+	return in.op == rx_op::row_count && in.res->count->count == count;
+}
+
+bool rx_program::run(size_t pc, const MESSAGE_CONTENT *ct,
+    const TAGGED_PROPVAL *const *vals) const
+{
+	auto &in  = code[pc];
+	auto &res = *in.res;
+	auto val  = [&](uint16_t s) -> const void * {
+		return vals[s] != nullptr ? vals[s]->pvalue : nullptr;
+	};
+	if (in.op != rx_op::plain)
+		return run_rows(in, ct);
+	switch (in.rt) {
+	case RES_OR:
+		for (auto c = pc + 1; c < in.next; c = code[c].next)
+			if (run(c, ct, vals))
+				return true;
+		return false;
+	case RES_AND:
+		for (auto c = pc + 1; c < in.next; c = code[c].next)
+			if (!run(c, ct, vals))
+				return false;
+		return true;
+	case RES_NOT:
+		return !run(pc + 1, ct, vals);
+	case RES_CONTENT: {
+		auto &rcon = *res.cont;
+		return rcon.comparable() && rcon.eval(val(in.slot));
+	}
+	case RES_PROPERTY: {
+		auto &rprop = *res.prop;
+		if (!rprop.comparable())
+			return false;
+		auto lhs = val(in.slot);
+		if (rprop_srchkey_eq(rprop, lhs, rp_org_name.c_str(),
+		    mysql_adaptor_userid_to_name))
+			return rprop.relop == RELOP_EQ;
+		return rprop.eval(lhs);
+	}
+	case RES_PROPCOMPARE: {
+		auto &rprop = *res.pcmp;
+		if (!rprop.comparable())
+			return false;
+		return propval_compare_relop_nullok(rprop.relop,
+		       PROP_TYPE(rprop.proptag1), val(in.slot), val(in.slot2));
+	}
+	case RES_BITMASK: {
+		auto &rbm = *res.bm;
+		return rbm.comparable() && rbm.eval(val(in.slot));
+	}
+	case RES_SIZE:
+		return res.size->eval(val(in.slot));
+	case RES_EXIST:
+		return vals[in.slot] != nullptr;
+	case RES_SUBRESTRICTION:
+		/* Recipients/attachments were compiled into row programs */
+		return false;
+	case RES_COMMENT:
+	case RES_ANNOTATION:
+		return pc + 1 == in.next ? true : run(pc + 1, ct, vals);
+	case RES_COUNT:
+		/*
+		 * At message level, each node is visited at most once per
+		 * evaluation, so the budget cannot run out midway.
+		 */
+		return res.count->count != 0 && run(pc + 1, ct, vals);
+	case RES_NULL:
+		return true;
+	default:
+		mlog(LV_WARN, "W-2468: restriction type %u unevaluated",
+			static_cast<unsigned int>(in.rt));
+		return false;
+	}
+}
+
+bool rx_program::eval(const MESSAGE_CONTENT *ct,
+    const rx_propindex &idx) const
+{
+	std::vector<const TAGGED_PROPVAL *> vals(tags.size());
+	for (size_t i = 0; i < tags.size(); ++i)
+		vals[i] = idx.find(tags[i]);
+	return run(0, ct, vals.data());
+}
+
+/**
+ * Evaluate a subobject row program. Rows are small, so their properties
+ * are looked up directly.
+ */
+bool rx_program::eval_row(const TPROPVAL_ARRAY &row) const
+{
+	std::vector<const TAGGED_PROPVAL *> vals(tags.size());
+	for (size_t i = 0; i < tags.size(); ++i)
+		vals[i] = row.find(tags[i]);
+	return run(0, nullptr, vals.data());
+}
+
+void rx_propindex::update(const TPROPVAL_ARRAY &props)
+{
+	if (m_valid && m_src == props.ppropval && m_count == props.count)
+		return;
+	m_valid = false;
+	m_sorted.resize(props.count);
+	for (size_t i = 0; i < props.count; ++i)
+		m_sorted[i] = &props.ppropval[i];
+	std::stable_sort(m_sorted.begin(), m_sorted.end(),
+		[](const TAGGED_PROPVAL *a, const TAGGED_PROPVAL *b) {
+			return a->proptag < b->proptag;
+		});
+	m_src = props.ppropval;
+	m_count = props.count;
+	m_valid = true;
+}
+
+const TAGGED_PROPVAL *rx_propindex::find(proptag_t tag) const
+{
+	auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), tag,
+	          [](const TAGGED_PROPVAL *a, proptag_t t) { return a->proptag < t; });
+	return it != m_sorted.end() && (*it)->proptag == tag ? *it : nullptr;
+}
+
+static bool rx_eval_rule(rxparam &par, const rule_node &rule) try
+{
+	if (rule.prog != nullptr) {
+		par.pidx.update(par.ctnt->proplist);
+		return rule.prog->eval(par.ctnt, par.pidx);
+	}
+	rx_counts counts;
+	return rx_eval_props(par.ctnt, par.ctnt->proplist, *rule.cond, counts);
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2469: ENOMEM");
+	return false;
+}
+
 static ec_error_t op_copy_other(rxparam &par, const rule_node &rule,
     const MOVECOPY_ACTION &mc, uint8_t act_type)
 {
@@ -1035,7 +1624,7 @@ static ec_error_t op_process(rxparam &par, const rule_node &rule)
 	if (rule.cond != nullptr) {
 		if (g_ruleproc_debug)
 			mlog(LV_DEBUG, "Rule_Condition %s", rule.cond->repr().c_str());
-		if (!rx_eval_props(par.ctnt, par.ctnt->proplist, *rule.cond))
+		if (!rx_eval_rule(par, rule))
 			return ecSuccess;
 	}
 	if (rule.state & ST_EXIT_LEVEL)
@@ -1072,8 +1661,7 @@ static ec_error_t opx_process(rxparam &par, const rule_node &rule)
 {
 	if (par.exit && !(rule.state & ST_ONLY_WHEN_OOF))
 		return ecSuccess;
-	if (rule.cond != nullptr &&
-	    !rx_eval_props(par.ctnt, par.ctnt->proplist, *rule.cond))
+	if (rule.cond != nullptr && !rx_eval_rule(par, rule))
 		return ecSuccess;
 	if (rule.state & ST_EXIT_LEVEL)
 		par.exit = true;
@@ -2273,6 +2861,7 @@ static ec_error_t exmdb_local_rules_execute(const char *dir, const char *ev_from
 
 static constexpr cfg_directive rp_config_defaults[] = {
 	{"outgoing_smtp_url", "sendmail://localhost"},
+	{"ruleproc_cache_size", "1024", CFG_SIZE},
 	{"ruleproc_debug", "0", CFG_BOOL},
 	{"x500_org_name", "Gromox default"},
 	CFG_TABLE_END,
@@ -2290,6 +2879,7 @@ bool SVC_ruleproc(enum plugin_op reason, const struct dlfuncs &param)
 		/* e.g. permission error */
 		return false;
 	g_ruleproc_debug = parse_bool(cfg->get_value("ruleproc_debug"));
+	rp_cache_max = cfg->get_ll("ruleproc_cache_size");
 	rp_org_name = znul(cfg->get_value("x500_org_name"));
 	auto str = cfg->get_value("outgoing_smtp_url");
 	if (str != nullptr) {
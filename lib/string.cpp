@@ -982,8 +982,8 @@ std::string iconvtext(std::string_view sv,
 		errno = 0;
 		return std::string(sv);
 	}
-	auto cd = iconv_open(to, from);
-	if (cd == reinterpret_cast<iconv_t>(-1)) {
+	iconv_pooled cd(to, from);
+	if (!cd.valid()) {
 		mlog(LV_ERR, "E-2116: iconv_open(%s -> %s): %s", from, to, strerror(errno));
 		errno = EINVAL;
 		return {};
@@ -1032,10 +1032,8 @@ std::string iconvtext(std::string_view sv,
 				out += '?';
 		}
 		errno = 0;
-		iconv_close(cd);
 		return out;
 	} catch (const std::bad_alloc &) {
-		iconv_close(cd);
 		errno = ENOMEM;
 		return {};
 	}
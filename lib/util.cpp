@@ -30,6 +30,10 @@
 #if defined(__linux__)
 #	include <sys/random.h>
 #endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#	include <immintrin.h>
+#	define GX_X86_SIMD 1
+#endif
 
 using namespace gromox;
 
@@ -271,6 +275,80 @@ const char* replace_iconv_charset(const char *charset)
 	return charset;
 }
 
+namespace {
+/* Idle iconv descriptors of one thread, least recently used first */
+struct iconv_pool {
+	~iconv_pool()
+	{
+		for (const auto &e : idle)
+			iconv_close(e.second);
+	}
+	std::vector<std::pair<std::string, iconv_t>> idle;
+};
+}
+
+static constexpr size_t ICONV_POOL_MAX = 16;
+static thread_local iconv_pool g_iconv_pool;
+
+iconv_pooled::iconv_pooled(const char *to, const char *from)
+{
+	try {
+		m_key = to;
+		m_key += '\n';
+		m_key += from;
+	} catch (const std::bad_alloc &) {
+		/* Not poolable then */
+		m_key.clear();
+		m_cd = iconv_open(to, from);
+		return;
+	}
+	auto &idle = g_iconv_pool.idle;
+	for (auto i = idle.size(); i-- > 0; ) {
+		if (idle[i].first != m_key)
+			continue;
+		m_cd = idle[i].second;
+		idle.erase(idle.begin() + i);
+		return;
+	}
+	m_cd = iconv_open(to, from);
+}
+
+iconv_pooled &iconv_pooled::operator=(iconv_pooled &&o) noexcept
+{
+	if (this == &o)
+		return *this;
+	reset();
+	m_cd = std::exchange(o.m_cd, iconv_t(-1));
+	m_key = std::move(o.m_key);
+	return *this;
+}
+
+void iconv_pooled::reset()
+{
+	if (m_cd == iconv_t(-1))
+		return;
+	auto cd = std::exchange(m_cd, iconv_t(-1));
+	auto saved_errno = errno;
+	auto cleanup = HX::make_scope_exit([&]() { errno = saved_errno; });
+	if (m_key.empty()) {
+		iconv_close(cd);
+		return;
+	}
+	/* Back to the initial shift state for the next borrower */
+	iconv(cd, nullptr, nullptr, nullptr, nullptr);
+	auto &idle = g_iconv_pool.idle;
+	try {
+		if (idle.size() >= ICONV_POOL_MAX) {
+			iconv_close(idle.front().second);
+			idle.erase(idle.begin());
+		}
+		idle.emplace_back(std::move(m_key), cd);
+	} catch (const std::bad_alloc &) {
+		iconv_close(cd);
+	}
+	m_key.clear();
+}
+
 BOOL string_mb_to_utf8(const char *charset, const char *in_string,
     char *out_string, size_t out_len)
 {
@@ -292,8 +370,8 @@ BOOL string_mb_to_utf8(const char *charset, const char *in_string,
 		/* Leave room for \0 */
 		--out_len;
 	auto cs = replace_iconv_charset(charset);
-	auto conv_id = iconv_open("UTF-8", cs);
-	if (conv_id == iconv_t(-1)) {
+	iconv_pooled conv_id("UTF-8", cs);
+	if (!conv_id.valid()) {
 		/* EINVAL could happen as a result of EMFILE... */
 		mlog(LV_ERR, "E-2108: iconv_open %s: %s", cs, strerror(errno));
 		return FALSE;
@@ -314,16 +392,12 @@ BOOL string_mb_to_utf8(const char *charset, const char *in_string,
 			}
 			continue;
 		}
-		iconv_close(conv_id);
 		return FALSE;
 	}
 	auto ret = iconv(conv_id, nullptr, nullptr, &pout, &out_len);
 	if (ret == static_cast<size_t>(-1) && errno != E2BIG &&
-	    errno != EILSEQ && errno != EINVAL) {
-		iconv_close(conv_id);
+	    errno != EILSEQ && errno != EINVAL)
 		return false;
-	}
-	iconv_close(conv_id);
 	if (orig_outlen > 0)
 		*pout = '\0';
 	return TRUE;
@@ -350,8 +424,8 @@ BOOL string_utf8_to_mb(const char *charset, const char *in_string,
 	auto orig_outlen = out_len;
 	--out_len; /* Leave room for \0 */
 	auto cs = replace_iconv_charset(charset);
-	auto conv_id = iconv_open(cs, "UTF-8");
-	if (conv_id == iconv_t(-1)) {
+	iconv_pooled conv_id(cs, "UTF-8");
+	if (!conv_id.valid()) {
 		mlog(LV_ERR, "E-2109: iconv_open %s: %s", cs, strerror(errno));
 		return FALSE;
 	}
@@ -371,99 +445,282 @@ BOOL string_utf8_to_mb(const char *charset, const char *in_string,
 			}
 			continue;
 		}
-		iconv_close(conv_id);
 		return FALSE;
 	}
 	auto ret = iconv(conv_id, nullptr, nullptr, &pout, &out_len);
 	if (ret == static_cast<size_t>(-1) && errno != E2BIG &&
-	    errno != EILSEQ && errno != EINVAL) {
-		iconv_close(conv_id);
+	    errno != EILSEQ && errno != EINVAL)
 		return false;
-	}
-	iconv_close(conv_id);
 	if (orig_outlen > 0)
 		*pout = '\0';
 	return TRUE;
 }
 
+/*
+ * ASCII fast paths for the UTF-8 <-> UTF-16LE transcoders. Each converts the
+ * leading run of (at most @n) ASCII characters and returns its length.
+ */
+static size_t ascii_widen_scalar(const uint8_t *s, size_t n, uint8_t *d)
+{
+	size_t i = 0;
+	for (; i < n && s[i] < 0x80; ++i) {
+		d[2*i]   = s[i];
+		d[2*i+1] = 0;
+	}
+	return i;
+}
+
+static size_t ascii_narrow_scalar(const uint8_t *s, size_t n, uint8_t *d)
+{
+	size_t i = 0;
+	for (; i < n && s[2*i] < 0x80 && s[2*i+1] == 0; ++i)
+		d[i] = s[2*i];
+	return i;
+}
+
+#ifdef GX_X86_SIMD
+static size_t ascii_widen_sse2(const uint8_t *s, size_t n, uint8_t *d)
+{
+	size_t i = 0;
+	const auto zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&s[i]));
+		if (_mm_movemask_epi8(v) != 0)
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&d[2*i]), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&d[2*i+16]), _mm_unpackhi_epi8(v, zero));
+	}
+	return i + ascii_widen_scalar(&s[i], n - i, &d[2*i]);
+}
+
+static size_t ascii_narrow_sse2(const uint8_t *s, size_t n, uint8_t *d)
+{
+	size_t i = 0;
+	const auto zero = _mm_setzero_si128();
+	const auto nonascii = _mm_set1_epi16(static_cast<short>(0xff80));
+	for (; i + 16 <= n; i += 16) {
+		auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&s[2*i]));
+		auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&s[2*i+16]));
+		auto t = _mm_and_si128(_mm_or_si128(a, b), nonascii);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(t, zero)) != 0xffff)
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&d[i]), _mm_packus_epi16(a, b));
+	}
+	return i + ascii_narrow_scalar(&s[2*i], n - i, &d[i]);
+}
+
+__attribute__((target("avx2"))) static size_t
+ascii_widen_avx2(const uint8_t *s, size_t n, uint8_t *d)
+{
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&s[i]));
+		if (_mm256_movemask_epi8(v) != 0)
+			break;
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&d[2*i]),
+			_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&d[2*i+32]),
+			_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+	}
+	return i + ascii_widen_sse2(&s[i], n - i, &d[2*i]);
+}
+
+__attribute__((target("avx2"))) static size_t
+ascii_narrow_avx2(const uint8_t *s, size_t n, uint8_t *d)
+{
+	size_t i = 0;
+	const auto nonascii = _mm256_set1_epi16(static_cast<short>(0xff80));
+	for (; i + 32 <= n; i += 32) {
+		auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&s[2*i]));
+		auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&s[2*i+32]));
+		auto t = _mm256_and_si256(_mm256_or_si256(a, b), nonascii);
+		if (!_mm256_testz_si256(t, t))
+			break;
+		/* packus works per 128-bit lane; restore the order */
+		auto p = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&d[i]), p);
+	}
+	return i + ascii_narrow_sse2(&s[2*i], n - i, &d[i]);
+}
+
+static bool have_avx2()
+{
+	static const bool r = [] {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	}();
+	return r;
+}
+
+static bool have_ssse3()
+{
+	static const bool r = [] {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("ssse3") != 0;
+	}();
+	return r;
+}
+#endif
+
+static inline size_t ascii_widen(const uint8_t *s, size_t n, uint8_t *d)
+{
+#ifdef GX_X86_SIMD
+	return have_avx2() ? ascii_widen_avx2(s, n, d) : ascii_widen_sse2(s, n, d);
+#else
+	return ascii_widen_scalar(s, n, d);
+#endif
+}
+
+static inline size_t ascii_narrow(const uint8_t *s, size_t n, uint8_t *d)
+{
+#ifdef GX_X86_SIMD
+	return have_avx2() ? ascii_narrow_avx2(s, n, d) : ascii_narrow_sse2(s, n, d);
+#else
+	return ascii_narrow_scalar(s, n, d);
+#endif
+}
+
+/**
+ * Decode one well-formed UTF-8 sequence (no overlongs, no surrogates, at
+ * most U+10FFFF) from [@p,@end). Returns its length, or 0 if malformed.
+ */
+static unsigned int utf8_decode1(const uint8_t *p, const uint8_t *end,
+    char32_t &cp)
+{
+	auto c = p[0];
+	size_t avail = end - p;
+	if (c >= 0xc2 && c <= 0xdf) {
+		if (avail < 2 || (p[1] & 0xc0) != 0x80)
+			return 0;
+		cp = ((c & 0x1f) << 6) | (p[1] & 0x3f);
+		return 2;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		if (avail < 3 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80 ||
+		    (c == 0xe0 && p[1] < 0xa0) || (c == 0xed && p[1] > 0x9f))
+			return 0;
+		cp = ((c & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+		return 3;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		if (avail < 4 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80 ||
+		    (p[3] & 0xc0) != 0x80 || (c == 0xf0 && p[1] < 0x90) ||
+		    (c == 0xf4 && p[1] > 0x8f))
+			return 0;
+		cp = ((c & 0x07) << 18) | ((p[1] & 0x3f) << 12) |
+		     ((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+		return 4;
+	}
+	return 0;
+}
+
+/**
+ * Convert the NUL-terminated UTF-8 string @src (including the terminator)
+ * to UTF-16LE in @dst. Malformed input bytes are skipped; output stops at
+ * the last complete character that fits into @len bytes, and the remainder
+ * of @dst is zeroed. Returns the number of bytes produced.
+ */
 ssize_t utf8_to_utf16le(const char *src, void *dst, size_t len)
 {
 	len = std::min(len, static_cast<size_t>(SSIZE_MAX));
-	auto conv_id = iconv_open("UTF-16LE", "UTF-8");
-	if (conv_id == (iconv_t)-1) {
-		mlog(LV_ERR, "E-2110: iconv_open: %s", strerror(errno));
-		return -1;
-	}
-	auto pin  = deconst(src);
-	auto pout = static_cast<char *>(dst);
-	auto in_len = strlen(src) + 1;
-	memset(dst, 0, len);
-	auto out_len = len;
-	while (in_len > 0) {
-		auto ret = iconv(conv_id, &pin, &in_len, &pout, &out_len);
-		if (ret != static_cast<size_t>(-1))
-			continue;
-		if (errno == E2BIG)
+	auto in     = reinterpret_cast<const uint8_t *>(src);
+	auto in_end = in + strlen(src) + 1;
+	auto out    = static_cast<uint8_t *>(dst);
+	auto out_end = out + len;
+	while (in < in_end) {
+		auto n = ascii_widen(in, std::min(static_cast<size_t>(in_end - in),
+		         static_cast<size_t>(out_end - out) / 2), out);
+		in  += n;
+		out += 2 * n;
+		if (in == in_end || *in < 0x80)
+			/* done, or no room for the next ASCII character */
 			break;
-		if (errno == EILSEQ || errno == EINVAL) {
-			if (in_len > 0) {
-				++pin;
-				--in_len;
-			}
+		char32_t cp;
+		auto seqlen = utf8_decode1(in, in_end, cp);
+		if (seqlen == 0) {
+			++in;
 			continue;
 		}
-		iconv_close(conv_id);
-		return -1;
-	}
-	auto ret = iconv(conv_id, nullptr, nullptr, &pout, &out_len);
-	if (ret == static_cast<size_t>(-1) && errno != E2BIG &&
-	    errno != EILSEQ && errno != EINVAL) {
-		iconv_close(conv_id);
-		return -1;
+		if (cp >= 0x10000) {
+			if (out_end - out < 4)
+				break;
+			cp -= 0x10000;
+			uint16_t hi = 0xd800 | (cp >> 10), lo = 0xdc00 | (cp & 0x3ff);
+			out[0] = hi;
+			out[1] = hi >> 8;
+			out[2] = lo;
+			out[3] = lo >> 8;
+			out += 4;
+		} else {
+			if (out_end - out < 2)
+				break;
+			out[0] = cp;
+			out[1] = cp >> 8;
+			out += 2;
+		}
+		in += seqlen;
 	}
-	iconv_close(conv_id);
-	return len - out_len;
+	auto produced = out - static_cast<uint8_t *>(dst);
+	memset(out, 0, out_end - out);
+	return produced;
 }
 
+/**
+ * Convert @src_len bytes of UTF-16LE to UTF-8 in @dst. Unpaired surrogates
+ * are skipped, and a trailing odd byte ends the string (the iconv-based
+ * version fed a U+0000 in its place). Output stops at the last complete
+ * character that fits into @len bytes, and the remainder of @dst is zeroed.
+ * (The result is therefore NUL-terminated only if there is room.)
+ * There is no failure case anymore; the BOOL is kept for the callers.
+ */
 BOOL utf16le_to_utf8(const void *src, size_t src_len, char *dst, size_t len)
 {
-	auto conv_id = iconv_open("UTF-8", "UTF-16LE");
-	if (conv_id == (iconv_t)-1) {
-		mlog(LV_ERR, "E-2111: iconv_open: %s", strerror(errno));
-		return false;
-	}
-	auto pin  = static_cast<char *>(deconst(src));
-	auto pout = dst;
-	auto out_len = len;
-	memset(dst, 0, len);
-	static const char unul[2]{};
-	while (src_len > 0) {
-		auto ret = iconv(conv_id, &pin, &src_len, &pout, &out_len);
-		if (ret != static_cast<size_t>(-1))
-			continue;
-		if (errno == E2BIG)
+	auto in      = static_cast<const uint8_t *>(src);
+	auto in_end  = in + (src_len & ~static_cast<size_t>(1));
+	auto out     = reinterpret_cast<uint8_t *>(dst);
+	auto out_end = out + len;
+	while (in < in_end) {
+		auto n = ascii_narrow(in, std::min(static_cast<size_t>(in_end - in) / 2,
+		         static_cast<size_t>(out_end - out)), out);
+		in  += 2 * n;
+		out += n;
+		if (in == in_end)
 			break;
-		if (errno == EILSEQ || errno == EINVAL) {
-			if (src_len >= 2) {
-				pin += 2;
-				src_len -= 2;
-				continue;
-			} else if (pin != unul) {
-				pin = deconst(unul);
-				src_len = 2;
+		char32_t cp = in[0] | (in[1] << 8);
+		if (cp < 0x80)
+			/* no room for the next ASCII character */
+			break;
+		unsigned int units = 1;
+		if (cp >= 0xdc00 && cp <= 0xdfff) {
+			in += 2;
+			continue;
+		} else if (cp >= 0xd800 && cp <= 0xdbff) {
+			char32_t lo = in_end - in >= 4 ? in[2] | (in[3] << 8) : 0;
+			if (lo < 0xdc00 || lo > 0xdfff) {
+				in += 2;
 				continue;
 			}
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+			units = 2;
 		}
-		iconv_close(conv_id);
-		return FALSE;
-	}
-	auto ret = iconv(conv_id, nullptr, nullptr, &pout, &out_len);
-	if (ret == static_cast<size_t>(-1) && errno != E2BIG &&
-	    errno != EILSEQ && errno != EINVAL) {
-		iconv_close(conv_id);
-		return false;
+		size_t need = cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+		if (static_cast<size_t>(out_end - out) < need)
+			break;
+		if (need == 2) {
+			out[0] = 0xc0 | (cp >> 6);
+			out[1] = 0x80 | (cp & 0x3f);
+		} else if (need == 3) {
+			out[0] = 0xe0 | (cp >> 12);
+			out[1] = 0x80 | ((cp >> 6) & 0x3f);
+			out[2] = 0x80 | (cp & 0x3f);
+		} else {
+			out[0] = 0xf0 | (cp >> 18);
+			out[1] = 0x80 | ((cp >> 12) & 0x3f);
+			out[2] = 0x80 | ((cp >> 6) & 0x3f);
+			out[3] = 0x80 | (cp & 0x3f);
+		}
+		out += need;
+		in  += 2 * units;
 	}
-	iconv_close(conv_id);
+	memset(out, 0, out_end - out);
 	return TRUE;
 }
 
@@ -601,6 +858,186 @@ static constexpr int8_t base64idx[] = {
 };
 #define basis_64 base64tab
 
+/*
+ * Vector kernels for the bulk of base64 data. The encoders turn 12-byte
+ * groups into 16 characters (Muła's multiply-shift + pshufb lookup); the
+ * decoders take 16 characters at a time and stop at the first block that
+ * contains anything other than the 64 alphabet characters, leaving
+ * whitespace, padding and garbage to the scalar code.
+ */
+#ifdef GX_X86_SIMD
+__attribute__((target("ssse3"))) static inline __m128i b64_enc16(__m128i v)
+{
+	v = _mm_shuffle_epi8(v, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	auto t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+	auto t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+	auto idx = _mm_or_si128(t0, t1);
+	auto r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+	r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+	const auto shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+	                   '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                   '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	return _mm_add_epi8(_mm_shuffle_epi8(shift, r), idx);
+}
+
+/* Returns false if @v has a non-alphabet character */
+__attribute__((target("ssse3"))) static inline bool b64_dec16(__m128i v, __m128i &out)
+{
+	const auto lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                    0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const auto lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+	                    0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const auto lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+	                      0, 0, 0, 0, 0, 0, 0, 0);
+	const auto nib = _mm_set1_epi8(0x0f);
+	auto hi = _mm_and_si128(_mm_srli_epi32(v, 4), nib);
+	auto bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, _mm_and_si128(v, nib)),
+	           _mm_shuffle_epi8(lut_hi, hi));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xffff)
+		return false;
+	auto roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), hi));
+	v = _mm_add_epi8(v, roll);
+	v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+	v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+	out = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	return true;
+}
+
+__attribute__((target("ssse3"))) static size_t
+b64_encode_ssse3(const uint8_t *in, size_t n, size_t avail, char *out)
+{
+	size_t g = 0;
+	for (; g + 4 <= n && 3 * g + 16 <= avail; g += 4) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&in[3*g]));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&out[4*g]), b64_enc16(v));
+	}
+	return g;
+}
+
+__attribute__((target("ssse3"))) static size_t
+b64_decode_ssse3(const char *in, size_t n, uint8_t *out, size_t outroom)
+{
+	size_t i = 0;
+	for (; i + 16 <= n && i / 4 * 3 + 16 <= outroom; i += 16) {
+		__m128i d;
+		if (!b64_dec16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&in[i])), d))
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i/4*3]), d);
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+b64_encode_avx2(const uint8_t *in, size_t n, size_t avail, char *out)
+{
+	size_t g = 0;
+	const auto shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+	                  1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const auto shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+	                   '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                   '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+	                   'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+	                   '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                   '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	for (; g + 8 <= n && 3 * g + 28 <= avail; g += 8) {
+		/* 12 bytes into each 128-bit lane */
+		auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&in[3*g]));
+		auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&in[3*g+12]));
+		auto v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		v = _mm256_shuffle_epi8(v, shuf);
+		auto t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		auto t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		auto idx = _mm256_or_si256(t0, t1);
+		auto r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+		r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&out[4*g]),
+			_mm256_add_epi8(_mm256_shuffle_epi8(shift, r), idx));
+	}
+	/* avoid AVX-SSE transition stalls in the non-VEX tail */
+	_mm256_zeroupper();
+	return g + b64_encode_ssse3(&in[3*g], n - g, avail - 3 * g, &out[4*g]);
+}
+
+__attribute__((target("avx2"))) static size_t
+b64_decode_avx2(const char *in, size_t n, uint8_t *out, size_t outroom)
+{
+	const auto lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                    0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+	                    0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                    0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const auto lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+	                    0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+	                    0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+	                    0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const auto lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+	                      0, 0, 0, 0, 0, 0, 0, 0,
+	                      0, 16, 19, 4, -65, -65, -71, -71,
+	                      0, 0, 0, 0, 0, 0, 0, 0);
+	const auto pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+	                  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const auto nib = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 32 <= n && i / 4 * 3 + 32 <= outroom; i += 32) {
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&in[i]));
+		auto hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), nib);
+		auto bad = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, _mm256_and_si256(v, nib)),
+		           _mm256_shuffle_epi8(lut_hi, hi));
+		if (!_mm256_testz_si256(bad, bad))
+			break;
+		auto roll = _mm256_shuffle_epi8(lut_roll,
+		            _mm256_add_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')), hi));
+		v = _mm256_add_epi8(v, roll);
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_shuffle_epi8(v, pack);
+		/* 12 bytes per lane; close the gap */
+		v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&out[i/4*3]), v);
+	}
+	_mm256_zeroupper();
+	return i + b64_decode_ssse3(&in[i], n - i, &out[i/4*3], outroom - i / 4 * 3);
+}
+#endif
+
+/*
+ * Encode @n complete 3-byte groups. @avail is the number of bytes readable
+ * at @in (at least 3*@n), which bounds the vector loads.
+ */
+static void b64_encode_groups(const uint8_t *in, size_t n, size_t avail,
+    char *out)
+{
+	size_t g = 0;
+#ifdef GX_X86_SIMD
+	if (have_avx2())
+		g = b64_encode_avx2(in, n, avail, out);
+	else if (have_ssse3())
+		g = b64_encode_ssse3(in, n, avail, out);
+#endif
+	for (in += 3 * g, out += 4 * g; g < n; ++g, in += 3, out += 4) {
+		out[0] = base64tab[in[0] >> 2];
+		out[1] = base64tab[((in[0] << 4) & 0x30) | (in[1] >> 4)];
+		out[2] = base64tab[((in[1] << 2) & 0x3c) | (in[2] >> 6)];
+		out[3] = base64tab[in[2] & 0x3f];
+	}
+}
+
+/*
+ * Decode the longest prefix of @in made of whole blocks of alphabet
+ * characters. @outroom is the space at @out. Returns the number of input
+ * characters consumed (a multiple of 4); each 4 yield 3 bytes.
+ */
+static inline size_t b64_decode_bulk(const char *in, size_t n, uint8_t *out,
+    size_t outroom)
+{
+#ifdef GX_X86_SIMD
+	if (have_avx2())
+		return b64_decode_avx2(in, n, out, outroom);
+	else if (have_ssse3())
+		return b64_decode_ssse3(in, n, out, outroom);
+#endif
+	return 0;
+}
+
 /*
  * On success, 0 is returned and @out is NUL-terminated (@outlen does not count NUL).
  */
@@ -620,15 +1057,11 @@ int base64_encode_sized(std::string_view sv_in, char *out,
 	  return BUFOVER;
 
 	/* Do the work... */
-	while (inlen >= 3) {
-	  /* user provided max buffer size; make sure we don't go over it */
-		*out++ = basis_64[in[0] >> 2];
-		*out++ = basis_64[((in[0] << 4) & 0x30) | (in[1] >> 4)];
-		*out++ = basis_64[((in[1] << 2) & 0x3c) | (in[2] >> 6)];
-		*out++ = basis_64[in[2] & 0x3f];
-		in += 3;
-		inlen -= 3;
-	}
+	auto groups = inlen / 3;
+	b64_encode_groups(in, groups, inlen, out);
+	in += 3 * groups;
+	out += 4 * groups;
+	inlen -= 3 * groups;
 	if (inlen > 0) {
 	  /* user provided max buffer size; make sure we don't go over it */
 		*out++ = basis_64[in[0] >> 2];
@@ -655,36 +1088,32 @@ int base64nl_encode_sized(std::string_view sv_in, char *_out,
 {
 	auto _in = reinterpret_cast<const uint8_t *>(sv_in.data());
 	size_t inLen = sv_in.size();
-	size_t i;
 	char* out = _out;
 	size_t outsize = (inLen+2)/3*4;		/* 3:4 conversion ratio */
 	size_t inpos  = 0;
 	size_t outPos = 0;
-	int c1, c2, c3;
-	int lineLen = 0;
+	int c1, c2;
 	const char* cp;
+	/* Groups per line: the line is broken once it reaches MAXLINE-3 chars */
+	static constexpr size_t line_groups = (MAXLINE - 3 + 3) / 4;
 	
 	if (_in == nullptr || _out == nullptr || outlen == nullptr)
 		return -1;
 	outsize += strlen(DW_EOL)*outsize/MAXLINE + 2;	/* Space for newlines and NUL */
 	if (outsize >= outmax)
 		return -1;
-	/* Get three characters at a time and encode them. */
-	for (i=0; i < inLen/3; ++i) {
-		c1 = _in[inpos++] & 0xFF;
-		c2 = _in[inpos++] & 0xFF;
-		c3 = _in[inpos++] & 0xFF;
-		out[outPos++] = base64tab[(c1 & 0xFC) >> 2];
-		out[outPos++] = base64tab[((c1 & 0x03) << 4) | ((c2 & 0xF0) >> 4)];
-		out[outPos++] = base64tab[((c2 & 0x0F) << 2) | ((c3 & 0xC0) >> 6)];
-		out[outPos++] = base64tab[c3 & 0x3F];
-		lineLen += 4;
-		if (lineLen >= MAXLINE-3) {
+	/* Encode a line's worth of three-byte groups at a time. */
+	for (size_t left = inLen / 3; left > 0; ) {
+		auto n = std::min(left, line_groups);
+		b64_encode_groups(&_in[inpos], n, inLen - inpos, &out[outPos]);
+		inpos  += 3 * n;
+		outPos += 4 * n;
+		left   -= n;
+		if (n == line_groups) {
 			const char *cq = DW_EOL;
 			out[outPos++] = *cq++;
 			if (*cq != '\0')
 				out[outPos++] = *cq;
-			lineLen = 0;
 		}
 	}
 	/* Encode the remaining one or two characters. */
@@ -763,6 +1192,19 @@ int base64nl_decode_sized(std::string_view sv_in, void *vout, size_t outmax,
 		return -1;
 	}
 	while (inpos < inLen) {
+		/*
+		 * At a quad boundary, leading whitespace would be skipped anyway,
+		 * and whole blocks of alphabet characters can go in bulk.
+		 */
+		while (inpos < inLen && HX_isspace(_in[inpos]))
+			++inpos;
+		auto bulk = b64_decode_bulk(&_in[inpos], inLen - inpos,
+		            &out[outPos], outmax - outPos);
+		if (bulk > 0) {
+			inpos  += bulk;
+			outPos += bulk / 4 * 3;
+			continue;
+		}
 		unsigned char a1 = '=', a2 = '=', a3 = '=', a4 = '=';
 		bool read_any = false;
 		while (inpos < inLen) {
@@ -887,6 +1329,55 @@ static inline bool qp_nonprintable(unsigned char c)
 	return c < 32 || c == '=' || c >= 127;
 }
 
+/*
+ * Length of the run at @p (at most @max) that qpnl_encode_sized would copy
+ * verbatim: printable ASCII other than '=', and spaces that are neither last
+ * nor in front of a CR. @n is the number of bytes available at @p.
+ */
+static size_t qp_plain_run(const char *p, size_t n, size_t max)
+{
+	size_t i = 0;
+#ifdef GX_X86_SIMD
+	/* SSE2 is baseline on x86_64. Needs one byte of lookahead. */
+	const auto lo = _mm_set1_epi8(' '), hi = _mm_set1_epi8(127);
+	const auto eq = _mm_set1_epi8('='), cr = _mm_set1_epi8('\r');
+	for (; i + 16 <= max && i + 17 <= n; i += 16) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&p[i]));
+		auto nx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&p[i+1]));
+		auto ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, eq),
+		          _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+		auto sp = _mm_andnot_si128(_mm_cmpeq_epi8(nx, cr), _mm_cmpeq_epi8(v, lo));
+		unsigned int m = _mm_movemask_epi8(_mm_or_si128(ok, sp));
+		if (m != 0xffff)
+			return i + __builtin_ctz(~m);
+	}
+#endif
+	for (; i < max && i < n; ++i) {
+		auto c = static_cast<unsigned char>(p[i]);
+		if (c == ' ' ? i + 1 >= n || p[i+1] == '\r' :
+		    c <= ' ' || c == '=' || c >= 127)
+			break;
+	}
+	return i;
+}
+
+/* Number of leading bytes at @p that are not '=' */
+static size_t qp_literal_run(const char *p, size_t n)
+{
+	size_t i = 0;
+#ifdef GX_X86_SIMD
+	const auto eq = _mm_set1_epi8('=');
+	for (; i + 16 <= n; i += 16) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&p[i]));
+		unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, eq));
+		if (m != 0)
+			return i + __builtin_ctz(m);
+	}
+#endif
+	auto q = static_cast<const char *>(memchr(&p[i], '=', n - i));
+	return q != nullptr ? q - p : n;
+}
+
 namespace gromox {
 
 void *zalloc(size_t z)
@@ -932,6 +1423,22 @@ ssize_t qpnl_encode_sized(std::string_view sv_in, void *voutput, size_t outlen)
 	outpos = 0;
 	linelen = 0;
 	while (inpos < length) {
+		/*
+		 * Copy plain text in bulk, as long as it does not reach the
+		 * soft-break column and the line-start rules do not apply.
+		 */
+		if (linelen < MAXLINE - 4 && (linelen > 0 ||
+		    (input[inpos] != '.' && input[inpos] != 'F'))) {
+			auto k = qp_plain_run(&input[inpos], length - inpos,
+			         MAXLINE - 4 - linelen);
+			if (k > 0 && outpos + k < outlen) {
+				memcpy(&output[outpos], &input[inpos], k);
+				inpos   += k;
+				outpos  += k;
+				linelen += k;
+				continue;
+			}
+		}
 		auto ch = static_cast<unsigned char>(input[inpos++]);
 		/* '.' at beginning of line (special meaning in SMTPs) */
 		if (linelen == 0 && ch == '.') {
@@ -1072,6 +1579,13 @@ static size_t qp_decode(void *voutput, const char *input, size_t length)
 	auto output = static_cast<uint8_t *>(voutput);
 	size_t i, cnt = 0;
 	for (i = 0; i < length; i++) {
+		auto run = qp_literal_run(&input[i], length - i);
+		if (run > 0) {
+			memcpy(&output[cnt], &input[i], run);
+			cnt += run;
+			i += run - 1;
+			continue;
+		}
 		char c = input[i];
 		switch (c) {
 		case '=': {
@@ -1117,7 +1631,12 @@ ssize_t qpnl_decode_sized(std::string_view sv_in, void *voutput, size_t out_len)
 	int c;
 	size_t i, cnt = 0;
 	for (i = 0; i < length; i++) {
-
+		auto run = qp_literal_run(&input[i], length - i);
+		if (run > 0) {
+			cnt += run;
+			i += run - 1;
+			continue;
+		}
 		c = input[i];
 
 		switch (c) {
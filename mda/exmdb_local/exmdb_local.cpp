@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only WITH linking exception
 // SPDX-FileCopyrightText: 2021–2026 grommunio GmbH
 // This file is part of Gromox.
+#include <algorithm>
 #include <cerrno>
 #include <climits>
 #include <cstdarg>
@@ -12,6 +13,8 @@
 #include <memory>
 #include <string>
 #include <unistd.h>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include <fmt/core.h>
 #include <libHX/string.h>
@@ -39,10 +42,31 @@ using namespace gromox;
 DECLARE_HOOK_API(exmdb_local, );
 using namespace exmdb_local;
 
+/**
+ * Recipient-independent part of a local delivery, computed once per message
+ * context and shared by all local recipients: the serialized eml, the
+ * digest, and the MAPI conversion. The conversion is done with placeholder
+ * IDs for named properties (one per entry in @names, starting at 0x8000);
+ * per mailbox, only those need to be rewritten to the store's own IDs.
+ * @named_slots records where placeholder IDs occur in the message tree.
+ */
+struct lda_shared_msg {
+	bool prepared = false;
+	delivery_status prep_status = delivery_status::ok;
+	bool deliver_to_junk = false;
+	std::string eml;
+	Json::Value digest;
+	std::unique_ptr<message_content, mc_delete> msg;
+	std::vector<PROPERTY_NAME> names;
+	std::vector<std::unique_ptr<char[]>> name_strs;
+	std::vector<std::tuple<TPROPVAL_ARRAY *, size_t, proptag_t>> named_slots;
+	alloc_context actx;
+};
+
 static bool g_lda_twostep, g_lda_mrautoproc;
 static char g_org_name[256];
 static thread_local alloc_context g_alloc_ctx;
-static thread_local const char *g_storedir;
+static thread_local lda_shared_msg *g_cvt_shared;
 
 static ec_error_t (*exmdb_local_rules_execute)(const char *, const char *, const char *, eid_t, eid_t, unsigned int flags);
 static junk_rule_list g_junk_rules;
@@ -75,6 +99,7 @@ hook_result exmdb_local_hook(MESSAGE_CONTEXT *pcontext) try
 	 */
 	bool had_error = false;
 	std::vector<std::string> new_rcpts;
+	lda_shared_msg shared;
 	for (const auto &rcpt : pcontext->ctrl.rcpt) {
 		auto rcpt_buff = rcpt.c_str();
 		auto pdomain = strchr(rcpt_buff, '@');
@@ -90,7 +115,7 @@ hook_result exmdb_local_hook(MESSAGE_CONTEXT *pcontext) try
 			new_rcpts.emplace_back(rcpt);
 			continue;
 		}
-		switch (exmdb_local_deliverquota(pcontext, rcpt_buff)) {
+		switch (exmdb_local_deliverquota(pcontext, rcpt_buff, &shared)) {
 		case delivery_status::ok:
 			break;
 		case delivery_status::bounce_sent:
@@ -223,13 +248,6 @@ static void* exmdb_local_alloc(size_t size)
 	return g_alloc_ctx.alloc(size);
 }
 
-static BOOL exmdb_local_get_propids(const PROPNAME_ARRAY *ppropnames,
-    PROPID_ARRAY *ppropids)
-{
-	return exmdb_client_remote::get_named_propids(g_storedir, true,
-	       ppropnames, ppropids);
-}
-
 static void lq_report(unsigned int qid, unsigned long long mid, const char *txt,
     const message_content &ct)
 {
@@ -301,12 +319,170 @@ static bool rcpt_directly_addressed(const char *envelope_to,
 	return false;
 }
 
+static void *lda_cvt_alloc(size_t size)
+{
+	return g_cvt_shared->actx.alloc(size);
+}
+
+/**
+ * GET_PROPIDS callback for the shared conversion: hands out placeholder
+ * IDs, the same one for the same name.
+ */
+static BOOL lda_virtual_propids(const PROPNAME_ARRAY *ppropnames,
+    PROPID_ARRAY *ppropids) try
+{
+	auto &sh = *g_cvt_shared;
+	ppropids->clear();
+	for (const auto &name : *ppropnames) {
+		size_t i;
+		for (i = 0; i < sh.names.size(); ++i)
+			if (sh.names[i] == name)
+				break;
+		if (i == sh.names.size()) {
+			if (i >= 0xFFFE - 0x8000 + 1)
+				return false;
+			auto copy = name;
+			if (copy.kind == MNID_STRING) {
+				auto len = strlen(znul(name.pname)) + 1;
+				sh.name_strs.push_back(std::make_unique<char[]>(len));
+				copy.pname = sh.name_strs.back().get();
+				memcpy(copy.pname, znul(name.pname), len);
+			}
+			sh.names.push_back(copy);
+		}
+		ppropids->push_back(0x8000 + i);
+	}
+	return TRUE;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2432: ENOMEM");
+	return false;
+}
+
+static void lda_collect_slots(lda_shared_msg &sh, message_content &msg)
+{
+	auto scan = [&](TPROPVAL_ARRAY &props) {
+		for (size_t i = 0; i < props.count; ++i)
+			if (is_nameprop_id(PROP_ID(props.ppropval[i].proptag)))
+				sh.named_slots.emplace_back(&props, i, props.ppropval[i].proptag);
+	};
+	scan(msg.proplist);
+	if (msg.children.prcpts != nullptr)
+		for (auto &rcpt : *msg.children.prcpts)
+			scan(rcpt);
+	if (msg.children.pattachments == nullptr)
+		return;
+	for (auto &at : *msg.children.pattachments) {
+		scan(at.proplist);
+		if (at.pembedded != nullptr)
+			lda_collect_slots(sh, *at.pembedded);
+	}
+}
+
+/**
+ * Rewrite the named property IDs of the shared message to @propids (the
+ * result of get_named_propids for sh.names), or back to the placeholder
+ * IDs if @propids is nullptr.
+ */
+static void lda_apply_propids(lda_shared_msg &sh, const PROPID_ARRAY *propids)
+{
+	for (const auto &[props, idx, vtag] : sh.named_slots)
+		props->ppropval[idx].proptag = propids == nullptr ? vtag :
+			PROP_TAG(PROP_TYPE(vtag), (*propids)[PROP_ID(vtag) - 0x8000]);
+}
+
+/**
+ * Slow path for when the store could not provide an ID for every name:
+ * like oxcmail_replace_propid, drop the properties that have none.
+ */
+static void lda_replace_propids(message_content &msg, const PROPID_ARRAY &propids)
+{
+	auto scan = [&](TPROPVAL_ARRAY &props) {
+		for (size_t i = 0; i < props.count; ) {
+			auto tag = props.ppropval[i].proptag;
+			if (!is_nameprop_id(PROP_ID(tag))) {
+				++i;
+				continue;
+			}
+			auto id = propids[PROP_ID(tag) - 0x8000];
+			if (id == 0) {
+				props.erase(tag);
+				continue;
+			}
+			props.ppropval[i++].proptag = PROP_TAG(PROP_TYPE(tag), id);
+		}
+	};
+	scan(msg.proplist);
+	if (msg.children.prcpts != nullptr)
+		for (auto &rcpt : *msg.children.prcpts)
+			scan(rcpt);
+	if (msg.children.pattachments == nullptr)
+		return;
+	for (auto &at : *msg.children.pattachments) {
+		scan(at.proplist);
+		if (at.pembedded != nullptr)
+			lda_replace_propids(*at.pembedded, propids);
+	}
+}
+
+/**
+ * Serialize, digest and convert the message of @pcontext. Failures are
+ * remembered in sh.prep_status, so that they are logged only once.
+ */
+static void lda_prepare(MESSAGE_CONTEXT *pcontext, const char *address,
+    lda_shared_msg &sh)
+{
+	sh.prepared = true;
+	auto pmail = &pcontext->mail;
+	sh.deliver_to_junk = should_move_to_junk(*pmail);
+	auto syserr = pmail->to_str(sh.eml);
+	if (syserr != 0) {
+		exmdb_local_log_info(pcontext->ctrl, address, LV_ERR,
+			"pmail->to_str failed: %s", strerror(syserr));
+		sh.prep_status = delivery_status::temp_fail;
+		return;
+	}
+	if (pmail->make_digest(sh.digest) <= 0) {
+		exmdb_local_log_info(pcontext->ctrl, address, LV_ERR,
+			"permanent failure getting mail digest");
+		sh.prep_status = delivery_status::perm_fail;
+		return;
+	}
+
+	oxcmail_converter cvt;
+	cvt.alloc = lda_cvt_alloc;
+	cvt.get_propids = lda_virtual_propids;
+	g_cvt_shared = &sh;
+	sh.msg = cvt.inet_to_mapi(*pmail);
+	g_cvt_shared = nullptr;
+	if (sh.msg == nullptr) {
+		exmdb_local_log_info(pcontext->ctrl, address, LV_ERR, "fail "
+			"to convert rfc5322 into MAPI message object");
+		sh.prep_status = delivery_status::perm_fail;
+		return;
+	}
+	/* Recipient-independent fixups */
+	uint64_t nt_time = 0;
+	if (sh.msg->proplist.set(PR_MESSAGE_DELIVERY_TIME, &nt_time) != ecSuccess) {
+		sh.prep_status = delivery_status::temp_fail;
+		return;
+	}
+	if (!pcontext->ctrl.need_bounce) {
+		uint32_t tmp_int32 = UINT32_MAX;
+		if (sh.msg->proplist.set(PR_AUTO_RESPONSE_SUPPRESS, &tmp_int32) != ecSuccess)
+			/* ignore */;
+	}
+	sh.msg->proplist.erase(PidTagChangeNumber);
+	lda_collect_slots(sh, *sh.msg);
+}
+
+/**
+ * @shared:	recipient-independent state, shared among the recipients of
+ * 		one message context; may be nullptr
+ */
 delivery_status exmdb_local_deliverquota(MESSAGE_CONTEXT *pcontext,
-    const char *address) try
+    const char *address, lda_shared_msg *shared) try
 {
-	uint64_t nt_time;
 	char hostname[UDOM_SIZE];
-	uint32_t tmp_int32;
 	uint32_t suppress_mask = 0;
 	BOOL b_bounce_delivered = false;
 	sql_meta_result mres{};
@@ -326,8 +502,15 @@ delivery_status exmdb_local_deliverquota(MESSAGE_CONTEXT *pcontext,
 		return delivery_status::no_user;
 	}
 	auto home_dir = mres.maildir.c_str();
-	auto pmail = &pcontext->mail;
-	bool deliver_to_junk = should_move_to_junk(*pmail);
+	std::unique_ptr<lda_shared_msg> local_shared;
+	if (shared == nullptr) {
+		local_shared = std::make_unique<lda_shared_msg>();
+		shared = local_shared.get();
+	}
+	if (!shared->prepared)
+		lda_prepare(pcontext, address, *shared);
+	if (shared->prep_status != delivery_status::ok)
+		return shared->prep_status;
 	gx_strlcpy(hostname, get_host_ID(), std::size(hostname));
 	if ('\0' == hostname[0]) {
 		if (gethostname(hostname, std::size(hostname)) < 0)
@@ -339,66 +522,53 @@ delivery_status exmdb_local_deliverquota(MESSAGE_CONTEXT *pcontext,
 	GUID::random_new().to_str(guidtxt, std::size(guidtxt), 32);
 	auto mid_string = fmt::format("R-{}/{}", &guidtxt[30], guidtxt);
 
-	{
-		std::string eml_content;
-		auto syserr = pmail->to_str(eml_content);
-		if (syserr != 0) {
-			exmdb_local_log_info(pcontext->ctrl, address, LV_ERR,
-				"%s: pmail->to_str failed: %s",
-				mid_string.c_str(), strerror(syserr));
-			return delivery_status::temp_fail;
-		}
-		if (!exmdb_client_remote::imapfile_write(home_dir, "eml", mid_string,
-		    std::move(eml_content))) {
-			mlog(LV_ERR, "E-1765: write %s/eml/%s failed",
-				home_dir, mid_string.c_str());
-			return delivery_status::perm_fail;
-		}
+	if (!exmdb_client_remote::imapfile_write(home_dir, "eml", mid_string,
+	    shared->eml)) {
+		mlog(LV_ERR, "E-1765: write %s/eml/%s failed",
+			home_dir, mid_string.c_str());
+		return delivery_status::perm_fail;
 	}
-
-	Json::Value digest;
-	auto result = pmail->make_digest(digest);
-	if (result <= 0) {
+	shared->digest["file"] = mid_string;
+	auto djson = json_to_str(shared->digest);
+
+	/* Map the placeholder named property IDs to this store's */
+	PROPID_ARRAY propids;
+	const PROPNAME_ARRAY propnames = {static_cast<uint16_t>(shared->names.size()),
+	      shared->names.data()};
+	if (propnames.count > 0 && (!exmdb_client_remote::get_named_propids(home_dir,
+	    true, &propnames, &propids) || propids.size() != propnames.count)) {
 		exmdb_local_log_info(pcontext->ctrl, address, LV_ERR,
-			"permanent failure getting mail digest");
-		return delivery_status::perm_fail;
+			"fail to get named property IDs from %s", home_dir);
+		return delivery_status::temp_fail;
 	}
-	digest["file"] = std::move(mid_string);
-	auto djson = json_to_str(digest);
-	g_storedir = mres.maildir.c_str();
-
-	oxcmail_converter cvt;
-	cvt.alloc = exmdb_local_alloc;
-	cvt.get_propids = exmdb_local_get_propids;
-	auto pmsg = cvt.inet_to_mapi(*pmail);
-	g_storedir = nullptr;
-	if (NULL == pmsg) {
-		exmdb_local_log_info(pcontext->ctrl, address, LV_ERR, "fail "
-			"to convert rfc5322 into MAPI message object");
-		return delivery_status::perm_fail;
+	std::unique_ptr<message_content, mc_delete> msg_copy;
+	auto pmsg = shared->msg.get();
+	if (std::find(propids.cbegin(), propids.cend(), 0) == propids.cend()) {
+		lda_apply_propids(*shared, &propids);
+	} else {
+		lda_apply_propids(*shared, nullptr);
+		msg_copy.reset(pmsg->dup());
+		if (msg_copy == nullptr)
+			return delivery_status::temp_fail;
+		lda_replace_propids(*msg_copy, propids);
+		pmsg = msg_copy.get();
 	}
 	lq_report(pcontext->ctrl.queue_ID, 0, "before_delivery", *pmsg);
 
-	nt_time = rop_util_current_nttime();
-	if (pmsg->proplist.set(PR_MESSAGE_DELIVERY_TIME, &nt_time) != ecSuccess)
-		/* ignore */;
-	if (!pcontext->ctrl.need_bounce) {
-		tmp_int32 = UINT32_MAX;
-		if (pmsg->proplist.set(PR_AUTO_RESPONSE_SUPPRESS, &tmp_int32) != ecSuccess)
-			/* ignore */;
-	}
+	auto nt_time = pmsg->proplist.get<uint64_t>(PR_MESSAGE_DELIVERY_TIME);
+	if (nt_time != nullptr)
+		*nt_time = rop_util_current_nttime();
 	
-	pmsg->proplist.erase(PidTagChangeNumber);
 	uint64_t folder_id, message_id = 0;
 	uint32_t r32 = 0;
 	unsigned int flags = DELIVERY_DO_RULES_SV | DELIVERY_DO_NOTIF_SV;
 	if (g_lda_twostep)
 		flags = DELIVERY_DO_RULES_CL | DELIVERY_DO_NOTIF_CL;
-	if (deliver_to_junk)
+	if (shared->deliver_to_junk)
 		flags |= DELIVERY_FORCE_JUNK;
 	if (!exmdb_client_remote::deliver_message(home_dir,
 	    pcontext->ctrl.from, address, CP_ACP, flags,
-	    pmsg.get(), djson.c_str(), &folder_id, &message_id, &r32)) {
+	    pmsg, djson.c_str(), &folder_id, &message_id, &r32)) {
 		exmdb_local_log_info(pcontext->ctrl, address, LV_ERR,
 			"exmdb.deliver_message to %s failed (see gxhttp log for more)", home_dir);
 		return delivery_status::perm_fail;
@@ -445,7 +615,7 @@ delivery_status exmdb_local_deliverquota(MESSAGE_CONTEXT *pcontext,
 			lq_report(pcontext->ctrl.queue_ID, rop_util_get_gc_value(message_id),
 				"after_delivery", *rbct);
 	}
-	pmsg.reset();
+	msg_copy.reset();
 
 	switch (dm_status) {
 	case deliver_message_result::result_ok:
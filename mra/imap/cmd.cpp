@@ -328,7 +328,7 @@ static bool icp_parse_fetch_args(mdi_list &plist, bool *pb_detail,
 		return FALSE;
 	/* full load the mail digests from MIDB */
 	*pb_detail = FALSE;
-	bool want_flags = false;
+	bool want_flags = false, want_sections = false;
 	*pb_simple = FALSE;
 	/* stream object contain file information */
 	*pb_data = FALSE;
@@ -366,10 +366,14 @@ static bool icp_parse_fetch_args(mdi_list &plist, bool *pb_detail,
 		    strncasecmp(kw, "BODY.PEEK[", 10) == 0) {
 			if (strcasestr(kw, "FIELDS") == nullptr)
 				*pb_data = TRUE;
-			*pb_detail = TRUE;
+			/*
+			 * Sections are located with the structure index, for
+			 * which P-SIMU's mid is enough (cf. icp_load_mst).
+			 */
+			want_sections = true;
 		}
 	}
-	if (want_flags && !*pb_detail)
+	if ((want_flags || want_sections) && !*pb_detail)
 		*pb_simple = TRUE;
 	/* move to front (UID goes in front of plist) */
 	for (const auto kw : {"RFC822.TEXT", "RFC822.HEADER", "ENVELOPE", "RFC822.SIZE", "INTERNALDATE", "FLAGS", "UID"})
@@ -644,20 +648,37 @@ static int pstruct_else(imap_context &ctx, MJSON *pjson,
 		return 0;
 	}
 	std::string eml_path;
+	size_t head_ofs = pmime->get_head_offset();
 	if (storage_path == nullptr) {
 		eml_path = ctx.maildir + "/eml/"s + pjson->get_mail_filename();
-		if (!ctx.io_actor.exists(eml_path)) {
-			std::string content;
-			if (exmdb_client->imapfile_read(ctx.maildir, "eml",
-			    pjson->get_mail_filename(), &content))
-				ctx.io_actor.place(eml_path, std::move(content), true);
+		/*
+		 * Unless the whole mail is already at hand, fetch just the
+		 * header block and keep it under its own cache key.
+		 */
+		auto hdr_path = eml_path + "#" + std::to_string(head_ofs);
+		std::string content;
+		if (ctx.io_actor.exists(eml_path)) {
+			/* use the full copy */
+		} else if (ctx.io_actor.exists(hdr_path)) {
+			eml_path = std::move(hdr_path);
+			head_ofs = 0;
+		} else if (exmdb_client->imapfile_read_range(ctx.maildir, "eml",
+		    pjson->get_mail_filename(), head_ofs,
+		    std::min(pmime->get_head_length(), static_cast<size_t>(UINT32_MAX)),
+		    &content)) {
+			ctx.io_actor.place(hdr_path, std::move(content), true);
+			eml_path = std::move(hdr_path);
+			head_ofs = 0;
+		} else if (exmdb_client->imapfile_read(ctx.maildir, "eml",
+		    pjson->get_mail_filename(), &content)) {
+			ctx.io_actor.place(eml_path, std::move(content), true);
 		}
 	} else {
 		eml_path = ctx.maildir + "/tmp/imap.rfc822/"s + storage_path + "/" + pjson->get_mail_filename();
 	}
 	std::string b2;
 	int len = icp_match_field(ctx.io_actor, cmd_tag.c_str(), eml_path.c_str(),
-	          pmime->get_head_offset(), pmime->get_head_length(),
+	          head_ofs, pmime->get_head_length(),
 	          b_not, data_item, offset, length, b2);
 	if (len == -1)
 		buf += "BODY"s + pbody + " NIL";
@@ -714,15 +735,116 @@ static std::pair<std::string, std::string> split_DI(std::string_view sv)
 	return {std::string(sv.substr(0, idlen)), std::string(sv.substr(i))};
 }
 
+/**
+ * Load the binary MIME structure index ("mst", written next to the ext
+ * digest) @idx of @item into @mjson. That is enough to resolve BODY[section]
+ * items to byte ranges of the eml file without the JSON digest, including
+ * parts of embedded message/rfc822 (rfc822_build works off the offsets).
+ */
+static bool icp_load_mst(imap_context &ctx, const MITEM &item,
+    std::string_view idx, MJSON &mjson)
+{
+	if (idx.empty() || !mjson.load_from_index(idx)) {
+		mjson.clear();
+		return false;
+	}
+	mjson.filename = item.mid;
+	mjson.path = ctx.maildir + "/eml"s;
+	return true;
+}
+
+static bool icp_wants_sections(const mdi_list &items)
+{
+	return std::any_of(items.cbegin(), items.cend(), [](const std::string &e) {
+		return strncasecmp(e.c_str(), "BODY[", 5) == 0 ||
+		       strncasecmp(e.c_str(), "BODY.PEEK[", 10) == 0;
+	});
+}
+
+/**
+ * For BODY[section] items over @xa (from P-SIMU or the trivial path), read
+ * the structure indices of the whole batch up front, and get the digests
+ * of the messages that have none with a single P-DTLU instead of one per
+ * message. @mst receives each item's index, empty where absent; items
+ * whose digest arrived are marked FLAG_LOADED.
+ */
+static void icp_fetch_prepare_mst(imap_context &ctx, XARRAY &xa,
+    const mdi_list &items, std::vector<std::string> &mst)
+{
+	mst.clear();
+	if (!icp_wants_sections(items))
+		return;
+	auto num = xa.get_capacity();
+	mst.resize(num);
+	imap_seq_list need;
+	for (size_t i = 0; i < num; ++i) {
+		auto pitem = xa.get_item(i);
+		if (pitem->flag_bits & FLAG_LOADED)
+			continue;
+		if (!exmdb_client->imapfile_read(ctx.maildir, "mst",
+		    pitem->mid, &mst[i]) || mst[i].empty()) {
+			mst[i].clear();
+			need.insert(pitem->uid, pitem->uid);
+		}
+	}
+	if (need.empty())
+		return;
+	XARRAY dx;
+	int errnum = 0;
+	if (midb_agent::fetch_detail_uid(ctx.maildir, ctx.selected_folder,
+	    need, &dx, &errnum) != MIDB_RESULT_OK)
+		return; /* icp_process_fetch_item retries per message */
+	for (size_t i = 0; i < dx.get_capacity(); ++i) {
+		auto d = dx.get_item(i);
+		auto pitem = xa.get_itemx(d->uid);
+		if (pitem == nullptr || !(d->flag_bits & FLAG_LOADED))
+			continue;
+		auto digest = dx.get_digest(*d);
+		pitem->digest_off = xa.m_dpool.size();
+		pitem->digest_len = digest.size();
+		xa.m_dpool.append(digest);
+		pitem->flag_bits |= FLAG_LOADED;
+	}
+}
+
+/**
+ * @row: pre-rendered items from P-DTLB (fetch_detail_stream); used for
+ *       messages that came without digest
+ * @mst: structure index as read by icp_fetch_prepare_mst (empty if
+ *       absent), or nullptr to have it read here
+ */
 static int icp_process_fetch_item(imap_context &ctx,
     bool b_data, MITEM *pitem, std::string_view digest_str,
-    int item_id, mdi_list &pitem_list) try
+    int item_id, mdi_list &pitem_list,
+    const midb_agent::fetch_row *row = nullptr,
+    const std::string *mst = nullptr) try
 {
 	auto pcontext = &ctx;
 	int errnum;
 	MJSON mjson;
-	std::string buf;
-
+	std::string buf, digest_hold, mst_hold;
+
+	if (mst == nullptr && !(pitem->flag_bits & FLAG_LOADED) &&
+	    icp_wants_sections(pitem_list)) {
+		if (!exmdb_client->imapfile_read(ctx.maildir, "mst",
+		    pitem->mid, &mst_hold))
+			mst_hold.clear();
+		mst = &mst_hold;
+	}
+	bool mst_absent = mst != nullptr && mst->empty();
+	if (!(pitem->flag_bits & FLAG_LOADED) && mst != nullptr &&
+	    !icp_load_mst(ctx, *pitem, *mst, mjson)) {
+		/* No usable index, get the digest of just this message. */
+		XARRAY dx;
+		imap_seq_list one;
+		one.insert(pitem->uid, pitem->uid);
+		if (midb_agent::fetch_detail_uid(ctx.maildir, ctx.selected_folder,
+		    one, &dx, &errnum) == MIDB_RESULT_OK && dx.get_capacity() > 0) {
+			digest_hold = dx.get_digest(*dx.get_item(0));
+			digest_str = digest_hold;
+			pitem->flag_bits |= FLAG_LOADED;
+		}
+	}
 	if (pitem->flag_bits & FLAG_LOADED) {
 		auto eml_path = std::string(pcontext->maildir) + "/eml";
 		Json::Value digest;
@@ -734,9 +856,17 @@ static int icp_process_fetch_item(imap_context &ctx,
 			return 1923;
 		}
 		mjson.path = std::move(eml_path);
+		if (mst_absent) {
+			/* Messages from before the index existed get one now. */
+			auto idx = mjson.to_index();
+			if (!idx.empty())
+				exmdb_client->imapfile_write(ctx.maildir, "mst", pitem->mid, idx);
+		}
 	}
+	if (pitem->flag_bits & FLAG_LOADED)
+		row = nullptr;
 	auto deferred_eml_load = [&]() {
-		if (!(pitem->flag_bits & FLAG_LOADED))
+		if (mjson.path.empty())
 			return;
 		auto eml_file = mjson.path + "/"s + pitem->mid;
 		if (!ctx.io_actor.exists(eml_file)) {
@@ -756,7 +886,9 @@ static int icp_process_fetch_item(imap_context &ctx,
 		auto kw = kwss.data();
 		if (strcasecmp(kw, "BODY") == 0) {
 			buf += "BODY ";
-			if (mjson.has_rfc822_part()) {
+			if (row != nullptr) {
+				buf += row->body.empty() ? "NIL" : row->body;
+			} else if (mjson.has_rfc822_part()) {
 				deferred_eml_load();
 				auto rfc_path = std::string(pcontext->maildir) + "/tmp/imap.rfc822";
 				if (rfc_path.size() <= 0 ||
@@ -780,7 +912,9 @@ static int icp_process_fetch_item(imap_context &ctx,
 			}
 		} else if (strcasecmp(kw, "BODYSTRUCTURE") == 0) {
 			buf += "BODYSTRUCTURE ";
-			if (mjson.has_rfc822_part()) {
+			if (row != nullptr) {
+				buf += row->bodystructure.empty() ? "NIL" : row->bodystructure;
+			} else if (mjson.has_rfc822_part()) {
 				deferred_eml_load();
 				auto rfc_path = std::string(pcontext->maildir) + "/tmp/imap.rfc822";
 				if (rfc_path.size() <= 0 ||
@@ -805,8 +939,11 @@ static int icp_process_fetch_item(imap_context &ctx,
 		} else if (strcasecmp(kw, "ENVELOPE") == 0) {
 			buf += "ENVELOPE ";
 			std::string b2;
-			auto len = mjson.fetch_envelope(pcontext->defcharset, b2);
-			if (len == -1)
+			auto len = row != nullptr ? -1 :
+			           mjson.fetch_envelope(pcontext->defcharset, b2);
+			if (row != nullptr && !row->envelope.empty())
+				buf += row->envelope;
+			else if (len == -1)
 				buf += "NIL";
 			else
 				buf += std::move(b2);
@@ -821,7 +958,9 @@ static int icp_process_fetch_item(imap_context &ctx,
 			time_t tmp_time;
 			struct tm tmp_tm;
 
-			if (!parse_rfc822_timestamp(mjson.get_mail_received(), &tmp_time))
+			if (row != nullptr)
+				tmp_time = row->idate;
+			else if (!parse_rfc822_timestamp(mjson.get_mail_received(), &tmp_time))
 				tmp_time = strtol(mjson.get_mail_filename(), nullptr, 0);
 			memset(&tmp_tm, 0, sizeof(tmp_tm));
 			gmtime_r(&tmp_time, &tmp_tm);
@@ -850,7 +989,8 @@ static int icp_process_fetch_item(imap_context &ctx,
 				buf += "RFC822.HEADER NIL";
 		} else if (strcasecmp(kw, "RFC822.SIZE") == 0) {
 			buf += "RFC822.SIZE ";
-			buf += std::to_string(mjson.get_mail_length());
+			buf += std::to_string(row != nullptr ? row->size :
+			       mjson.get_mail_length());
 		} else if (strcasecmp(kw, "RFC822.TEXT") == 0) {
 			auto pmime = mjson.get_mime("");
 			size_t ct_length = pmime != nullptr ? pmime->get_content_length() : 0;
@@ -1499,6 +1639,8 @@ static int icp_password2(const char *cmdbuf, imap_context &ctx) try
 	gx_strlcpy(pcontext->maildir, mres.maildir.c_str(), std::size(pcontext->maildir));
 	if (*pcontext->maildir == '\0')
 		return 1902 | DISPATCH_TAG;
+	/* Have exmdb open the store while the client gets going */
+	exmdb_client->prewarm_store(pcontext->maildir);
 	if (mres.lang.empty())
 		mres.lang = znul(g_config_file->get_value("default_lang"));
 	gx_strlcpy(pcontext->defcharset, resource_get_default_charset(mres.lang.c_str()),
@@ -1578,6 +1720,7 @@ int icp_login(std::span<std::string> argv, imap_context &ctx)
 	gx_strlcpy(pcontext->maildir, mres.maildir.c_str(), std::size(pcontext->maildir));
 	if (*pcontext->maildir == '\0')
 		return 1902;
+	exmdb_client->prewarm_store(pcontext->maildir);
 	if (mres.lang.empty())
 		mres.lang = znul(g_config_file->get_value("default_lang"));
 	gx_strlcpy(pcontext->defcharset, resource_get_default_charset(mres.lang.c_str()),
@@ -3110,6 +3253,13 @@ static errno_t parse_imap_seqx(imap_context &ctx, const char *range_string,
 
 /* Facilitate incremental streaming of the metadata for FETCH responses. */
 static constexpr unsigned int FETCH_STREAM_CHUNK = 256;
+/*
+ * Output that a detail batch should produce. The batch size is adapted to
+ * it, so that rows reach the client (through the non-blocking wrlst
+ * drain) in pieces of about this size rather than 256 messages at a time.
+ */
+static constexpr size_t FETCH_STREAM_FLUSH = 16384;
+static constexpr unsigned int FETCH_STREAM_DETAIL_FIRST = 32;
 
 static int fetch_trivial_uid(imap_context &ctx, const imap_seq_list &range_list,
     XARRAY &xa) try
@@ -3125,6 +3275,88 @@ static int fetch_trivial_uid(imap_context &ctx, const imap_seq_list &range_list,
 	return MIDB_LOCAL_ENOMEM;
 }
 
+/**
+ * Which P-DTLB items to have midb pre-render for @items. Sections are
+ * resolved through the digest, so ask for that instead.
+ */
+static unsigned int icp_dtlb_fields(const mdi_list &items)
+{
+	unsigned int fields = icp_wants_sections(items) ? DTLB_DIGEST : 0;
+	for (const auto &e : items) {
+		if (strcasecmp(e.c_str(), "ENVELOPE") == 0)
+			fields |= DTLB_ENVELOPE;
+		else if (strcasecmp(e.c_str(), "BODY") == 0)
+			fields |= DTLB_BODY;
+		else if (strcasecmp(e.c_str(), "BODYSTRUCTURE") == 0)
+			fields |= DTLB_BODYSTRUCTURE;
+	}
+	return fields;
+}
+
+/**
+ * Render the detail items of @batch. Each `* n FETCH` line is produced as
+ * soon as midb's record for it has been received, rather than after the
+ * whole batch was parsed.
+ */
+static int icp_fetch_stream_rows(imap_context &ctx,
+    const imap_seq_list &batch)
+{
+	auto &fs = ctx.fstream;
+	int errnum = 0, result = 0;
+	auto ssr = midb_agent::fetch_detail_stream(ctx.maildir,
+	           ctx.selected_folder, batch, ctx.defcharset,
+	           icp_dtlb_fields(fs.items),
+	           [&](MITEM &mitem, const midb_agent::fetch_row &row) {
+		/*
+		 * midb might have yielded new mails, so filter with respect
+		 * to current sequence assignment. The `* <id> FETCH` uses
+		 * the session seqid.
+		 */
+		auto ct_item = ctx.contents.get_itemx(mitem.uid);
+		if (ct_item == nullptr)
+			return true;
+		result = icp_process_fetch_item(ctx, false, &mitem,
+		         row.digest, ct_item->id, fs.items, &row);
+		return result == 0;
+	}, &errnum);
+	auto ret = m2icode(ssr, errnum);
+	return ret != 0 ? ret : result;
+}
+
+/**
+ * Render the flags/section items of @batch.
+ */
+static int icp_fetch_stream_items(imap_context &ctx,
+    const imap_seq_list &batch)
+{
+	auto &fs = ctx.fstream;
+	int errnum = 0;
+	XARRAY xarray;
+	auto ssr = fs.use_trivial ? fetch_trivial_uid(ctx, batch, xarray) :
+	           midb_agent::fetch_simple_uid(ctx.maildir,
+	           ctx.selected_folder, batch, &xarray, &errnum);
+	auto result = m2icode(ssr, errnum);
+	if (result != 0)
+		return result;
+	std::vector<std::string> mst;
+	icp_fetch_prepare_mst(ctx, xarray, fs.items, mst);
+	int num = xarray.get_capacity();
+	for (int i = 0; i < num; ++i) {
+		auto pitem = xarray.get_item(i);
+		/* filter like icp_fetch_stream_rows */
+		auto ct_item = ctx.contents.get_itemx(pitem->uid);
+		if (ct_item == nullptr)
+			continue;
+		result = icp_process_fetch_item(ctx, false,
+		         pitem, xarray.get_digest(*pitem),
+		         ct_item->id, fs.items, nullptr,
+		         mst.empty() ? nullptr : &mst[i]);
+		if (result != 0)
+			return result;
+	}
+	return 0;
+}
+
 /**
  * Emit the next batch of `* n FETCH (...)` lines into ctx.stream. Or, when the
  * message set is exhausted, emit the final unsolicited responses and the
@@ -3140,7 +3372,6 @@ int icp_fetch_stream_continue(imap_context &ctx) try
 {
 	auto pcontext = &ctx;
 	auto &fs = ctx.fstream;
-	int errnum = 0;
 	imrpc_build_env();
 	auto cl_0 = HX::make_scope_exit(imrpc_free_env);
 	pcontext->stream.clear();
@@ -3173,37 +3404,20 @@ int icp_fetch_stream_continue(imap_context &ctx) try
 			fs.mid_range = false;
 			continue;
 		}
-		auto i1 = std::min(i9 - 1, i0 + FETCH_STREAM_CHUNK - 1);
+		auto i1 = std::min(i9 - 1, i0 + (fs.detail ? fs.detail_chunk :
+		          FETCH_STREAM_CHUNK) - 1);
 		imap_seq_list batch;
 		batch.insert(pcontext->contents.get_item(i0)->uid,
 		             pcontext->contents.get_item(i1)->uid);
-		XARRAY xarray;
-		auto ssr = fs.detail ?
-		           midb_agent::fetch_detail_uid(pcontext->maildir,
-		           pcontext->selected_folder, batch, &xarray, &errnum) :
-		           fs.use_trivial ?
-		           fetch_trivial_uid(*pcontext, batch, xarray) :
-		           midb_agent::fetch_simple_uid(pcontext->maildir,
-		           pcontext->selected_folder, batch, &xarray, &errnum);
-		auto result = m2icode(ssr, errnum);
+		auto result = fs.detail ? icp_fetch_stream_rows(ctx, batch) :
+		              icp_fetch_stream_items(ctx, batch);
 		if (result != 0)
 			return result;
-		int num = xarray.get_capacity();
-		for (int i = 0; i < num; ++i) {
-			auto pitem = xarray.get_item(i);
-			/*
-			 * fetch_detail_uid might have yielded new mails, so
-			 * filter with respect to current sequence assignment.
-			 * The `* <id> FETCH` uses the session seqid.
-			 */
-			auto ct_item = pcontext->contents.get_itemx(pitem->uid);
-			if (ct_item == nullptr)
-				continue;
-			result = icp_process_fetch_item(ctx, FALSE,
-			         pitem, xarray.get_digest(*pitem),
-			         ct_item->id, fs.items);
-			if (result != 0)
-				return result;
+		if (fs.detail) {
+			/* Size the next batch by what this one produced */
+			size_t z = std::max<size_t>(pcontext->stream.get_total_length(), 1);
+			fs.detail_chunk = std::clamp<size_t>(FETCH_STREAM_FLUSH *
+			                  (i1 - i0 + 1) / z, 1, FETCH_STREAM_CHUNK);
 		}
 		if (i1 + 1 >= i9) {
 			++fs.range_idx;
@@ -3243,6 +3457,7 @@ static int icp_fetch_stream_begin(imap_context &ctx, const std::string &tag,
 	auto &fs = ctx.fstream;
 	fs.reset();
 	fs.detail = b_detail;
+	fs.detail_chunk = FETCH_STREAM_DETAIL_FIRST;
 	fs.use_trivial = !uid_cmd && !b_detail && !b_simple;
 	fs.uid_cmd = uid_cmd;
 	fs.ranges = std::move(ranges);
@@ -3279,9 +3494,11 @@ int icp_fetch(std::span<std::string> argv, imap_context &ctx)
 		return 1800;
 	/*
 	 * Metadata requests (FLAGS/ENVELOPE/BODY[HEADER.FIELDS]/BODYSTRUCTURE)
-	 * are streamed in batches. Detail leads to full digests (via P-DTLU).
-	 * Simple leads to fresh flags+keywords (via P-SIMU). Otherwise, the
-	 * in-memory cache is enough (UID-only).
+	 * are streamed in batches. Detail leads to binary records with items
+	 * pre-rendered by midb (via P-DTLB), or digests where needed.
+	 * Simple leads to fresh flags+keywords (via P-SIMU), whose mids also
+	 * serve BODY[section] lookups. Otherwise, the in-memory cache is
+	 * enough (UID-only).
 	 */
 	if (!b_data)
 		return icp_fetch_stream_begin(ctx, argv[0], false, b_detail,
@@ -3301,6 +3518,8 @@ int icp_fetch(std::span<std::string> argv, imap_context &ctx)
 	num = xarray.get_capacity();
 	imrpc_build_env();
 	auto cl_0 = HX::make_scope_exit(imrpc_free_env);
+	std::vector<std::string> mst;
+	icp_fetch_prepare_mst(ctx, xarray, list_data, mst);
 	for (i=0; i<num; i++) {
 		auto pitem = xarray.get_item(i);
 		/*
@@ -3312,7 +3531,8 @@ int icp_fetch(std::span<std::string> argv, imap_context &ctx)
 			continue;
 		result = icp_process_fetch_item(ctx, b_data,
 		         pitem, xarray.get_digest(*pitem),
-		         ct_item->id, list_data);
+		         ct_item->id, list_data, nullptr,
+		         mst.empty() ? nullptr : &mst[i]);
 		if (result != 0)
 			return result;
 	}
@@ -3613,6 +3833,8 @@ int icp_uid_fetch(std::span<std::string> argv, imap_context &ctx) try
 	num = xarray.get_capacity();
 	imrpc_build_env();
 	auto cl_0 = HX::make_scope_exit(imrpc_free_env);
+	std::vector<std::string> mst;
+	icp_fetch_prepare_mst(ctx, xarray, list_data, mst);
 	for (i=0; i<num; i++) {
 		auto pitem = xarray.get_item(i);
 		auto ct_item = pcontext->contents.get_itemx(pitem->uid);
@@ -3620,7 +3842,8 @@ int icp_uid_fetch(std::span<std::string> argv, imap_context &ctx) try
 			continue;
 		auto ret = icp_process_fetch_item(ctx, b_data,
 		           pitem, xarray.get_digest(*pitem),
-		           ct_item->id, list_data);
+		           ct_item->id, list_data, nullptr,
+		           mst.empty() ? nullptr : &mst[i]);
 		if (ret != 0)
 			return ret;
 	}
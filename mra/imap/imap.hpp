@@ -86,6 +86,7 @@ struct fetch_stream_state {
 	bool use_trivial = false, uid_cmd = false;
 	bool mid_range = false; /* next_idx is a resume point inside the range */
 	size_t range_idx = 0, next_idx = 0;
+	unsigned int detail_chunk = 0; /* messages per P-DTLB batch */
 	gromox::imap_seq_list ranges;
 	std::vector<std::string> items;
 	std::string tag;
@@ -1054,6 +1054,10 @@ static int imap_parser_wrdat_retrieve(imap_context &ctx)
 			} else {
 				*ptr = '\0';
 				*ptr1 = '\0';
+				size_t want_ofs = strtoul(&ptr[1], nullptr, 0);
+				size_t want_len = strtoul(&ptr1[1], nullptr, 0);
+				/* file offset of wrdat_content[0] */
+				size_t base_ofs = 0;
 				ctx.wrdat_content = nullptr;
 				ctx.wrdat_backing.reset();
 				try {
@@ -1063,9 +1067,21 @@ static int imap_parser_wrdat_retrieve(imap_context &ctx)
 						ctx.wrdat_backing.emplace();
 						imrpc_build_env();
 						auto cl_0 = HX::make_scope_exit(imrpc_free_env);
-						if (exmdb_client->imapfile_read(ctx.maildir, "eml",
-						    &last_line[8], &*ctx.wrdat_backing))
+						/*
+						 * Read only the requested section. Servers
+						 * without imapfile_read_range get asked for
+						 * the whole file.
+						 */
+						if (want_len <= UINT32_MAX &&
+						    exmdb_client->imapfile_read_range(ctx.maildir,
+						    "eml", &last_line[8], want_ofs, want_len,
+						    &*ctx.wrdat_backing)) {
 							ctx.wrdat_content = &*ctx.wrdat_backing;
+							base_ofs = want_ofs;
+						} else if (exmdb_client->imapfile_read(ctx.maildir, "eml",
+						    &last_line[8], &*ctx.wrdat_backing)) {
+							ctx.wrdat_content = &*ctx.wrdat_backing;
+						}
 					}
 				} catch (const std::bad_alloc &) {
 					mlog(LV_ERR, "E-1466: ENOMEM");
@@ -1074,14 +1090,14 @@ static int imap_parser_wrdat_retrieve(imap_context &ctx)
 					strcpy(&pcontext->write_buff[pcontext->write_length], "NIL");
 					pcontext->write_length += 3;
 				} else {
-					ctx.wrdat_offset = strtoul(&ptr[1], nullptr, 0);
+					ctx.wrdat_offset = want_ofs - base_ofs;
 					if (ctx.wrdat_offset > ctx.wrdat_content->size()) {
 						mlog(LV_ERR, "E-1758");
 						ctx.wrdat_content = nullptr;
 						ctx.wrdat_backing.reset();
 						return IMAP_RETRIEVE_ERROR;
 					}
-					ctx.literal_len = std::min(static_cast<size_t>(strtoul(&ptr1[1], nullptr, 0)),
+					ctx.literal_len = std::min(want_len,
 					                  ctx.wrdat_content->size() - ctx.wrdat_offset);
 					pcontext->current_len = 0;
 					pcontext->write_length += sprintf(&pcontext->write_buff[pcontext->write_length], "{%u}\r\n", pcontext->literal_len);
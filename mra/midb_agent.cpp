@@ -11,6 +11,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <fcntl.h>
 #include <list>
 #include <mutex>
 #include <poll.h>
@@ -19,10 +20,12 @@
 #include <string>
 #include <string_view>
 #include <unistd.h>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <fmt/core.h>
 #include <libHX/ctype_helper.h>
+#include <libHX/endian.h>
 #include <libHX/io.h>
 #include <libHX/scope.hpp>
 #include <libHX/socket.h>
@@ -54,10 +57,15 @@ DECLARE_SVC_API(,);
 namespace {
 
 struct BACK_SVR;
+/**
+ * @virt: @sockd is our end of a stream multiplexed over a shared
+ *        connection (cf. midbag_muxwork), not a connection of its own
+ */
 struct BACK_CONN {
 	int sockd = -1;
 	time_t last_time = 0;
 	BACK_SVR *psvr = nullptr;
+	bool virt = false;
 };
 
 struct BACK_CONN_floating {
@@ -72,16 +80,49 @@ struct BACK_CONN_floating {
 	std::list<BACK_CONN> tmplist;
 };
 
+enum class mux_st {
+	off, /* plain connections (conn_list) in use */
+	probing, up, down,
+};
+
+/**
+ * @mux_newfds: mux thread ends of streams yet to be adopted by it
+ * @n_streams:  streams in existence (pooled, in use, or lost)
+ */
 struct BACK_SVR {
 	std::string prefix;
 	char ip_addr[40]{};
 	uint16_t port = 0;
 	std::list<BACK_CONN> conn_list;
+	std::atomic<mux_st> mux_state{mux_st::off};
+	pthread_t mux_id{};
+	int mux_wake[2] = {-1, -1};
+	std::vector<int> mux_newfds;
+	unsigned int n_streams = 0;
+};
+
+/**
+ * One multiplexed stream, as seen by the mux thread.
+ * @reqid: request awaiting its response, 0 if none
+ * @rx:    command bytes received from the stream
+ * @tx:    response bytes yet to be passed to the stream
+ * @eof:   the midb_agent side has hung up
+ */
+/**
+ * @tx_since:	when @tx last went from empty to non-empty, or was sent from
+ */
+struct mux_stream {
+	int fd = -1;
+	uint32_t reqid = 0;
+	std::string rx, tx;
+	time_t tx_since = 0;
+	bool eof = false;
 };
 
 }
 
 static void *midbag_scanwork(void *);
+static void *midbag_muxwork(void *);
 static ssize_t read_line(int sockd, char *buff, size_t length);
 static ssize_t read_line_dyn(int sockd, std::string &out);
 static int connect_midb(const char *host, uint16_t port);
@@ -99,6 +140,8 @@ std::atomic<size_t> g_midb_command_buffer_size{256 * 1024};
  */
 static constexpr int MIDB_CMD_TIMEOUT_MS = 90000;
 static int g_conn_num;
+static bool g_mux_enable;
+static std::atomic<unsigned int> g_mux_streams{64};
 static gromox::atomic_bool g_midbagent_stop;
 static pthread_t g_scan_id;
 static std::list<BACK_CONN> g_lost_list;
@@ -110,6 +153,8 @@ static constexpr cfg_directive midb_agent_cfg_defaults[] = {
 	{"connection_num", "5", CFG_SIZE, "2", "100"},
 	{"context_average_mem", "1024", CFG_SIZE},
 	{"midb_agent_command_buffer_size", "256K", CFG_SIZE},
+	{"midb_agent_multiplex", "yes", CFG_BOOL},
+	{"midb_agent_mux_streams", "64", CFG_SIZE, "1", "4096"},
 	CFG_TABLE_END,
 };
 
@@ -134,8 +179,9 @@ static bool list_file_read_midb(const char *filename) try
 		svr.prefix = "/";
 		strcpy(pserver->ip_addr, "::1");
 		pserver->port = 5555;
-		for (decltype(g_conn_num) j = 0; j < g_conn_num; ++j)
-			g_lost_list.push_back(BACK_CONN{-1, 0, pserver});
+		if (!g_mux_enable)
+			for (decltype(g_conn_num) j = 0; j < g_conn_num; ++j)
+				g_lost_list.push_back(BACK_CONN{-1, 0, pserver});
 		return true;
 	}
 	for (decltype(list_num) i = 0; i < list_num; ++i) {
@@ -144,8 +190,9 @@ static bool list_file_read_midb(const char *filename) try
 		svr.prefix = pitem[i].prefix;
 		gx_strlcpy(pserver->ip_addr, pitem[i].ip_addr, std::size(pserver->ip_addr));
 		pserver->port = pitem[i].port;
-		for (decltype(g_conn_num) j = 0; j < g_conn_num; ++j)
-			g_lost_list.emplace_back(BACK_CONN{-1, 0, pserver});
+		if (!g_mux_enable)
+			for (decltype(g_conn_num) j = 0; j < g_conn_num; ++j)
+				g_lost_list.emplace_back(BACK_CONN{-1, 0, pserver});
 	}
 	return true;
 } catch (const std::bad_alloc &) {
@@ -166,6 +213,7 @@ static bool midb_agent_reload(std::shared_ptr<config_file> &&cfg)
 	if (g_file_ratio == 0)
 		fprintf(stderr, "[midb_agent]: memory pool is switched off through config\n");
 	g_midb_command_buffer_size = cfg->get_ll("midb_agent_command_buffer_size");
+	g_mux_streams = cfg->get_ll("midb_agent_mux_streams");
 	return true;
 }
 
@@ -185,6 +233,8 @@ bool SVC_midb_agent(enum plugin_op reason, const struct dlfuncs &ppdata)
 				strerror(errno));
 			return FALSE;
 		}
+		/* not reloadable */
+		g_mux_enable = pconfig->get_ll("midb_agent_multiplex");
 		if (!midb_agent_reload(std::move(pconfig)))
 			return false;
 		if (!list_file_read_midb("midb_list.txt"))
@@ -197,6 +247,21 @@ bool SVC_midb_agent(enum plugin_op reason, const struct dlfuncs &ppdata)
 			return FALSE;
 		}
 		pthread_setname_np(g_scan_id, "midb_agent");
+		if (!g_mux_enable)
+			return TRUE;
+		for (auto &srv : g_server_list) {
+			if (pipe2(srv.mux_wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+				printf("[midb_agent]: pipe: %s\n", strerror(errno));
+				return FALSE;
+			}
+			srv.mux_state = mux_st::probing;
+			ret = pthread_create4(&srv.mux_id, nullptr, midbag_muxwork, &srv);
+			if (ret != 0) {
+				printf("[midb_agent]: failed to create mux thread: %s\n", strerror(ret));
+				return FALSE;
+			}
+			pthread_setname_np(srv.mux_id, "midb_agent/mux");
+		}
 		return TRUE;
 	}
 	case PLUGIN_FREE:
@@ -206,15 +271,24 @@ bool SVC_midb_agent(enum plugin_op reason, const struct dlfuncs &ppdata)
 				pthread_kill(g_scan_id, SIGALRM);
 				pthread_join(g_scan_id, NULL);
 			}
+			for (auto &srv : g_server_list)
+				if (!pthread_equal(srv.mux_id, {}))
+					pthread_join(srv.mux_id, nullptr);
 		}
 		g_lost_list.clear();
 		for (auto &srv : g_server_list) {
 			for (auto &c : srv.conn_list) {
 				auto pback = &c;
-				if (HXio_fullwrite(pback->sockd, "QUIT\r\n", 6) != 6)
+				if (!pback->virt &&
+				    HXio_fullwrite(pback->sockd, "QUIT\r\n", 6) != 6)
 					/* ignore */;
 				close(pback->sockd);
 			}
+			for (auto fd : srv.mux_newfds)
+				close(fd);
+			for (auto fd : srv.mux_wake)
+				if (fd >= 0)
+					close(fd);
 		}
 		g_server_list.clear();
 		return TRUE;
@@ -266,6 +340,13 @@ static void *midbag_scanwork(void *param)
 
 		while (temp_list.size() > 0) {
 			auto pback = &temp_list.front();
+			if (pback->virt) {
+				/* a new stream is made on demand */
+				std::unique_lock sv_hold(g_server_lock);
+				--pback->psvr->n_streams;
+				temp_list.pop_front();
+				continue;
+			}
 			pback->sockd = connect_midb(pback->psvr->ip_addr,
 							pback->psvr->port);
 			if (-1 != pback->sockd) {
@@ -282,6 +363,53 @@ static void *midbag_scanwork(void *param)
 	return NULL;
 }
 
+/**
+ * Make a new multiplexed stream to @svr if the shared connection is up.
+ * Needs g_server_lock.
+ */
+static bool mux_open_stream(BACK_SVR &svr, BACK_CONN_floating &fc) try
+{
+	if (svr.mux_state != mux_st::up || svr.n_streams >= g_mux_streams)
+		return false;
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+		return false;
+	try {
+		svr.mux_newfds.push_back(sv[1]);
+	} catch (const std::bad_alloc &) {
+		close(sv[0]);
+		close(sv[1]);
+		throw;
+	}
+	fc.tmplist.push_back(BACK_CONN{sv[0], time(nullptr), &svr, true});
+	++svr.n_streams;
+	if (write(svr.mux_wake[1], "", 1) < 0)
+		/* pipe full: a wakeup is pending anyway */;
+	return true;
+} catch (const std::bad_alloc &) {
+	return false;
+}
+
+/**
+ * Take an idle connection from the pool of @svr. Needs g_server_lock.
+ */
+static bool take_pooled(BACK_SVR &svr, BACK_CONN_floating &fc)
+{
+	while (svr.conn_list.size() > 0) {
+		auto &c = svr.conn_list.front();
+		struct pollfd pfd = {c.sockd, POLLIN, 0};
+		/* Idle streams read as EOF once their mux connection is gone. */
+		if (!c.virt || poll(&pfd, 1, 0) == 0) {
+			fc.tmplist.splice(fc.tmplist.end(), svr.conn_list, svr.conn_list.begin());
+			return true;
+		}
+		close(c.sockd);
+		c.sockd = -1;
+		g_lost_list.splice(g_lost_list.end(), svr.conn_list, svr.conn_list.begin());
+	}
+	return false;
+}
+
 static BACK_CONN_floating get_connection(const char *prefix)
 {
 	BACK_CONN_floating fc;
@@ -292,20 +420,15 @@ static BACK_CONN_floating get_connection(const char *prefix)
 
 	{
 	std::unique_lock sv_hold(g_server_lock);
-	if (i->conn_list.size() > 0) {
-		fc.tmplist.splice(fc.tmplist.end(), i->conn_list, i->conn_list.begin());
+	if (take_pooled(*i, fc) || mux_open_stream(*i, fc))
 		return fc;
 	}
-	}
 
 	for (size_t j = 0; j < SOCKET_TIMEOUT && !g_midbagent_stop; ++j) {
 		sleep(1);
 		std::unique_lock sv_hold(g_server_lock);
-		if (i->conn_list.size() > 0) {
-			fc.tmplist.splice(fc.tmplist.end(),
-				i->conn_list, i->conn_list.begin());
+		if (take_pooled(*i, fc) || mux_open_stream(*i, fc))
 			return fc;
-		}
 	}
 	return fc;
 }
@@ -333,6 +456,241 @@ BACK_CONN_floating::BACK_CONN_floating(BACK_CONN_floating &&o)
 	tmplist = std::move(o.tmplist);
 }
 
+/**
+ * Ask midb to switch @sockd to multiplexed mode. Returns 1 if it did, 0 if
+ * it does not know how to, and -1 on I/O error.
+ */
+static int mux_negotiate(int sockd)
+{
+	char buf[64];
+	if (HXio_fullwrite(sockd, "MUX\r\n", 5) != 5)
+		return -1;
+	auto ret = read_line(sockd, buf, std::size(buf));
+	if (ret <= 0)
+		return -1;
+	return strcmp(buf, "TRUE") == 0 ? 1 : 0;
+}
+
+/**
+ * Pass a command line of @s to midb if @s has no request outstanding.
+ */
+static void mux_submit(mux_stream &s, uint32_t &next_id, std::string &tx,
+    std::unordered_map<uint32_t, mux_stream *> &pending)
+{
+	if (s.reqid != 0 || s.eof)
+		return;
+	auto eol = s.rx.find("\r\n");
+	if (eol == s.rx.npos)
+		return;
+	/* 0 is for keepalives */
+	do {
+		++next_id;
+	} while (next_id == 0 || pending.contains(next_id));
+	tx += std::to_string(next_id);
+	tx += ' ';
+	tx.append(s.rx, 0, eol + 2);
+	s.rx.erase(0, eol + 2);
+	s.reqid = next_id;
+	pending.emplace(next_id, &s);
+}
+
+/**
+ * Move one stream's bytes (commands in, responses out) without blocking.
+ */
+static void mux_stream_io(mux_stream &s, short revents, time_t now)
+{
+	if (revents & POLLOUT && !s.tx.empty()) {
+		auto ret = send(s.fd, s.tx.data(), s.tx.size(), MSG_NOSIGNAL);
+		if (ret > 0) {
+			s.tx.erase(0, ret);
+			s.tx_since = now;
+		} else if (ret < 0 && errno != EAGAIN) {
+			s.eof = true;
+		}
+	}
+	if (revents & (POLLIN | POLLHUP | POLLERR)) {
+		char buf[4096];
+		auto ret = read(s.fd, buf, std::size(buf));
+		if (ret > 0)
+			s.rx.append(buf, ret);
+		else if (ret == 0 || errno != EAGAIN)
+			s.eof = true;
+	}
+}
+
+/* Response bytes buffered per stream before midb's output is held back */
+static constexpr size_t MUX_STREAM_TXMAX = 1U << 20;
+
+/**
+ * Shuttle requests and responses between the streams and the shared
+ * connection @sockd until the latter fails. While a stream's user lags
+ * behind by MUX_STREAM_TXMAX, no more is read from @sockd; a stream that
+ * stays that way for SOCKET_TIMEOUT is dropped, so that one stuck user
+ * cannot stall the others for good.
+ */
+static void mux_serve(BACK_SVR &svr, int sockd, std::list<mux_stream> &streams) try
+{
+	std::unordered_map<uint32_t, mux_stream *> pending;
+	std::string tx, rx;
+	std::vector<struct pollfd> pfd;
+	std::vector<mux_stream *> pstr;
+	uint32_t next_id = 0;
+	auto buf = std::make_unique<char[]>(64 * 1024);
+	time_t last_tx = time(nullptr);
+
+	while (!g_midbagent_stop) {
+		{
+			std::unique_lock sv_hold(g_server_lock);
+			for (auto fd : svr.mux_newfds) {
+				if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+					close(fd);
+					continue;
+				}
+				streams.emplace_back().fd = fd;
+			}
+			svr.mux_newfds.clear();
+		}
+		for (auto it = streams.begin(); it != streams.end(); ) {
+			if (!it->eof || it->reqid != 0) {
+				mux_submit(*it, next_id, tx, pending);
+				++it;
+				continue;
+			}
+			close(it->fd);
+			it = streams.erase(it);
+		}
+		auto now = time(nullptr);
+		bool backlog = false;
+		for (auto &s : streams) {
+			if (s.tx.size() < MUX_STREAM_TXMAX)
+				continue;
+			if (now - s.tx_since < SOCKET_TIMEOUT) {
+				backlog = true;
+				continue;
+			}
+			/* further frames for s.reqid are discarded */
+			mlog(LV_WARN, "W-2477: midb_agent: dropping a stream whose user "
+			        "stopped reading responses");
+			shutdown(s.fd, SHUT_RDWR);
+			s.eof = true;
+			s.tx.clear();
+			s.tx.shrink_to_fit();
+		}
+		if (tx.empty() && pending.empty() && now - last_tx >= SOCKET_TIMEOUT / 2)
+			/* the response ("FALSE 1") is dropped; it only keeps midb from timing out */
+			tx = "0 PING\r\n";
+
+		pfd.clear();
+		pstr.clear();
+		pfd.push_back({svr.mux_wake[0], POLLIN, 0});
+		pfd.push_back({sockd, static_cast<short>((backlog ? 0 : POLLIN) |
+			(tx.empty() ? 0 : POLLOUT)), 0});
+		for (auto &s : streams) {
+			short ev = (s.reqid == 0 ? POLLIN : 0) | (s.tx.empty() ? 0 : POLLOUT);
+			pfd.push_back({s.fd, ev, 0});
+			pstr.push_back(&s);
+		}
+		if (poll(pfd.data(), pfd.size(), 1000) <= 0)
+			continue;
+		if (pfd[0].revents & POLLIN)
+			while (read(svr.mux_wake[0], buf.get(), 64) > 0)
+				/* drain */;
+
+		if (pfd[1].revents & POLLOUT) {
+			auto ret = send(sockd, tx.data(), tx.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (ret < 0 && errno != EAGAIN)
+				return;
+			if (ret > 0) {
+				tx.erase(0, ret);
+				last_tx = now;
+			}
+		}
+		if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			auto ret = recv(sockd, buf.get(), 64 * 1024, MSG_DONTWAIT);
+			if (ret == 0 || (ret < 0 && errno != EAGAIN))
+				return;
+			if (ret > 0)
+				rx.append(buf.get(), ret);
+			size_t ofs = 0;
+			while (rx.size() - ofs >= MIDB_MUX_HDR) {
+				uint32_t id  = le32p_to_cpu(&rx[ofs]);
+				uint32_t len = le32p_to_cpu(&rx[ofs+4]);
+				if (rx.size() - ofs - MIDB_MUX_HDR < len)
+					break;
+				auto it = pending.find(id);
+				if (it != pending.end()) {
+					auto &s = *it->second;
+					if (len == 0) {
+						s.reqid = 0;
+						pending.erase(it);
+					} else if (!s.eof) {
+						if (s.tx.empty())
+							s.tx_since = now;
+						s.tx.append(&rx[ofs+MIDB_MUX_HDR], len);
+					}
+				}
+				ofs += MIDB_MUX_HDR + len;
+			}
+			rx.erase(0, ofs);
+		}
+		for (size_t i = 0; i < pstr.size(); ++i)
+			if (pfd[i+2].revents != 0)
+				mux_stream_io(*pstr[i], pfd[i+2].revents, now);
+	}
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2466: ENOMEM");
+}
+
+/**
+ * Keeps one connection to a midb server, over which all streams of that
+ * server are multiplexed. Streams are socketpairs, so that the request
+ * functions further below work on them the same as on a plain connection.
+ * If midb turns out to not support multiplexing, the thread sets up the
+ * plain connection pool instead and exits.
+ */
+static void *midbag_muxwork(void *param)
+{
+	auto &svr = *static_cast<BACK_SVR *>(param);
+	std::list<mux_stream> streams;
+
+	while (!g_midbagent_stop) {
+		auto sockd = connect_midb(svr.ip_addr, svr.port);
+		if (sockd < 0) {
+			sleep(1);
+			continue;
+		}
+		auto ret = mux_negotiate(sockd);
+		if (ret == 0) {
+			close(sockd);
+			mlog(LV_NOTICE, "midb_agent: [%s]:%hu does not support "
+			        "multiplexing; using %d plain connections",
+			        svr.ip_addr, svr.port, g_conn_num);
+			std::unique_lock sv_hold(g_server_lock);
+			for (decltype(g_conn_num) j = 0; j < g_conn_num; ++j)
+				g_lost_list.emplace_back(BACK_CONN{-1, 0, &svr});
+			svr.mux_state = mux_st::off;
+			return nullptr;
+		} else if (ret > 0) {
+			svr.mux_state = mux_st::up;
+			mux_serve(svr, sockd, streams);
+		}
+		svr.mux_state = mux_st::down;
+		close(sockd);
+		/*
+		 * Responses in flight are lost, and so are the streams. Users
+		 * notice by way of EOF; the pool (and scanwork) will drop them.
+		 */
+		for (auto &s : streams)
+			close(s.fd);
+		streams.clear();
+		if (!g_midbagent_stop)
+			sleep(1);
+	}
+	for (auto &s : streams)
+		close(s.fd);
+	return nullptr;
+}
+
 /*
  * Older midb versions stored MAPI category keywords with atom-special
  * characters in them; coerce all tokens (banned set mirrors midb's
@@ -1613,6 +1971,184 @@ int fetch_detail_uid(const char *path, const std::string &folder,
 	return MIDB_LOCAL_ENOMEM;
 }
 
+namespace {
+
+/**
+ * Buffered reader for the binary part of a P-DTLB response.
+ */
+struct dtlb_reader {
+	bool need(size_t);
+
+	int fd = -1;
+	std::string buf;
+	size_t pos = 0;
+};
+
+}
+
+/**
+ * Make at least @n unconsumed bytes available at buf[pos].
+ */
+bool dtlb_reader::need(size_t n)
+{
+	static constexpr size_t chunk = 64 * 1024;
+	while (buf.size() - pos < n) {
+		if (pos > 0 && pos >= buf.size() / 2) {
+			buf.erase(0, pos);
+			pos = 0;
+		}
+		struct pollfd pfd_read;
+		pfd_read.fd = fd;
+		pfd_read.events = POLLIN | POLLPRI;
+		if (poll(&pfd_read, 1, MIDB_CMD_TIMEOUT_MS) != 1)
+			return false;
+		auto old = buf.size();
+		buf.resize(old + chunk);
+		auto read_len = read(fd, &buf[old], chunk);
+		buf.resize(old + std::max(read_len, static_cast<ssize_t>(0)));
+		if (read_len <= 0)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Decode one P-DTLB record (without its length prefix).
+ */
+static bool dtlb_parse(std::string_view rec, MITEM &mitem, fetch_row &row)
+{
+	/* same bit assignment, so no translation needed */
+	static_assert(unsigned{FLAG_RECENT} == DTLB_FL_RECENT &&
+		unsigned{FLAG_ANSWERED} == DTLB_FL_ANSWERED &&
+		unsigned{FLAG_FLAGGED} == DTLB_FL_FLAGGED &&
+		unsigned{FLAG_DELETED} == DTLB_FL_DELETED &&
+		unsigned{FLAG_SEEN} == DTLB_FL_SEEN &&
+		unsigned{FLAG_DRAFT} == DTLB_FL_DRAFT &&
+		unsigned{FLAG_FORWARDED} == DTLB_FL_FORWARDED);
+	if (rec.size() < 24)
+		return false;
+	mitem.uid = le32p_to_cpu(&rec[0]);
+	mitem.flag_bits = le32p_to_cpu(&rec[4]) & (FLAG_RECENT | FLAG_SETTABLE);
+	row.size  = le64p_to_cpu(&rec[8]);
+	row.idate = le64p_to_cpu(&rec[16]);
+	rec.remove_prefix(24);
+	std::string_view field[6];
+	for (auto &f : field) {
+		if (rec.size() < 4)
+			return false;
+		uint32_t len = le32p_to_cpu(rec.data());
+		rec.remove_prefix(4);
+		if (len > rec.size())
+			return false;
+		f = rec.substr(0, len);
+		rec.remove_prefix(len);
+	}
+	mitem.mid = field[0];
+	mitem.keywords = kw_sanitize(field[1]);
+	row.envelope = field[2];
+	row.body = field[3];
+	row.bodystructure = field[4];
+	row.digest = field[5];
+	if (!row.digest.empty())
+		mitem.flag_bits |= FLAG_LOADED;
+	return true;
+}
+
+/**
+ * Serve fetch_detail_stream() via P-DTLU, for midb servers that do not know
+ * P-DTLB. The rows only carry the digest.
+ */
+static int fetch_detail_legacy(const char *path, const std::string &folder,
+    const imap_seq_list &list, const fetch_row_cb &cb, int *perrno)
+{
+	XARRAY xa;
+	auto ret = fetch_detail_uid(path, folder, list, &xa, perrno);
+	if (ret != MIDB_RESULT_OK)
+		return ret;
+	for (size_t i = 0; i < xa.get_capacity(); ++i) {
+		auto pitem = xa.get_item(i);
+		fetch_row row;
+		row.digest = xa.get_digest(*pitem);
+		if (!cb(*pitem, row))
+			break;
+	}
+	return MIDB_RESULT_OK;
+}
+
+/**
+ * Like fetch_detail_uid, but with P-DTLB: the server sends fixed-layout
+ * binary records with ENVELOPE/BODY/BODYSTRUCTURE (as selected by the
+ * DTLB_* bits in @fields) already rendered in @charset, and @cb is invoked
+ * for each message as soon as its record has arrived, so that the caller can
+ * produce output while the server is still working on the range.
+ *
+ * If @cb returns false, the rest of the response is abandoned (and the
+ * connection with it); reporting why is up to the callback's owner.
+ */
+int fetch_detail_stream(const char *path, const std::string &folder,
+    const imap_seq_list &list, const char *charset, unsigned int fields,
+    const fetch_row_cb &cb, int *perrno) try
+{
+	/* generous bound for one message; P-DTLU capped lines at 257K */
+	static constexpr uint32_t max_record = 16U << 20;
+	auto pback = get_connection(path);
+	if (pback == nullptr)
+		return MIDB_NO_SERVER;
+	if (charset == nullptr || *charset == '\0')
+		charset = "-";
+
+	bool first_cmd = true;
+	for (const auto &seq : list) {
+		auto cbuf = fmt::format("P-DTLB {} {} {} {} {} {}\r\n", path,
+		            folder, seq.lo, seq.hi, charset, fields);
+		auto wrret = write(pback->sockd, cbuf.c_str(), cbuf.size());
+		if (wrret < 0 || static_cast<size_t>(wrret) != cbuf.size())
+			return MIDB_RDWR_ERROR;
+
+		dtlb_reader rd;
+		rd.fd = pback->sockd;
+		size_t eol;
+		while ((eol = rd.buf.find("\r\n")) == rd.buf.npos)
+			if (rd.buf.size() > 1024 || !rd.need(rd.buf.size() + 1))
+				return MIDB_RDWR_ERROR;
+		if (strncmp(rd.buf.c_str(), "FALSE ", 6) == 0) {
+			pback.reset();
+			*perrno = strtol(&rd.buf[6], nullptr, 0);
+			if (first_cmd && *perrno == MIDB_E_UNKNOWN_COMMAND)
+				return fetch_detail_legacy(path, folder, list, cb, perrno);
+			return MIDB_RESULT_ERROR;
+		} else if (rd.buf.compare(0, eol, "TRUE") != 0) {
+			return MIDB_RDWR_ERROR;
+		}
+		first_cmd = false;
+		rd.pos = eol + 2;
+		while (true) {
+			if (!rd.need(4))
+				return MIDB_RDWR_ERROR;
+			uint32_t reclen = le32p_to_cpu(&rd.buf[rd.pos]);
+			rd.pos += 4;
+			if (reclen == 0)
+				break;
+			if (reclen > max_record || !rd.need(reclen))
+				return MIDB_RDWR_ERROR;
+			MITEM mitem;
+			fetch_row row;
+			if (!dtlb_parse(std::string_view(&rd.buf[rd.pos], reclen), mitem, row))
+				return MIDB_RDWR_ERROR;
+			rd.pos += reclen;
+			if (!cb(mitem, row))
+				return MIDB_RESULT_OK;
+		}
+		/* the terminator must be the last thing sent */
+		if (rd.pos != rd.buf.size())
+			return MIDB_RDWR_ERROR;
+	}
+	pback.reset();
+	return MIDB_RESULT_OK;
+} catch (const std::bad_alloc &) {
+	return MIDB_LOCAL_ENOMEM;
+}
+
 int set_flags(const char *path, const std::string &folder,
     const std::string &mid_string, unsigned int flag_bits,
     unsigned int *new_bits, int *perrno)
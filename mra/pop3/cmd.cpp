@@ -27,6 +27,7 @@
 #include <gromox/fileio.h>
 #include <gromox/mail_func.hpp>
 #include <gromox/midb_agent.hpp>
+#include <gromox/mjson.hpp>
 #include <gromox/mysql_adaptor.hpp>
 #include <gromox/util.hpp>
 #include "pop3.hpp"
@@ -300,6 +301,45 @@ int cmdh_list(std::vector<std::string> &&argv, pop3_context *pcontext)
 	return 1707;
 }
 
+/**
+ * Arm retrieval of message @mid, reading at most @limit bytes of it. The
+ * message is read in pieces (see pop3_parser_refill); servers without ranged
+ * reads get asked for the whole file at once.
+ */
+static bool pop3_begin_retrieve(pop3_context &ctx, const std::string &mid,
+    uint64_t limit)
+{
+	ctx.wrdat_mid = mid;
+	ctx.wrdat_fileofs = 0;
+	ctx.wrdat_end = limit;
+	if (!pop3_parser_refill(ctx)) {
+		if (!exmdb_client->imapfile_read(ctx.maildir, "eml", mid,
+		    &ctx.wrdat_content))
+			return false;
+		ctx.wrdat_offset = 0;
+		ctx.wrdat_fileofs = ctx.wrdat_end = ctx.wrdat_content.size();
+	}
+	ctx.wrdat_active = true;
+	return true;
+}
+
+/**
+ * For "TOP n 0", only the header block is sent. Its size is taken from the
+ * message's structure index, if there is one.
+ */
+static uint64_t pop3_top_limit(pop3_context &ctx, const std::string &mid)
+{
+	if (ctx.until_line != 0)
+		return UINT64_MAX;
+	std::string idx;
+	MJSON mjson;
+	if (!exmdb_client->imapfile_read(ctx.maildir, "mst", mid, &idx) ||
+	    !mjson.load_from_index(idx))
+		return UINT64_MAX;
+	auto root = mjson.get_mime("");
+	return root != nullptr ? root->get_content_offset() : UINT64_MAX;
+}
+
 int cmdh_retr(std::vector<std::string> &&argv, pop3_context *pcontext)
 {
 	if (argv.size() < 2)
@@ -319,14 +359,11 @@ int cmdh_retr(std::vector<std::string> &&argv, pop3_context *pcontext)
 	ctx.wrdat_content.clear();
 	xrpc_build_env();
 	auto cl_0 = HX::make_scope_exit(xrpc_free_env);
-	if (!exmdb_client->imapfile_read(ctx.maildir, "eml", punit->file_name,
-	    &ctx.wrdat_content)) {
+	if (!pop3_begin_retrieve(ctx, punit->file_name, UINT64_MAX)) {
 		mlog(LV_ERR, "E-1469: imapfile_read %s/eml/%s failed",
 			ctx.maildir, punit->file_name.c_str());
 		return 1709;
 	}
-	ctx.wrdat_active = true;
-	ctx.wrdat_offset = 0;
 	pcontext->stream.clear();
 	if (pcontext->stream.write("+OK\r\n", 5) != STREAM_WRITE_OK)
 		return 1729;
@@ -379,11 +416,9 @@ int cmdh_top(std::vector<std::string> &&argv, pop3_context *pcontext)
 	ctx.wrdat_content.clear();
 	xrpc_build_env();
 	auto cl_0 = HX::make_scope_exit(xrpc_free_env);
-	if (!exmdb_client->imapfile_read(ctx.maildir, "eml", punit->file_name,
-	    &ctx.wrdat_content))
+	if (!pop3_begin_retrieve(ctx, punit->file_name,
+	    pop3_top_limit(ctx, punit->file_name)))
 		return 1709;
-	ctx.wrdat_active = true;
-	ctx.wrdat_offset = 0;
 	pcontext->stream.clear();
 	if (pcontext->stream.write("+OK\r\n", 5) != STREAM_WRITE_OK)
 		return 1729;
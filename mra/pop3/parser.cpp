@@ -17,11 +17,13 @@
 #include <utility>
 #include <vector>
 #include <libHX/io.h>
+#include <libHX/scope.hpp>
 #include <libHX/string.h>
 #include <openssl/err.h>
 #include <gromox/config_file.hpp>
 #include <gromox/cryptoutil.hpp>
 #include <gromox/defs.h>
+#include <gromox/exmdb_client.hpp>
 #include <gromox/fileio.h>
 #include <gromox/mail_func.hpp>
 #include <gromox/threads_pool.hpp>
@@ -36,6 +38,9 @@
 
 using namespace gromox;
 
+/* size of the pieces RETR/TOP read the message in */
+static constexpr size_t POP3_READ_CHUNK = 256 * 1024;
+
 static int pop3_parser_dispatch_cmd(const char *cm, int len, pop3_context *);
 
 unsigned int g_popcmd_debug;
@@ -441,6 +446,29 @@ tproc_status pop3_parser_process(schedule_context *vcontext)
 
 }
 
+/**
+ * Read the next piece of the message being retrieved into wrdat_content.
+ */
+bool pop3_parser_refill(pop3_context &ctx) try
+{
+	auto want = std::min(ctx.wrdat_end - ctx.wrdat_fileofs,
+	            static_cast<uint64_t>(POP3_READ_CHUNK));
+	xrpc_build_env();
+	auto cl_0 = HX::make_scope_exit(xrpc_free_env);
+	if (!exmdb_client->imapfile_read_range(ctx.maildir, "eml", ctx.wrdat_mid,
+	    ctx.wrdat_fileofs, want, &ctx.wrdat_content))
+		return false;
+	ctx.wrdat_offset = 0;
+	ctx.wrdat_fileofs += ctx.wrdat_content.size();
+	if (ctx.wrdat_content.size() < want)
+		/* end of file */
+		ctx.wrdat_end = ctx.wrdat_fileofs;
+	return true;
+} catch (const std::bad_alloc &) {
+	mlog(LV_ERR, "E-2462: ENOMEM");
+	return false;
+}
+
 int pop3_parser_retrieve(pop3_context *pcontext)
 {
 	auto &ctx = *pcontext;
@@ -465,6 +493,15 @@ int pop3_parser_retrieve(pop3_context *pcontext)
 		ctx.wrdat_offset += size;
 		temp_stream.fwd_write_ptr(size);
 		if (ctx.wrdat_offset >= ctx.wrdat_content.size()) {
+			if (ctx.wrdat_fileofs < ctx.wrdat_end) {
+				if (!pop3_parser_refill(ctx)) {
+					pop3_parser_log_info(pcontext, LV_WARN,
+						"failed to read eml/%s", ctx.wrdat_mid.c_str());
+					return POP3_RETRIEVE_ERROR;
+				}
+				if (ctx.wrdat_content.size() > 0)
+					continue;
+			}
 			ctx.wrdat_active = false;
 			ctx.wrdat_content.clear();
 			break;
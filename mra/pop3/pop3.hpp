@@ -51,6 +51,13 @@ struct pop3_context final : public schedule_context {
 	size_t write_length = 0, write_offset = 0, wrdat_offset = 0;
 	bool wrdat_active = false, data_stat = false, list_stat = false;
 	int until_line = 0x7FFFFFFF, cur_line = -1;
+	/*
+	 * The message being retrieved is read in pieces; wrdat_content is the
+	 * current one and ends at file offset wrdat_fileofs. Reading stops at
+	 * wrdat_end.
+	 */
+	std::string wrdat_mid;
+	uint64_t wrdat_fileofs = 0, wrdat_end = 0;
 	STREAM stream; /* stream accepted from pop3 client */
 	int total_mail = 0;
 	uint64_t total_size = 0;
@@ -83,6 +90,7 @@ extern gromox::time_point pop3_parser_get_context_timestamp(const schedule_conte
 extern SCHEDULE_CONTEXT **pop3_parser_get_contexts_list();
 extern int pop3_parser_threads_event_proc(int action);
 extern int pop3_parser_retrieve(pop3_context *);
+extern bool pop3_parser_refill(pop3_context &);
 extern void pop3_parser_log_info(pop3_context *, int level, const char *format, ...);
 
 extern int resource_run();
@@ -5,11 +5,13 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstdlib>
+#include <ctime>
 #include <unistd.h>
 #include <vector>
 #include <libHX/scope.hpp>
 #include <gromox/exmdb_client.hpp>
 #include <gromox/exmdb_rpc.hpp>
+#include <gromox/freebusy.hpp>
 #include <gromox/paths.h>
 #include <gromox/rop_util.hpp>
 #include <gromox/util.hpp>
@@ -55,10 +57,41 @@ static int t_2209(const char *dir)
 	return EXIT_SUCCESS;
 }
 
+/* message_ids is optional; get_freebusy() does not ask for it */
+static int t_fbquery(const char *dir)
+{
+	auto now = time(nullptr);
+	std::vector<freebusy_event> events;
+	if (!exmdb_client->freebusy_query(dir, now - 86400, now + 86400,
+	    &events, nullptr)) {
+		mlog(LV_ERR, "freebusy_query without message_ids failed unexpectedly");
+		return EXIT_FAILURE;
+	}
+	std::vector<uint64_t> mids;
+	std::vector<freebusy_event> events2;
+	if (!exmdb_client->freebusy_query(dir, now - 86400, now + 86400,
+	    &events2, &mids)) {
+		mlog(LV_ERR, "freebusy_query failed unexpectedly");
+		return EXIT_FAILURE;
+	}
+	if (events.size() != events2.size() || mids.size() != events2.size()) {
+		mlog(LV_ERR, "freebusy_query: %zu/%zu events, %zu message ids",
+			events.size(), events2.size(), mids.size());
+		return EXIT_FAILURE;
+	}
+	std::vector<freebusy_event> fb;
+	if (get_freebusy(nullptr, dir, now - 86400, now + 86400, fb) != ecSuccess) {
+		mlog(LV_ERR, "get_freebusy failed unexpectedly");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
 	exmdb_rpc_alloc = [](size_t z) { return g_alloc_mgr.alloc(z); };
 	exmdb_rpc_free = [](void *) {};
+	exmdb_rpc_zerocopy = true;
 	exmdb_client.emplace();
 	auto cl_0 = HX::make_scope_exit([]() { exmdb_client.reset(); });
 	if (exmdb_client_run(PKGSYSCONFDIR) != 0)
@@ -90,5 +123,7 @@ int main(int argc, char **argv)
 		sleep(waitx);
 	}
 
+	if (t_fbquery(g_storedir) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
 	return t_2209(g_storedir);
 }
@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+// SPDX-FileCopyrightText: 2026 grommunio GmbH
+// This file is part of Gromox.
+/*
+ * Throughput benchmarks for serialization, codecs and format conversions.
+ * The corpora are generated from a fixed seed, so numbers from different
+ * builds are comparable. Allocations are counted at operator new, which
+ * also covers the blocks handed out through the EXT_BUFFER_ALLOC callback.
+ *
+ * Usage: tests/microbench [-t seconds] [name-substring...]
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+#include <gromox/element_data.hpp>
+#include <gromox/ext_buffer.hpp>
+#include <gromox/ical.hpp>
+#include <gromox/lzxpress.hpp>
+#include <gromox/mail.hpp>
+#include <gromox/mail_func.hpp>
+#include <gromox/oxcmail.hpp>
+#include <gromox/textmaps.hpp>
+#include <gromox/util.hpp>
+#include "../tools/staticnpmap.cpp"
+
+using namespace gromox;
+using message_ptr = std::unique_ptr<message_content, mc_delete>;
+
+static std::atomic<uint64_t> g_allocs;
+static alloc_context g_alloc_mgr;
+static double g_seconds = 0.5;
+static std::vector<const char *> g_filter;
+
+void *operator new(size_t z)
+{
+	g_allocs.fetch_add(1, std::memory_order_relaxed);
+	auto p = malloc(z != 0 ? z : 1);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t z) { return operator new(z); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+/* alloc_context hands out operator new[] blocks, so these are counted too */
+static void *g_alloc(size_t z) { return g_alloc_mgr.alloc(z); }
+
+static constexpr const char *bench_words[] = {
+	"the", "meeting", "agenda", "budget", "quarterly", "report", "Grüße",
+	"schedule", "project", "and", "of", "to", "invoice", "Überweisung",
+	"please", "review", "attached", "draft", "€", "tomorrow", "server",
+	"mailbox", "calendar", "notes", "naïve", "résumé", "a", "is",
+};
+
+/* Deterministic pseudo-prose with line breaks every ~72 columns */
+static std::string gen_text(size_t size, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::string s;
+	size_t col = 0;
+	while (s.size() < size) {
+		auto w = bench_words[rng() % std::size(bench_words)];
+		s += w;
+		col += strlen(w) + 1;
+		if (col > 72) {
+			s += "\r\n";
+			col = 0;
+		} else {
+			s += ' ';
+		}
+	}
+	return s;
+}
+
+static std::string gen_html(size_t size, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::string s = "<html><head><meta charset=\"utf-8\"></head><body>\n";
+	while (s.size() < size) {
+		s += "<p>";
+		for (unsigned int i = 0, n = 8 + rng() % 40; i < n; ++i) {
+			auto w = bench_words[rng() % std::size(bench_words)];
+			switch (rng() % 16) {
+			case 0: s += "<b>"; s += w; s += "</b>"; break;
+			case 1: s += "<a href=\"https://example.com/"; s += w; s += "\">"; s += w; s += "</a>"; break;
+			case 2: s += "&amp;"; break;
+			default: s += w; break;
+			}
+			s += ' ';
+		}
+		s += "</p>\n";
+	}
+	s += "</body></html>\n";
+	return s;
+}
+
+static std::string gen_binary(size_t size, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::string s(size, '\0');
+	for (auto &c : s)
+		c = rng();
+	return s;
+}
+
+static std::string gen_mail(const std::string &text, const std::string &html,
+    const std::string &attach)
+{
+	std::string s =
+		"From: Alice <alice@example.com>\r\n"
+		"To: Bob <bob@example.com>, Carol <carol@example.com>\r\n"
+		"Subject: =?utf-8?Q?Quarterly_report_=E2=82=AC?=\r\n"
+		"Date: Mon, 05 Oct 2026 10:00:00 +0200\r\n"
+		"Message-ID: <bench.1@example.com>\r\n"
+		"MIME-Version: 1.0\r\n"
+		"Content-Type: multipart/mixed; boundary=\"outer\"\r\n"
+		"\r\n"
+		"--outer\r\n"
+		"Content-Type: multipart/alternative; boundary=\"inner\"\r\n"
+		"\r\n"
+		"--inner\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n"
+		"Content-Transfer-Encoding: quoted-printable\r\n"
+		"\r\n";
+	std::string qp(text.size() * 3 + 16, '\0');
+	auto z = qpnl_encode_sized(text, qp.data(), qp.size());
+	qp.resize(z > 0 ? z : 0);
+	s += qp;
+	s += "\r\n--inner\r\n"
+		"Content-Type: text/html; charset=utf-8\r\n"
+		"Content-Transfer-Encoding: base64\r\n"
+		"\r\n";
+	std::string b64(html.size() * 2 + 16, '\0');
+	size_t outlen = 0;
+	base64nl_encode_sized(html, b64.data(), b64.size(), &outlen);
+	b64.resize(outlen);
+	s += b64;
+	s += "\r\n--inner--\r\n"
+		"--outer\r\n"
+		"Content-Type: application/octet-stream; name=\"data.bin\"\r\n"
+		"Content-Disposition: attachment; filename=\"data.bin\"\r\n"
+		"Content-Transfer-Encoding: base64\r\n"
+		"\r\n";
+	b64.resize(attach.size() * 2 + 16);
+	base64nl_encode_sized(attach, b64.data(), b64.size(), &outlen);
+	b64.resize(outlen);
+	s += b64;
+	s += "\r\n--outer--\r\n";
+	return s;
+}
+
+static std::string gen_ics(unsigned int events)
+{
+	std::string s = "BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//gromox//microbench//EN\r\nMETHOD:PUBLISH\r\n";
+	char buf[512];
+	for (unsigned int i = 0; i < events; ++i) {
+		snprintf(buf, std::size(buf),
+			"BEGIN:VEVENT\r\n"
+			"UID:bench-%u@example.com\r\n"
+			"DTSTAMP:20261001T080000Z\r\n"
+			"DTSTART:202610%02uT%02u0000Z\r\n"
+			"DTEND:202610%02uT%02u3000Z\r\n"
+			"SUMMARY:Meeting %u\r\n"
+			"LOCATION:Room %u\r\n"
+			"DESCRIPTION:Agenda item %u\\, budget and schedule review\r\n"
+			"%s"
+			"END:VEVENT\r\n",
+			i, 1 + i % 28, 8 + i % 9, 1 + i % 28, 8 + i % 9, i, i % 12, i,
+			i % 3 == 0 ? "RRULE:FREQ=WEEKLY;COUNT=10;BYDAY=MO,WE\r\n" : "");
+		s += buf;
+	}
+	s += "END:VCALENDAR\r\n";
+	return s;
+}
+
+namespace {
+/* A row of the kind exmdb/EMSMDB ship around in query_table and read_message */
+struct propval_corpus {
+	propval_corpus(const std::string &text, const std::string &bin);
+	std::vector<TAGGED_PROPVAL> pv;
+	std::vector<uint32_t> v32;
+	std::vector<uint64_t> v64;
+	std::vector<std::string> str;
+	std::vector<BINARY> bin;
+	uint8_t yes = 1;
+};
+}
+
+propval_corpus::propval_corpus(const std::string &text, const std::string &b)
+{
+	static constexpr unsigned int count = 40;
+	v32.resize(count);
+	v64.resize(count);
+	str.resize(count);
+	bin.resize(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		auto id = static_cast<propid_t>(0x6000 + i);
+		switch (i % 5) {
+		case 0:
+			v32[i] = i * 2654435761U;
+			pv.push_back({PROP_TAG(PT_LONG, id), &v32[i]});
+			break;
+		case 1:
+			v64[i] = 0x1db0f96441fb000ULL + i;
+			pv.push_back({PROP_TAG(PT_SYSTIME, id), &v64[i]});
+			break;
+		case 2:
+			str[i] = text.substr(i * 37, 20 + i * 7);
+			pv.push_back({PROP_TAG(PT_UNICODE, id), str[i].data()});
+			break;
+		case 3:
+			bin[i].cb = 24 + i * 4;
+			bin[i].pv = deconst(&b[i * 64]);
+			pv.push_back({PROP_TAG(PT_BINARY, id), &bin[i]});
+			break;
+		default:
+			pv.push_back({PROP_TAG(PT_BOOLEAN, id), &yes});
+			break;
+		}
+	}
+}
+
+static bool selected(const char *name)
+{
+	if (g_filter.empty())
+		return true;
+	for (auto f : g_filter)
+		if (strstr(name, f) != nullptr)
+			return true;
+	return false;
+}
+
+/**
+ * Run @fn repeatedly for about g_seconds and report its throughput, with
+ * @bytes being the amount of payload processed per call.
+ */
+template<typename F> static int bench(const char *name, size_t bytes, F &&fn)
+{
+	if (!selected(name))
+		return 0;
+	if (!fn()) {
+		fprintf(stderr, "%s: operation failed\n", name);
+		return -1;
+	}
+	uint64_t ops = 0;
+	auto allocs = g_allocs.load();
+	auto start = std::chrono::steady_clock::now();
+	double secs;
+	do {
+		if (!fn()) {
+			fprintf(stderr, "%s: operation failed\n", name);
+			return -1;
+		}
+		++ops;
+		secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (secs < g_seconds);
+	allocs = g_allocs.load() - allocs;
+	printf("%-24s %10.1f MB/s %11.0f op/s %10.1f allocs/op\n", name,
+		bytes * ops / secs / 1e6, ops / secs,
+		static_cast<double>(allocs) / ops);
+	return 0;
+}
+
+static int bench_ext(const propval_corpus &corpus)
+{
+	std::span<const TAGGED_PROPVAL> row(corpus.pv);
+	for (auto flags : {EXT_FLAG_WCOUNT, EXT_FLAG_UTF16}) {
+		auto tag = flags & EXT_FLAG_UTF16 ? "utf16" : "utf8";
+		std::string packed;
+		{
+			EXT_PUSH ep;
+			if (!ep.init(nullptr, 0, flags) ||
+			    ep.p_tpropval_a(row) != pack_result::ok)
+				return -1;
+			packed.assign(reinterpret_cast<const char *>(ep.m_udata), ep.m_offset);
+		}
+		auto size = packed.size();
+		auto name = std::string("ext_push_tpropval_") + tag;
+		if (bench(name.c_str(), size, [&]() {
+			EXT_PUSH ep;
+			return ep.init(nullptr, 0, flags) &&
+			       ep.p_tpropval_a(row) == pack_result::ok;
+		}) != 0)
+			return -1;
+		for (auto zc : {0U, static_cast<unsigned int>(EXT_FLAG_ZEROCOPY)}) {
+			if (zc != 0 && (flags & EXT_FLAG_UTF16))
+				continue;
+			name = std::string("ext_pull_tpropval_") + tag + (zc ? "_zc" : "");
+			if (bench(name.c_str(), size, [&]() {
+				g_alloc_mgr.clear();
+				EXT_PULL ep;
+				TPROPVAL_ARRAY out{};
+				ep.init(packed.data(), packed.size(), g_alloc, flags | zc);
+				return ep.g_tpropval_a(&out) == pack_result::ok &&
+				       out.count == row.size();
+			}) != 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_codecs(const std::string &text, const std::string &html,
+    const std::string &binary)
+{
+	std::vector<uint8_t> lzx(std::max(text.size(), binary.size()) * 2 + 64),
+		plain(text.size());
+	ssize_t lzx_size = 0;
+	for (unsigned int level : {LZX_FAST, LZX_DEFAULT, LZX_BEST}) {
+		auto name = "lzxpress_compress_l" + std::to_string(level);
+		if (bench(name.c_str(), text.size(), [&]() {
+			lzx_size = lzxpress_compress(text.data(), text.size(),
+			           lzx.data(), lzx.size(), level);
+			return lzx_size > 0;
+		}) != 0)
+			return -1;
+		printf("%-24s %10.3f ratio\n", name.c_str(),
+		       static_cast<double>(lzx_size) / text.size());
+	}
+	if (bench("lzxpress_decompress", text.size(), [&]() {
+		return lzxpress_decompress(lzx.data(), lzx_size, plain.data(), plain.size()) ==
+		       static_cast<ssize_t>(text.size());
+	}) != 0 || bench("lzxpress_compress_bin", binary.size(), [&]() {
+		return lzxpress_compress(binary.data(), binary.size(), lzx.data(),
+		       lzx.size()) > 0;
+	}) != 0 || bench("lzxpress_skip_bin", binary.size(), [&]() {
+		return lzxpress_compress(binary.data(), binary.size(), lzx.data(),
+		       binary.size(), LZX_DEFAULT | LZX_SKIP_INCOMPRESSIBLE) < 0;
+	}) != 0)
+		return -1;
+
+	std::string rtf, rtfcp, out;
+	if (html_to_rtf(html, CP_UTF8, rtf) != ecSuccess ||
+	    rtfcp_encode(rtf, rtfcp) != ecSuccess)
+		return -1;
+	if (bench("html_to_rtf", html.size(), [&]() {
+		return html_to_rtf(html, CP_UTF8, out) == ecSuccess;
+	}) != 0 || bench("rtfcp_encode", rtf.size(), [&]() {
+		return rtfcp_encode(rtf, out) == ecSuccess;
+	}) != 0 || bench("rtfcp_uncompress", rtf.size(), [&]() {
+		return rtfcp_uncompress(rtfcp, out) == ecSuccess;
+	}) != 0)
+		return -1;
+	printf("%-24s %10.3f ratio\n", "rtfcp_encode",
+	       static_cast<double>(rtfcp.size()) / rtf.size());
+
+	std::string b64(binary.size() * 2, '\0'), raw(binary.size() + 16, '\0');
+	size_t b64_size = 0, outlen = 0;
+	if (bench("base64_encode", binary.size(), [&]() {
+		return base64nl_encode_sized(binary, b64.data(), b64.size(), &b64_size) == 0;
+	}) != 0 || bench("base64_decode", binary.size(), [&]() {
+		return base64nl_decode_sized({b64.data(), b64_size}, raw.data(),
+		       raw.size(), &outlen) == 0 && outlen == binary.size();
+	}) != 0)
+		return -1;
+
+	std::string qp(text.size() * 3 + 16, '\0'), unqp(text.size() + 16, '\0');
+	ssize_t qp_size = 0;
+	if (bench("qp_encode", text.size(), [&]() {
+		qp_size = qpnl_encode_sized(text, qp.data(), qp.size());
+		return qp_size > 0;
+	}) != 0 || bench("qp_decode", text.size(), [&]() {
+		return qpnl_decode_sized({qp.data(), static_cast<size_t>(qp_size)},
+		       unqp.data(), unqp.size()) > 0;
+	}) != 0)
+		return -1;
+	return 0;
+}
+
+static int bench_formats(const std::string &mail, const std::string &ics)
+{
+	if (bench("mime_parse", mail.size(), [&]() {
+		MAIL m;
+		return m.refonly_parse(mail.data(), mail.size());
+	}) != 0)
+		return -1;
+
+	oxcmail_converter cvt;
+	cvt.alloc = g_alloc;
+	cvt.get_propids = ee_get_propids;
+	cvt.get_propname = [](uint16_t propid, PROPERTY_NAME **name) -> BOOL {
+		auto xn = ee_get_propname(propid);
+		if (xn == nullptr)
+			return false;
+		*name = static_cast<PROPERTY_NAME *>(g_alloc(sizeof(PROPERTY_NAME)));
+		if (*name == nullptr)
+			return false;
+		**name = static_cast<PROPERTY_NAME>(*xn);
+		return TRUE;
+	};
+	if (bench("oxcmail_import", mail.size(), [&]() {
+		g_alloc_mgr.clear();
+		MAIL m;
+		return m.refonly_parse(mail.data(), mail.size()) &&
+		       cvt.inet_to_mapi(m) != nullptr;
+	}) != 0)
+		return -1;
+	MAIL m;
+	if (!m.refonly_parse(mail.data(), mail.size()))
+		return -1;
+	auto msg = cvt.inet_to_mapi(m);
+	if (msg == nullptr)
+		return -1;
+	if (bench("oxcmail_export", mail.size(), [&]() {
+		MAIL im;
+		std::string out;
+		return cvt.mapi_to_inet(*msg, im) && im.to_str(out) == 0;
+	}) != 0)
+		return -1;
+
+	oxcical_converter icvt;
+	icvt.alloc = g_alloc;
+	icvt.get_propids = ee_get_propids;
+	icvt.username_to_entryid = [](const char *, const char *, BINARY *, enum display_type *) -> BOOL { return false; };
+	return bench("oxcical_import", ics.size(), [&]() {
+		g_alloc_mgr.clear();
+		std::string buf = ics;
+		ical ic;
+		std::vector<message_ptr> msgs;
+		std::string err;
+		return ic.load_from_str_move(buf.data()) &&
+		       icvt.ical_to_mapi_multi(ic, msgs, err) == ecSuccess;
+	});
+}
+
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			g_seconds = strtod(argv[++i], nullptr);
+		else
+			g_filter.push_back(argv[i]);
+	}
+	textmaps_init(getenv("TEST_PATH"));
+	setenv("GROMOX_HTMLTOPLAIN", "internal", true);
+	auto ee_get_user_ids = [](const char *, unsigned int *, unsigned int *, enum display_type *) -> bool { return false; };
+	auto ee_get_domain_ids = [](const char *, unsigned int *, unsigned int *) -> bool { return false; };
+	auto ee_userid_to_name = [](unsigned int, std::string &) -> ec_error_t { return ecNotFound; };
+	if (!oxcmail_init_library("x500", ee_get_user_ids, ee_get_domain_ids, ee_userid_to_name)) {
+		fprintf(stderr, "oxcmail_init: unspecified error\n");
+		return EXIT_FAILURE;
+	}
+
+	auto text   = gen_text(64 << 10, 1);
+	auto html   = gen_html(64 << 10, 2);
+	auto binary = gen_binary(256 << 10, 3);
+	auto mail   = gen_mail(text, html, binary);
+	auto ics    = gen_ics(50);
+	propval_corpus corpus(text, binary);
+	if (bench_ext(corpus) != 0 || bench_codecs(text, html, binary) != 0 ||
+	    bench_formats(mail, ics) != 0)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
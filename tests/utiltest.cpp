@@ -15,8 +15,10 @@
 #include <gromox/fileio.h>
 #include <gromox/ical.hpp>
 #include <gromox/idset.hpp>
+#include <gromox/lzxpress.hpp>
 #include <gromox/mail_func.hpp>
 #include <gromox/mapi_types.hpp>
+#include <gromox/mjson.hpp>
 #include <gromox/paths.h>
 #include <gromox/propval.hpp>
 #include <gromox/resource_pool.hpp>
@@ -86,6 +88,47 @@ static int t_extpp()
 	return EXIT_SUCCESS;
 }
 
+static int t_zerocopy()
+{
+	/* "ab\0", bin{cb=3,"xyz"}, bin body "uv", blob rest "w" */
+	static constexpr char raw[] = "ab\0\x03\0xyzuvw";
+	std::string s(raw, sizeof(raw) - 1);
+	for (auto zc : {0U, static_cast<unsigned int>(EXT_FLAG_ZEROCOPY)}) {
+		EXT_PULL ep;
+		ep.init(s.data(), s.size(), zalloc, zc);
+		char *str = nullptr;
+		BINARY bin{}, body{};
+		DATA_BLOB blob{};
+		assert(ep.g_str(&str) == pack_result::ok && strcmp(str, "ab") == 0);
+		assert(ep.g_bin(&bin) == pack_result::ok && bin.cb == 3 &&
+		       memcmp(bin.pv, "xyz", 3) == 0);
+		body.cb = 2;
+		assert(ep.g_bin_body(&body) == pack_result::ok &&
+		       memcmp(body.pv, "uv", 2) == 0);
+		assert(ep.g_blob(&blob) == pack_result::ok && blob.cb == 1 &&
+		       blob.pb[0] == 'w');
+		/* Zero-copy results point into the input, others do not */
+		bool inside = str == &s[0] && bin.pc == &s[5] &&
+		              body.pc == &s[8] && blob.pb == reinterpret_cast<uint8_t *>(&s[10]);
+		bool outside = str != &s[0] && bin.pc != &s[5] &&
+		               body.pc != &s[8] && blob.pb != reinterpret_cast<uint8_t *>(&s[10]);
+		assert(zc ? inside : outside);
+
+		/* Truncated input must not be handed out either way */
+		ep.init(s.data(), 7, zalloc, zc);
+		assert(ep.g_str(&str) == pack_result::ok);
+		assert(ep.g_bin(&bin) == pack_result::bufsize);
+		ep.init(s.data(), 8, zalloc, zc);
+		assert(ep.g_str(&str) == pack_result::ok);
+		assert(ep.g_bin(&bin) == pack_result::ok);
+		body.cb = 5;
+		assert(ep.g_bin_body(&body) == pack_result::bufsize);
+		ep.init(s.data(), 2, zalloc, zc);
+		assert(ep.g_str(&str) == pack_result::format);
+	}
+	return EXIT_SUCCESS;
+}
+
 static int t_convert()
 {
 	char out[1];
@@ -145,6 +188,26 @@ static int t_convert()
 	assert(strcmp(largeout, "AB") == 0);
 	assert(utf16le_to_utf8("A\x00""B", 3, largeout, std::size(largeout)));
 	assert(strcmp(largeout, "A") == 0);
+	/* lone low surrogate; high surrogate without a low one, also at the end */
+	assert(utf16le_to_utf8("A\x00\x00\xdc""B\x00", 6, largeout, std::size(largeout)));
+	assert(strcmp(largeout, "AB") == 0);
+	assert(utf16le_to_utf8("A\x00\x00\xd8\x00\xd8\x00\xdc", 8, largeout, std::size(largeout)));
+	assert(strcmp(largeout, "A\xf0\x90\x80\x80") == 0);
+	assert(utf16le_to_utf8("A\x00\x3d\xd8", 4, largeout, std::size(largeout)));
+	assert(strcmp(largeout, "A") == 0);
+	assert(utf16le_to_utf8("A\x00\x3d\xd8""B", 5, largeout, std::size(largeout)));
+	assert(strcmp(largeout, "A") == 0);
+	/* Long ASCII runs (vector paths), astral plane, truncation */
+	std::string s4(70, 'x');
+	s4 += "\xf0\x9f\x98\x80\xc3\xa4";
+	char u16[256];
+	assert(utf8_to_utf16le(s4.c_str(), u16, std::size(u16)) == 148);
+	assert(memcmp(&u16[140], "\x3d\xd8\x00\xde\xe4\x00\x00\x00", 8) == 0);
+	assert(utf16le_to_utf8(u16, 148, largeout, std::size(largeout)));
+	assert(strcmp(largeout, s4.c_str()) == 0);
+	assert(utf8_to_utf16le(s4.c_str(), u16, 142) == 140);
+	assert(utf16le_to_utf8(u16, 148, largeout, 73));
+	assert(strncmp(largeout, s4.c_str(), 70) == 0 && largeout[70] == '\0');
 
 	sout = iconvtext("E", "windows-1258", "utf-8");
 	assert(sout.size() == 1);
@@ -527,6 +590,135 @@ static int t_base64()
 	return 0;
 }
 
+static int t_base64_long()
+{
+	/* Lengths that exercise the vectorized bulk paths and their tails */
+	char raw[1000], enc[1400], dec[1100];
+	for (size_t i = 0; i < std::size(raw); ++i)
+		raw[i] = i * 131 + (i >> 3);
+	for (size_t len : {47, 48, 49, 95, 96, 97, 191, 570, 1000}) {
+		size_t enclen = 0, declen = 0;
+		assert(base64_encode_sized({raw, len}, enc, std::size(enc), &enclen) == 0);
+		assert(enclen == (len + 2) / 3 * 4);
+		assert(base64_decode_sized({enc, enclen}, dec, std::size(dec), &declen) == 0);
+		assert(declen == len && memcmp(raw, dec, len) == 0);
+		assert(base64nl_encode_sized({raw, len}, enc, std::size(enc), &enclen) == 0);
+		assert(base64nl_decode_sized({enc, enclen}, dec, std::size(dec), &declen) == 0);
+		assert(declen == len && memcmp(raw, dec, len) == 0);
+	}
+	/* Every line but the last is 76 characters */
+	size_t enclen = 0, declen = 0;
+	assert(base64nl_encode_sized({raw, 570}, enc, std::size(enc), &enclen) == 0);
+	assert(enc[76] == '\r' && enc[77] == '\n' && enc[154] == '\r');
+	/* Stray whitespace between quads is skipped, garbage is rejected */
+	std::string spaced = std::string(enc, 100) + " \t" + std::string(&enc[101], enclen - 101);
+	spaced[100] = 'A';
+	assert(base64nl_decode_sized(spaced, dec, std::size(dec), &declen) == 0);
+	spaced[300] = '*';
+	assert(base64nl_decode_sized(spaced, dec, std::size(dec), &declen) < 0);
+
+	/* Quoted-printable: long plain runs, line starts and trailing blanks */
+	std::string text;
+	for (int i = 0; i < 20; ++i)
+		text += "The quick brown fox jumps over the lazy dog, 100% = awesome. \r\n"
+		        ".dot\r\nFrom here \r\n";
+	text += std::string(300, 'x');
+	std::string qp(text.size() * 3 + 64, '\0');
+	auto qplen = qpnl_encode_sized(text, qp.data(), qp.size());
+	assert(qplen > 0);
+	qp.resize(qplen);
+	assert(qp.find("\r\n.dot") == qp.npos && qp.find("\r\nFrom ") == qp.npos);
+	assert(qp.find(" \r\n") == qp.npos && qp.find("=3D") != qp.npos);
+	size_t col = 0;
+	for (auto c : qp) {
+		col = c == '\n' ? 0 : col + 1;
+		assert(col <= 77);
+	}
+	std::string back(text.size() + 16, '\0');
+	auto backlen = qpnl_decode_sized(qp, back.data(), back.size());
+	assert(backlen == static_cast<ssize_t>(text.size()));
+	assert(memcmp(back.data(), text.data(), text.size()) == 0);
+	return EXIT_SUCCESS;
+}
+
+static int t_compress()
+{
+	std::string text;
+	for (int i = 0; i < 400; ++i)
+		text += "{\\rtf1 Line " + std::to_string(i * 7919 % 1000) + " of the body\\par}\r\n";
+	std::string lzx(text.size() + 64, '\0'), back(text.size(), '\0');
+	for (unsigned int level : {LZX_FAST, LZX_DEFAULT, LZX_BEST}) {
+		auto z = lzxpress_compress(text.data(), text.size(), lzx.data(), lzx.size(), level);
+		assert(z > 0 && static_cast<size_t>(z) < text.size() / 2);
+		assert(lzxpress_decompress(lzx.data(), z, back.data(), back.size()) ==
+		       static_cast<ssize_t>(text.size()));
+		assert(back == text);
+	}
+	/* Output that does not fit is an error, not a truncated stream */
+	assert(lzxpress_compress(text.data(), text.size(), lzx.data(), 64) < 0);
+
+	std::string rtfcp, plain;
+	assert(rtfcp_encode(text, rtfcp) == ecSuccess);
+	assert(rtfcp.size() < text.size() / 2 && memcmp(&rtfcp[8], "LZFu", 4) == 0);
+	assert(rtfcp_uncompress(rtfcp, plain) == ecSuccess && plain == text);
+	assert(rtfcp_encode("", rtfcp) == ecSuccess);
+	assert(rtfcp_uncompress(rtfcp, plain) == ecSuccess && plain.empty());
+	return EXIT_SUCCESS;
+}
+
+static int t_mime_index()
+{
+	MJSON m;
+	auto &root = m.m_root.emplace();
+	root.mime_type = mime_type::multiple;
+	root.ctype = "multipart/mixed";
+	root.begin = 100;
+	root.length = 900;
+	auto &p1 = root.children.emplace_back();
+	p1.id = "1";
+	p1.mime_type = mime_type::single;
+	p1.ctype = "text/plain";
+	p1.encoding = "quoted-printable";
+	p1.head = 150;
+	p1.begin = 200;
+	p1.length = 50;
+	auto &p2 = root.children.emplace_back();
+	p2.id = "2";
+	p2.mime_type = mime_type::multiple;
+	p2.ctype = "multipart/alternative";
+	p2.head = 300;
+	p2.begin = 350;
+	p2.length = 500;
+	auto &p21 = p2.children.emplace_back();
+	p21.id = "2.1";
+	p21.mime_type = mime_type::single;
+	p21.ctype = "text/html";
+	p21.encoding = "base64";
+	p21.head = 400;
+	p21.begin = 450;
+	p21.length = 20;
+	m.size = 1000;
+
+	auto idx = m.to_index();
+	MJSON n;
+	assert(n.load_from_index(idx));
+	assert(n.get_mail_length() == 1000);
+	assert(n.get_mime("")->get_head_length() == 100);
+	assert(n.get_mime("1")->encoding_is_q());
+	auto p = n.get_mime("2.1");
+	assert(p != nullptr && p->encoding_is_b());
+	assert(p->get_head_offset() == 400 && p->get_content_offset() == 450 &&
+	       p->get_content_length() == 20);
+	assert(strcmp(n.get_mime("2")->get_ctype(), "multipart/alternative") == 0);
+	assert(n.get_mime("3") == nullptr);
+	/* truncated or damaged indices are rejected */
+	for (size_t i = 0; i < idx.size(); ++i)
+		assert(!n.load_from_index(std::string_view(idx).substr(0, i)));
+	idx[6] = 9;
+	assert(!n.load_from_index(idx));
+	return EXIT_SUCCESS;
+}
+
 static int t_cmp_icaltime()
 {
 	ical_time a{}, b{};
@@ -670,12 +862,12 @@ static int runner()
 
 	using fpt = decltype(&t_interval);
 	static constexpr fpt fct[] = {
-		t_extpp, t_convert, t_emailaddr, t_base64,
+		t_extpp, t_zerocopy, t_convert, t_emailaddr, t_base64, t_base64_long,
 		t_interval, t_id1, t_id2, t_id3, t_id4, t_id5, t_id6,
 		t_id7, t_id8, t_id9, t_seq,
 		t_cmp_binary, t_cmp_guid, t_cmp_svreid, t_cmp_icaltime,
 		t_wildcard, t_utf8_prefix, t_eidcvt, t_bin2cstr, t_string,
-		t_time, t_tzdef,
+		t_time, t_tzdef, t_compress, t_mime_index,
 	};
 	for (auto f : fct) {
 		auto ret = f();
@@ -0,0 +1,649 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+// SPDX-FileCopyrightText: 2026 grommunio GmbH
+// This file is part of Gromox.
+/*
+ * exmdb load generator
+ *
+ * Creates a number of synthetic private stores below a base directory (using
+ * the same code path as gromox-mkprivate, minus the user database), fills
+ * them with folders and messages through exmdb_client, and then drives a
+ * configurable mix of RPCs from several threads for a fixed duration.
+ * Reports per-operation latency percentiles and throughput.
+ *
+ * The base directory must be writable by this program (i.e. run it on the
+ * exmdb host, as the gromox user) and lie below a prefix that is listed in
+ * exmdb_list.txt, so that the exmdb service actually serves the stores.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sqlite3.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <libHX/option.h>
+#include <libHX/scope.hpp>
+#include <sys/stat.h>
+#include <gromox/database.h>
+#include <gromox/dbop.h>
+#include <gromox/element_data.hpp>
+#include <gromox/exmdb_client.hpp>
+#include <gromox/exmdb_rpc.hpp>
+#include <gromox/ext_buffer.hpp>
+#include <gromox/idset.hpp>
+#include <gromox/mapidefs.h>
+#include <gromox/notify_types.hpp>
+#include <gromox/paths.h>
+#include <gromox/pcl.hpp>
+#include <gromox/rop_util.hpp>
+#include <gromox/textmaps.hpp>
+#include <gromox/util.hpp>
+#include "mkshared.hpp"
+
+using namespace gromox;
+using LLU = unsigned long long;
+using lg_clock = std::chrono::steady_clock;
+
+namespace {
+
+enum lg_op : unsigned int {
+	LG_TABLE, LG_READ, LG_WRITE, LG_SYNC, LG_NOTIFY, LG_OPMAX,
+};
+
+struct lg_folder {
+	uint64_t fid = 0;
+	std::vector<uint64_t> mids;
+};
+
+struct lg_store {
+	std::string dir;
+	std::vector<lg_folder> folders;
+	size_t msg_count = 0;
+	std::atomic<uint32_t> sub_id{0}; /* read by the notification thread */
+	std::mutex pend_lock;
+	/* GC value of a MID being written -> time the write was issued */
+	std::unordered_map<uint64_t, lg_clock::time_point> pending;
+};
+
+/* Latencies in microseconds */
+struct lg_stats {
+	std::vector<uint32_t> lat[LG_OPMAX];
+	uint64_t fail[LG_OPMAX]{};
+};
+
+}
+
+static constexpr const char *lg_op_names[] = {"table", "read", "write", "sync", "notify"};
+static char *opt_basedir, *opt_mix, *opt_datadir;
+static unsigned int opt_stores = 4, opt_folders = 8, opt_messages = 2000;
+static unsigned int opt_bodysize = 4096, opt_threads = 8, opt_duration = 30;
+static unsigned int opt_force, opt_setup_only;
+static double opt_zipf = 1.0;
+static unsigned int g_mix[LG_OPMAX] = {40, 35, 10, 10, 5};
+static thread_local alloc_context g_alloc_mgr;
+static std::vector<std::unique_ptr<lg_store>> g_stores;
+static std::unordered_map<std::string, lg_store *> g_store_by_dir;
+static std::mutex g_notif_lock;
+static std::vector<uint32_t> g_notif_lat;
+static std::atomic<uint64_t> g_notif_count;
+
+static constexpr HXoption g_options_table[] = {
+	{nullptr, 'F', HXTYPE_UINT, &opt_folders, {}, {}, 0, "Folders per store (default: 8)", "N"},
+	{nullptr, 'T', HXTYPE_STRING, &opt_datadir, {}, {}, 0, "Directory with templates (default: " PKGDATADIR ")", "DIR"},
+	{nullptr, 'b', HXTYPE_UINT, &opt_bodysize, {}, {}, 0, "Approximate body size of generated messages (default: 4096)", "BYTES"},
+	{nullptr, 'd', HXTYPE_STRING, &opt_basedir, {}, {}, 0, "Base directory for the synthetic stores", "DIR"},
+	{nullptr, 'f', HXTYPE_NONE, &opt_force, {}, {}, 0, "Recreate stores that already exist"},
+	{nullptr, 'm', HXTYPE_UINT, &opt_messages, {}, {}, 0, "Messages per store (default: 2000)", "N"},
+	{nullptr, 'n', HXTYPE_UINT, &opt_stores, {}, {}, 0, "Number of stores (default: 4)", "N"},
+	{nullptr, 't', HXTYPE_UINT, &opt_threads, {}, {}, 0, "Number of client threads (default: 8)", "N"},
+	{nullptr, 'x', HXTYPE_STRING, &opt_mix, {}, {}, 0, "Operation mix (default: table=40,read=35,write=10,sync=10,notify=5)", "SPEC"},
+	{nullptr, 'z', HXTYPE_DOUBLE, &opt_zipf, {}, {}, 0, "Zipf exponent for the message distribution over folders (default: 1.0, 0 = uniform)", "S"},
+	{"duration", 'D', HXTYPE_UINT, &opt_duration, {}, {}, 0, "Seconds to run the load phase (default: 30)", "SEC"},
+	{"setup-only", 0, HXTYPE_NONE, &opt_setup_only, {}, {}, 0, "Only create and populate the stores"},
+	HXOPT_AUTOHELP,
+	HXOPT_TABLEEND,
+};
+
+static constexpr const char *lg_words[] = {
+	"the", "meeting", "agenda", "budget", "quarterly", "report", "schedule",
+	"project", "and", "of", "to", "invoice", "please", "review", "attached",
+	"draft", "tomorrow", "server", "mailbox", "calendar", "notes", "a", "is",
+};
+
+static std::string lg_text(std::mt19937 &rng, size_t size)
+{
+	std::string s;
+	while (s.size() < size) {
+		s += lg_words[rng() % std::size(lg_words)];
+		s += rng() % 12 == 0 ? "\r\n" : " ";
+	}
+	return s;
+}
+
+static int parse_mix(const char *spec)
+{
+	std::fill(std::begin(g_mix), std::end(g_mix), 0);
+	std::unique_ptr<char[], stdlib_delete> copy(strdup(spec));
+	if (copy == nullptr)
+		return -ENOMEM;
+	char *save = nullptr;
+	for (auto tok = strtok_r(copy.get(), ",", &save); tok != nullptr;
+	     tok = strtok_r(nullptr, ",", &save)) {
+		auto eq = strchr(tok, '=');
+		if (eq == nullptr) {
+			fprintf(stderr, "Mix element \"%s\" lacks a weight\n", tok);
+			return -EINVAL;
+		}
+		*eq++ = '\0';
+		auto it = std::find_if(std::begin(lg_op_names), std::end(lg_op_names),
+		          [&](const char *n) { return strcmp(n, tok) == 0; });
+		if (it == std::end(lg_op_names)) {
+			fprintf(stderr, "Unknown operation \"%s\" in mix\n", tok);
+			return -EINVAL;
+		}
+		g_mix[it - std::begin(lg_op_names)] = strtoul(eq, nullptr, 0);
+	}
+	unsigned int sum = 0;
+	for (auto w : g_mix)
+		sum += w;
+	if (sum == 0) {
+		fprintf(stderr, "Operation mix has no positive weights\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int lg_set_change_keys(TPROPVAL_ARRAY &props, uint64_t change_num)
+{
+	XID zxid{rop_util_make_user_guid(0), change_num};
+	char tmp_buff[22];
+	EXT_PUSH ep;
+	if (!ep.init(tmp_buff, std::size(tmp_buff), 0) ||
+	    ep.p_xid(zxid) != pack_result::ok)
+		return -ENOMEM;
+	BINARY bxid;
+	bxid.pv = tmp_buff;
+	bxid.cb = ep.m_offset;
+	PCL pcl;
+	if (!pcl.replace(zxid))
+		return -ENOMEM;
+	auto pclbin = pcl.serialize();
+	if (pclbin == nullptr)
+		return -ENOMEM;
+	auto cl_0 = HX::make_scope_exit([&]() { rop_util_free_binary(pclbin); });
+	if (props.set(PidTagChangeNumber, &change_num) != ecSuccess ||
+	    props.set(PR_CHANGE_KEY, &bxid) != ecSuccess ||
+	    props.set(PR_PREDECESSOR_CHANGE_LIST, pclbin) != ecSuccess)
+		return -ENOMEM;
+	return 0;
+}
+
+/**
+ * Create the store database for @dir, the same way gromox-mkprivate would.
+ * Existing stores are kept unless -f was given.
+ */
+static int lg_mkstore(const std::string &dir, const char *datadir)
+{
+	auto path = dir + "/exmdb/exchange.sqlite3";
+	struct stat sb;
+	if (!opt_force && stat(path.c_str(), &sb) == 0)
+		return 0;
+	/* Make exmdb drop a cached handle on the file we are about to replace */
+	if (opt_force)
+		exmdb_client->unload_store(dir.c_str());
+	if (!make_mailbox_hierarchy(dir))
+		return EXIT_FAILURE;
+	auto ret = mbop_truncate_chown("exloadgen", path.c_str(), true);
+	if (ret != 0)
+		return EXIT_FAILURE;
+	sqlite3 *psqlite = nullptr;
+	if (sqlite3_open_v2(path.c_str(), &psqlite, SQLITE_OPEN_READWRITE |
+	    SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+		fprintf(stderr, "%s: cannot create store database\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+	auto cl_0 = HX::make_scope_exit([&]() { sqlite3_close_v2(psqlite); });
+	if (gx_sql_exec(psqlite, "PRAGMA journal_mode=WAL") != SQLITE_OK)
+		return EXIT_FAILURE;
+	auto sql_transact = gx_sql_begin(psqlite, txn_mode::write);
+	if (!sql_transact)
+		return EXIT_FAILURE;
+	ret = mbop_create_private(psqlite, datadir, "en", 0, 0);
+	if (ret != EXIT_SUCCESS)
+		return ret;
+	return sql_transact.commit() == SQLITE_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int lg_mkfolder(const char *dir, const char *name, uint64_t *fid,
+    bool *created)
+{
+	*created = false;
+	auto parent = rop_util_make_eid_ex(1, PRIVATE_FID_IPMSUBTREE);
+	if (!exmdb_client->get_folder_by_name(dir, parent, name, fid)) {
+		fprintf(stderr, "%s: get_folder_by_name RPC failed\n", dir);
+		return -EIO;
+	}
+	if (*fid != 0)
+		return 0;
+	uint64_t change_num = 0;
+	if (!exmdb_client->allocate_cn(dir, &change_num)) {
+		fprintf(stderr, "%s: allocate_cn RPC failed\n", dir);
+		return -EIO;
+	}
+	auto props = tpropval_array_init();
+	if (props == nullptr)
+		return -ENOMEM;
+	auto cl_0 = HX::make_scope_exit([&]() { tpropval_array_free(props); });
+	uint32_t type = FOLDER_GENERIC;
+	auto now = rop_util_current_nttime();
+	if (props->set(PR_DISPLAY_NAME, name) != ecSuccess ||
+	    props->set(PR_CONTAINER_CLASS, "IPF.Note") != ecSuccess ||
+	    props->set(PR_FOLDER_TYPE, &type) != ecSuccess ||
+	    props->set(PidTagParentFolderId, &parent) != ecSuccess ||
+	    props->set(PR_LAST_MODIFICATION_TIME, &now) != ecSuccess ||
+	    lg_set_change_keys(*props, change_num) != 0)
+		return -ENOMEM;
+	ec_error_t err = ecSuccess;
+	if (!exmdb_client->create_folder(dir, CP_ACP, props, fid, &err) ||
+	    err != ecSuccess || *fid == 0) {
+		fprintf(stderr, "%s: create_folder \"%s\" failed: %s\n",
+		        dir, name, mapi_strerror(err));
+		return -EIO;
+	}
+	*created = true;
+	return 0;
+}
+
+static std::unique_ptr<message_content, mc_delete>
+lg_mkmessage(std::mt19937 &rng, uint64_t mid)
+{
+	std::unique_ptr<message_content, mc_delete> ctnt(message_content_init());
+	if (ctnt == nullptr)
+		return nullptr;
+	auto subject = lg_text(rng, 40);
+	auto body = lg_text(rng, opt_bodysize);
+	auto now = rop_util_current_nttime();
+	uint64_t dlv = now - static_cast<uint64_t>(rng() % (365 * 86400)) * 10000000;
+	uint32_t flags = rng() % 10 < 7 ? MSGFLAG_READ : 0;
+	auto &p = ctnt->proplist;
+	if (p.set(PR_MESSAGE_CLASS, "IPM.Note") != ecSuccess ||
+	    p.set(PR_SUBJECT, subject.c_str()) != ecSuccess ||
+	    p.set(PR_BODY, body.c_str()) != ecSuccess ||
+	    p.set(PR_SENDER_NAME, "Load Generator") != ecSuccess ||
+	    p.set(PR_SENDER_SMTP_ADDRESS, "loadgen@example.com") != ecSuccess ||
+	    p.set(PR_DISPLAY_TO, "Recipient") != ecSuccess ||
+	    p.set(PR_CLIENT_SUBMIT_TIME, &dlv) != ecSuccess ||
+	    p.set(PR_MESSAGE_DELIVERY_TIME, &dlv) != ecSuccess ||
+	    p.set(PR_MESSAGE_FLAGS, &flags) != ecSuccess)
+		return nullptr;
+	if (mid != 0 && p.set(PidTagMid, &mid) != ecSuccess)
+		return nullptr;
+	return ctnt;
+}
+
+/**
+ * Create the loadgen folders in @st and spread opt_messages over them
+ * following a Zipf distribution. Folders that already exist are left alone.
+ */
+static int lg_populate(lg_store &st, std::mt19937 &rng)
+{
+	double wsum = 0;
+	std::vector<double> weight(opt_folders);
+	for (unsigned int i = 0; i < opt_folders; ++i)
+		wsum += weight[i] = 1 / pow(i + 1, opt_zipf);
+	for (unsigned int i = 0; i < opt_folders; ++i) {
+		char name[32];
+		snprintf(name, std::size(name), "loadgen-%02u", i);
+		uint64_t fid = 0;
+		bool fresh = false;
+		auto ret = lg_mkfolder(st.dir.c_str(), name, &fid, &fresh);
+		if (ret != 0)
+			return ret;
+		st.folders.push_back({fid});
+		if (!fresh)
+			continue;
+		auto count = static_cast<unsigned int>(lround(opt_messages * weight[i] / wsum));
+		std::vector<std::unique_ptr<message_content, mc_delete>> batch;
+		std::vector<message_write_item> items;
+		for (unsigned int done = 0; done < count; ) {
+			batch.clear();
+			items.clear();
+			for (; done < count && batch.size() < 100; ++done) {
+				batch.push_back(lg_mkmessage(rng, 0));
+				if (batch.back() == nullptr)
+					return -ENOMEM;
+				items.push_back(message_write_item{fid, batch.back().get()});
+			}
+			std::vector<message_write_result> results;
+			if (!exmdb_client->write_messages(st.dir.c_str(), CP_UTF8,
+			    items, &results)) {
+				fprintf(stderr, "%s: write_messages RPC failed\n", st.dir.c_str());
+				return -EIO;
+			}
+			for (const auto &r : results)
+				if (r.e_result != ecSuccess) {
+					fprintf(stderr, "%s: write_messages: %s\n",
+					        st.dir.c_str(), mapi_strerror(r.e_result));
+					return -EIO;
+				}
+			g_alloc_mgr.clear();
+		}
+	}
+	return 0;
+}
+
+/* Collect the message IDs of all loadgen folders */
+static int lg_scan(lg_store &st)
+{
+	static constexpr proptag_t tags[] = {PidTagMid};
+	st.msg_count = 0;
+	for (auto &fld : st.folders) {
+		uint32_t table_id = 0, row_count = 0;
+		if (!exmdb_client->load_content_table(st.dir.c_str(), CP_ACP,
+		    fld.fid, nullptr, TABLE_FLAG_NONOTIFICATIONS, nullptr,
+		    nullptr, &table_id, &row_count))
+			return -EIO;
+		tarray_set set{};
+		auto ok = exmdb_client->query_table(st.dir.c_str(), nullptr,
+		          CP_ACP, table_id, tags, 0, row_count, &set);
+		exmdb_client->unload_table(st.dir.c_str(), table_id);
+		if (!ok)
+			return -EIO;
+		fld.mids.clear();
+		for (const auto &row : set) {
+			auto mid = row.get<const uint64_t>(PidTagMid);
+			if (mid != nullptr)
+				fld.mids.push_back(*mid);
+		}
+		st.msg_count += fld.mids.size();
+		g_alloc_mgr.clear();
+	}
+	return 0;
+}
+
+static void lg_notif_handler(const char *dir, BOOL b_table, uint32_t sub_id,
+    const DB_NOTIFY *n) try
+{
+	if (b_table || n->type != db_notify_type::message_created)
+		return;
+	auto it = g_store_by_dir.find(dir);
+	if (it == g_store_by_dir.end() || it->second->sub_id != sub_id)
+		return;
+	auto now = lg_clock::now();
+	g_notif_count.fetch_add(1, std::memory_order_relaxed);
+	auto &st = *it->second;
+	lg_clock::time_point start;
+	{
+		std::lock_guard lk(st.pend_lock);
+		auto pi = st.pending.find(n->message_id);
+		if (pi == st.pending.end())
+			return;
+		start = pi->second;
+		st.pending.erase(pi);
+	}
+	std::lock_guard lk(g_notif_lock);
+	g_notif_lat.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - start).count());
+} catch (const std::bad_alloc &) {
+}
+
+static const lg_folder &lg_pick_folder(const lg_store &st, std::mt19937 &rng)
+{
+	/* Weighted by size, like user activity tends to be */
+	if (st.msg_count == 0)
+		return st.folders[rng() % st.folders.size()];
+	auto n = rng() % st.msg_count;
+	for (const auto &f : st.folders) {
+		if (n < f.mids.size())
+			return f;
+		n -= f.mids.size();
+	}
+	return st.folders.back();
+}
+
+static bool lg_do_table(const lg_store &st, std::mt19937 &rng)
+{
+	static constexpr proptag_t tags[] = {
+		PidTagMid, PR_SUBJECT, PR_SENDER_NAME, PR_MESSAGE_DELIVERY_TIME,
+		PR_MESSAGE_SIZE, PR_MESSAGE_FLAGS,
+	};
+	SORT_ORDER so{PT_SYSTIME, PROP_ID(PR_MESSAGE_DELIVERY_TIME), TABLE_SORT_DESCEND};
+	SORTORDER_SET sorts{1, 0, 0, &so};
+	auto dir = st.dir.c_str();
+	auto &fld = lg_pick_folder(st, rng);
+	uint32_t table_id = 0, row_count = 0;
+	if (!exmdb_client->load_content_table(dir, CP_UTF8, fld.fid, nullptr,
+	    TABLE_FLAG_NONOTIFICATIONS, nullptr, &sorts, &table_id, &row_count))
+		return false;
+	tarray_set set{};
+	auto start = row_count > 50 ? rng() % (row_count - 50) : 0;
+	auto ok = exmdb_client->query_table(dir, nullptr, CP_UTF8, table_id,
+	          tags, start, 50, &set);
+	return exmdb_client->unload_table(dir, table_id) && ok;
+}
+
+static bool lg_do_read(const lg_store &st, std::mt19937 &rng)
+{
+	auto &fld = lg_pick_folder(st, rng);
+	if (fld.mids.empty())
+		return false; /* lg_worker does not send us to empty stores */
+	message_content *ctnt = nullptr;
+	return exmdb_client->read_message(st.dir.c_str(), nullptr, CP_UTF8,
+	       fld.mids[rng() % fld.mids.size()], &ctnt) && ctnt != nullptr;
+}
+
+static bool lg_do_write(lg_store &st, std::mt19937 &rng)
+{
+	auto dir = st.dir.c_str();
+	auto &fld = st.folders[rng() % st.folders.size()];
+	uint64_t mid = 0;
+	if (!exmdb_client->allocate_message_id(dir, fld.fid, &mid))
+		return false;
+	auto ctnt = lg_mkmessage(rng, mid);
+	if (ctnt == nullptr)
+		return false;
+	auto gcv = rop_util_get_gc_value(mid);
+	{
+		std::lock_guard lk(st.pend_lock);
+		st.pending.emplace(gcv, lg_clock::now());
+	}
+	uint64_t outmid = 0, outcn = 0;
+	ec_error_t err = ecSuccess;
+	if (!exmdb_client->write_message(dir, CP_UTF8, fld.fid, ctnt.get(),
+	    {}, &outmid, &outcn, &err) || err != ecSuccess) {
+		std::lock_guard lk(st.pend_lock);
+		st.pending.erase(gcv);
+		return false;
+	}
+	return true;
+}
+
+static bool lg_do_sync(const lg_store &st, std::mt19937 &rng)
+{
+	auto &fld = st.folders[rng() % st.folders.size()];
+	idset given(idset::type::id_loose), seen(idset::type::id_loose);
+	uint32_t fai_count = 0, normal_count = 0;
+	uint64_t fai_total = 0, normal_total = 0, last_cn = 0, last_readcn = 0;
+	EID_ARRAY updated, chg, given_mids, deleted, nolonger, read, unread;
+	return exmdb_client->get_content_sync(st.dir.c_str(), fld.fid, nullptr,
+	       &given, &seen, nullptr, nullptr, CP_UTF8, nullptr, TRUE,
+	       &fai_count, &fai_total, &normal_count, &normal_total, &updated,
+	       &chg, &last_cn, &given_mids, &deleted, &nolonger, &read,
+	       &unread, &last_readcn);
+}
+
+static bool lg_do_notify(const lg_store &st, std::mt19937 &rng)
+{
+	auto &fld = st.folders[rng() % st.folders.size()];
+	uint32_t sub_id = 0;
+	if (!exmdb_client->subscribe_notification(st.dir.c_str(),
+	    fnevObjectCreated | fnevObjectDeleted | fnevObjectModified,
+	    false, fld.fid, 0, &sub_id))
+		return false;
+	return exmdb_client->unsubscribe_notification(st.dir.c_str(), sub_id);
+}
+
+static void lg_worker(unsigned int idx, lg_clock::time_point deadline,
+    lg_stats &stats)
+{
+	std::mt19937 rng(0x10ad + idx);
+	unsigned int wsum = 0;
+	for (auto w : g_mix)
+		wsum += w;
+	while (lg_clock::now() < deadline) {
+		auto &st = *g_stores[rng() % g_stores.size()];
+		unsigned int pick = rng() % wsum, op = 0;
+		while (pick >= g_mix[op])
+			pick -= g_mix[op++];
+		if (op == LG_READ && st.msg_count == 0)
+			continue; /* nothing to read; do not count a sample */
+		auto t0 = lg_clock::now();
+		bool ok = false;
+		switch (op) {
+		case LG_TABLE: ok = lg_do_table(st, rng); break;
+		case LG_READ: ok = lg_do_read(st, rng); break;
+		case LG_WRITE: ok = lg_do_write(st, rng); break;
+		case LG_SYNC: ok = lg_do_sync(st, rng); break;
+		case LG_NOTIFY: ok = lg_do_notify(st, rng); break;
+		}
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(lg_clock::now() - t0).count();
+		g_alloc_mgr.clear();
+		if (!ok)
+			++stats.fail[op];
+		else
+			stats.lat[op].push_back(us);
+	}
+}
+
+static void lg_report(const char *name, std::vector<uint32_t> &lat,
+    uint64_t fail, double secs)
+{
+	if (lat.empty() && fail == 0)
+		return;
+	std::sort(lat.begin(), lat.end());
+	auto pct = [&](double q) -> double {
+		if (lat.empty())
+			return 0;
+		return lat[std::min(lat.size() - 1, static_cast<size_t>(q * lat.size()))] / 1000.0;
+	};
+	printf("%-8s %9zu %8llu %9.1f %8.2f %8.2f %8.2f %8.2f %9.2f\n", name,
+	       lat.size(), LLU{fail}, lat.size() / secs, pct(0.50), pct(0.90),
+	       pct(0.99), pct(0.999), lat.empty() ? 0.0 : lat.back() / 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+	HXopt6_auto_result argp;
+	setvbuf(stdout, nullptr, _IOLBF, 0);
+	if (HX_getopt6(g_options_table, argc, argv, &argp,
+	    HXOPT_USAGEONERR) != HXOPT_ERR_SUCCESS)
+		return EXIT_FAILURE;
+	if (opt_basedir == nullptr) {
+		fprintf(stderr, "The -d option is mandatory.\n");
+		return EXIT_FAILURE;
+	}
+	if (opt_stores == 0 || opt_folders == 0 || opt_threads == 0) {
+		fprintf(stderr, "-n, -F and -t must be positive.\n");
+		return EXIT_FAILURE;
+	}
+	if (opt_mix != nullptr && parse_mix(opt_mix) != 0)
+		return EXIT_FAILURE;
+	textmaps_init();
+	if (SQLITE_OK != sqlite3_initialize()) {
+		fprintf(stderr, "Failed to initialize sqlite engine\n");
+		return EXIT_FAILURE;
+	}
+	auto cl_0 = HX::make_scope_exit(sqlite3_shutdown);
+
+	exmdb_rpc_alloc = [](size_t z) { return g_alloc_mgr.alloc(z); };
+	exmdb_rpc_free = [](void *) {};
+	exmdb_rpc_zerocopy = true;
+	exmdb_client.emplace(opt_threads + 1);
+	exmdb_client->set_async_notif(lg_notif_handler);
+	auto cl_1 = HX::make_scope_exit([]() { exmdb_client.reset(); });
+	if (exmdb_client_run(PKGSYSCONFDIR, nullptr,
+	    []() { g_alloc_mgr.clear(); }) != 0)
+		return EXIT_FAILURE;
+
+	/* Setup phase */
+	auto datadir = opt_datadir != nullptr ? opt_datadir : PKGDATADIR;
+	std::mt19937 rng(0x5eed);
+	auto t_setup = lg_clock::now();
+	size_t total_msgs = 0;
+	for (unsigned int i = 0; i < opt_stores; ++i) {
+		auto st = std::make_unique<lg_store>();
+		st->dir = opt_basedir;
+		st->dir += "/lg" + std::to_string(i);
+		if (lg_mkstore(st->dir, datadir) != EXIT_SUCCESS ||
+		    lg_populate(*st, rng) != 0 || lg_scan(*st) != 0) {
+			fprintf(stderr, "%s: setup failed\n", st->dir.c_str());
+			return EXIT_FAILURE;
+		}
+		total_msgs += st->msg_count;
+		g_store_by_dir.emplace(st->dir, st.get());
+		g_stores.push_back(std::move(st));
+	}
+	printf("Setup: %u stores, %u folders each, %zu messages in %.1f s\n",
+	       opt_stores, opt_folders, total_msgs,
+	       std::chrono::duration<double>(lg_clock::now() - t_setup).count());
+	if (opt_setup_only)
+		return EXIT_SUCCESS;
+
+	/* Whole-store subscriptions measure write-to-notification latency */
+	for (auto &st : g_stores) {
+		uint32_t sub_id = 0;
+		if (!exmdb_client->subscribe_notification(st->dir.c_str(),
+		    fnevObjectCreated, TRUE, 0, 0, &sub_id))
+			fprintf(stderr, "%s: subscribe_notification failed\n", st->dir.c_str());
+		st->sub_id = sub_id;
+	}
+
+	/* Load phase */
+	std::vector<lg_stats> stats(opt_threads);
+	std::vector<std::thread> thr;
+	auto t_start = lg_clock::now();
+	auto deadline = t_start + std::chrono::seconds(opt_duration);
+	for (unsigned int i = 0; i < opt_threads; ++i)
+		thr.emplace_back(lg_worker, i, deadline, std::ref(stats[i]));
+	for (auto &t : thr)
+		t.join();
+	auto secs = std::chrono::duration<double>(lg_clock::now() - t_start).count();
+	/* Let in-flight notifications arrive */
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	for (auto &st : g_stores)
+		if (st->sub_id != 0)
+			exmdb_client->unsubscribe_notification(st->dir.c_str(), st->sub_id);
+
+	printf("%-8s %9s %8s %9s %8s %8s %8s %8s %9s\n", "op", "count",
+	       "failed", "op/s", "p50/ms", "p90/ms", "p99/ms", "p99.9/ms", "max/ms");
+	std::vector<uint32_t> all;
+	uint64_t all_fail = 0;
+	for (unsigned int op = 0; op < LG_OPMAX; ++op) {
+		std::vector<uint32_t> lat;
+		uint64_t fail = 0;
+		for (auto &s : stats) {
+			lat.insert(lat.end(), s.lat[op].begin(), s.lat[op].end());
+			fail += s.fail[op];
+		}
+		all.insert(all.end(), lat.begin(), lat.end());
+		all_fail += fail;
+		lg_report(lg_op_names[op], lat, fail, secs);
+	}
+	lg_report("total", all, all_fail, secs);
+	{
+		std::lock_guard lk(g_notif_lock);
+		lg_report("notif", g_notif_lat, 0, secs);
+	}
+	printf("Notifications received: %llu\n", LLU{g_notif_count.load()});
+	exmdb_client->stop_async_listeners();
+	return all_fail == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
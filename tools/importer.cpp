@@ -4,11 +4,17 @@
 #include <algorithm>
 #include <cerrno>
 #include <climits>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 #include <fmt/format.h>
 #include <json/value.h>
 #include <libHX/ctype_helper.h>
@@ -40,6 +46,36 @@ struct ob_desc {
 	parent_desc parent;
 };
 
+struct exm_pending_msg {
+	uint64_t folder_id = 0;
+	message_content_ptr ctnt;
+	std::string im_repr, midstr, digest;
+};
+
+/**
+ * Bulk-load pipeline (--batch): the main thread keeps parsing the input
+ * stream while a worker thread stores completed batches with the
+ * write_messages RPC, one transaction per batch.
+ */
+class exm_batch_writer {
+	public:
+	~exm_batch_writer();
+	int push(exm_pending_msg &&);
+	int finish();
+
+	private:
+	void run();
+	int write_batch(std::vector<exm_pending_msg> &);
+
+	std::vector<exm_pending_msg> m_cur;
+	std::deque<std::vector<exm_pending_msg>> m_queue;
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	std::thread m_thr;
+	bool m_stop = false;
+	int m_err = 0;
+};
+
 }
 
 using propididmap_t = std::unordered_map<uint16_t, uint16_t>;
@@ -53,6 +89,8 @@ static uint64_t g_anchor_folder; /* GCV */
 static unsigned int g_oexcl = 1, g_repeat_iter = 1;
 static unsigned int g_do_delivery, g_skip_notif, g_skip_rules, g_twostep;
 static unsigned int g_continuous_mode, g_mrautoproc, g_mlog_level = MLOG_DEFAULT_LEVEL;
+static unsigned int g_batch_size;
+static std::unique_ptr<exm_batch_writer> g_batch_writer;
 
 static constexpr generic_module g_dfl_svc_plugins[] = {
 	{"libgxs_ruleproc.so", SVC_ruleproc},
@@ -78,6 +116,7 @@ static constexpr HXoption g_options_table[] = {
 	{"skip-rules", 0, HXTYPE_NONE, &g_skip_rules, nullptr, nullptr, 0, "Skip execution of rules (if -D)"},
 	{"twostep", '2', HXTYPE_NONE, &g_twostep, nullptr, nullptr, 0, "TWOSTEP rule executor (implies -D; development)"},
 	{"autoproc", 0, HXTYPE_NONE, &g_mrautoproc, {}, {}, 0, "Perform meeting request processing (development)"},
+	{"batch", 0, HXTYPE_UINT, &g_batch_size, {}, {}, 0, "Store messages in batches of N per transaction (bulk-load mode)", "N"},
 	HXOPT_AUTOHELP,
 	HXOPT_TABLEEND,
 };
@@ -448,6 +487,151 @@ static int exm_create_msg(uint64_t parent_fld, MESSAGE_CONTENT *ctnt,
 	return 0;
 }
 
+int exm_batch_writer::push(exm_pending_msg &&msg)
+{
+	std::unique_lock lk(m_mtx);
+	if (!m_thr.joinable())
+		m_thr = std::thread([this]() { run(); });
+	m_cur.push_back(std::move(msg));
+	if (m_cur.size() >= g_batch_size) {
+		/* Bound the amount of parsed-but-unwritten data */
+		m_cv.wait(lk, [&]() { return m_queue.size() < 2 || m_err != 0; });
+		m_queue.push_back(std::move(m_cur));
+		m_cur.clear();
+		m_cv.notify_all();
+	}
+	return m_err;
+}
+
+int exm_batch_writer::finish()
+{
+	{
+		std::unique_lock lk(m_mtx);
+		if (m_cur.size() > 0) {
+			m_queue.push_back(std::move(m_cur));
+			m_cur.clear();
+		}
+		m_stop = true;
+		m_cv.notify_all();
+	}
+	if (m_thr.joinable())
+		m_thr.join();
+	m_queue.clear();
+	return m_err;
+}
+
+exm_batch_writer::~exm_batch_writer()
+{
+	{
+		/* Abnormal exit: discard whatever has not been sent yet */
+		std::unique_lock lk(m_mtx);
+		m_queue.clear();
+		m_stop = true;
+		m_cv.notify_all();
+	}
+	if (m_thr.joinable())
+		m_thr.join();
+}
+
+void exm_batch_writer::run()
+{
+	while (true) {
+		std::vector<exm_pending_msg> batch;
+		{
+			std::unique_lock lk(m_mtx);
+			m_cv.wait(lk, [&]() { return m_stop || !m_queue.empty(); });
+			if (m_queue.empty())
+				return;
+			batch = std::move(m_queue.front());
+			m_queue.pop_front();
+			m_cv.notify_all();
+		}
+		auto ret = write_batch(batch);
+		gi_purge_alloc();
+		if (ret == 0)
+			continue;
+		std::unique_lock lk(m_mtx);
+		if (m_err == 0)
+			m_err = ret;
+		m_cv.notify_all();
+		if (!g_continuous_mode)
+			return;
+	}
+}
+
+int exm_batch_writer::write_batch(std::vector<exm_pending_msg> &batch)
+{
+	std::vector<message_write_item> items;
+	items.reserve(batch.size());
+	for (auto &m : batch) {
+		if (m.im_repr.size() > 0 && !exmdb_client->imapfile_write(g_storedir,
+		    "eml", m.midstr, m.im_repr)) {
+			fprintf(stderr, "exm: imapfile_write RPC failed\n");
+			return -EIO;
+		}
+		m.im_repr = {};
+		items.push_back(message_write_item{m.folder_id, m.ctnt.get(), std::move(m.digest)});
+	}
+	std::vector<message_write_result> results;
+	if (!exmdb_client->write_messages(g_storedir, CP_UTF8, items, &results)) {
+		fprintf(stderr, "exm: write_messages RPC failed\n");
+		return -EIO;
+	} else if (results.size() != items.size()) {
+		fprintf(stderr, "exm: write_messages: expected %zu results, got %zu\n",
+		        items.size(), results.size());
+		return -EIO;
+	}
+	int ret = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto &r = results[i];
+		if (r.e_result != ecSuccess) {
+			fprintf(stderr, "exm: write_messages: %s\n", mapi_strerror(r.e_result));
+			ret = -EIO;
+		} else if (g_verbose_create) {
+			fprintf(stderr, "Created new message f%llu:m%llu\n",
+				LLU{rop_util_get_gc_value(items[i].folder_id)},
+				LLU{rop_util_get_gc_value(r.outmid)});
+		}
+	}
+	return ret;
+}
+
+/**
+ * Hand a message to the batch writer. The MID, change number and change
+ * key are left for the server to assign (as exm_create_msg does, just
+ * without the extra allocation RPCs). @ctnt is taken over when @steal is
+ * set, and copied otherwise.
+ */
+static int exm_queue_msg(uint64_t parent_fld, MESSAGE_CONTENT &ctnt,
+    const std::string &im_repr, Json::Value &digest, bool steal)
+{
+	exm_pending_msg msg;
+	msg.folder_id = parent_fld;
+	if (steal) {
+		auto p = static_cast<MESSAGE_CONTENT *>(malloc(sizeof(MESSAGE_CONTENT)));
+		if (p == nullptr)
+			return -ENOMEM;
+		msg.ctnt.reset(new(p) MESSAGE_CONTENT(ctnt));
+		ctnt = {};
+	} else {
+		msg.ctnt.reset(ctnt.dup());
+		if (msg.ctnt == nullptr)
+			return -ENOMEM;
+	}
+	for (auto tag : {PidTagMid, PidTagChangeNumber, PR_CHANGE_KEY, PR_PREDECESSOR_CHANGE_LIST})
+		msg.ctnt->proplist.erase(tag);
+	if (im_repr.size() > 0) {
+		char guidtxt[GUIDSTR_SIZE]{};
+		GUID::random_new().to_str(guidtxt, std::size(guidtxt), 32);
+		msg.midstr = fmt::format("R-{}/{}", &guidtxt[30], guidtxt);
+		msg.im_repr = im_repr;
+		digest["file"] = msg.midstr;
+		msg.digest = json_to_str(digest);
+		digest.removeMember("file");
+	}
+	return g_batch_writer->push(std::move(msg));
+}
+
 static int exm_deliver_msg(const char *target, MESSAGE_CONTENT *ct,
     const std::string &im_repr, Json::Value &digest, unsigned int mode)
 {
@@ -578,7 +762,10 @@ static int exm_message(const ob_desc &obd, MESSAGE_CONTENT &ctnt,
 			auto fid_to = folder_it->second.fid_to;
 			if (fid_to == MAILBOX_FID_UNANCHORED)
 				fid_to = g_anchor_folder;
-			auto ret = exm_create_msg(fid_to, &ctnt, im_repr, digest);
+			auto ret = g_batch_writer != nullptr ?
+			           exm_queue_msg(fid_to, ctnt, im_repr, digest,
+			           i + 1 == g_repeat_iter) :
+			           exm_create_msg(fid_to, &ctnt, im_repr, digest);
 			if (ret != EXIT_SUCCESS)
 				return ret;
 		}
@@ -713,9 +900,16 @@ int main(int argc, char **argv) try
 	textmaps_init();
 	if (g_username != nullptr && gi_setup_from_user(g_username) != EXIT_SUCCESS)
 		return EXIT_FAILURE;
-	if (gi_startup_client() != EXIT_SUCCESS)
+	if (g_do_delivery && g_batch_size > 0) {
+		fprintf(stderr, "gromox-import: --batch has no effect when -D is used\n");
+		g_batch_size = 0;
+	}
+	if (gi_startup_client(g_batch_size > 0 ? 2 : 1) != EXIT_SUCCESS)
 		return EXIT_FAILURE;
 	auto cl_0 = HX::make_scope_exit(gi_shutdown);
+	if (g_batch_size > 0)
+		g_batch_writer = std::make_unique<exm_batch_writer>();
+	auto cl_2 = HX::make_scope_exit([]() { g_batch_writer.reset(); });
 	if (g_anchor_folder_str == nullptr) {
 		/* g_public_folder populated by gi_setup* */
 		if (g_public_folder) {
@@ -753,6 +947,12 @@ int main(int argc, char **argv) try
 			break;
 		}
 	}
+	if (g_batch_writer != nullptr) {
+		auto ret = g_batch_writer->finish();
+		g_batch_writer.reset();
+		if (ret != 0 && iret == EXIT_SUCCESS)
+			iret = EXIT_FAILURE;
+	}
 	gi_dump_thru_map(g_thru_name_map);
 	return iret;
 } catch (const std::exception &e) {
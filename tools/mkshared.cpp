@@ -4,6 +4,7 @@
 #ifdef HAVE_CONFIG_H
 #	include "config.h"
 #endif
+#include <cassert>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
@@ -33,6 +34,7 @@
 #include <gromox/pcl.hpp>
 #include <gromox/process.hpp>
 #include <gromox/rop_util.hpp>
+#include <gromox/textmaps.hpp>
 #include <gromox/tie.hpp>
 #include "mkshared.hpp"
 
@@ -365,6 +367,230 @@ int mbop_create_search_folder(sqlite3 *sdb, uint64_t folder_id,
 	return 0;
 }
 
+static int create_generic_folder(sqlite3 *sq, const char *lang, uint64_t fid,
+    uint64_t parent, int user, const char *fldclass, BOOL hidden)
+{
+	auto dn_eng  = folder_namedb_get("en", fid);
+	auto dn_lang = folder_namedb_get(lang, fid);
+	auto ret = mbop_create_generic_folder(sq, fid, parent, user, dn_lang,
+	           fldclass, hidden);
+	if (ret != 0)
+		fprintf(stderr, "Failed to create folder \"%s\" (%s)\n", dn_lang, dn_eng);
+	return ret;
+}
+
+static int create_search_folder(sqlite3 *sdb, const char *lang, uint64_t fid,
+    uint64_t parent, int sec_id)
+{
+	auto dn_eng  = folder_namedb_get("en", fid);
+	auto dn_lang = folder_namedb_get(lang, fid);
+	auto ret = mbop_create_search_folder(sdb, fid, parent, sec_id, dn_lang);
+	if (ret != 0)
+		fprintf(stderr, "Failed to create folder \"%s\" (%s)\n", dn_lang, dn_eng);
+	return ret;
+}
+
+static int mk_storeprops(sqlite3 *psqlite, mapitime_t nt_time)
+{
+	std::pair<uint32_t, uint64_t> storeprops[] = {
+		{PR_CREATION_TIME, nt_time},
+		{PR_OOF_STATE, 0},
+		{PR_MESSAGE_SIZE_EXTENDED, 0},
+		{PR_ASSOC_MESSAGE_SIZE_EXTENDED, 0},
+		{PR_NORMAL_MESSAGE_SIZE_EXTENDED, 0},
+		{},
+	};
+	return mbop_insert_storeprops(psqlite, storeprops);
+}
+
+static int mk_receivefolders(sqlite3 *psqlite, mapitime_t nt_time)
+{
+	auto pstmt = gx_sql_prep(psqlite, "INSERT INTO receive_table VALUES (?, ?, ?)");
+	if (pstmt == nullptr)
+		return EXIT_FAILURE;
+	static constexpr std::pair<const char *, uint64_t> receive_folders[] = {
+		{"", PRIVATE_FID_INBOX}, {"IPC", PRIVATE_FID_ROOT},
+		{"IPM", PRIVATE_FID_INBOX}, {"REPORT.IPM", PRIVATE_FID_INBOX},
+	};
+	for (const auto &e : receive_folders) {
+		sqlite3_bind_text(pstmt, 1, e.first, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(pstmt, 2, e.second);
+		sqlite3_bind_int64(pstmt, 3, nt_time);
+		if (pstmt.step() != SQLITE_DONE) {
+			printf("fail to step sql inserting\n");
+			return EXIT_FAILURE;
+		}
+		sqlite3_reset(pstmt);
+	}
+	return EXIT_SUCCESS;
+}
+
+static int mk_folders(sqlite3 *psqlite, const char *lang, uint32_t user_id)
+{
+	static constexpr struct {
+		uint64_t parent = 0, fid = 0;
+		const char *fldclass = nullptr;
+		BOOL hidden = false;
+	} generic_folders[] = {
+		{0, PRIVATE_FID_ROOT},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_IPMSUBTREE},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_INBOX, "IPF.Note"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_DRAFT, "IPF.Note"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_OUTBOX, "IPF.Note"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_SENT_ITEMS, "IPF.Note"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_DELETED_ITEMS, "IPF.Note"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_CONTACTS, "IPF.Contact"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_CALENDAR, "IPF.Appointment"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_JOURNAL, "IPF.Journal"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_NOTES, "IPF.StickyNote"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_TASKS, "IPF.Task"},
+		{PRIVATE_FID_CONTACTS, PRIVATE_FID_QUICKCONTACTS, "IPF.Contact.MOC.QuickContacts", TRUE},
+		{PRIVATE_FID_CONTACTS, PRIVATE_FID_IMCONTACTLIST, "IPF.Contact.MOC.ImContactList", TRUE},
+		{PRIVATE_FID_CONTACTS, PRIVATE_FID_GALCONTACTS, "IPF.Contact.GalContacts", TRUE},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_JUNK, "IPF.Note"},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_CONVERSATION_ACTION_SETTINGS, "IPF.Configuration", TRUE},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_DEFERRED_ACTION},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_COMMON_VIEWS},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_SCHEDULE},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_FINDER},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_VIEWS},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_SHORTCUTS},
+		{PRIVATE_FID_IPMSUBTREE, PRIVATE_FID_SYNC_ISSUES, "IPF.Note"},
+		{PRIVATE_FID_SYNC_ISSUES, PRIVATE_FID_CONFLICTS, "IPF.Note"},
+		{PRIVATE_FID_SYNC_ISSUES, PRIVATE_FID_LOCAL_FAILURES, "IPF.Note"},
+		{PRIVATE_FID_SYNC_ISSUES, PRIVATE_FID_SERVER_FAILURES, "IPF.Note"},
+		{PRIVATE_FID_ROOT, PRIVATE_FID_LOCAL_FREEBUSY},
+	};
+	for (const auto &e : generic_folders)
+		if (create_generic_folder(psqlite, lang, e.fid,
+		    e.parent, user_id, e.fldclass, e.hidden) != 0)
+			return EXIT_FAILURE;
+	if (create_search_folder(psqlite, lang, PRIVATE_FID_SPOOLER_QUEUE,
+	    PRIVATE_FID_ROOT, user_id) != 0) {
+		printf("fail to create \"spooler queue\" folder\n");
+		return EXIT_FAILURE;
+	}
+	char tmp_sql[1024];
+	snprintf(tmp_sql, std::size(tmp_sql), "INSERT INTO permissions (folder_id, "
+		"username, permission) VALUES (%llu, 'default', %u)",
+		static_cast<unsigned long long>(PRIVATE_FID_CALENDAR), frightsFreeBusySimple | frightsVisible);
+	if (gx_sql_exec(psqlite, tmp_sql) != SQLITE_OK)
+		return EXIT_FAILURE;
+	snprintf(tmp_sql, std::size(tmp_sql), "INSERT INTO permissions (folder_id, "
+		"username, permission) VALUES (%llu, 'default', %u)",
+		static_cast<unsigned long long>(PRIVATE_FID_LOCAL_FREEBUSY), frightsFreeBusySimple);
+	if (gx_sql_exec(psqlite, tmp_sql) != SQLITE_OK)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+static int mk_options(sqlite3 *psqlite, time_t ux_time, bool create_old)
+{
+	auto record_key  = GUID::random_new();
+	auto mapping_sig = GUID::random_new();
+	char rgtxt[5][GUIDSTR_SIZE];
+	record_key.to_str(rgtxt[0], sizeof(rgtxt[0]));
+	exc_replid2.to_str(rgtxt[1], sizeof(rgtxt[1]));
+	exc_replid3.to_str(rgtxt[2], sizeof(rgtxt[2]));
+	exc_replid4.to_str(rgtxt[3], sizeof(rgtxt[3]));
+	mapping_sig.to_str(rgtxt[4], sizeof(rgtxt[4]));
+
+	auto pstmt = gx_sql_prep(psqlite, "INSERT INTO configurations VALUES (?, ?)");
+	if (pstmt == nullptr)
+		return EXIT_FAILURE;
+	pstmt.bind_int64(1, CONFIG_ID_MAILBOX_GUID);
+	pstmt.bind_text(2, rgtxt[0]);
+	if (pstmt.step() != SQLITE_DONE) {
+		printf("fail to step sql inserting\n");
+		return EXIT_FAILURE;
+	}
+	pstmt.reset();
+	if (!create_old) {
+		pstmt.bind_int64(1, CONFIG_ID_MAPPING_SIGNATURE);
+		pstmt.bind_text(2, rgtxt[4]);
+		if (pstmt.step() != SQLITE_DONE)
+			return EXIT_FAILURE;
+		pstmt.reset();
+	}
+
+	/*
+	 * By now, we have already created some built-in folders,
+	 * given them message reservation ranges,
+	 * and used some CNs already.
+	 *
+	 * - EIDs 1 .. 0x1d (PRIVATE_FID_UNASSIGNED_START-1) are used for folders
+	 * - EIDs 0x10001 .. 0x170000 are reserved for folders' messages
+	 * - g_cur_eid is 0x170001
+	 * - CNs 1 .. 0x1d are used
+	 * - g_last_cn is 0x1d
+	 *
+	 * The region 0x1e .. 0xff is set aside for built-in folders.
+	 *
+	 * The region 0x100 .. 0x10000 is free for use, and that is what we
+	 * enter for CONFIG_ID_*_EID instead of g_last_eid. Once this region is
+	 * used up, exmdb will automatically jump and continue at e.g.
+	 * 0x170001.
+	 */
+	std::pair<uint32_t, uint64_t> confprops[] = {
+		{CONFIG_ID_CURRENT_EID, CUSTOM_EID_BEGIN},
+		{CONFIG_ID_MAXIMUM_EID, ALLOCATED_EID_RANGE - 1},
+		{CONFIG_ID_LAST_CHANGE_NUMBER, g_last_cn},
+		{CONFIG_ID_LAST_CID, 0},
+		{CONFIG_ID_LAST_ARTICLE_NUMBER, g_last_art},
+		{CONFIG_ID_SEARCH_STATE, 0},
+		{CONFIG_ID_DEFAULT_PERMISSION, 0},
+		{CONFIG_ID_ANONYMOUS_PERMISSION, 0},
+	};
+	for (const auto &e : confprops) {
+		sqlite3_bind_int64(pstmt, 1, e.first);
+		sqlite3_bind_int64(pstmt, 2, e.second);
+		if (pstmt.step() != SQLITE_DONE) {
+			printf("fail to step sql inserting\n");
+			return EXIT_FAILURE;
+		}
+		sqlite3_reset(pstmt);
+	}
+	assert(confprops[1].first == CONFIG_ID_MAXIMUM_EID);
+	if (gx_sql_exec(psqlite, fmt::format("INSERT INTO allocated_eids VALUES ({}, {}, {}, 1)",
+	    1, confprops[1].second, ux_time).c_str()) != SQLITE_OK)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Populate a freshly created private store database. The caller is expected
+ * to have opened @psqlite and started a write transaction. Can be called
+ * repeatedly within one process (it resets the EID/CN counters).
+ */
+int mbop_create_private(sqlite3 *psqlite, const char *datadir,
+    const char *lang, uint32_t user_id, unsigned int dbop_flags)
+{
+	g_cur_eid  = ALLOCATED_EID_RANGE;
+	g_last_cn  = CHANGE_NUMBER_BEGIN;
+	g_last_art = 0;
+	auto ret = dbop_sqlite_create(psqlite, sqlite_kind::pvt, dbop_flags);
+	if (ret != 0) {
+		fprintf(stderr, "sqlite_create: %s\n", strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	ret = mbop_insert_namedprops(psqlite, datadir);
+	if (ret != 0)
+		return EXIT_FAILURE;
+
+	auto ux_time = time(nullptr);
+	auto nt_time = rop_util_unix_to_nttime(ux_time);
+	ret = mk_receivefolders(psqlite, nt_time);
+	if (ret != EXIT_SUCCESS)
+		return ret;
+	ret = mk_storeprops(psqlite, nt_time);
+	if (ret != EXIT_SUCCESS)
+		return ret;
+	ret = mk_folders(psqlite, lang, user_id);
+	if (ret != EXIT_SUCCESS)
+		return ret;
+	return mk_options(psqlite, ux_time, dbop_flags & DBOP_SCHEMA_0);
+}
+
 static char kind_to_char(sqlite_kind k)
 {
 	switch (k) {